@@ -4,6 +4,10 @@
 #define EXECUTABLE_SIZE 100
 #define EXT_SUPPORTED_VERSION 0
 
+// lmvm-ext version 1 is a large memory program, whose cells are 4 bytes each and which only lmvm's large memory engine
+// runs, so it isn't covered by EXT_SUPPORTED_VERSION, which every other loader checks against
+#define EXT_LARGE_MEMORY_VERSION 1
+
 // standard lmc files will start with LMCX, followed by the data
 // extended lmc files will start with LMCXTENDED, followed by the major version, minor version, patch version, and the data
 // both have file extensions of .lmc
@@ -14,4 +18,7 @@
 #define MAGIC_STRING_LMC "LMCX"
 #define MAGIC_STRING_LMC_EXTENDED "LMCXTENDED"
 
+// the largest executable whose cells all fit in memory, an extended header and a full memory
+#define EXECUTABLE_MAX_FILE_SIZE (10 + 2 + 2 * EXECUTABLE_SIZE)
+
 #endif //LMVM_EXECUTABLE_PROPS_H
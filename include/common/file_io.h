@@ -38,6 +38,25 @@ enum write_status_e {
  */
 typedef enum write_status_e write_status_et;
 
+/**
+ * Represents the result of loading an executable's cells straight into memory.
+ * @see load_status_et
+ */
+enum load_status_e {
+    LOAD_SUCCESS,
+    LOAD_CANT_OPEN,
+    LOAD_IS_DIRECTORY,
+    LOAD_INVALID,           // not an LMCX file
+    LOAD_UNSUPPORTED_EXT,   // an lmvm-ext version newer than EXT_SUPPORTED_VERSION
+    LOAD_TOO_LARGE          // more cells than fit in the memory given
+};
+
+/**
+ * Represents the result of loading an executable's cells straight into memory.
+ * @see load_status_e
+ */
+typedef enum load_status_e load_status_et;
+
 
 /**
  * Reads an LMCX file and returns the data and lmvm-ext version used, or NULL if the file is not valid or can't be opened.
@@ -48,6 +67,34 @@ typedef enum write_status_e write_status_et;
  */
 lmcx_file_descriptor_st *read_lmcx_file(char *path);
 
+/**
+ * Checks the header of the contents of an LMCX file where it lies, then decodes the cells after it into memory,
+ * zeroing the rest of it.
+ *
+ * @param data         The contents of the file
+ * @param size         The size of data
+ * @param memory       Where to load the cells
+ * @param capacity     The number of cells that fit in memory
+ * @param cell_count   Set to the number of cells in data, even if they don't fit
+ * @param ext_version  Set to the lmvm-ext version of the file, or 0 if it is a standard LMC file
+ * @return             LOAD_SUCCESS if memory holds the program, otherwise why it doesn't
+ */
+load_status_et parse_lmcx_image(const unsigned char *data, size_t size, unsigned short int *memory, size_t capacity, size_t *cell_count, unsigned short int *ext_version);
+
+/**
+ * Loads the cells of an LMCX file into memory, zeroing the rest of it, without allocating.
+ * Where mmap is available, the file is opened, checked and mapped with one call each, and the header is checked where
+ * it lies in the mapping, so starting a short run costs as few system calls as possible.
+ *
+ * @param path         The path of the file to load
+ * @param memory       Where to load the cells
+ * @param capacity     The number of cells that fit in memory
+ * @param cell_count   Set to the number of cells in the file, even if they don't fit
+ * @param ext_version  Set to the lmvm-ext version of the file, or 0 if it is a standard LMC file
+ * @return             LOAD_SUCCESS if memory holds the program, otherwise why it doesn't
+ */
+load_status_et load_lmcx_image(const char *path, unsigned short int *memory, size_t capacity, size_t *cell_count, unsigned short int *ext_version);
+
 /**
  * Reads a text file and returns the data or NULL if the file can't be opened.
  *
@@ -95,4 +142,31 @@ int file_exists_and_accessible(char *path);
  */
 int is_dir(char *path);
 
+/**
+ * Checks the byte order of the machine, since files are always stored in little endian.
+ *
+ * @return  Whether the machine is little endian
+ */
+int machine_is_little_endian(void);
+
+/**
+ * Stores a value as little endian bytes, whatever the machine.
+ *
+ * @param at     Where to store the bytes
+ * @param value  The value to store
+ * @param size   The size of the value, at most 8
+ * @return       The byte after the value
+ */
+unsigned char *store_little_endian(unsigned char *at, const void *value, size_t size);
+
+/**
+ * Loads a value stored by store_little_endian.
+ *
+ * @param at     Where the bytes are
+ * @param value  Where to load the value to
+ * @param size   The size of the value, at most 8
+ * @return       The byte after the value
+ */
+const unsigned char *load_little_endian(const unsigned char *at, void *value, size_t size);
+
 #endif //LMVM_FILE_IO_H
@@ -0,0 +1,56 @@
+#ifndef LMVM_SOURCE_MAP_H
+#define LMVM_SOURCE_MAP_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+
+/**
+ * Represents the assembly each cell of a program was assembled from, as far as it can be told from the source.
+ * @see source_map_st
+ */
+struct source_map_s {
+    char *text;  // the source, which the labels and lines point into
+
+    size_t cell_count;
+    unsigned int lines[EXECUTABLE_SIZE];  // counted from 1
+    const char *labels[EXECUTABLE_SIZE];  // or NULL where the cell has no label
+    const char *code[EXECUTABLE_SIZE];    // the line without its label or comment
+    unsigned char data[EXECUTABLE_SIZE];  // set where the line is a DAT, so the cell holds a value rather than code
+};
+
+/**
+ * Represents the assembly each cell of a program was assembled from.
+ * @see source_map_s
+ */
+typedef struct source_map_s source_map_st;
+
+
+/**
+ * Reads the assembly a program was assembled from, mapping each cell to the line it came from the way lmasm does,
+ * one cell for every line with an instruction on it.
+ *
+ * @param path   The path of the source
+ * @param image  The program as loaded, which every instruction in the source is checked against
+ * @param map    Where to read the map to
+ * @return       0 if the source was read, 1 if it couldn't be or doesn't assemble to the program
+ */
+int read_source_map(const char *path, const unsigned short int image[EXECUTABLE_SIZE], source_map_st *map);
+
+/**
+ * Frees the source a map was read from.
+ *
+ * @param map  The map to free
+ */
+void free_source_map(source_map_st *map);
+
+/**
+ * Gets the path of the source a file was made from, the same path with its extension replaced by .lmasm, where a
+ * program's .lmc extension is taken off along with any extension after it.
+ *
+ * @param path  The path of the program, or of something written from running it
+ * @return      The path of the source, which the caller frees
+ */
+char *source_path_for(const char *path);
+
+#endif //LMVM_SOURCE_MAP_H
@@ -0,0 +1,70 @@
+#ifndef LMVM_TRACE_FORMAT_H
+#define LMVM_TRACE_FORMAT_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+
+/*
+ * An execution trace starts with a header of MAGIC_STRING_TRACE, TRACE_FORMAT_VERSION as a little endian 16 bit value,
+ * and the EXECUTABLE_SIZE cells of the image as little endian 16 bit values.
+ * Then there is one record per instruction run, each a flags byte followed by whichever fields the flags say are present:
+ *   - the PC as one byte, if it isn't the one expected after the last record
+ *   - the CIR as a little endian 16 bit value, if it isn't what was last run from that PC (or the image, if nothing was)
+ *   - the change in ACC as a zigzag varint, if ACC changed
+ * After a record, the next PC is expected to be the branch target if it branched, and the next cell otherwise.
+ * The trace ends at the end of the file.
+ */
+
+#define MAGIC_STRING_TRACE "LMTRACE"
+#define MAGIC_STRING_TRACE_SIZE 8  // including the terminator
+#define TRACE_FORMAT_VERSION 1
+
+#define TRACE_FLAG_RESULT_MASK 0x07  // the execution result of the instruction
+#define TRACE_FLAG_PC 0x08
+#define TRACE_FLAG_CIR 0x10
+#define TRACE_FLAG_ACC 0x20
+
+// one flags byte, one PC byte, two CIR bytes and a 5 byte varint for the largest change in a 32 bit ACC
+#define TRACE_MAX_RECORD_SIZE 9
+
+// the result of an instruction that raised an error, matching EXECUTION_ERROR
+#define TRACE_RESULT_ERROR 1
+
+// the result of a taken branch, matching EXECUTION_SUCCESS_BRANCHED
+#define TRACE_RESULT_BRANCHED 4
+
+
+/**
+ * Works out the PC expected after a record, which the next record only stores if it was somewhere else.
+ *
+ * @param pc      The PC of the record
+ * @param cir     The CIR of the record
+ * @param result  The result of the record
+ * @return        The PC expected next
+ */
+static inline unsigned int trace_expected_pc(unsigned int pc, unsigned int cir, unsigned int result) {
+    return result == TRACE_RESULT_BRANCHED ? cir % 100 : pc + 1;
+}
+
+/**
+ * Writes a signed value as a zigzag varint, so small changes either way take a single byte.
+ *
+ * @param out    Where to write the varint, with room for at least 10 bytes
+ * @param value  The value to write
+ * @return       The number of bytes written
+ */
+static inline size_t write_zigzag_varint(unsigned char *out, long long value) {
+    unsigned long long zigzag = ((unsigned long long) value << 1) ^ (unsigned long long) (value < 0 ? -1 : 0);
+    size_t size = 0;
+
+    while (zigzag >= 0x80) {
+        out[size++] = (unsigned char) (zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    out[size++] = (unsigned char) zigzag;
+
+    return size;
+}
+
+#endif //LMVM_TRACE_FORMAT_H
@@ -0,0 +1,305 @@
+#ifndef LMVM_LIBLMVM_H
+#define LMVM_LIBLMVM_H
+
+#include <stddef.h>
+#include <limits.h>
+
+// only the functions declared here are exported from the shared library
+#if defined(__GNUC__)
+#define LMVM_API __attribute__((visibility("default")))
+#else
+#define LMVM_API
+#endif
+
+// the number of cells in a machine's memory
+#define LMVM_MEMORY_SIZE 100
+
+// the bytes a state sets aside for what the library keeps about the program, which only the library reads
+#define LMVM_STATE_INTERNAL_SIZE 2048
+
+// a budget for lmvm_run that lets the program run until it stops
+#define LMVM_NO_BUDGET ULLONG_MAX
+
+/**
+ * Represents how far a program has got.
+ * @see lmvm_status_et
+ */
+enum lmvm_status_e {
+    LMVM_RUNNABLE,    // loaded or part way through, so lmvm_run can carry it on
+    LMVM_NEED_INPUT,  // waiting at an INP the input callback had no value for yet, which lmvm_run asks for again
+    LMVM_HALTED,
+    LMVM_ERROR        // stopped on an error, described by lmvm_describe_error
+};
+
+/**
+ * Represents how far a program has got.
+ * @see lmvm_status_e
+ */
+typedef enum lmvm_status_e lmvm_status_et;
+
+/**
+ * Represents the error a program stopped on.
+ * @see lmvm_error_et
+ */
+enum lmvm_error_e {
+    LMVM_ERROR_NONE,
+    LMVM_ERROR_OVERFLOW,
+    LMVM_ERROR_UNDERFLOW,
+    LMVM_ERROR_OUT_OF_MEMORY_RANGE,  // STA with an ACC that isn't a cell value
+    LMVM_ERROR_INVALID_OPCODE,
+    LMVM_ERROR_INVALID_IO,
+    LMVM_ERROR_PC_OUT_OF_RANGE,
+    LMVM_ERROR_OUT_OF_INPUT,
+    LMVM_ERROR_OUTPUT_REFUSED,       // the output callback refused a value, or the output array is full
+    LMVM_ERROR_STEP_LIMIT,           // a scheduler stopped the program for running too many instructions
+    LMVM_ERROR_TIME_LIMIT            // a scheduler stopped the program for running too long
+};
+
+/**
+ * Represents the error a program stopped on.
+ * @see lmvm_error_e
+ */
+typedef enum lmvm_error_e lmvm_error_et;
+
+/**
+ * Represents the result of asking an input callback for a value.
+ * @see lmvm_input_result_et
+ */
+enum lmvm_input_result_e {
+    LMVM_INPUT_VALUE,
+    LMVM_INPUT_END,
+    LMVM_INPUT_WAIT  // no value yet, so the program waits with LMVM_NEED_INPUT
+};
+
+/**
+ * Represents the result of asking an input callback for a value.
+ * @see lmvm_input_result_e
+ */
+typedef enum lmvm_input_result_e lmvm_input_result_et;
+
+/**
+ * Gives the value for an INP.
+ *
+ * @param context  The context the callback was set with
+ * @param value    Where to store the value
+ * @return         LMVM_INPUT_VALUE if a value was stored, LMVM_INPUT_END if the input has run out,
+ *                 or LMVM_INPUT_WAIT if a value may come later
+ */
+typedef lmvm_input_result_et (*lmvm_input_fn)(void *context, int *value);
+
+/**
+ * Takes the value of an OUT.
+ *
+ * @param context  The context the callback was set with
+ * @param value    The value written
+ * @return         0 if the value was taken, 1 to stop the program with LMVM_ERROR_OUTPUT_REFUSED
+ */
+typedef int (*lmvm_output_fn)(void *context, int value);
+
+/**
+ * Represents a machine and the program loaded into it, owned by the caller.
+ * Nothing here is allocated by the library and nothing is shared between states, so a state can live anywhere and
+ * any number can be run at once from different threads, each by one thread at a time.
+ * Loading decodes the program once, and resetting copies it back, so a program can be run over and over cheaply.
+ * The fields can be read at any time, but should only be changed through the functions below. What the library keeps
+ * about the program itself is in a block of a fixed size, so the layout of a state only changes with the major version.
+ * @see lmvm_state_st
+ */
+struct lmvm_state_s {
+    unsigned short int image[LMVM_MEMORY_SIZE];  // the program as loaded, which resetting goes back to
+    unsigned short int memory[LMVM_MEMORY_SIZE];
+    int acc;
+    unsigned short int pc;  // the next instruction, or the one that failed if the program stopped on an error
+
+    unsigned long long executed;  // instructions run since the last reset
+    lmvm_status_et status;
+    lmvm_error_et error;
+
+    // callbacks take priority over the arrays
+    lmvm_input_fn input;
+    void *input_context;
+    lmvm_output_fn output;
+    void *output_context;
+
+    const int *input_values;
+    size_t input_count;
+    size_t input_used;  // values taken from input_values since the last reset
+
+    int *output_values;
+    size_t output_capacity;
+    size_t output_count;  // values written since the last reset, whether to the callback or output_values
+
+    // a scheduler links the states waiting for a turn through the states themselves, so it never allocates
+    struct lmvm_state_s *previous_turn;
+    struct lmvm_state_s *next_turn;
+    int scheduled;
+    unsigned long long run_ns;  // time spent in turns since the last reset
+
+    // the program decoded, as loaded and as run, aligned for whatever the library keeps in it
+    union {
+        unsigned char bytes[LMVM_STATE_INTERNAL_SIZE];
+        unsigned long long align;
+        void *pointer;
+    } internal;
+};
+
+/**
+ * Represents a machine and the program loaded into it.
+ * @see lmvm_state_s
+ */
+typedef struct lmvm_state_s lmvm_state_st;
+
+/**
+ * Represents machines taking turns on one thread, in the order they were scheduled, each running for at most a quantum
+ * of instructions a turn, so none can keep the rest from running however long it runs for.
+ * Limits are checked after every turn, so the time limit only costs a clock read per quantum.
+ * @see lmvm_scheduler_st
+ */
+struct lmvm_scheduler_s {
+    lmvm_state_st *head;
+    lmvm_state_st *tail;
+
+    unsigned long long quantum;
+    unsigned long long max_steps;  // a program that has run this many instructions is stopped, 0 for no limit
+    unsigned long long max_ns;     // a program that has spent this long in its turns is stopped, 0 for no limit
+};
+
+/**
+ * Represents machines taking turns on one thread.
+ * @see lmvm_scheduler_s
+ */
+typedef struct lmvm_scheduler_s lmvm_scheduler_st;
+
+
+/**
+ * Sets up a state with an empty program, no input, and output thrown away.
+ *
+ * @param state  The state to set up
+ */
+LMVM_API void lmvm_init(lmvm_state_st *state);
+
+/**
+ * Loads a program and resets the machine to run it. Cells past the end of the image are zeroed.
+ *
+ * @param state  The state to load into
+ * @param image  The cells of the program
+ * @param size   The number of cells in image
+ * @return       0 if the program was loaded, 1 if it doesn't fit in memory
+ */
+LMVM_API int lmvm_load_image(lmvm_state_st *state, const unsigned short int *image, size_t size);
+
+/**
+ * Loads a program from the contents of an executable written by lmasm, and resets the machine to run it.
+ *
+ * @param state  The state to load into
+ * @param data   The contents of the executable
+ * @param size   The size of data
+ * @return       0 if the program was loaded, 1 if data isn't an executable this library can run
+ */
+LMVM_API int lmvm_load_executable(lmvm_state_st *state, const unsigned char *data, size_t size);
+
+/**
+ * Puts the machine back to the start of the loaded program, with the input and output arrays back at their starts.
+ * The callbacks and arrays themselves are kept.
+ *
+ * @param state  The state to reset
+ */
+LMVM_API void lmvm_reset(lmvm_state_st *state);
+
+/**
+ * Sets the callback INP reads from, instead of the input array.
+ *
+ * @param state    The state to set it on
+ * @param input    The callback, or NULL to go back to the input array
+ * @param context  Passed to every call of input
+ */
+LMVM_API void lmvm_set_input_callback(lmvm_state_st *state, lmvm_input_fn input, void *context);
+
+/**
+ * Sets the callback OUT writes to, instead of the output array.
+ *
+ * @param state    The state to set it on
+ * @param output   The callback, or NULL to go back to the output array
+ * @param context  Passed to every call of output
+ */
+LMVM_API void lmvm_set_output_callback(lmvm_state_st *state, lmvm_output_fn output, void *context);
+
+/**
+ * Sets the values INP reads, in order, when there is no input callback. Running out of them is an error.
+ * The values aren't copied, so they must last as long as the program runs.
+ *
+ * @param state   The state to set them on
+ * @param values  The values, which can be NULL if count is 0
+ * @param count   The number of values
+ */
+LMVM_API void lmvm_set_input_values(lmvm_state_st *state, const int *values, size_t count);
+
+/**
+ * Sets where OUT writes its values, in order, when there is no output callback. Writing more than fit is an error.
+ * If no array is set, output is only counted.
+ *
+ * @param state     The state to set it on
+ * @param values    The array to write to, or NULL to only count output
+ * @param capacity  The number of values that fit in the array
+ */
+LMVM_API void lmvm_set_output_values(lmvm_state_st *state, int *values, size_t capacity);
+
+/**
+ * Runs the program until it stops, waits for input, or has run budget more instructions, whichever comes first.
+ * A program that used up its budget or is waiting for input can be carried on by calling this again, and everything
+ * it needs to carry on is in the state, so a thread can take turns running any number of programs.
+ *
+ * @param state   The state to run
+ * @param budget  The most instructions to run, or LMVM_NO_BUDGET to run until the program stops or waits
+ * @return        LMVM_RUNNABLE if the budget ran out first, LMVM_NEED_INPUT if it is waiting at an INP,
+ *                otherwise how the program stopped
+ */
+LMVM_API lmvm_status_et lmvm_run(lmvm_state_st *state, unsigned long long budget);
+
+/**
+ * Sets up a scheduler with no machines waiting.
+ *
+ * @param scheduler  The scheduler to set up
+ * @param quantum    The most instructions a machine runs each turn
+ * @param max_steps  The most instructions a program can run before it is stopped with LMVM_ERROR_STEP_LIMIT, or 0
+ * @param max_ms     The most milliseconds a program can spend in its turns before it is stopped with LMVM_ERROR_TIME_LIMIT, or 0
+ */
+LMVM_API void lmvm_scheduler_init(lmvm_scheduler_st *scheduler, unsigned long long quantum, unsigned long long max_steps, unsigned long long max_ms);
+
+/**
+ * Puts a machine at the back of the queue for a turn, if it isn't already waiting for one.
+ * The state must not be freed or moved while it is waiting.
+ *
+ * @param scheduler  The scheduler to queue on
+ * @param state      The machine to queue
+ */
+LMVM_API void lmvm_schedule(lmvm_scheduler_st *scheduler, lmvm_state_st *state);
+
+/**
+ * Takes a machine out of the queue, if it is waiting for a turn.
+ *
+ * @param scheduler  The scheduler it was queued on
+ * @param state      The machine to take out
+ */
+LMVM_API void lmvm_unschedule(lmvm_scheduler_st *scheduler, lmvm_state_st *state);
+
+/**
+ * Gives the machine at the front of the queue its turn, stopping it if it has gone past the scheduler's limits.
+ * The machine isn't queued again, so the caller can decide whether it should be, usually by its status.
+ *
+ * @param scheduler  The scheduler to take a turn from
+ * @return           The machine that had the turn, or NULL if none were waiting
+ */
+LMVM_API lmvm_state_st *lmvm_run_turn(lmvm_scheduler_st *scheduler);
+
+/**
+ * Writes a message describing the error the program stopped on, in the words lmvm uses.
+ *
+ * @param state   The state that stopped
+ * @param buffer  Where to write the message, which is always terminated if size isn't 0
+ * @param size    The size of buffer
+ * @return        The length of the whole message, as snprintf returns
+ */
+LMVM_API int lmvm_describe_error(const lmvm_state_st *state, char *buffer, size_t size);
+
+#endif //LMVM_LIBLMVM_H
@@ -0,0 +1,20 @@
+#ifndef LMVM_LMC2C_CODEGEN_H
+#define LMVM_LMC2C_CODEGEN_H
+
+#include <stdio.h>
+
+#include "common/executable_props.h"
+
+/**
+ * Writes a standalone C program that behaves the same as running the image with lmvm, including its error messages.
+ * Each cell is compiled to its own case, with ACC as a local and branches as gotos.
+ * Cells that the image can store to are checked before they run, and a changed cell is run by an interpreter built into the program.
+ *
+ * @param out          The stream to write the C source to
+ * @param image        The cells of the image
+ * @param source_name  The name of the image, for the header comment
+ * @return             1 if successful, 0 if the source could not be written
+ */
+int generate_c_program(FILE *out, const unsigned short int image[EXECUTABLE_SIZE], const char *source_name);
+
+#endif //LMVM_LMC2C_CODEGEN_H
@@ -0,0 +1,87 @@
+#ifndef LMVM_LMTRACE_ANALYSIS_H
+#define LMVM_LMTRACE_ANALYSIS_H
+
+#include <stdio.h>
+
+#include "common/executable_props.h"
+#include "common/source_map.h"
+
+// enough power of two buckets for any 64 bit count
+#define LOOP_HISTOGRAM_BUCKETS 64
+
+/**
+ * Represents what is known about one loop, identified by the branch that jumps back to its start.
+ * A stay in the loop starts the first time the branch jumps back, and ends when something outside the loop is run.
+ * @see loop_stats_st
+ */
+struct loop_stats_s {
+    unsigned char start;
+    unsigned long long entries;
+    unsigned long long iterations;  // times the branch jumped back, over every stay
+    unsigned long long most_iterations;
+
+    // histogram[n] counts the stays that jumped back between 2^n and 2^(n+1) - 1 times
+    unsigned long long histogram[LOOP_HISTOGRAM_BUCKETS];
+
+    // the stay in progress while reading the trace
+    int active;
+    unsigned long long current;
+};
+
+/**
+ * Represents what is known about one loop, identified by the branch that jumps back to its start.
+ * @see loop_stats_s
+ */
+typedef struct loop_stats_s loop_stats_st;
+
+/**
+ * Represents everything gathered from a trace.
+ * Counts are kept by address, with one extra for running off the end of memory.
+ * @see trace_analysis_st
+ */
+struct trace_analysis_s {
+    unsigned short int image[EXECUTABLE_SIZE];
+    unsigned long long instructions;
+    int last_result;  // the result of the last instruction, or -1 for an empty trace
+
+    unsigned long long runs[EXECUTABLE_SIZE + 1];
+    unsigned long long rewritten[EXECUTABLE_SIZE + 1];  // runs of a different instruction to the one before at that address
+    unsigned long long branches[EXECUTABLE_SIZE];       // conditional or not, runs of BRA, BRZ and BRP
+    unsigned long long taken[EXECUTABLE_SIZE];
+    unsigned long long reads[EXECUTABLE_SIZE];   // by ADD, SUB and LDA
+    unsigned long long writes[EXECUTABLE_SIZE];  // by STA
+
+    // keyed by the address of the branch jumping back
+    loop_stats_st loops[EXECUTABLE_SIZE];
+};
+
+/**
+ * Represents everything gathered from a trace.
+ * @see trace_analysis_s
+ */
+typedef struct trace_analysis_s trace_analysis_st;
+
+
+/**
+ * Reads a whole trace written by lmvm --trace and gathers its statistics.
+ * The trace is streamed, so it can be far larger than memory.
+ *
+ * @param in        The stream to read the trace from
+ * @param analysis  Where to store the statistics
+ * @param errors    The stream to describe any problem with the trace to
+ * @return          1 if the trace was read, 0 if it is not a trace, is of an unsupported version or is corrupted
+ */
+int analyse_trace(FILE *in, trace_analysis_st *analysis, FILE *errors);
+
+/**
+ * Writes a human readable report of the statistics: a coverage listing of the image with execution counts,
+ * how often each branch was taken and a histogram of the iterations of each loop.
+ * Cells that hold data rather than code are listed with how often they were read and written instead.
+ *
+ * @param out       The stream to write the report to
+ * @param analysis  The statistics to report on
+ * @param source    The source of the program, to show cells as their lines and labels, or NULL to show them disassembled
+ */
+void write_trace_report(FILE *out, const trace_analysis_st *analysis, const source_map_st *source);
+
+#endif //LMVM_LMTRACE_ANALYSIS_H
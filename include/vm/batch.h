@@ -0,0 +1,110 @@
+#ifndef LMVM_BATCH_H
+#define LMVM_BATCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+#include "vm/metering.h"
+#include "vm/bulk_loader.h"
+
+/**
+ * Represents one run of a program by the batch runner, with its own input file and output buffers.
+ * @see batch_job_st
+ */
+struct batch_job_s {
+    const unsigned short int *image;  // the program to run, shared between jobs and never written to
+
+    // if not NULL, the program is instead the one at this index of a load, which the job waits for
+    bulk_load_st *load;
+    size_t program;
+    const char *input_path;           // the file INP reads from, or NULL if the program takes no input
+    const run_limits_st *limits;      // the limits the job runs with, or NULL for none
+
+    char *output;
+    size_t output_size;
+
+    char *errors;
+    size_t errors_size;
+
+    int exit_code;
+};
+
+/**
+ * Represents one run of a program by the batch runner, with its own input file and output buffers.
+ * @see batch_job_s
+ */
+typedef struct batch_job_s batch_job_st;
+
+/**
+ * Represents an engine the batch runner can run jobs with, such as do_threaded_execution.
+ */
+typedef int (*batch_engine_fn)(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed);
+
+/**
+ * Represents a task that can be run by run_batch_tasks, given its index and the context passed in.
+ */
+typedef void (*batch_task_fn)(size_t task, void *context);
+
+
+/**
+ * Gets the number of workers to run a batch with, which is the number of cores, or 1 without thread support.
+ *
+ * @return  The number of workers to use
+ */
+size_t batch_worker_count(void);
+
+/**
+ * Runs every task on a pool of workers, each of which steals from the others once it runs out of tasks.
+ * Tasks may run in any order and at the same time, so they should only write to state of their own.
+ * Without thread support, the tasks are run one at a time.
+ *
+ * @param task_count    The number of tasks
+ * @param worker_count  The number of workers to run the tasks on
+ * @param task          The function to run each task with
+ * @param context       Passed to every task
+ */
+void run_batch_tasks(size_t task_count, size_t worker_count, batch_task_fn task, void *context);
+
+/**
+ * Opens a stream that collects everything written to it in memory, so tasks can buffer their output.
+ * Exits if the stream can't be opened.
+ *
+ * @param data  Set to the collected data once the stream is closed
+ * @param size  Set to the size of the collected data once the stream is closed
+ * @return      The stream to write to
+ */
+FILE *open_batch_buffer(char **data, size_t *size);
+
+/**
+ * Closes a stream opened by open_batch_buffer, setting its data and size. The data is freed with silent_checked_free.
+ *
+ * @param stream  The stream to close
+ * @param data    The data pointer given to open_batch_buffer
+ * @param size    The size pointer given to open_batch_buffer
+ */
+void close_batch_buffer(FILE *stream, char **data, size_t *size);
+
+/**
+ * Runs every job with the given engine on a pool of workers, each of which steals from the others once it runs out of jobs.
+ * Each job runs on its own copy of its image, and its output and errors are collected into buffers instead of being printed.
+ * Without thread support, the jobs are run one at a time.
+ *
+ * @param jobs          The jobs to run, whose buffers are allocated and exit codes set (0 if it halted, 1 if it errored)
+ * @param job_count     The number of jobs
+ * @param worker_count  The number of workers to run the jobs on
+ * @param engine        The engine to run each job with
+ * @return              0 if every job halted, 1 if any job errored
+ */
+int do_batch_execution(batch_job_st *jobs, size_t job_count, size_t worker_count, batch_engine_fn engine);
+
+/**
+ * Frees the buffers of jobs run by do_batch_execution.
+ *
+ * @param jobs       The jobs to free the buffers of
+ * @param job_count  The number of jobs
+ */
+void free_batch_outputs(batch_job_st *jobs, size_t job_count);
+
+#endif //LMVM_BATCH_H
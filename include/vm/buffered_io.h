@@ -0,0 +1,186 @@
+#ifndef LMVM_BUFFERED_IO_H
+#define LMVM_BUFFERED_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <signal.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 15)
+#define INPUT_CHUNK_SIZE (1 << 15)
+
+// the most bytes one OUT can write, as a sign, 10 digits and a newline
+#define OUTPUT_VALUE_MAX_SIZE 12
+
+/**
+ * Represents the outcome of reading a value for INP.
+ * @see input_status_et
+ */
+enum input_status_e {
+    INPUT_VALUE,
+    INPUT_NOT_A_NUMBER,  // the next word wasn't a number, and has been skipped
+    INPUT_OUT_OF_RANGE,  // the next word was a number too large for ACC, and has been skipped
+    INPUT_END,           // there is no more input, or the last raw value was cut short
+    INPUT_INTERRUPTED    // waiting for input was cut short by stop being set, and the value doesn't count as read
+};
+
+/**
+ * Represents the outcome of reading a value for INP.
+ * @see input_status_e
+ */
+typedef enum input_status_e input_status_et;
+
+
+/**
+ * Represents the values written by OUT, which are formatted into a buffer and only written to the stream when it fills
+ * up or the program stops, instead of going through stdio for every value.
+ * In raw mode, each value is written as a little endian 32 bit integer instead of a line of text.
+ * @see output_buffer_st
+ */
+struct output_buffer_s {
+    FILE *stream;
+    int raw;
+    int failed;
+    size_t used;
+    unsigned char data[OUTPUT_BUFFER_SIZE];
+};
+
+/**
+ * Represents the values written by OUT, which are formatted into a buffer and only written to the stream when it fills up.
+ * @see output_buffer_s
+ */
+typedef struct output_buffer_s output_buffer_st;
+
+/**
+ * Represents where INP reads values from, scanned straight out of memory.
+ * Regular files are mapped into memory whole where possible, and anything else (pipes, terminals) is read a chunk at a
+ * time, taking whatever is available so a pipeline never waits on input it doesn't need yet.
+ * In text mode, values are whitespace separated decimal integers. In raw mode, they are little endian 32 bit integers.
+ * @see input_source_st
+ */
+struct input_source_s {
+    FILE *stream;
+    int raw;
+
+    // what is left to scan, either the mapping or the chunk
+    const unsigned char *data;
+    size_t size;
+    size_t used;
+
+    // how much of the stream came before data, so where the scan is can be saved and gone back to
+    unsigned long long position;
+
+    void *mapping;
+    size_t mapping_size;
+    int ended;
+    int whole;  // set if data holds everything left in the stream, so the input is known before it is read
+
+    // flushed before waiting on more input, so anything written is seen before the program waits for a reply
+    output_buffer_st *flush_before_wait;
+
+    // if not NULL, a wait for more input that a signal interrupts gives up once the signal has set this
+    volatile sig_atomic_t *stop;
+    int interrupted;
+    unsigned long long unread;  // bytes of the value that gave up, which the position doesn't count
+
+    unsigned char chunk[INPUT_CHUNK_SIZE];
+};
+
+/**
+ * Represents where INP reads values from, scanned straight out of memory.
+ * @see input_source_s
+ */
+typedef struct input_source_s input_source_st;
+
+
+/**
+ * Checks whether a stream is a terminal, where buffering output would hold it back from the user.
+ *
+ * @param stream  The stream to check
+ * @return        1 if it is a terminal, 0 if not or it can't be told
+ */
+int stream_is_interactive(FILE *stream);
+
+/**
+ * Initialises an empty output buffer.
+ *
+ * @param buffer  The buffer to initialise
+ * @param stream  The stream the buffer is written to
+ * @param raw     Whether values are written as raw 32 bit integers rather than text
+ */
+void init_output_buffer(output_buffer_st *buffer, FILE *stream, int raw);
+
+/**
+ * Writes a value to the buffer, writing the buffer to its stream first if it is full.
+ *
+ * @param buffer  The buffer to write to
+ * @param value   The value to write
+ */
+void write_output_value(output_buffer_st *buffer, int value);
+
+/**
+ * Writes everything in the buffer to its stream and flushes the stream.
+ *
+ * @param buffer  The buffer to flush
+ * @return        0 if everything written so far has reached the stream, 1 if any of it failed to
+ */
+int flush_output_buffer(output_buffer_st *buffer);
+
+/**
+ * Initialises an input source, mapping the stream into memory if it is a regular file.
+ * Nothing should have been read from the stream yet.
+ *
+ * @param source             The source to initialise
+ * @param stream             The stream to read from
+ * @param raw                Whether values are read as raw 32 bit integers rather than text
+ * @param flush_before_wait  The buffer to flush before waiting on more input, or NULL
+ */
+void init_input_source(input_source_st *source, FILE *stream, int raw, output_buffer_st *flush_before_wait);
+
+/**
+ * Releases the mapping of an input source, if it has one. The stream is left open.
+ *
+ * @param source  The source to close
+ */
+void close_input_source(input_source_st *source);
+
+/**
+ * Reads the next value from an input source.
+ * Once a read has given up with INPUT_INTERRUPTED, the source is left where the value started, as far as
+ * input_source_position says, but can't be read from again.
+ *
+ * @param source  The source to read from
+ * @param value   Where to store the value, only set if INPUT_VALUE is returned
+ * @return        Whether a value was read, or why not
+ */
+input_status_et read_input_value(input_source_st *source, int *value);
+
+/**
+ * Parses a single whitespace separated word of text input, the way read_input_value does.
+ *
+ * @param word    The word, without the whitespace around it
+ * @param length  The length of the word
+ * @param value   Where to store the value, only set if INPUT_VALUE is returned
+ * @return        INPUT_VALUE, or why the word isn't a value, never INPUT_END
+ */
+input_status_et parse_input_word(const char *word, size_t length, int *value);
+
+/**
+ * Gets how far into its stream an input source has read, counting from where it started.
+ *
+ * @param source  The source to check
+ * @return        The number of bytes scanned so far
+ */
+static inline unsigned long long input_source_position(const input_source_st *source) {
+    return source->position + source->used - source->unread;
+}
+
+/**
+ * Skips over the start of an input source, to carry on from a position saved with input_source_position.
+ *
+ * @param source  The source to skip through
+ * @param count   The number of bytes to skip
+ * @return        1 if they were all skipped, 0 if the input ended first
+ */
+int skip_input_source(input_source_st *source, unsigned long long count);
+
+#endif //LMVM_BUFFERED_IO_H
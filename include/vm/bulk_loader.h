@@ -0,0 +1,92 @@
+#ifndef LMVM_BULK_LOADER_H
+#define LMVM_BULK_LOADER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "common/executable_props.h"
+#include "common/file_io.h"
+
+// the most files being opened or read at once by io_uring, or the most loading threads without it
+#define BULK_LOAD_QUEUE_DEPTH 64
+
+/**
+ * Represents a program loaded in the background, which can be run once it is done.
+ * @see program_load_st
+ */
+struct program_load_s {
+    const char *path;
+
+    unsigned short int image[EXECUTABLE_SIZE];
+    load_status_et status;
+    size_t cell_count;  // the cells in the file, even if they didn't fit, for reporting
+
+    int done;  // set once image and status are ready, and only read with wait_for_program
+};
+
+/**
+ * Represents a program loaded in the background.
+ * @see program_load_s
+ */
+typedef struct program_load_s program_load_st;
+
+/**
+ * Represents programs being loaded in the background, in order, so they can be run as soon as each is ready instead
+ * of once every one has been read.
+ * On Linux, the opens, reads and closes of many files are all in flight at once through io_uring, from one thread.
+ * Elsewhere, or where io_uring isn't allowed, a pool of threads loads them with blocking calls instead.
+ * @see bulk_load_st
+ */
+struct bulk_load_s {
+    program_load_st *programs;
+    size_t program_count;
+
+    int used_io_uring;  // whether io_uring did the loading, for debugging
+
+    // the thread loading the programs and what waiting on it takes, kept in bulk_loader.c
+    struct bulk_loader_s *loader;
+};
+
+/**
+ * Represents programs being loaded in the background.
+ * @see bulk_load_s
+ */
+typedef struct bulk_load_s bulk_load_st;
+
+
+/**
+ * Starts loading programs in the background, in the order given.
+ *
+ * @param load           The load to start
+ * @param programs       The programs to load, whose paths are set, which must last until finish_bulk_load
+ * @param program_count  The number of programs
+ */
+void start_bulk_load(bulk_load_st *load, program_load_st *programs, size_t program_count);
+
+/**
+ * Waits for a program to be loaded, whether or not it could be. Safe to call from any number of threads at once.
+ *
+ * @param load     The load the program is part of
+ * @param program  The index of the program
+ * @return         The program, with its image and status ready
+ */
+const program_load_st *wait_for_program(bulk_load_st *load, size_t program);
+
+/**
+ * Waits for every program to be loaded, then frees what the load used, but not the programs.
+ *
+ * @param load  The load to finish
+ */
+void finish_bulk_load(bulk_load_st *load);
+
+/**
+ * Reports why a program couldn't be loaded, in the words lmvm always uses.
+ *
+ * @param errors      The stream to report to
+ * @param path        The path of the program
+ * @param status      The status loading it returned, which isn't LOAD_SUCCESS
+ * @param cell_count  The cells in the file, given by the load
+ */
+void report_load_error(FILE *errors, const char *path, load_status_et status, size_t cell_count);
+
+#endif //LMVM_BULK_LOADER_H
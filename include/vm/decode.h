@@ -0,0 +1,142 @@
+#ifndef LMVM_DECODE_H
+#define LMVM_DECODE_H
+
+#include "common/executable_props.h"
+#include "common/opcodes.h"
+
+/**
+ * Represents the handler that a decoded instruction dispatches to.
+ * Kept compact so that it can be used directly as an index into a dispatch table.
+ * @see decoded_handler_et
+ */
+enum decoded_handler_e {
+    HANDLER_HLT,
+    HANDLER_ADD,
+    HANDLER_SUB,
+    HANDLER_STA,
+    HANDLER_LDA,
+    HANDLER_BRA,
+    HANDLER_BRZ,
+    HANDLER_BRP,
+    HANDLER_INP,
+    HANDLER_OUT,
+    HANDLER_INVALID,          // not a valid instruction, raises an error if executed
+    HANDLER_PC_OUT_OF_RANGE,  // sentinel after the last cell, raises an error if executed
+    HANDLER_REDECODE,         // the cell was written to since it was decoded
+    // superinstructions, covering the cell and the ones after it
+    HANDLER_LDA_ADD_STA,
+    HANDLER_LDA_SUB_STA,
+    HANDLER_SUB_BRZ,
+    HANDLER_LDA_OUT,
+    HANDLER_COUNT
+};
+
+/**
+ * Represents the handler that a decoded instruction dispatches to.
+ * @see decoded_handler_e
+ */
+typedef enum decoded_handler_e decoded_handler_et;
+
+
+// the most cells a superinstruction can cover
+#define MAX_FUSED_LENGTH 3
+
+/**
+ * Represents a single pre-decoded instruction.
+ * The raw cell value is kept for error and debug messages.
+ * Superinstructions keep the operands of the following cells too, but the entries of those cells are left alone,
+ * so a branch into the middle of a group just runs the instructions one by one.
+ * @see decoded_instruction_st
+ */
+struct decoded_instruction_s {
+    unsigned char handler;
+    unsigned char operand;
+    unsigned char operand2;
+    unsigned char operand3;
+    unsigned short int cir;
+};
+
+/**
+ * Represents a single pre-decoded instruction.
+ * @see decoded_instruction_s
+ */
+typedef struct decoded_instruction_s decoded_instruction_st;
+
+
+/**
+ * Represents the pre-decoded form of every cell in memory.
+ * There is one extra entry past the end of memory so that running off the end is caught without a bounds check.
+ * @see instruction_cache_st
+ */
+struct instruction_cache_s {
+    decoded_instruction_st ops[EXECUTABLE_SIZE + 1];
+    int fuse;
+};
+
+/**
+ * Represents the pre-decoded form of every cell in memory.
+ * @see instruction_cache_s
+ */
+typedef struct instruction_cache_s instruction_cache_st;
+
+
+/**
+ * Decodes a single cell value into an instruction.
+ *
+ * @param cir  The value of the cell
+ * @return     The decoded instruction
+ */
+decoded_instruction_st decode_instruction(unsigned short int cir);
+
+/**
+ * Decodes every cell of memory into the cache.
+ * When fusing, common sequences of instructions are decoded into a single superinstruction at the first cell.
+ *
+ * @param cache   The cache to fill
+ * @param memory  The memory array
+ * @param fuse    Whether to use superinstructions, which only engines that understand them should enable
+ */
+void decode_image(instruction_cache_st *cache, const unsigned short int *memory, int fuse);
+
+/**
+ * Marks a cell as written to, so it will be decoded again before it is next executed.
+ * Superinstructions starting just before it that cover it are marked too.
+ * The decoded form is only rebuilt if the cell is actually executed, so writes to data cells stay cheap.
+ *
+ * @param cache    The cache to update
+ * @param address  The address that was written to
+ */
+static inline void invalidate_cell(instruction_cache_st *cache, unsigned short int address) {
+    cache->ops[address].handler = HANDLER_REDECODE;
+
+    // every superinstruction covers at least two cells
+    if (address >= 1 && cache->ops[address - 1].handler >= HANDLER_LDA_ADD_STA) {
+        cache->ops[address - 1].handler = HANDLER_REDECODE;
+    }
+
+    // only the STA forms cover three
+    if (address >= 2 && (cache->ops[address - 2].handler == HANDLER_LDA_ADD_STA || cache->ops[address - 2].handler == HANDLER_LDA_SUB_STA)) {
+        cache->ops[address - 2].handler = HANDLER_REDECODE;
+    }
+}
+
+/**
+ * Decodes a cell that was marked as written to, updating the cache.
+ *
+ * @param cache    The cache to update
+ * @param memory   The memory array
+ * @param address  The address to decode
+ * @return         The freshly decoded instruction
+ */
+decoded_instruction_st redecode_cell(instruction_cache_st *cache, const unsigned short int *memory, unsigned short int address);
+
+/**
+ * Gets the opcode that a decoded instruction corresponds to, for use with execute.
+ * Invalid instructions give the raw first digit(s) of the cell, so that execute reports them.
+ *
+ * @param instruction  The decoded instruction
+ * @return             The matching opcode
+ */
+lmc_opcode_et decoded_opcode(decoded_instruction_st instruction);
+
+#endif //LMVM_DECODE_H
@@ -1,7 +1,13 @@
 #ifndef LMVM_EXECUTION_H
 #define LMVM_EXECUTION_H
 
+#include <stdio.h>
+
 #include "common/opcodes.h"
+#include "vm/decode.h"
+#include "vm/flight_recorder.h"
+#include "vm/trace_writer.h"
+#include "vm/buffered_io.h"
 
 /**
  * Represents the result of executing an instruction.
@@ -13,7 +19,8 @@ enum execution_result_e {
     EXECUTION_SUCCESS_ACC_CHANGED,
     EXECUTION_SUCCESS_ACC_UNCHANGED,
     EXECUTION_SUCCESS_BRANCHED,
-    EXECUTION_HALT
+    EXECUTION_HALT,
+    EXECUTION_INTERRUPTED  // INP gave up waiting for input so the run could stop, and didn't run
 };
 
 /**
@@ -23,6 +30,72 @@ enum execution_result_e {
 typedef enum execution_result_e execution_result_et;
 
 
+/**
+ * Represents the streams an instance of the VM reads input from and writes output and errors to.
+ * Every instance has its own, so several can run at once without sharing state.
+ * @see execution_io_st
+ */
+struct execution_io_s {
+    FILE *input;
+    FILE *output;
+    FILE *errors;
+    int accept_digits;  // the most digits INP reads, worked out on first use
+
+    // if not NULL, OUT writes to this buffer instead of output, and the engine flushes it when the program stops
+    output_buffer_st *buffer;
+
+    // if not NULL, INP reads from this source instead of input
+    input_source_st *source;
+
+    // if not NULL, INP and OUT read from and write to these rings instead, joining this VM to others in a pipeline
+    struct value_ring_s *in_ring;
+    struct value_ring_s *out_ring;
+
+    // where the engine records the instructions it runs, dumped to errors if it fails
+    // if NULL, the engine records into one of its own, so only set this to look at the recording from outside
+    flight_recorder_st *recorder;
+
+    // if not NULL, the interpreter writes every instruction it runs to this trace
+    trace_writer_st *trace;
+
+    // the number of values OUT has written, which a snapshot saves so a resumed run knows where its output got to
+    unsigned long long output_count;
+
+    // if not NULL, the threaded engine starts from the state in this and saves snapshots as it asks
+    struct snapshot_control_s *snapshots;
+
+    // if not NULL, the threaded engine and the interpreter stop the program with an error once it goes past these
+    const struct run_limits_s *limits;
+};
+
+/**
+ * Represents the streams an instance of the VM reads input from and writes output and errors to.
+ * @see execution_io_s
+ */
+typedef struct execution_io_s execution_io_st;
+
+
+/**
+ * Initialises the IO state of a VM instance.
+ *
+ * @param io      The IO state to initialise
+ * @param input   The stream INP reads from
+ * @param output  The stream OUT writes to
+ * @param errors  The stream errors are reported to
+ */
+void init_execution_io(execution_io_st *io, FILE *input, FILE *output, FILE *errors);
+
+/**
+ * Writes out anything OUT has buffered. Engines call this when the program halts or errors.
+ *
+ * @param io  The IO state to flush
+ */
+static inline void flush_execution_io(execution_io_st *io) {
+    if (io->buffer != NULL) {
+        flush_output_buffer(io->buffer);
+    }
+}
+
 /**
  * Executes the given instruction.
  *
@@ -31,9 +104,37 @@ typedef enum execution_result_e execution_result_et;
  * @param reg_ACC The accumulator register.
  * @param reg_PC The program counter register.
  * @param memory The memory array.
+ * @param cache The pre-decoded instruction cache to invalidate on writes, or NULL if there is none.
+ * @param io The IO state of the VM instance.
  * @return The result of executing the instruction.
  */
 execution_result_et
-execute(lmc_opcode_et opcode, unsigned short int *reg_MAR, int *reg_ACC, unsigned short int *reg_PC, unsigned short int *memory);
+execute(lmc_opcode_et opcode, unsigned short int *reg_MAR, int *reg_ACC, unsigned short int *reg_PC, unsigned short int *memory, instruction_cache_st *cache, execution_io_st *io);
+
+/**
+ * Executes the given pre-decoded instruction, reporting invalid instructions and a program counter out of range.
+ * The program counter should already have been moved past the instruction.
+ *
+ * @param instruction The decoded instruction to execute.
+ * @param reg_ACC The accumulator register.
+ * @param reg_PC The program counter register.
+ * @param memory The memory array.
+ * @param cache The pre-decoded instruction cache to invalidate on writes, or NULL if there is none.
+ * @param io The IO state of the VM instance.
+ * @return The result of executing the instruction, never EXECUTION_INDETERMINATE, and only EXECUTION_INTERRUPTED if
+ *         the input source of io has something to stop for.
+ */
+execution_result_et
+execute_decoded(decoded_instruction_st instruction, int *reg_ACC, unsigned short int *reg_PC, unsigned short int *memory, instruction_cache_st *cache, execution_io_st *io);
+
+/**
+ * Executes INP or OUT, which don't touch memory, so engines with memory of their own can share them.
+ *
+ * @param opcode The opcode to execute, either OP_LMC_IO_OP_INP or OP_LMC_IO_OP_OUT.
+ * @param reg_ACC The accumulator register.
+ * @param io The IO state of the VM instance.
+ * @return The result of executing the instruction.
+ */
+execution_result_et execute_io(lmc_opcode_et opcode, int *reg_ACC, execution_io_st *io);
 
 #endif //LMVM_EXECUTION_H
@@ -0,0 +1,106 @@
+#ifndef LMVM_FLIGHT_RECORDER_H
+#define LMVM_FLIGHT_RECORDER_H
+
+#include <stdio.h>
+
+// must be a power of two, so the ring can be indexed with a mask
+#define FLIGHT_RECORDER_SIZE 1024
+
+// the result of a record standing for a counting loop gone round in one step, one past the last execution_result_e
+#define FLIGHT_RESULT_SKIPPED 7
+
+/**
+ * Represents one instruction kept by the flight recorder, with the ACC and result it left behind.
+ * @see flight_record_st
+ */
+struct flight_record_s {
+    unsigned char pc;      // at most EXECUTABLE_SIZE, for running off the end
+    unsigned char result;  // an execution_result_et
+    unsigned short int cir;
+    int acc;
+};
+
+/**
+ * Represents one instruction kept by the flight recorder, with the ACC and result it left behind.
+ * @see flight_record_s
+ */
+typedef struct flight_record_s flight_record_st;
+
+/**
+ * Represents a ring buffer of the last FLIGHT_RECORDER_SIZE instructions run, for reporting what led up to a failure.
+ * Only the thread running the VM writes to it, so it needs no locks, and it can be dumped from a signal handler at any point.
+ * Records are kept to 8 bytes, so a whole recorder fits in a few pages.
+ * @see flight_recorder_st
+ */
+struct flight_recorder_s {
+    flight_record_st records[FLIGHT_RECORDER_SIZE];
+    unsigned long long count;  // the number of records ever written, the newest being at (count - 1) % FLIGHT_RECORDER_SIZE
+};
+
+/**
+ * Represents a ring buffer of the last FLIGHT_RECORDER_SIZE instructions run, for reporting what led up to a failure.
+ * @see flight_recorder_s
+ */
+typedef struct flight_recorder_s flight_recorder_st;
+
+
+/**
+ * Empties the flight recorder, ready for a new run.
+ *
+ * @param recorder  The recorder to empty
+ */
+static inline void reset_flight_recorder(flight_recorder_st *recorder) {
+    recorder->count = 0;
+}
+
+/**
+ * Records an instruction, overwriting the oldest once the recorder is full.
+ * The engine keeps the index in a local and passes it in, so recording is just two stores with nothing to load.
+ * A signal that lands part way through may see the newest record half written, which is fine for a post-mortem.
+ *
+ * @param recorder  The recorder to write to
+ * @param index     The number of instructions recorded before this one
+ * @param pc        The address the instruction was run from
+ * @param cir       The value of the instruction
+ * @param acc       The ACC after it ran
+ * @param result    The result of running it
+ */
+static inline void record_flight(flight_recorder_st *recorder, unsigned long long index, unsigned short int pc, unsigned short int cir, int acc, int result) {
+    flight_record_st record = {(unsigned char) pc, (unsigned char) result, cir, acc};
+
+    recorder->records[index & (FLIGHT_RECORDER_SIZE - 1)] = record;
+    recorder->count = index + 1;
+}
+
+/**
+ * Records that the engine went round a counting loop in one step rather than running it, so the instructions before it
+ * in the recorder aren't mistaken for the ones that led up to what comes next.
+ *
+ * @param recorder  The recorder to write to
+ * @param index     The number of instructions recorded before this one
+ * @param head      The address of the start of the loop
+ * @param tail      The address of the branch back
+ * @param acc       The ACC after the last time round skipped
+ */
+static inline void record_flight_skip(flight_recorder_st *recorder, unsigned long long index, unsigned short int head, unsigned short int tail, int acc) {
+    record_flight(recorder, index, head, tail, acc, FLIGHT_RESULT_SKIPPED);
+}
+
+/**
+ * Writes the recorded instructions to a stream, oldest first, with each instruction decoded.
+ *
+ * @param recorder  The recorder to dump
+ * @param stream    The stream to write to
+ */
+void dump_flight_recorder(const flight_recorder_st *recorder, FILE *stream);
+
+/**
+ * Dumps the recorder to stderr if the process is interrupted, terminated or crashes, or whenever it gets SIGUSR1.
+ * The dump is written without stdio or allocation, so it is safe from a signal handler.
+ * Only one recorder can be watched at a time, so this is meant for the main run of the process.
+ *
+ * @param recorder  The recorder to dump, or NULL to stop watching
+ */
+void watch_flight_recorder(flight_recorder_st *recorder);
+
+#endif //LMVM_FLIGHT_RECORDER_H
@@ -0,0 +1,34 @@
+#ifndef LMVM_HOST_H
+#define LMVM_HOST_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+#include "vm/metering.h"
+
+// the text a session has been sent but its program hasn't read yet, beyond which the session stops reading
+#define HOST_INPUT_SIZE 256
+
+// a session with this much output its client hasn't taken yet isn't run until the client catches up
+#define HOST_OUTPUT_HIGH_WATER (1 << 16)
+
+// the most instructions a session runs before the other sessions on its thread get a turn
+#define HOST_QUANTUM 10000
+
+/**
+ * Listens on a Unix domain socket, running a new copy of the program for every connection, as an interactive session.
+ * A client sends input as text and receives output as text, just like running lmvm in a terminal, and the connection is
+ * closed once the program stops, after any error message.
+ * A session waiting for input is just a paused machine, taking no thread, so each thread runs any number of sessions
+ * from a single epoll loop, taking turns with the sessions that are running.
+ * The socket is removed when the host is stopped by SIGINT or SIGTERM.
+ *
+ * @param socket_path   The path to create the socket at, replacing a socket nothing is listening on
+ * @param image         The program every session runs
+ * @param limits        The limits on each session, where time only counts while it is running, or NULL for none
+ * @param thread_count  The number of threads to spread the sessions across
+ * @return              1 if the host couldn't be started or could no longer accept connections, otherwise it doesn't return
+ */
+int do_host_sessions(const char *socket_path, const unsigned short int image[EXECUTABLE_SIZE], const run_limits_st *limits, size_t thread_count);
+
+#endif //LMVM_HOST_H
@@ -0,0 +1,21 @@
+#ifndef LMVM_INTERPRETER_H
+#define LMVM_INTERPRETER_H
+
+#include <stdio.h>
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+
+/**
+ * Runs the program in memory until it halts or errors, tracing every instruction to the debug stream.
+ * This is the reference engine, used when debug mode is enabled or a trace is being written to io.
+ *
+ * @param memory    The memory array, holding the loaded program
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param debugout  The stream to write the debug trace to, or NULL to not write one
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, FILE *debugout, unsigned long long *executed);
+
+#endif //LMVM_INTERPRETER_H
@@ -0,0 +1,27 @@
+#ifndef LMVM_JIT_H
+#define LMVM_JIT_H
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+
+/**
+ * Checks whether the JIT engine can be used on this platform (x86-64 with mmap).
+ *
+ * @return  1 if the JIT is supported, 0 otherwise
+ */
+int jit_available(void);
+
+/**
+ * Runs the program in memory until it halts or errors, after compiling every cell to native x86-64 code.
+ * Each cell gets a fixed size slot, so branches become direct jumps, and a write to a cell that could run recompiles it.
+ * IO and anything that would raise an error are handed back to execute, so output and errors match do_execution.
+ * Falls back to the threaded engine if executable memory can't be allocated.
+ *
+ * @param memory    The memory array, holding the loaded program
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_jit_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed);
+
+#endif //LMVM_JIT_H
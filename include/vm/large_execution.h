@@ -0,0 +1,23 @@
+#ifndef LMVM_LARGE_EXECUTION_H
+#define LMVM_LARGE_EXECUTION_H
+
+#include <stdio.h>
+
+#include "vm/execution.h"
+#include "vm/paged_memory.h"
+
+/**
+ * Runs a large memory program until it halts or errors, in paged memory of its own that starts as the image.
+ * The instructions are the classic ones with seven digit addresses, and produce the same output and errors, but there
+ * is nothing to catch infinite loops in a memory this size, so only the limits in io stop a program that never halts.
+ * Kept apart from the other engines, so the classic 100 cell memory never has to check which kind it is.
+ *
+ * @param image     The program, which can be shared with any number of other runs at once
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param debugout  The stream to write how much memory the run copied to, or NULL to not write it
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_large_execution(const large_image_st *image, execution_io_st *io, FILE *debugout, unsigned long long *executed);
+
+#endif //LMVM_LARGE_EXECUTION_H
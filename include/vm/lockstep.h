@@ -0,0 +1,54 @@
+#ifndef LMVM_LOCKSTEP_H
+#define LMVM_LOCKSTEP_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+#include "vm/metering.h"
+
+/**
+ * Represents one instance of a program run by the lockstep engine, with its own input and output.
+ * INP takes the next of the lane's inputs, and OUT appends to its outputs instead of printing.
+ * @see lockstep_lane_st
+ */
+struct lockstep_lane_s {
+    const int *inputs;
+    size_t input_count;
+
+    int *outputs;
+    size_t output_count;
+
+    int exit_code;
+};
+
+/**
+ * Represents one instance of a program run by the lockstep engine, with its own input and output.
+ * @see lockstep_lane_s
+ */
+typedef struct lockstep_lane_s lockstep_lane_st;
+
+
+/**
+ * Runs a copy of the image for every lane until they have all halted or errored, stepping lanes at the same PC together with vector instructions.
+ * Lanes that diverge wait until the others reach their PC, and lanes that halt or error retire.
+ * Errors are reported to stderr as they happen, along with the lane they happened in. Running out of input is an error.
+ * The limits count the instructions of every lane together, and hitting one stops every lane still running with an error.
+ *
+ * @param image       The program every lane starts from
+ * @param lanes       The lanes to run, whose outputs are allocated and exit codes set (0 if it halted, 1 if it errored)
+ * @param lane_count  The number of lanes
+ * @param limits      The limits of the run, or NULL if it has none
+ * @param executed    Set to the total number of instructions executed by all lanes, or NULL if not needed
+ * @return            0 if every lane halted, 1 if any lane errored
+ */
+int do_lockstep_execution(const unsigned short int image[EXECUTABLE_SIZE], lockstep_lane_st *lanes, size_t lane_count, const run_limits_st *limits, unsigned long long *executed);
+
+/**
+ * Frees the outputs of lanes run by do_lockstep_execution.
+ *
+ * @param lanes       The lanes to free the outputs of
+ * @param lane_count  The number of lanes
+ */
+void free_lockstep_outputs(lockstep_lane_st *lanes, size_t lane_count);
+
+#endif //LMVM_LOCKSTEP_H
@@ -0,0 +1,78 @@
+#ifndef LMVM_LOOP_ACCELERATOR_H
+#define LMVM_LOOP_ACCELERATOR_H
+
+#include "common/executable_props.h"
+#include "vm/decode.h"
+#include "vm/loop_detector.h"
+
+// marks an address that isn't the branch back of a counting loop
+#define NO_COUNTING_LOOP EXECUTABLE_SIZE
+
+/**
+ * Represents the counting loops found in a program when it is loaded, so that an engine can go round them many times at once.
+ * A counting loop is a run of LDA, ADD, SUB and STA ending in a branch back to its start, left by a BRZ or BRP to
+ * somewhere outside it, or by its branch back not being taken. Every cell it stores to must only be changed by adding
+ * cells it never stores to, and everything it tests must only depend on those cells and the ACC in the same way, so
+ * each value it works with goes up or down by the same amount every time round.
+ * That makes the first time round on which it leaves, or would raise an error, a matter of division, and every time
+ * round before that can be skipped, leaving that last time round to run as normal.
+ * @see loop_accelerator_st
+ */
+struct loop_accelerator_s {
+    unsigned short int image[EXECUTABLE_SIZE];  // the code the loops were found in, to check it is still there
+    unsigned short int heads[EXECUTABLE_SIZE];  // the start of the loop branched back to from each address
+};
+
+/**
+ * Represents the counting loops found in a program when it is loaded.
+ * @see loop_accelerator_s
+ */
+typedef struct loop_accelerator_s loop_accelerator_st;
+
+
+/**
+ * Finds every counting loop in a program.
+ *
+ * @param accelerator  The accelerator to fill in
+ * @param memory       The program, as it is about to start
+ */
+void find_counting_loops(loop_accelerator_st *accelerator, const unsigned short int memory[EXECUTABLE_SIZE]);
+
+/**
+ * Goes round a counting loop as many times as it can without leaving or raising an error, only called by skip_loop_iterations.
+ *
+ * @param accelerator  The accelerator that found the loop
+ * @param memory       The memory the program runs in, which is updated
+ * @param tail         The address of the branch back, which was just taken
+ * @param acc          The ACC, which is updated
+ * @param cache        The decoded cells to invalidate the stored cells in, or NULL
+ * @param detector     The loop detector to tell about stores, or NULL
+ * @param budget       The most instructions that may be skipped
+ * @return             The number of instructions skipped, 0 if the loop wasn't skipped
+ */
+unsigned long long run_counting_loop(const loop_accelerator_st *accelerator, unsigned short int memory[EXECUTABLE_SIZE], unsigned short int tail, int *acc, instruction_cache_st *cache, loop_detector_st *detector, unsigned long long budget);
+
+/**
+ * Goes round a counting loop as many times as it can without leaving or raising an error, after a branch back.
+ * The program is then left at the start of the loop, about to go round for the last time, which it does as normal.
+ * No more than budget instructions are skipped, so a run stops going round in time for its next limit or snapshot,
+ * and is left at the start of the loop with however many times round are still to go.
+ *
+ * @param accelerator  The accelerator that found the loop
+ * @param memory       The memory the program runs in, which is updated
+ * @param tail         The address of the branch that was just taken, to an address at most tail
+ * @param acc          The ACC, which is updated
+ * @param cache        The decoded cells to invalidate the stored cells in, or NULL
+ * @param detector     The loop detector to tell about stores, or NULL
+ * @param budget       The most instructions that may be skipped
+ * @return             The number of instructions skipped, 0 if there is no counting loop there or it can't be skipped
+ */
+static inline unsigned long long skip_loop_iterations(const loop_accelerator_st *accelerator, unsigned short int memory[EXECUTABLE_SIZE], unsigned short int tail, int *acc, instruction_cache_st *cache, loop_detector_st *detector, unsigned long long budget) {
+    if (accelerator->heads[tail] == NO_COUNTING_LOOP) {
+        return 0;
+    }
+
+    return run_counting_loop(accelerator, memory, tail, acc, cache, detector, budget);
+}
+
+#endif //LMVM_LOOP_ACCELERATOR_H
@@ -0,0 +1,125 @@
+#ifndef LMVM_LOOP_DETECTOR_H
+#define LMVM_LOOP_DETECTOR_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common/executable_props.h"
+
+/**
+ * Represents what an engine needs to prove that a program will never halt.
+ * The whole machine is just memory, ACC and PC, so if the same state comes round twice without an INP in between,
+ * the program is certain to go round that way forever. A program that writes output in between isn't stuck, so an OUT
+ * clears the states seen too, however the output is connected.
+ * A hash of memory is kept up to date on every store, and the state is compared at every backward branch against a
+ * checkpoint, which is moved on after 1, 2, 4, 8... backward branches (Brent's cycle detection), so a loop of any length
+ * is caught within a few times its length, with only one saved state.
+ * Hashes only say where to look, and a repeat is only reported once the saved memory matches exactly.
+ * @see loop_detector_st
+ */
+struct loop_detector_s {
+    unsigned long long hash;  // of memory as it is now
+    unsigned long long weights[EXECUTABLE_SIZE];
+
+    int has_checkpoint;
+    unsigned long long checkpoint_hash;
+    int checkpoint_acc;
+    unsigned short int checkpoint_pc;
+    unsigned short int checkpoint_memory[EXECUTABLE_SIZE];
+
+    unsigned long long since_checkpoint;  // backward branches since the checkpoint was taken
+    unsigned long long interval;          // how many there will be before the next is taken
+
+    // the addresses covered by the backward branches since the checkpoint, which is where any loop must be
+    unsigned short int low;
+    unsigned short int high;
+};
+
+/**
+ * Represents what an engine needs to prove that a program will never halt.
+ * @see loop_detector_s
+ */
+typedef struct loop_detector_s loop_detector_st;
+
+
+/**
+ * Starts watching a program, hashing its memory as it is now.
+ *
+ * @param detector  The detector to initialise
+ * @param memory    The memory the program runs in
+ */
+void reset_loop_detector(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE]);
+
+/**
+ * Forgets every state seen so far. Called after INP, since the input may take the program somewhere new, and after OUT.
+ *
+ * @param detector  The detector to clear
+ */
+static inline void forget_loop_states(loop_detector_st *detector) {
+    detector->has_checkpoint = 0;
+    detector->interval = 1;
+    detector->since_checkpoint = 0;
+}
+
+/**
+ * Keeps the hash up to date with a store. Called just before the cell is written.
+ *
+ * @param detector  The detector to update
+ * @param memory    The memory the program runs in, not yet written to
+ * @param address   The address being stored to
+ * @param value     The value being stored
+ */
+static inline void note_loop_store(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int address, unsigned short int value) {
+    detector->hash += (unsigned long long) ((long long) value - (long long) memory[address]) * detector->weights[address];
+}
+
+/**
+ * Saves the current state as the one to look out for, only called by check_loop_state.
+ *
+ * @param detector  The detector to update
+ * @param memory    The memory the program runs in
+ * @param from      The address of the branch that was just taken
+ * @param to        The address it branched to
+ * @param acc       The ACC
+ */
+void take_loop_checkpoint(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int from, unsigned short int to, int acc);
+
+/**
+ * Checks the state after a taken branch to an earlier address, the only way a program can come back round.
+ *
+ * @param detector  The detector to check with
+ * @param memory    The memory the program runs in
+ * @param from      The address of the branch
+ * @param to        The address branched to, which is at most from
+ * @param acc       The ACC
+ * @return          1 if the program has been in exactly this state before, so will never halt, 0 if not
+ */
+static inline int check_loop_state(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int from, unsigned short int to, int acc) {
+    if (to < detector->low) {
+        detector->low = to;
+    }
+    if (from > detector->high) {
+        detector->high = from;
+    }
+
+    if (detector->has_checkpoint && to == detector->checkpoint_pc && acc == detector->checkpoint_acc && detector->hash == detector->checkpoint_hash
+        && memcmp(memory, detector->checkpoint_memory, sizeof(detector->checkpoint_memory)) == 0) {
+        return 1;
+    }
+
+    if (++detector->since_checkpoint >= detector->interval) {
+        take_loop_checkpoint(detector, memory, from, to, acc);
+    }
+
+    return 0;
+}
+
+/**
+ * Reports a loop found by check_loop_state, with the addresses it runs between.
+ *
+ * @param detector  The detector that found the loop
+ * @param errors    The stream to report to
+ */
+void report_loop(const loop_detector_st *detector, FILE *errors);
+
+#endif //LMVM_LOOP_DETECTOR_H
@@ -0,0 +1,79 @@
+#ifndef LMVM_METERING_H
+#define LMVM_METERING_H
+
+#include <stdio.h>
+
+// the clock is only read once this many instructions have run since it was last read
+#define METER_CLOCK_INTERVAL (1ULL << 18)
+
+/**
+ * Represents the most a run is allowed to do before it is stopped with an error.
+ * @see run_limits_st
+ */
+struct run_limits_s {
+    unsigned long long max_steps;  // instructions, or 0 for no limit
+    unsigned long long max_ms;     // milliseconds since the run started, or 0 for no limit
+};
+
+/**
+ * Represents the most a run is allowed to do before it is stopped with an error.
+ * @see run_limits_s
+ */
+typedef struct run_limits_s run_limits_st;
+
+/**
+ * Represents a run being checked against its limits.
+ * Engines only look at the meter once their instruction count reaches due, which they compare against at branches
+ * back and IO, the same places they already check for loops and snapshots, so metering costs nothing between them.
+ * Every basic block ends at one of those, or within a hundred instructions at the end of memory, so a run can only go
+ * that far past its step limit. The threaded engine only skips round a counting loop as far as due, for the same reason.
+ * @see step_meter_st
+ */
+struct step_meter_s {
+    const run_limits_st *limits;
+    unsigned long long due;          // the instruction count at which the meter next needs checking
+    unsigned long long started_ms;   // when the run started, by the monotonic clock
+    int exceeded;                    // the limit that was hit, 1 for steps and 2 for time, or 0 if neither
+};
+
+/**
+ * Represents a run being checked against its limits.
+ * @see step_meter_s
+ */
+typedef struct step_meter_s step_meter_st;
+
+
+/**
+ * Gets the time by a clock that only goes forward, for measuring how long something takes.
+ *
+ * @return  The time in milliseconds, from an arbitrary start
+ */
+unsigned long long monotonic_ms(void);
+
+/**
+ * Starts checking a run against its limits.
+ *
+ * @param meter   The meter to start
+ * @param limits  The limits of the run, or NULL if it has none, in which case the meter is never due
+ */
+void start_meter(step_meter_st *meter, const run_limits_st *limits);
+
+/**
+ * Checks a run against its limits once the meter is due, working out when it is next due.
+ *
+ * @param meter  The meter of the run
+ * @param steps  The instructions the run has executed
+ * @return       0 if the run can carry on, 1 if it has hit a limit
+ */
+int check_meter(step_meter_st *meter, unsigned long long steps);
+
+/**
+ * Reports the limit a run hit.
+ *
+ * @param meter   The meter of the run, after check_meter returned 1
+ * @param steps   The instructions the run has executed
+ * @param errors  The stream to report to
+ */
+void report_limit(const step_meter_st *meter, unsigned long long steps, FILE *errors);
+
+#endif //LMVM_METERING_H
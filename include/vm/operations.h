@@ -0,0 +1,105 @@
+#ifndef LMVM_OPERATIONS_H
+#define LMVM_OPERATIONS_H
+
+#include <stddef.h>
+#include <limits.h>
+
+#include "common/opcodes.h"
+
+/**
+ * Represents an error raised by running an instruction, which execute and liblmvm both raise and describe the same way.
+ * The numbers are the same as the first of liblmvm's errors, so one can be handed on as the other.
+ * @see lmc_fault_et
+ */
+enum lmc_fault_e {
+    FAULT_NONE,
+    FAULT_OVERFLOW,
+    FAULT_UNDERFLOW,
+    FAULT_OUT_OF_MEMORY_RANGE,
+    FAULT_INVALID_OPCODE,
+    FAULT_INVALID_IO,
+    FAULT_PC_OUT_OF_RANGE,
+    FAULT_OUT_OF_INPUT
+};
+
+/**
+ * Represents an error raised by running an instruction.
+ * @see lmc_fault_e
+ */
+typedef enum lmc_fault_e lmc_fault_et;
+
+
+/**
+ * Adds a cell to the ACC, as ADD does, unless the result wouldn't fit.
+ *
+ * @param acc  The ACC, left as it was on an error
+ * @param mdr  The value of the cell
+ * @return     FAULT_NONE, or FAULT_OVERFLOW
+ */
+static inline lmc_fault_et add_to_acc(int *acc, unsigned short int mdr) {
+    if (*acc > INT_MAX - mdr) {
+        return FAULT_OVERFLOW;
+    }
+
+    // doesn't need to stay within 0-999, this will be checked when STA is executed
+    *acc += mdr;
+    return FAULT_NONE;
+}
+
+/**
+ * Subtracts a cell from the ACC, as SUB does, unless the result wouldn't fit.
+ *
+ * @param acc  The ACC, left as it was on an error
+ * @param mdr  The value of the cell
+ * @return     FAULT_NONE, or FAULT_UNDERFLOW
+ */
+static inline lmc_fault_et subtract_from_acc(int *acc, unsigned short int mdr) {
+    if (*acc < INT_MIN + mdr) {
+        return FAULT_UNDERFLOW;
+    }
+
+    *acc -= mdr;
+    return FAULT_NONE;
+}
+
+/**
+ * Stores the ACC in a cell, as STA does, unless it isn't a value a cell can hold.
+ *
+ * @param acc   The ACC
+ * @param cell  The cell, left as it was on an error
+ * @return      FAULT_NONE, or FAULT_OUT_OF_MEMORY_RANGE
+ */
+static inline lmc_fault_et store_acc(int acc, unsigned short int *cell) {
+    if (acc < 0 || acc > 999) {
+        return FAULT_OUT_OF_MEMORY_RANGE;
+    }
+
+    *cell = (unsigned short int) acc;
+    return FAULT_NONE;
+}
+
+/**
+ * Gets the error an invalid instruction raises, where an IO operation is only valid as INP or OUT.
+ *
+ * @param cir  The value of the instruction
+ * @return     FAULT_INVALID_IO or FAULT_INVALID_OPCODE
+ */
+static inline lmc_fault_et invalid_instruction_fault(unsigned short int cir) {
+    return cir / 100 == OP_LMC_IO_OP ? FAULT_INVALID_IO : FAULT_INVALID_OPCODE;
+}
+
+/**
+ * Describes an error in the words lmvm reports it with, without the "Error: " before it.
+ *
+ * @param buffer  Where to write the message, which is always terminated if size isn't 0
+ * @param size    The size of buffer
+ * @param fault   The error
+ * @param acc     The ACC before the instruction that raised it
+ * @param mdr     The value of the cell the instruction read
+ * @param cir     The value of the instruction
+ * @param pc      The PC, already moved past the instruction
+ * @return        The length of the whole message, as snprintf returns
+ */
+int describe_fault(char *buffer, size_t size, lmc_fault_et fault, int acc, unsigned short int mdr, unsigned short int cir, unsigned int pc);
+
+#endif //LMVM_OPERATIONS_H
@@ -0,0 +1,158 @@
+#ifndef LMVM_PAGED_MEMORY_H
+#define LMVM_PAGED_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/file_io.h"
+
+// a large memory program addresses this many cells, and its instructions are opcode * LARGE_ADDRESS_SPACE + address,
+// so it reads like a classic program with seven digit addresses instead of two
+#define LARGE_ADDRESS_SPACE 10000000u
+
+// cells hold a digit of opcode and seven of address, so every value is below this
+#define LARGE_CELL_LIMIT (10u * LARGE_ADDRESS_SPACE)
+
+// a page is 1024 cells, 4KB, and a page table maps 256 pages, so the directory only needs 39 entries
+#define PAGE_CELL_BITS 10
+#define PAGE_CELLS (1u << PAGE_CELL_BITS)
+#define PAGE_TABLE_BITS 8
+#define PAGE_TABLE_PAGES (1u << PAGE_TABLE_BITS)
+#define PAGE_COUNT ((LARGE_ADDRESS_SPACE + PAGE_CELLS - 1) / PAGE_CELLS)
+#define PAGE_DIRECTORY_SIZE ((PAGE_COUNT + PAGE_TABLE_PAGES - 1) / PAGE_TABLE_PAGES)
+
+/**
+ * Represents a large memory program as loaded, which is only ever read, so any number of machines can share it.
+ * Where the file can be mapped and is already in the machine's byte order, its pages are the pages of the mapping, so
+ * the program is only in memory once however many machines, or processes, run it. Pages past the end of the program
+ * are all one page of zeros.
+ * @see large_image_st
+ */
+struct large_image_s {
+    const uint32_t *pages[PAGE_COUNT];
+    size_t cell_count;
+
+    // what the pages point into, freed with the image
+    void *mapping;
+    size_t mapping_size;
+    uint32_t *cells;  // a copy of the cells, padded to whole pages, where the mapping can't be used or for its last page
+};
+
+/**
+ * Represents a large memory program as loaded.
+ * @see large_image_s
+ */
+typedef struct large_image_s large_image_st;
+
+/**
+ * Represents the pages of a machine's memory that it has written to.
+ * @see page_table_st
+ */
+struct page_table_s {
+    uint32_t *pages[PAGE_TABLE_PAGES];
+};
+
+/**
+ * Represents the pages of a machine's memory that it has written to.
+ * @see page_table_s
+ */
+typedef struct page_table_s page_table_st;
+
+/**
+ * Represents the memory of one machine running a large memory program, through a two level page table.
+ * Nothing is allocated until the program writes to a page, which is then copied from the image, so a machine only
+ * costs the pages it has changed, and reading anywhere else reads the shared image.
+ * @see paged_memory_st
+ */
+struct paged_memory_s {
+    const large_image_st *image;
+    page_table_st *directory[PAGE_DIRECTORY_SIZE];
+    size_t private_pages;  // pages copied so far, for debugging
+};
+
+/**
+ * Represents the memory of one machine running a large memory program.
+ * @see paged_memory_s
+ */
+typedef struct paged_memory_s paged_memory_st;
+
+
+/**
+ * Loads a large memory program, an lmvm-ext EXT_LARGE_MEMORY_VERSION file whose cells are stored in 4 bytes each.
+ *
+ * @param path        The path of the file to load
+ * @param image       Where to load the program
+ * @param cell_count  Set to the number of cells in the file, even if they don't fit
+ * @return            LOAD_SUCCESS if image holds the program, otherwise why it doesn't
+ */
+load_status_et load_large_image(const char *path, large_image_st *image, size_t *cell_count);
+
+/**
+ * Frees what a loaded image uses. No memory using it can be read afterwards.
+ *
+ * @param image  The image to free
+ */
+void free_large_image(large_image_st *image);
+
+/**
+ * Sets up memory holding a program, without allocating anything.
+ *
+ * @param memory  The memory to set up
+ * @param image   The program, which must last as long as memory is used
+ */
+void init_paged_memory(paged_memory_st *memory, const large_image_st *image);
+
+/**
+ * Frees the pages the machine has written to, putting its memory back to the image.
+ *
+ * @param memory  The memory to reset
+ */
+void reset_paged_memory(paged_memory_st *memory);
+
+/**
+ * Gives a machine its own copy of a page it is about to write to, copied from the image.
+ *
+ * @param memory  The memory the page is part of
+ * @param page    The page, which the machine doesn't have its own copy of yet
+ * @return        The machine's copy of the page
+ */
+uint32_t *copy_paged_page(paged_memory_st *memory, uint32_t page);
+
+/**
+ * Reads a cell, from the machine's own copy of its page if it has written to it, otherwise from the image.
+ *
+ * @param memory   The memory to read from
+ * @param address  The address of the cell, below LARGE_ADDRESS_SPACE
+ * @return         The value of the cell
+ */
+static inline uint32_t read_paged_cell(const paged_memory_st *memory, uint32_t address) {
+    uint32_t page = address >> PAGE_CELL_BITS;
+    const page_table_st *table = memory->directory[page >> PAGE_TABLE_BITS];
+
+    if (table != NULL && table->pages[page & (PAGE_TABLE_PAGES - 1)] != NULL) {
+        return table->pages[page & (PAGE_TABLE_PAGES - 1)][address & (PAGE_CELLS - 1)];
+    }
+
+    return memory->image->pages[page][address & (PAGE_CELLS - 1)];
+}
+
+/**
+ * Writes a cell, copying its page from the image the first time the page is written to.
+ *
+ * @param memory   The memory to write to
+ * @param address  The address of the cell, below LARGE_ADDRESS_SPACE
+ * @param value    The value to write
+ */
+static inline void write_paged_cell(paged_memory_st *memory, uint32_t address, uint32_t value) {
+    uint32_t page = address >> PAGE_CELL_BITS;
+    const page_table_st *table = memory->directory[page >> PAGE_TABLE_BITS];
+    uint32_t *cells = table != NULL ? table->pages[page & (PAGE_TABLE_PAGES - 1)] : NULL;
+
+    if (cells == NULL) {
+        cells = copy_paged_page(memory, page);
+    }
+
+    cells[address & (PAGE_CELLS - 1)] = value;
+}
+
+#endif //LMVM_PAGED_MEMORY_H
@@ -0,0 +1,91 @@
+#ifndef LMVM_PIPELINE_H
+#define LMVM_PIPELINE_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+#include "vm/batch.h"
+
+// must be a power of two, so positions can be wrapped with a mask
+#define VALUE_RING_SIZE 4096
+
+/**
+ * Represents a bounded queue of values from one VM's OUT to the next one's INP, for exactly one writer and one reader.
+ * Values are passed without locks, and either side only sleeps (on a condition variable) when the ring is full or empty.
+ * Either side can close its end: the reader sees the end of the values once it has read everything written before,
+ * and the writer is refused as soon as the reader has gone.
+ * @see value_ring_st
+ */
+typedef struct value_ring_s value_ring_st;
+
+/**
+ * Represents one program in a pipeline, with the errors it reported.
+ * @see pipeline_stage_st
+ */
+struct pipeline_stage_s {
+    const unsigned short int *image;  // the program to run, which is not written to
+    const char *name;                 // what to call the stage when reporting its errors
+
+    char *errors;
+    size_t errors_size;
+
+    int exit_code;
+};
+
+/**
+ * Represents one program in a pipeline, with the errors it reported.
+ * @see pipeline_stage_s
+ */
+typedef struct pipeline_stage_s pipeline_stage_st;
+
+
+/**
+ * Writes a value to a ring, waiting for room if it is full.
+ *
+ * @param ring   The ring to write to
+ * @param value  The value to write
+ * @return       1 if the value was written, 0 if the reader has closed its end
+ */
+int push_ring_value(value_ring_st *ring, int value);
+
+/**
+ * Reads the next value from a ring, waiting for one if it is empty.
+ *
+ * @param ring   The ring to read from
+ * @param value  Where to store the value
+ * @return       1 if a value was read, 0 if the writer has closed its end and every value has been read
+ */
+int pop_ring_value(value_ring_st *ring, int *value);
+
+/**
+ * Checks whether pipelines can be run on this platform, which needs threads and atomics.
+ *
+ * @return  1 if do_pipeline_execution can be used, 0 if not
+ */
+int pipeline_available(void);
+
+/**
+ * Runs every stage at once on threads of their own, each stage's OUT feeding the next stage's INP through a ring.
+ * The first stage reads from the input of ends and the last writes to its output, using its source and buffer if set,
+ * so neither should be shared with anything else while the pipeline runs.
+ * When a stage stops, the stage after it runs out of input once it has read everything, and the stage before it stops
+ * quietly at its next OUT, so a failure anywhere brings the whole pipeline down.
+ *
+ * @param stages       The stages to run, in order, whose errors are collected and exit codes set
+ * @param stage_count  The number of stages, at least 1
+ * @param engine       The engine to run each stage with
+ * @param ends         The streams at either end of the pipeline, and the stream for errors that aren't from a stage
+ * @return             0 if every stage halted, 1 if any stage errored or the pipeline couldn't be started
+ */
+int do_pipeline_execution(pipeline_stage_st *stages, size_t stage_count, batch_engine_fn engine, execution_io_st *ends);
+
+/**
+ * Frees the errors collected by do_pipeline_execution.
+ *
+ * @param stages       The stages to free the errors of
+ * @param stage_count  The number of stages
+ */
+void free_pipeline_errors(pipeline_stage_st *stages, size_t stage_count);
+
+#endif //LMVM_PIPELINE_H
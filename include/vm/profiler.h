@@ -0,0 +1,62 @@
+#ifndef LMVM_PROFILER_H
+#define LMVM_PROFILER_H
+
+#include <stdio.h>
+
+#include "common/executable_props.h"
+#include "common/source_map.h"
+#include "vm/decode.h"
+#include "vm/execution.h"
+
+// the most lines of each ranking the report prints
+#define PROFILE_TOP_COUNT 10
+
+/**
+ * Represents how often each cell was run, branched from, read and written, kept in flat arrays indexed by address the
+ * way memory is, so counting an instruction is one increment next to the memory it touches.
+ * The arrays have a slot past the last cell, for a program that runs off the end of memory.
+ * @see execution_profile_st
+ */
+struct execution_profile_s {
+    unsigned long long executions[EXECUTABLE_SIZE + 1];
+    unsigned long long taken[EXECUTABLE_SIZE + 1];  // branches from the cell that were taken, the rest weren't
+    unsigned long long reads[EXECUTABLE_SIZE];      // by ADD, SUB and LDA
+    unsigned long long writes[EXECUTABLE_SIZE];     // by STA
+    unsigned long long handlers[HANDLER_COUNT];     // instructions run of each kind, only up to HANDLER_INVALID
+    unsigned long long steps;
+
+    unsigned short int image[EXECUTABLE_SIZE];  // the program as loaded, since it may have changed itself by the end
+};
+
+/**
+ * Represents how often each cell was run, branched from, read and written.
+ * @see execution_profile_s
+ */
+typedef struct execution_profile_s execution_profile_st;
+
+
+/**
+ * Runs the program in memory until it halts or errors, counting everything it does into profile.
+ * Produces the same output and errors as do_execution, without tracing. Counting loops are skipped the way the threaded
+ * engine skips them, and every cell of the loop is counted once for each time round skipped, so the counts are the same
+ * as if it had gone round each time.
+ *
+ * @param memory    The memory array, holding the loaded program
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param profile   Where to count, which is cleared first
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_profiled_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, execution_profile_st *profile, unsigned long long *executed);
+
+/**
+ * Writes a report of a profile, with the hottest cells, the branches, the loops found from the branches that went back,
+ * and the instructions run of each kind.
+ *
+ * @param profile  The profile to report
+ * @param source   The source of the program, to show cells as their lines and labels, or NULL to show them disassembled
+ * @param stream   The stream to write the report to
+ */
+void write_profile_report(const execution_profile_st *profile, const source_map_st *source, FILE *stream);
+
+#endif //LMVM_PROFILER_H
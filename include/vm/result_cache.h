@@ -0,0 +1,113 @@
+#ifndef LMVM_RESULT_CACHE_H
+#define LMVM_RESULT_CACHE_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+
+// the size of the hash runs are stored under
+#define RESULT_KEY_SIZE 32
+
+/**
+ * Represents a directory of the results of earlier runs, stored under a SHA-256 hash of the program and all of its
+ * input, which is all a run depends on.
+ * Results are appended to a data file and then to an index of fixed size records, each in a single write to a file
+ * opened for appending, so any number of processes can add to the cache at once without locking.
+ * Lookups map the index and scan it, and a record is only trusted once the data it points to matches its checksum,
+ * so a result being written by another process, or cut short by a crash, is never returned.
+ * @see result_cache_st
+ */
+struct result_cache_s {
+    char *index_path;
+    char *data_path;
+};
+
+/**
+ * Represents a directory of the results of earlier runs.
+ * @see result_cache_s
+ */
+typedef struct result_cache_s result_cache_st;
+
+/**
+ * Represents everything a run produced.
+ * @see cached_result_st
+ */
+struct cached_result_s {
+    char *output;
+    size_t output_size;
+    char *errors;
+    size_t errors_size;
+
+    unsigned long long executed;
+    int exit_code;
+};
+
+/**
+ * Represents everything a run produced.
+ * @see cached_result_s
+ */
+typedef struct cached_result_s cached_result_st;
+
+
+/**
+ * Checks whether results can be cached on this platform, which needs posix files.
+ *
+ * @return  1 if the other functions can be used, 0 if not
+ */
+int result_cache_available(void);
+
+/**
+ * Works out the key a run is stored under.
+ *
+ * @param key         Where to store the key
+ * @param image       The program, as loaded
+ * @param raw_io      Whether INP and OUT are raw, which changes what the same input and output mean
+ * @param input       Everything the run could read
+ * @param input_size  The size of the input
+ */
+void hash_run(unsigned char key[RESULT_KEY_SIZE], const unsigned short int image[EXECUTABLE_SIZE], int raw_io, const unsigned char *input, size_t input_size);
+
+/**
+ * Opens the cache in a directory, creating the directory if it doesn't exist.
+ *
+ * @param cache      The cache to open
+ * @param directory  The directory to keep the cache in
+ * @return           0 if the cache can be used, 1 if not
+ */
+int open_result_cache(result_cache_st *cache, const char *directory);
+
+/**
+ * Closes a cache opened with open_result_cache.
+ *
+ * @param cache  The cache to close
+ */
+void close_result_cache(result_cache_st *cache);
+
+/**
+ * Looks for the result of a run, taking the newest if it was stored more than once.
+ *
+ * @param cache   The cache to look in
+ * @param key     The key of the run, from hash_run
+ * @param result  Where to store the result, to be freed with free_cached_result
+ * @return        1 if the run was found, 0 if not
+ */
+int find_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], cached_result_st *result);
+
+/**
+ * Stores the result of a run.
+ *
+ * @param cache   The cache to store in
+ * @param key     The key of the run, from hash_run
+ * @param result  The result to store
+ * @return        0 if it was stored, 1 if not
+ */
+int store_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], const cached_result_st *result);
+
+/**
+ * Frees a result found by find_cached_result.
+ *
+ * @param result  The result to free
+ */
+void free_cached_result(cached_result_st *result);
+
+#endif //LMVM_RESULT_CACHE_H
@@ -0,0 +1,79 @@
+#ifndef LMVM_SERVER_H
+#define LMVM_SERVER_H
+
+#include <stddef.h>
+
+#include "vm/metering.h"
+
+// every number in a request or response is little endian, and input and output values are 32 bit signed integers
+
+#define SERVE_REQUEST_MAGIC "LMRQ"
+#define SERVE_RESPONSE_MAGIC "LMRS"
+
+// magic, image size in bytes, input count, step budget, then the image (the contents of an executable) and the inputs
+#define SERVE_REQUEST_HEADER_SIZE (4 + 4 + 4 + 8)
+
+// magic, status, instructions run, output count, message length, then the outputs and the message
+#define SERVE_RESPONSE_HEADER_SIZE (4 + 4 + 8 + 4 + 4)
+
+// the largest executable, which has the extended magic string and version
+#define SERVE_MAX_IMAGE_SIZE (10 + 2 + 2 * 100)
+
+#define SERVE_MAX_INPUTS (1 << 20)
+
+// a program that writes more than this stops with an error, rather than filling the server's memory
+#define SERVE_MAX_OUTPUTS (1 << 20)
+
+// the most instructions a request runs between looks at the clock, when the server has a time limit
+#define SERVE_TIME_SLICE (1ULL << 20)
+
+/**
+ * Represents how a request ended.
+ * Only SERVE_HALTED would have given an exit code of 0 from lmvm.
+ * @see serve_status_et
+ */
+enum serve_status_e {
+    SERVE_HALTED,
+    SERVE_ERROR,       // the program stopped on an error, given in the message
+    SERVE_STEP_LIMIT,  // the program was still running when its step budget ran out
+    SERVE_BAD_REQUEST  // the request couldn't be run, for the reason given in the message
+};
+
+/**
+ * Represents how a request ended.
+ * @see serve_status_e
+ */
+typedef enum serve_status_e serve_status_et;
+
+
+/**
+ * Creates a Unix domain socket and listens on it, reporting any failure.
+ *
+ * @param socket_path  The path to create the socket at, replacing a socket nothing is listening on
+ * @return             The listening socket, or -1 if it couldn't be created
+ */
+int open_server_socket(const char *socket_path);
+
+/**
+ * Removes a server's socket when the process is stopped by SIGINT or SIGTERM, and keeps clients that disconnect early
+ * from stopping the process with SIGPIPE.
+ *
+ * @param socket_path  The path of the socket, which must last as long as the process
+ */
+void remove_socket_on_stop(const char *socket_path);
+
+/**
+ * Listens on a Unix domain socket, running the programs sent to it until the process is stopped.
+ * A connection can send any number of requests, each answered in order once it has run. A step budget of 0 runs the
+ * program until it stops, or until it reaches the server's own limits, which are errors.
+ * Each worker serves one connection at a time, so clients that keep connections open should keep to one per worker.
+ * The socket is removed when the server is stopped by SIGINT or SIGTERM.
+ *
+ * @param socket_path   The path to create the socket at, replacing a socket nothing is listening on
+ * @param limits        The limits on every request, whatever budget it asks for, or NULL for none
+ * @param worker_count  The number of connections to serve at once, each on its own thread
+ * @return              1 if the server couldn't be started or could no longer accept connections, otherwise it doesn't return
+ */
+int do_serve(const char *socket_path, const run_limits_st *limits, size_t worker_count);
+
+#endif //LMVM_SERVER_H
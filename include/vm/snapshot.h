@@ -0,0 +1,119 @@
+#ifndef LMVM_SNAPSHOT_H
+#define LMVM_SNAPSHOT_H
+
+#include <signal.h>
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+
+#define SNAPSHOT_MAGIC "LMCS"
+#define SNAPSHOT_VERSION 1
+
+// magic, version, PC, ACC, input offset, output count, instructions run, then memory
+#define SNAPSHOT_FILE_SIZE (4 + 2 + 2 + 4 + 8 + 8 + 8 + 2 * EXECUTABLE_SIZE)
+
+/**
+ * Represents everything needed to carry on a run from part way through it.
+ * The machine is only memory, ACC and PC, and the rest says how far through its input and output it had got.
+ * @see vm_snapshot_st
+ */
+struct vm_snapshot_s {
+    unsigned short int memory[EXECUTABLE_SIZE];
+    int acc;
+    unsigned short int pc;
+
+    unsigned long long input_offset;  // bytes of input read, which are skipped when resuming
+    unsigned long long output_count;  // values written, so the output of the run so far can be matched up
+    unsigned long long executed;      // instructions run, over every run the snapshot has been resumed through
+};
+
+/**
+ * Represents everything needed to carry on a run from part way through it.
+ * @see vm_snapshot_s
+ */
+typedef struct vm_snapshot_s vm_snapshot_st;
+
+/**
+ * Represents a snapshot asked for by a signal.
+ * @see snapshot_request_et
+ */
+enum snapshot_request_e {
+    SNAPSHOT_NONE,
+    SNAPSHOT_SAVE,  // save and carry on
+    SNAPSHOT_STOP   // save and stop, as the machine is going away
+};
+
+/**
+ * Represents a snapshot asked for by a signal.
+ * @see snapshot_request_e
+ */
+typedef enum snapshot_request_e snapshot_request_et;
+
+/**
+ * Represents when an engine should save snapshots of a run, and where to, along with where the run starts from.
+ * Snapshots are only taken between instructions, at branches back and IO, which every long run keeps coming to.
+ * @see snapshot_control_st
+ */
+struct snapshot_control_s {
+    const char *path;          // where snapshots are written, replacing the last one
+    unsigned long long every;  // instructions between snapshots, 0 to only take them when signalled
+
+    // if not NULL, the run carries on from this, whose memory should already be loaded
+    const vm_snapshot_st *start;
+
+    volatile sig_atomic_t requested;  // a snapshot_request_et, set by the signal handlers
+    volatile sig_atomic_t stopping;   // set along with SNAPSHOT_STOP, for the input source to stop waiting on
+
+    int failed;   // set if any snapshot couldn't be written
+    int stopped;  // set if the run was stopped by SNAPSHOT_STOP
+};
+
+/**
+ * Represents when an engine should save snapshots of a run, and where to.
+ * @see snapshot_control_s
+ */
+typedef struct snapshot_control_s snapshot_control_st;
+
+
+/**
+ * Writes a snapshot to a file in one go, through a temporary file, so it is never left half written.
+ *
+ * @param path      The path to write to
+ * @param snapshot  The snapshot to write
+ * @return          0 if it was written, 1 if not
+ */
+int write_snapshot(const char *path, const vm_snapshot_st *snapshot);
+
+/**
+ * Reads a snapshot written by write_snapshot.
+ *
+ * @param path      The path to read from
+ * @param snapshot  Where to store the snapshot
+ * @return          0 if it was read, 1 if the file couldn't be read or isn't a snapshot
+ */
+int read_snapshot(const char *path, vm_snapshot_st *snapshot);
+
+/**
+ * Saves the state of a running program, first writing out any output it has buffered so the output matches the snapshot.
+ * Failures are reported to the errors stream of io, and noted in control.
+ *
+ * @param control   Where to save to
+ * @param memory    The memory the program runs in
+ * @param acc       The ACC
+ * @param pc        The address of the next instruction
+ * @param executed  The instructions run since the engine started
+ * @param io        The IO state of the program, to save how far it has got through its input and output
+ * @return          0 if the snapshot was saved, 1 if not
+ */
+int save_snapshot(snapshot_control_st *control, const unsigned short int memory[EXECUTABLE_SIZE], int acc, unsigned short int pc, unsigned long long executed, execution_io_st *io);
+
+/**
+ * Takes snapshots when the process is signalled, replacing the flight recorder's handlers for SIGINT and SIGTERM.
+ * SIGUSR2 saves and carries on, and SIGINT and SIGTERM save and stop. Where it can be, the handlers are installed so
+ * the signals interrupt a wait for input rather than restarting it, so a run stuck at an INP can still be stopped.
+ *
+ * @param control  Where the requests are made
+ */
+void watch_snapshot_signals(snapshot_control_st *control);
+
+#endif //LMVM_SNAPSHOT_H
@@ -0,0 +1,42 @@
+#ifndef LMVM_SWEEP_H
+#define LMVM_SWEEP_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "common/executable_props.h"
+
+/**
+ * Represents the inputs a sweep tries and how it reports them.
+ * @see sweep_options_st
+ */
+struct sweep_options_s {
+    int min;                       // the lowest value given to each INP
+    int max;                       // the highest value given to each INP
+    size_t input_count;            // how many INPs are swept, after which a run stops as if it needs more input
+    unsigned long long step_limit; // the most instructions a run can execute before it is counted as failing
+    int failures_only;             // whether to only report runs that errored or hit the step limit
+};
+
+/**
+ * Represents the inputs a sweep tries and how it reports them.
+ * @see sweep_options_s
+ */
+typedef struct sweep_options_s sweep_options_st;
+
+
+/**
+ * Runs the program once for every combination of inputs, sharing the work done before each INP between every run that reaches it.
+ * When a run reaches an INP, its state is copied into one run per value, which carry on from there.
+ * The runs are spread across the workers, and a line for each is written to the report in order of its inputs:
+ * the inputs, a colon, then its outputs, followed by "(error)", "(step limit)" or "(more input)" if it didn't halt.
+ *
+ * @param image         The program to sweep
+ * @param options       The inputs to try and how to report them
+ * @param worker_count  The number of workers to spread the runs across
+ * @param report        The stream to write the report to
+ * @return              0 if every run halted or stopped for more input, 1 if any errored or hit the step limit
+ */
+int do_sweep_execution(const unsigned short int image[EXECUTABLE_SIZE], const sweep_options_st *options, size_t worker_count, FILE *report);
+
+#endif //LMVM_SWEEP_H
@@ -0,0 +1,19 @@
+#ifndef LMVM_THREADED_H
+#define LMVM_THREADED_H
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+
+/**
+ * Runs the program in memory until it halts or errors, using direct-threaded dispatch over the decoded image.
+ * Produces the same output and errors as do_execution, but never traces.
+ * Falls back to a switch-based loop on compilers without computed goto.
+ *
+ * @param memory    The memory array, holding the loaded program
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_threaded_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed);
+
+#endif //LMVM_THREADED_H
@@ -0,0 +1,100 @@
+#ifndef LMVM_TRACE_WRITER_H
+#define LMVM_TRACE_WRITER_H
+
+#include <stddef.h>
+
+#include "common/executable_props.h"
+#include "common/trace_format.h"
+
+/**
+ * Represents a trace file being written, as described in common/trace_format.h.
+ * Records are encoded into a buffer, which is handed to a background thread to write out once full while the other
+ * buffer is filled, so the VM only waits if it gets a whole buffer ahead of the disk.
+ * @see trace_writer_st
+ */
+struct trace_writer_s {
+    unsigned char *buffer;
+    size_t used;
+    size_t capacity;
+
+    // what the reader will expect, so only what differs is written
+    unsigned int expected_pc;
+    int acc;
+    unsigned short int cirs[EXECUTABLE_SIZE + 1];
+
+    struct trace_flusher_s *flusher;
+};
+
+/**
+ * Represents a trace file being written, as described in common/trace_format.h.
+ * @see trace_writer_s
+ */
+typedef struct trace_writer_s trace_writer_st;
+
+
+/**
+ * Creates a trace file and writes its header.
+ *
+ * @param path   The path of the file to write
+ * @param image  The program that will be traced, as it is before it runs
+ * @return       The writer, or NULL if the file couldn't be created
+ */
+trace_writer_st *open_trace_writer(const char *path, const unsigned short int image[EXECUTABLE_SIZE]);
+
+/**
+ * Hands the full buffer over to be written and carries on with the other, waiting if that one is still being written.
+ * Used by write_trace_step, and not normally needed otherwise.
+ *
+ * @param writer  The writer to swap the buffers of
+ */
+void swap_trace_buffers(trace_writer_st *writer);
+
+/**
+ * Writes everything left, waits for it to reach the file and closes it.
+ *
+ * @param writer  The writer to close, which is freed
+ * @return        0 if the whole trace was written, 1 if any of it failed to write
+ */
+int close_trace_writer(trace_writer_st *writer);
+
+/**
+ * Records an instruction that was run.
+ *
+ * @param writer  The writer to record to
+ * @param pc      The address the instruction was run from
+ * @param cir     The value of the instruction
+ * @param acc     The ACC after it ran
+ * @param result  The result of running it
+ */
+static inline void write_trace_step(trace_writer_st *writer, unsigned short int pc, unsigned short int cir, int acc, int result) {
+    if (writer->capacity - writer->used < TRACE_MAX_RECORD_SIZE) {
+        swap_trace_buffers(writer);
+    }
+
+    unsigned char *flags = &writer->buffer[writer->used];
+    unsigned char *at = flags + 1;
+    *flags = (unsigned char) (result & TRACE_FLAG_RESULT_MASK);
+
+    if (pc != writer->expected_pc) {
+        *flags |= TRACE_FLAG_PC;
+        *at++ = (unsigned char) pc;
+    }
+
+    if (cir != writer->cirs[pc]) {
+        *flags |= TRACE_FLAG_CIR;
+        *at++ = (unsigned char) (cir & 0xFF);
+        *at++ = (unsigned char) (cir >> 8);
+        writer->cirs[pc] = cir;
+    }
+
+    if (acc != writer->acc) {
+        *flags |= TRACE_FLAG_ACC;
+        at += write_zigzag_varint(at, (long long) acc - writer->acc);
+        writer->acc = acc;
+    }
+
+    writer->used = (size_t) (at - writer->buffer);
+    writer->expected_pc = trace_expected_pc(pc, cir, (unsigned int) result);
+}
+
+#endif //LMVM_TRACE_WRITER_H
@@ -0,0 +1,21 @@
+#ifndef LMVM_TRACING_H
+#define LMVM_TRACING_H
+
+#include "common/executable_props.h"
+#include "vm/execution.h"
+
+/**
+ * Runs the program in memory until it halts or errors, interpreting it while watching for hot loops.
+ * Once a backward branch target has been hit often enough, the path through the loop is recorded and compiled to
+ * native x86-64 code, with guards on the conditional branches that exit back to the interpreter when they fail.
+ * Writes to a cell covered by a trace throw the trace away. Output and errors match do_execution.
+ * Without native code support, this only interprets.
+ *
+ * @param memory    The memory array, holding the loaded program
+ * @param io        The streams the program reads input from and writes output and errors to
+ * @param executed  Set to the number of instructions executed, or NULL if not needed
+ * @return          0 if execution was successful, 1 if there was an error
+ */
+int do_tracing_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed);
+
+#endif //LMVM_TRACING_H
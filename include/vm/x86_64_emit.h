@@ -0,0 +1,239 @@
+#ifndef LMVM_X86_64_EMIT_H
+#define LMVM_X86_64_EMIT_H
+
+#include <stddef.h>
+
+// native code generation is only supported on x86-64 with mmap
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define NATIVE_CODE_SUPPORTED 1
+#else
+#define NATIVE_CODE_SUPPORTED 0
+#endif
+
+// generated code keeps the VM state in callee-saved registers, so calls out to C don't disturb it:
+//   r12d  ACC
+//   r13   memory base
+//   r14   the native_context_st
+//   r15   executed instruction count
+
+/**
+ * Represents the VM state shared between C and generated code.
+ * Generated code loads it on entry and stores it back on exit.
+ * @see native_context_st
+ */
+struct native_context_s {
+    int acc;
+    unsigned int pc;
+    unsigned short int *memory;
+    unsigned long long steps;
+    struct execution_io_s *io;  // only used by helpers
+    int result;                 // what the last helper to stop generated code ran into, for C to act on after the exit
+};
+
+/**
+ * Represents the VM state shared between C and generated code.
+ * @see native_context_s
+ */
+typedef struct native_context_s native_context_st;
+
+/**
+ * The signature of the entry trampoline.
+ * Loads the context into registers, jumps to the target, and returns the exit reason once generated code exits.
+ */
+typedef int (*native_entry_fn)(native_context_st *context, const void *target);
+
+/**
+ * The signature of a C function called from generated code, given the context and the current ACC.
+ * The context's ACC is stale while generated code is running.
+ * Returns 0 for generated code to carry on, or anything else for it to exit.
+ */
+typedef int (*native_helper_fn)(native_context_st *context, int acc);
+
+
+/**
+ * Represents a block of memory for generated code, which is either writable or executable but never both.
+ * @see code_buffer_st
+ */
+struct code_buffer_s {
+    unsigned char *base;
+    size_t size;
+};
+
+/**
+ * Represents a block of memory for generated code.
+ * @see code_buffer_s
+ */
+typedef struct code_buffer_s code_buffer_st;
+
+
+/**
+ * Represents a position in a code buffer that instructions are written to.
+ * @see emitter_st
+ */
+struct emitter_s {
+    unsigned char *at;
+};
+
+/**
+ * Represents a position in a code buffer that instructions are written to.
+ * @see emitter_s
+ */
+typedef struct emitter_s emitter_st;
+
+
+/**
+ * Condition codes for conditional jumps, as encoded in the second opcode byte of Jcc rel32.
+ * @see condition_code_et
+ */
+enum condition_code_e {
+    CC_OVERFLOW = 0x80,
+    CC_ABOVE = 0x87,
+    CC_ZERO = 0x84,
+    CC_NOT_ZERO = 0x85,
+    CC_SIGN = 0x88,
+    CC_NOT_SIGN = 0x89
+};
+
+/**
+ * Condition codes for conditional jumps.
+ * @see condition_code_e
+ */
+typedef enum condition_code_e condition_code_et;
+
+
+/**
+ * Allocates a writable code buffer.
+ *
+ * @param buffer  The buffer to initialise
+ * @param size    The size in bytes
+ * @return        1 if successful, 0 if the memory could not be mapped
+ */
+int code_buffer_init(code_buffer_st *buffer, size_t size);
+
+/**
+ * Frees a code buffer.
+ *
+ * @param buffer  The buffer to free
+ */
+void code_buffer_free(code_buffer_st *buffer);
+
+/**
+ * Makes a code buffer writable (and not executable), for generating code into.
+ *
+ * @param buffer  The buffer to change
+ * @return        1 if successful, 0 otherwise
+ */
+int code_buffer_make_writable(code_buffer_st *buffer);
+
+/**
+ * Makes a code buffer executable (and not writable), for running its code.
+ *
+ * @param buffer  The buffer to change
+ * @return        1 if successful, 0 otherwise
+ */
+int code_buffer_make_executable(code_buffer_st *buffer);
+
+
+/**
+ * Writes the entry trampoline and the shared exit sequence.
+ * Generated code exits by putting the reason in eax and jumping to the exit sequence.
+ *
+ * @param emitter  Where to write the code
+ * @param exit     Set to the address of the exit sequence
+ * @return         The entry trampoline
+ */
+native_entry_fn emit_entry_and_exit(emitter_st *emitter, unsigned char **exit);
+
+/**
+ * ACC = memory[address], counting one instruction.
+ */
+void emit_lda(emitter_st *emitter, unsigned int address);
+
+/**
+ * Loads memory[address] into ecx as ACC +/- memory[address], jumping to the slow path on overflow.
+ * ACC is left alone until emit_commit_ecx, so the slow path sees the state before the instruction.
+ *
+ * @param emitter    Where to write the code
+ * @param address    The operand
+ * @param subtract   Whether to subtract rather than add
+ * @return           The jump to the slow path, to be patched
+ */
+unsigned char *emit_add_sub_to_ecx(emitter_st *emitter, unsigned int address, int subtract);
+
+/**
+ * ACC = ecx, counting one instruction.
+ */
+void emit_commit_ecx(emitter_st *emitter);
+
+/**
+ * Checks ACC is a storable value (0-999), counting one instruction.
+ *
+ * @param emitter  Where to write the code
+ * @return         The jump to the slow path, to be patched
+ */
+unsigned char *emit_sta_check(emitter_st *emitter);
+
+/**
+ * Compares memory[address] with ACC, setting the zero flag if they're equal.
+ */
+void emit_compare_cell(emitter_st *emitter, unsigned int address);
+
+/**
+ * memory[address] = ACC.
+ */
+void emit_store(emitter_st *emitter, unsigned int address);
+
+/**
+ * Counts one instruction.
+ */
+void emit_count_step(emitter_st *emitter);
+
+/**
+ * Calls a C function, passing the context and ACC. ACC and the step count are preserved.
+ * Sets the zero flag if the function returned 0, so it can be followed by a jump to carry on.
+ */
+void emit_call_helper(emitter_st *emitter, native_helper_fn helper);
+
+/**
+ * Tests ACC against itself, setting the zero and sign flags.
+ */
+void emit_test_acc(emitter_st *emitter);
+
+/**
+ * Writes a conditional jump.
+ *
+ * @param emitter    Where to write the code
+ * @param condition  The condition to jump on
+ * @param target     The target, or NULL to patch later
+ * @return           The jump, for patching
+ */
+unsigned char *emit_jcc(emitter_st *emitter, condition_code_et condition, const unsigned char *target);
+
+/**
+ * Writes an unconditional jump.
+ *
+ * @param emitter  Where to write the code
+ * @param target   The target, or NULL to patch later
+ * @return         The jump, for patching
+ */
+unsigned char *emit_jmp(emitter_st *emitter, const unsigned char *target);
+
+/**
+ * Points a jump written by emit_jcc or emit_jmp at the given target.
+ *
+ * @param jump    The jump to patch
+ * @param target  The new target
+ */
+void patch_jump(unsigned char *jump, const unsigned char *target);
+
+/**
+ * Sets the context PC, puts the reason in eax, and jumps to the exit sequence.
+ *
+ * @param emitter  Where to write the code
+ * @param pc       The PC to resume from
+ * @param reason   The exit reason returned to C
+ * @param exit     The exit sequence
+ */
+void emit_exit(emitter_st *emitter, unsigned int pc, int reason, const unsigned char *exit);
+
+#endif //LMVM_X86_64_EMIT_H
@@ -0,0 +1,154 @@
+#include "common/file_io.h"
+#include "common/executable_props.h"
+#include "common/checked_alloc.h"
+#include "vm/interpreter.h"
+#include "vm/threaded.h"
+#include "vm/jit.h"
+#include "vm/tracing.h"
+#include "vm/lockstep.h"
+#include "vm/profiler.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// measures the instructions per second of each engine, running each program repeatedly for at least this long
+#define MIN_BENCH_SECONDS 0.5
+
+// the lockstep engine runs this many copies of the program at once, with no input
+#define LOCKSTEP_BENCH_LANES 64
+
+static const char *NULL_DEVICE =
+#ifdef _WIN32
+        "NUL";
+#else
+"/dev/null";
+#endif
+
+static FILE *debugout = NULL;
+static execution_io_st io;
+
+static int run_interpreter(unsigned short int *memory, unsigned long long *executed) {
+    return do_execution(memory, &io, debugout, executed);
+}
+
+static int run_threaded(unsigned short int *memory, unsigned long long *executed) {
+    return do_threaded_execution(memory, &io, executed);
+}
+
+static int run_jit(unsigned short int *memory, unsigned long long *executed) {
+    return do_jit_execution(memory, &io, executed);
+}
+
+static int run_tracing(unsigned short int *memory, unsigned long long *executed) {
+    return do_tracing_execution(memory, &io, executed);
+}
+
+static int run_profiled(unsigned short int *memory, unsigned long long *executed) {
+    static execution_profile_st profile;
+    return do_profiled_execution(memory, &io, &profile, executed);
+}
+
+static int run_lockstep(unsigned short int *memory, unsigned long long *executed) {
+    lockstep_lane_st lanes[LOCKSTEP_BENCH_LANES] = {{NULL, 0, NULL, 0, 0}};
+
+    int exit_code = do_lockstep_execution(memory, lanes, LOCKSTEP_BENCH_LANES, NULL, executed);
+    free_lockstep_outputs(lanes, LOCKSTEP_BENCH_LANES);
+
+    return exit_code;
+}
+
+struct engine_s {
+    const char *name;
+    int (*run)(unsigned short int *memory, unsigned long long *executed);
+};
+
+static const struct engine_s ENGINES[] = {
+        {"interpreter", run_interpreter},
+        {"threaded",    run_threaded},
+        {"jit",         run_jit},
+        {"tracing-jit", run_tracing},
+        {"lockstep",    run_lockstep},
+        {"profiler",    run_profiled}
+};
+
+#define ENGINE_COUNT (sizeof(ENGINES) / sizeof(ENGINES[0]))
+
+
+static int load_image(char *path, unsigned short int image[EXECUTABLE_SIZE]) {
+    size_t cell_count;
+    unsigned short int ext_version;
+
+    return load_lmcx_image(path, image, EXECUTABLE_SIZE, &cell_count, &ext_version) == LOAD_SUCCESS;
+}
+
+static void bench_engine(FILE *report, const char *path, const struct engine_s *engine, const unsigned short int image[EXECUTABLE_SIZE]) {
+    unsigned short int memory[EXECUTABLE_SIZE];
+
+    unsigned long long runs = 0;
+    unsigned long long instructions = 0;
+    int failed = 0;
+
+    clock_t start = clock();
+    double elapsed;
+
+    do {
+        // programs can write to themselves, so every run starts from a fresh copy
+        memcpy(memory, image, sizeof(memory));
+
+        unsigned long long executed = 0;
+        failed |= engine->run(memory, &executed);
+
+        instructions += executed;
+        runs++;
+
+        elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    fprintf(report, "%-24s %-12s %10llu %14llu %9.3f %16.0f%s\n", path, engine->name, runs, instructions, elapsed,
+            instructions / elapsed, failed ? " (errored)" : "");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s PROGRAM.lmc [PROGRAM.lmc ...]\n", argv[0]);
+        return 1;
+    }
+
+    // keep a handle on the real stdout for the report, since program output is thrown away
+    FILE *report = fdopen(dup(fileno(stdout)), "w");
+    debugout = fopen(NULL_DEVICE, "w");
+
+    if (report == NULL || debugout == NULL || freopen(NULL_DEVICE, "w", stdout) == NULL) {
+        fprintf(stderr, "Error: Failed to redirect output to null device\n");
+        return 1;
+    }
+
+    init_execution_io(&io, stdin, stdout, stderr);
+
+    fprintf(report, "%-24s %-12s %10s %14s %9s %16s\n", "program", "engine", "runs", "instructions", "seconds", "instructions/s");
+
+    for (int i = 1; i < argc; i++) {
+        unsigned short int image[EXECUTABLE_SIZE];
+
+        if (!load_image(argv[i], image)) {
+            fprintf(stderr, "Error: Failed to read input file '%s'\n", argv[i]);
+            return 1;
+        }
+
+        for (size_t engine = 0; engine < ENGINE_COUNT; engine++) {
+            if ((ENGINES[engine].run == run_jit || ENGINES[engine].run == run_tracing) && !jit_available()) {
+                continue;
+            }
+
+            bench_engine(report, argv[i], &ENGINES[engine], image);
+        }
+    }
+
+    fclose(report);
+    fclose(debugout);
+
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// programs are started with posix_spawn, which only posix systems have
+#if defined(__unix__) || defined(__APPLE__)
+#define STARTUP_BENCH_SUPPORTED 1
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#else
+#define STARTUP_BENCH_SUPPORTED 0
+#endif
+
+// starts the VM on each program repeatedly for at least this long, and at least MIN_STARTUP_RUNS times
+#define MIN_STARTUP_SECONDS 0.5
+#define MIN_STARTUP_RUNS 100
+
+// the most runs timed for one program, which is plenty for a stable median
+#define MAX_STARTUP_RUNS 100000
+
+#if STARTUP_BENCH_SUPPORTED
+
+extern char **environ;
+
+static double run_times[MAX_STARTUP_RUNS];
+
+static double seconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+static int compare_times(const void *a, const void *b) {
+    double difference = *(const double *) a - *(const double *) b;
+    return (difference > 0) - (difference < 0);
+}
+
+// runs the VM on the program once, from starting the process to it exiting, returning its exit code or -1
+static int run_once(const char *vm_path, const char *program_path, const posix_spawn_file_actions_t *actions) {
+    char *args[3];
+    args[0] = (char *) vm_path;
+    args[1] = (char *) program_path;
+    args[2] = NULL;
+
+    pid_t pid;
+    if (posix_spawn(&pid, vm_path, actions, NULL, args, environ) != 0) {
+        return -1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+
+    return WEXITSTATUS(status);
+}
+
+static int bench_startup(const char *vm_path, const char *program_path, const posix_spawn_file_actions_t *actions) {
+    size_t runs = 0;
+    int failed = 0;
+    double started = seconds_now();
+    double elapsed;
+
+    do {
+        double run_started = seconds_now();
+        int exit_code = run_once(vm_path, program_path, actions);
+        run_times[runs++] = seconds_now() - run_started;
+
+        if (exit_code == -1) {
+            fprintf(stderr, "Error: Failed to run '%s %s'\n", vm_path, program_path);
+            return 1;
+        }
+
+        failed |= exit_code != 0;
+        elapsed = seconds_now() - started;
+    } while ((elapsed < MIN_STARTUP_SECONDS || runs < MIN_STARTUP_RUNS) && runs < MAX_STARTUP_RUNS);
+
+    qsort(run_times, runs, sizeof(double), compare_times);
+
+    printf("%-24s %8zu %10.1f %10.1f %10.1f %10.1f%s\n", program_path, runs, run_times[0] * 1e6, run_times[runs / 2] * 1e6,
+           run_times[runs * 99 / 100] * 1e6, elapsed / (double) runs * 1e6, failed ? " (errored)" : "");
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s LMVM PROGRAM.lmc [PROGRAM.lmc ...]\n", argv[0]);
+        return 1;
+    }
+
+    // the VM reads no input and its output is thrown away, so only getting it started and running is timed
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+
+    printf("%-24s %8s %10s %10s %10s %10s\n", "program", "runs", "min us", "median us", "p99 us", "mean us");
+
+    int exit_code = 0;
+    for (int i = 2; i < argc && exit_code == 0; i++) {
+        exit_code = bench_startup(argv[1], argv[i], &actions);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return exit_code;
+}
+
+#else
+
+int main(void) {
+    fputs("Error: The startup benchmark is not supported on this platform\n", stderr);
+    return 1;
+}
+
+#endif
@@ -6,6 +6,16 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+// executables are mapped rather than read where there's mmap
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#define MMAP_SUPPORTED 0
+#endif
+
 static int is_little_endian_machine = -1;
 
 static void detect_little_endian_machine(void) {
@@ -111,6 +121,109 @@ lmcx_file_descriptor_st *read_lmcx_file(char *path) {
     return result;
 }
 
+load_status_et parse_lmcx_image(const unsigned char *data, size_t size, unsigned short int *memory, size_t capacity, size_t *cell_count, unsigned short int *ext_version) {
+    size_t magic_length = strlen(MAGIC_STRING_LMC);
+    size_t extended_magic_length = strlen(MAGIC_STRING_LMC_EXTENDED);
+
+    const unsigned char *at;
+
+    if (size >= extended_magic_length + 2 && memcmp(data, MAGIC_STRING_LMC_EXTENDED, extended_magic_length) == 0) {
+        *ext_version = (unsigned short int) (data[extended_magic_length] | data[extended_magic_length + 1] << 8);
+        at = data + extended_magic_length + 2;
+    } else if (size >= magic_length && memcmp(data, MAGIC_STRING_LMC, magic_length) == 0) {
+        *ext_version = 0;
+        at = data + magic_length;
+    } else {
+        return LOAD_INVALID;
+    }
+
+    if (*ext_version > EXT_SUPPORTED_VERSION) {
+        return LOAD_UNSUPPORTED_EXT;
+    }
+
+    // a trailing odd byte isn't a cell
+    *cell_count = (size - (size_t) (at - data)) / 2;
+
+    if (*cell_count > capacity) {
+        return LOAD_TOO_LARGE;
+    }
+
+    for (size_t address = 0; address < *cell_count; address++) {
+        memory[address] = (unsigned short int) (at[2 * address] | at[2 * address + 1] << 8);
+    }
+    memset(memory + *cell_count, 0, sizeof(unsigned short int) * (capacity - *cell_count));
+
+    return LOAD_SUCCESS;
+}
+
+load_status_et load_lmcx_image(const char *path, unsigned short int *memory, size_t capacity, size_t *cell_count, unsigned short int *ext_version) {
+    *cell_count = 0;
+    *ext_version = 0;
+
+#if MMAP_SUPPORTED
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        // opening a directory read only works on some systems, but where it doesn't, it should still be reported as one
+        return is_dir((char *) path) ? LOAD_IS_DIRECTORY : LOAD_CANT_OPEN;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return LOAD_CANT_OPEN;
+    }
+
+    if (S_ISDIR(file_stat.st_mode)) {
+        close(fd);
+        return LOAD_IS_DIRECTORY;
+    }
+
+    // an empty file can't be mapped, and isn't an executable anyway
+    size_t size = (size_t) file_stat.st_size;
+    if (size == 0) {
+        close(fd);
+        return LOAD_INVALID;
+    }
+
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return LOAD_CANT_OPEN;
+    }
+
+    load_status_et status = parse_lmcx_image(mapping, size, memory, capacity, cell_count, ext_version);
+    munmap(mapping, size);
+
+    return status;
+#else
+    if (is_dir((char *) path)) {
+        return LOAD_IS_DIRECTORY;
+    }
+
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return LOAD_CANT_OPEN;
+    }
+
+    // nothing bigger than a full memory can be loaded, so a byte past that is enough to tell the file is too large
+    unsigned char data[EXECUTABLE_MAX_FILE_SIZE + 1];
+    size_t size = fread(data, 1, sizeof(data), file);
+    int truncated = size == sizeof(data);
+    fclose(file);
+
+    load_status_et status = parse_lmcx_image(data, size, memory, capacity, cell_count, ext_version);
+
+    if (status == LOAD_SUCCESS && truncated) {
+        status = LOAD_TOO_LARGE;
+    }
+
+    return status;
+#endif
+}
+
 char *read_text_file(char *path) {
     FILE *file = fopen(path, "rb");
 
@@ -241,3 +354,40 @@ int is_dir(char *path) {
 
     return S_ISDIR(statbuf.st_mode);
 }
+
+int machine_is_little_endian(void) {
+    detect_little_endian_machine();
+    return is_little_endian_machine;
+}
+
+static void reverse_bytes(unsigned char *bytes, size_t size) {
+    for (size_t low = 0, high = size - 1; low < high; low++, high--) {
+        unsigned char swap = bytes[low];
+        bytes[low] = bytes[high];
+        bytes[high] = swap;
+    }
+}
+
+unsigned char *store_little_endian(unsigned char *at, const void *value, size_t size) {
+    detect_little_endian_machine();
+
+    memcpy(at, value, size);
+    if (!is_little_endian_machine) {
+        reverse_bytes(at, size);
+    }
+
+    return at + size;
+}
+
+const unsigned char *load_little_endian(const unsigned char *at, void *value, size_t size) {
+    detect_little_endian_machine();
+
+    unsigned char bytes[8];
+    memcpy(bytes, at, size);
+    if (!is_little_endian_machine) {
+        reverse_bytes(bytes, size);
+    }
+
+    memcpy(value, bytes, size);
+    return at + size;
+}
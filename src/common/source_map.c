@@ -0,0 +1,186 @@
+#include "common/source_map.h"
+#include "common/opcodes.h"
+#include "common/file_io.h"
+#include "common/checked_alloc.h"
+
+#include <string.h>
+#include <ctype.h>
+
+// the opcode each mnemonic assembles to, in the order lmasm lists them, where DAT can assemble to anything
+static const struct {
+    const char *mnemonic;
+    int opcode;
+} SOURCE_MNEMONICS[] = {
+        {"ADD", OP_LMC_ADD},
+        {"SUB", OP_LMC_SUB},
+        {"STA", OP_LMC_STA},
+        {"LDA", OP_LMC_LDA},
+        {"BRA", OP_LMC_BRA},
+        {"BRZ", OP_LMC_BRZ},
+        {"BRP", OP_LMC_BRP},
+        {"INP", OP_LMC_IO_OP_INP},
+        {"OUT", OP_LMC_IO_OP_OUT},
+        {"HLT", OP_LMC_HLT},
+        {"DAT", -1}
+};
+#define SOURCE_MNEMONIC_COUNT (sizeof(SOURCE_MNEMONICS) / sizeof(SOURCE_MNEMONICS[0]))
+
+// returns the index of the mnemonic the word is, case-insensitively, or -1 if it isn't one
+static int find_mnemonic(const char *word, size_t length) {
+    for (size_t index = 0; index < SOURCE_MNEMONIC_COUNT; index++) {
+        const char *mnemonic = SOURCE_MNEMONICS[index].mnemonic;
+        size_t at = 0;
+
+        while (at < length && mnemonic[at] != '\0' && toupper((unsigned char) word[at]) == mnemonic[at]) {
+            at++;
+        }
+
+        if (at == length && mnemonic[at] == '\0') {
+            return (int) index;
+        }
+    }
+
+    return -1;
+}
+
+// INP and OUT are told apart by their whole value, and every other instruction by its first digit
+static int assembles_to(int opcode, unsigned short int cell) {
+    if (opcode == -1) {
+        return 1;
+    }
+
+    if (opcode == OP_LMC_IO_OP_INP || opcode == OP_LMC_IO_OP_OUT) {
+        return cell == opcode;
+    }
+
+    return cell / 100 == opcode;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// turns each run of spaces and tabs into one space, so code lines up in the report however it was indented
+static void collapse_blanks(char *text) {
+    char *to = text;
+
+    for (char *from = text; *from != '\0'; from++) {
+        if (!is_blank(*from) || (to > text && to[-1] != ' ')) {
+            *to++ = is_blank(*from) ? ' ' : *from;
+        }
+    }
+
+    *to = '\0';
+}
+
+int read_source_map(const char *path, const unsigned short int image[EXECUTABLE_SIZE], source_map_st *map) {
+    map->text = read_text_file((char *) path);
+    map->cell_count = 0;
+
+    if (map->text == NULL) {
+        return 1;
+    }
+
+    char *line = map->text;
+    unsigned int line_number = 0;
+
+    while (line != NULL) {
+        line_number++;
+
+        char *next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+
+        // as lmasm does, comments start at a ; and lines with nothing else on them aren't cells
+        char *comment = strchr(line, ';');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        while (is_blank(*line)) {
+            line++;
+        }
+
+        size_t length = strlen(line);
+        while (length > 0 && is_blank(line[length - 1])) {
+            line[--length] = '\0';
+        }
+
+        if (length == 0) {
+            line = next;
+            continue;
+        }
+
+        if (map->cell_count == EXECUTABLE_SIZE) {
+            free_source_map(map);
+            return 1;
+        }
+
+        // a label is a first word that isn't a mnemonic
+        size_t word_length = strcspn(line, " \t");
+        int mnemonic = find_mnemonic(line, word_length);
+        const char *label = NULL;
+
+        if (mnemonic == -1) {
+            label = line;
+            line[word_length] = '\0';
+            line += word_length + (word_length < length);
+
+            while (is_blank(*line)) {
+                line++;
+            }
+
+            mnemonic = find_mnemonic(line, strcspn(line, " \t"));
+        }
+
+        // a source that doesn't assemble to the program would only make the report wrong
+        if (mnemonic == -1 || !assembles_to(SOURCE_MNEMONICS[mnemonic].opcode, image[map->cell_count])) {
+            free_source_map(map);
+            return 1;
+        }
+
+        collapse_blanks(line);
+
+        map->lines[map->cell_count] = line_number;
+        map->labels[map->cell_count] = label;
+        map->code[map->cell_count] = line;
+        map->data[map->cell_count] = SOURCE_MNEMONICS[mnemonic].opcode == -1;
+        map->cell_count++;
+
+        line = next;
+    }
+
+    return 0;
+}
+
+void free_source_map(source_map_st *map) {
+    silent_checked_free(map->text);
+    map->text = NULL;
+    map->cell_count = 0;
+}
+
+char *source_path_for(const char *path) {
+    // only the last part of the path has an extension
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+
+    size_t length = strlen(path);
+    const char *extension = strrchr(name, '.');
+
+    if (extension != NULL && extension != name) {
+        length = (size_t) (extension - path);
+    }
+
+    // a trace or snapshot is usually named after the program, extension and all
+    size_t exec_length = strlen(DEFAULT_EXECFILE_EXT);
+    if (length - (size_t) (name - path) > exec_length && strncmp(path + length - exec_length, DEFAULT_EXECFILE_EXT, exec_length) == 0) {
+        length -= exec_length;
+    }
+
+    char *source_path = checked_malloc(length + strlen(DEFAULT_ASMFILE_EXT) + 1);
+    memcpy(source_path, path, length);
+    strcpy(source_path + length, DEFAULT_ASMFILE_EXT);
+
+    return source_path;
+}
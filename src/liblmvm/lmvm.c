@@ -0,0 +1,418 @@
+#include "liblmvm/lmvm.h"
+#include "vm/decode.h"
+#include "vm/operations.h"
+#include "common/executable_props.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// posix has a monotonic clock, elsewhere the processor time used has to do
+#if defined(__unix__) || defined(__APPLE__)
+#define MONOTONIC_CLOCK_SUPPORTED 1
+#else
+#define MONOTONIC_CLOCK_SUPPORTED 0
+#endif
+
+// fails to compile if the condition is false, since an array can't have a negative size
+#define STATIC_CHECK(condition, name) typedef char name[(condition) ? 1 : -1]
+
+/**
+ * Represents what a state keeps in its internal block, which callers can't see.
+ * @see lmvm_internal_st
+ */
+struct lmvm_internal_s {
+    instruction_cache_st image_cache;  // the image already decoded
+    instruction_cache_st cache;
+};
+
+/**
+ * Represents what a state keeps in its internal block.
+ * @see lmvm_internal_s
+ */
+typedef struct lmvm_internal_s lmvm_internal_st;
+
+// the header can't see the machine or the decoder, so anything it repeats is checked against them
+STATIC_CHECK(sizeof(lmvm_internal_st) <= LMVM_STATE_INTERNAL_SIZE, internal_block_fits);
+STATIC_CHECK(LMVM_MEMORY_SIZE == EXECUTABLE_SIZE, memory_size_matches);
+STATIC_CHECK((int) LMVM_ERROR_OVERFLOW == (int) FAULT_OVERFLOW && (int) LMVM_ERROR_UNDERFLOW == (int) FAULT_UNDERFLOW &&
+             (int) LMVM_ERROR_OUT_OF_MEMORY_RANGE == (int) FAULT_OUT_OF_MEMORY_RANGE &&
+             (int) LMVM_ERROR_INVALID_OPCODE == (int) FAULT_INVALID_OPCODE && (int) LMVM_ERROR_INVALID_IO == (int) FAULT_INVALID_IO &&
+             (int) LMVM_ERROR_PC_OUT_OF_RANGE == (int) FAULT_PC_OUT_OF_RANGE && (int) LMVM_ERROR_OUT_OF_INPUT == (int) FAULT_OUT_OF_INPUT,
+             errors_match_faults);
+
+static inline lmvm_internal_st *internal_of(lmvm_state_st *state) {
+    return (lmvm_internal_st *) (void *) state->internal.bytes;
+}
+
+
+void lmvm_init(lmvm_state_st *state) {
+    state->input = NULL;
+    state->input_context = NULL;
+    state->output = NULL;
+    state->output_context = NULL;
+
+    state->input_values = NULL;
+    state->input_count = 0;
+    state->output_values = NULL;
+    state->output_capacity = 0;
+
+    state->previous_turn = NULL;
+    state->next_turn = NULL;
+    state->scheduled = 0;
+
+    lmvm_load_image(state, NULL, 0);
+}
+
+int lmvm_load_image(lmvm_state_st *state, const unsigned short int *image, size_t size) {
+    if (size > EXECUTABLE_SIZE) {
+        return 1;
+    }
+
+    memset(state->image, 0, sizeof(state->image));
+    if (size != 0) {
+        memcpy(state->image, image, size * sizeof(unsigned short int));
+    }
+
+    // superinstructions would run several instructions at once, which a budget has to be able to stop between
+    decode_image(&internal_of(state)->image_cache, state->image, 0);
+
+    lmvm_reset(state);
+    return 0;
+}
+
+int lmvm_load_executable(lmvm_state_st *state, const unsigned char *data, size_t size) {
+    size_t magic_length = strlen(MAGIC_STRING_LMC);
+    size_t extended_magic_length = strlen(MAGIC_STRING_LMC_EXTENDED);
+
+    const unsigned char *at;
+
+    if (size >= extended_magic_length + 2 && memcmp(data, MAGIC_STRING_LMC_EXTENDED, extended_magic_length) == 0) {
+        unsigned short int ext_version = (unsigned short int) (data[extended_magic_length] | data[extended_magic_length + 1] << 8);
+
+        if (ext_version > EXT_SUPPORTED_VERSION) {
+            return 1;
+        }
+
+        at = data + extended_magic_length + 2;
+    } else if (size >= magic_length && memcmp(data, MAGIC_STRING_LMC, magic_length) == 0) {
+        at = data + magic_length;
+    } else {
+        return 1;
+    }
+
+    // executables are always little endian, and a trailing odd byte isn't a cell
+    size_t cell_count = (size - (size_t) (at - data)) / 2;
+
+    if (cell_count > EXECUTABLE_SIZE) {
+        return 1;
+    }
+
+    unsigned short int image[EXECUTABLE_SIZE];
+    for (size_t address = 0; address < cell_count; address++) {
+        image[address] = (unsigned short int) (at[2 * address] | at[2 * address + 1] << 8);
+    }
+
+    return lmvm_load_image(state, image, cell_count);
+}
+
+void lmvm_reset(lmvm_state_st *state) {
+    // copying the decoded image is cheaper than decoding it again
+    memcpy(state->memory, state->image, sizeof(state->memory));
+    lmvm_internal_st *internal = internal_of(state);
+    memcpy(&internal->cache, &internal->image_cache, sizeof(internal->cache));
+
+    state->acc = 0;
+    state->pc = 0;
+    state->executed = 0;
+    state->status = LMVM_RUNNABLE;
+    state->error = LMVM_ERROR_NONE;
+
+    state->input_used = 0;
+    state->output_count = 0;
+    state->run_ns = 0;
+}
+
+void lmvm_set_input_callback(lmvm_state_st *state, lmvm_input_fn input, void *context) {
+    state->input = input;
+    state->input_context = context;
+}
+
+void lmvm_set_output_callback(lmvm_state_st *state, lmvm_output_fn output, void *context) {
+    state->output = output;
+    state->output_context = context;
+}
+
+void lmvm_set_input_values(lmvm_state_st *state, const int *values, size_t count) {
+    state->input_values = values;
+    state->input_count = count;
+    state->input_used = 0;
+}
+
+void lmvm_set_output_values(lmvm_state_st *state, int *values, size_t capacity) {
+    state->output_values = values;
+    state->output_capacity = capacity;
+    state->output_count = 0;
+}
+
+
+static lmvm_input_result_et read_input(lmvm_state_st *state, int *acc) {
+    if (state->input != NULL) {
+        return state->input(state->input_context, acc);
+    }
+
+    if (state->input_used == state->input_count) {
+        return LMVM_INPUT_END;
+    }
+
+    *acc = state->input_values[state->input_used++];
+    return LMVM_INPUT_VALUE;
+}
+
+// returns 0 if the value was taken
+static int write_output(lmvm_state_st *state, int value) {
+    if (state->output != NULL) {
+        if (state->output(state->output_context, value) != 0) {
+            return 1;
+        }
+    } else if (state->output_values != NULL) {
+        if (state->output_count == state->output_capacity) {
+            return 1;
+        }
+
+        state->output_values[state->output_count] = value;
+    }
+
+    state->output_count++;
+    return 0;
+}
+
+lmvm_status_et lmvm_run(lmvm_state_st *state, unsigned long long budget) {
+    // a program waiting for input asks for it again
+    if (state->status != LMVM_RUNNABLE && state->status != LMVM_NEED_INPUT) {
+        return state->status;
+    }
+
+    // registers are kept in locals, so the compiler can hold them in machine registers
+    unsigned short int *memory = state->memory;
+    instruction_cache_st *cache = &internal_of(state)->cache;
+    int acc = state->acc;
+    unsigned short int pc = state->pc;
+
+    lmvm_status_et status = LMVM_RUNNABLE;
+    lmvm_error_et error = LMVM_ERROR_NONE;
+    lmc_fault_et fault = FAULT_NONE;
+    unsigned long long steps = 0;
+
+    while (steps < budget) {
+        decoded_instruction_st instruction = cache->ops[pc];
+
+        if (instruction.handler == HANDLER_REDECODE) {
+            instruction = redecode_cell(cache, memory, pc);
+        }
+
+        // errors leave everything as it was before the instruction, so it can be described afterwards
+        switch (instruction.handler) {
+            case HANDLER_HLT:
+                status = LMVM_HALTED;
+                break;
+            case HANDLER_ADD:
+                if ((fault = add_to_acc(&acc, memory[instruction.operand])) == FAULT_NONE) {
+                    pc++;
+                }
+                break;
+            case HANDLER_SUB:
+                if ((fault = subtract_from_acc(&acc, memory[instruction.operand])) == FAULT_NONE) {
+                    pc++;
+                }
+                break;
+            case HANDLER_STA:
+                if ((fault = store_acc(acc, &memory[instruction.operand])) == FAULT_NONE) {
+                    invalidate_cell(cache, instruction.operand);
+                    pc++;
+                }
+                break;
+            case HANDLER_LDA:
+                acc = memory[instruction.operand];
+                pc++;
+                break;
+            case HANDLER_BRA:
+                pc = instruction.operand;
+                break;
+            case HANDLER_BRZ:
+                pc = acc == 0 ? instruction.operand : pc + 1;
+                break;
+            case HANDLER_BRP:
+                pc = acc >= 0 ? instruction.operand : pc + 1;
+                break;
+            case HANDLER_INP:
+                switch (read_input(state, &acc)) {
+                    case LMVM_INPUT_VALUE:
+                        pc++;
+                        break;
+                    case LMVM_INPUT_END:
+                        fault = FAULT_OUT_OF_INPUT;
+                        break;
+                    case LMVM_INPUT_WAIT:
+                        status = LMVM_NEED_INPUT;
+                        break;
+                }
+                break;
+            case HANDLER_OUT:
+                if (write_output(state, acc) != 0) {
+                    error = LMVM_ERROR_OUTPUT_REFUSED;
+                    break;
+                }
+                pc++;
+                break;
+            case HANDLER_PC_OUT_OF_RANGE:
+                fault = FAULT_PC_OUT_OF_RANGE;
+                break;
+            default:
+                fault = invalid_instruction_fault(instruction.cir);
+                break;
+        }
+
+        // the errors an instruction raises are numbered the same as the library's
+        if (fault != FAULT_NONE) {
+            error = (lmvm_error_et) fault;
+        }
+
+        // the INP is run again once there is input, so it only counts then
+        if (status == LMVM_NEED_INPUT) {
+            break;
+        }
+
+        // like the other engines, HLT and the instruction that failed count as run
+        steps++;
+
+        if (error != LMVM_ERROR_NONE) {
+            status = LMVM_ERROR;
+            break;
+        }
+
+        if (status != LMVM_RUNNABLE) {
+            break;
+        }
+    }
+
+    state->acc = acc;
+    state->pc = pc;
+    state->executed += steps;
+    state->status = status;
+    state->error = error;
+
+    return status;
+}
+
+static unsigned long long monotonic_ns(void) {
+#if MONOTONIC_CLOCK_SUPPORTED
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000000000 + (unsigned long long) now.tv_nsec;
+#else
+    return (unsigned long long) clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+void lmvm_scheduler_init(lmvm_scheduler_st *scheduler, unsigned long long quantum, unsigned long long max_steps, unsigned long long max_ms) {
+    scheduler->head = NULL;
+    scheduler->tail = NULL;
+    scheduler->quantum = quantum;
+    scheduler->max_steps = max_steps;
+    scheduler->max_ns = max_ms * 1000000;
+}
+
+void lmvm_schedule(lmvm_scheduler_st *scheduler, lmvm_state_st *state) {
+    if (state->scheduled) {
+        return;
+    }
+
+    state->scheduled = 1;
+    state->previous_turn = scheduler->tail;
+    state->next_turn = NULL;
+
+    if (scheduler->tail != NULL) {
+        scheduler->tail->next_turn = state;
+    } else {
+        scheduler->head = state;
+    }
+    scheduler->tail = state;
+}
+
+void lmvm_unschedule(lmvm_scheduler_st *scheduler, lmvm_state_st *state) {
+    if (!state->scheduled) {
+        return;
+    }
+
+    if (state->previous_turn != NULL) {
+        state->previous_turn->next_turn = state->next_turn;
+    } else {
+        scheduler->head = state->next_turn;
+    }
+
+    if (state->next_turn != NULL) {
+        state->next_turn->previous_turn = state->previous_turn;
+    } else {
+        scheduler->tail = state->previous_turn;
+    }
+
+    state->scheduled = 0;
+    state->previous_turn = NULL;
+    state->next_turn = NULL;
+}
+
+lmvm_state_st *lmvm_run_turn(lmvm_scheduler_st *scheduler) {
+    lmvm_state_st *state = scheduler->head;
+
+    if (state == NULL) {
+        return NULL;
+    }
+
+    lmvm_unschedule(scheduler, state);
+
+    // the turn is cut short rather than letting the program run past its step limit
+    unsigned long long budget = scheduler->quantum;
+    if (scheduler->max_steps != 0 && scheduler->max_steps - state->executed < budget) {
+        budget = scheduler->max_steps > state->executed ? scheduler->max_steps - state->executed : 0;
+    }
+
+    // the clock is read once a turn, not once an instruction
+    unsigned long long started = scheduler->max_ns != 0 ? monotonic_ns() : 0;
+    lmvm_run(state, budget);
+    if (scheduler->max_ns != 0) {
+        state->run_ns += monotonic_ns() - started;
+    }
+
+    // a program waiting for input isn't running, so only one that could carry on is stopped
+    if (state->status == LMVM_RUNNABLE) {
+        if (scheduler->max_steps != 0 && state->executed >= scheduler->max_steps) {
+            state->status = LMVM_ERROR;
+            state->error = LMVM_ERROR_STEP_LIMIT;
+        } else if (scheduler->max_ns != 0 && state->run_ns >= scheduler->max_ns) {
+            state->status = LMVM_ERROR;
+            state->error = LMVM_ERROR_TIME_LIMIT;
+        }
+    }
+
+    return state;
+}
+
+int lmvm_describe_error(const lmvm_state_st *state, char *buffer, size_t size) {
+    // the failed instruction is still at the PC, with the ACC as it was before it
+    unsigned short int cir = state->pc < EXECUTABLE_SIZE ? state->memory[state->pc] : 0;
+    unsigned short int mdr = state->memory[cir % 100];
+
+    switch (state->error) {
+        case LMVM_ERROR_OUTPUT_REFUSED:
+            return snprintf(buffer, size, "Output was refused");
+        case LMVM_ERROR_STEP_LIMIT:
+            return snprintf(buffer, size, "Step limit reached after %llu instructions", state->executed);
+        case LMVM_ERROR_TIME_LIMIT:
+            return snprintf(buffer, size, "Time limit reached after %llu instructions", state->executed);
+        default:
+            // lmvm reports the PC already moved past the instruction that failed
+            return describe_fault(buffer, size, (lmc_fault_et) state->error, state->acc, mdr, cir, state->pc + 1u);
+    }
+}
@@ -0,0 +1,356 @@
+#include "lmc2c/codegen.h"
+#include "common/opcodes.h"
+
+#include <stdio.h>
+
+// the parts of the generated program that don't depend on the image
+// errors are reported with the same messages as src/vm/execution.c, so the output matches lmvm exactly
+
+static const char *RUNTIME_HEADER =
+        "#include <stdio.h>\n"
+        "#include <limits.h>\n"
+        "\n"
+        "#define CELLS 100\n"
+        "\n"
+        "// the statuses a program stops with double as its exit codes\n"
+        "enum status_e {\n"
+        "    HALTED = 0,\n"
+        "    FAILED = 1,\n"
+        "    RUNNING = 2\n"
+        "};\n"
+        "\n";
+
+// INP reads text the way lmvm's input source does, one whitespace separated word at a time
+static const char *RUNTIME_INPUT =
+        "static int is_space(int c) {\n"
+        "    return c == ' ' || c == '\\n' || c == '\\r' || c == '\\t' || c == '\\v' || c == '\\f';\n"
+        "}\n"
+        "\n"
+        "// reads whitespace separated words until one is a number that fits, the same way lmvm does, or returns 0 at the end\n"
+        "static int read_input(int *acc) {\n"
+        "    // anything written is seen before the program waits for a reply\n"
+        "    fflush(stdout);\n"
+        "\n"
+        "    for (;;) {\n"
+        "        int c;\n"
+        "        do {\n"
+        "            c = getchar();\n"
+        "        } while (is_space(c));\n"
+        "\n"
+        "        if (c == EOF) {\n"
+        "            fputs(\"Error: Ran out of input\\n\", stderr);\n"
+        "            return 0;\n"
+        "        }\n"
+        "\n"
+        "        int negative = c == '-';\n"
+        "        if (c == '-' || c == '+') {\n"
+        "            c = getchar();\n"
+        "        }\n"
+        "\n"
+        "        // INT_MIN has one more than INT_MAX, so the limit depends on the sign\n"
+        "        unsigned long long limit = negative ? (unsigned long long) INT_MAX + 1 : (unsigned long long) INT_MAX;\n"
+        "        unsigned long long magnitude = 0;\n"
+        "        int digits = 0;\n"
+        "\n"
+        "        while (c >= '0' && c <= '9') {\n"
+        "            magnitude = magnitude * 10 + (unsigned long long) (c - '0');\n"
+        "            digits++;\n"
+        "\n"
+        "            if (magnitude > limit) {\n"
+        "                magnitude = limit + 1;\n"
+        "            }\n"
+        "\n"
+        "            c = getchar();\n"
+        "        }\n"
+        "\n"
+        "        // the whole word has to be the number\n"
+        "        if (digits == 0 || (c != EOF && !is_space(c))) {\n"
+        "            while (c != EOF && !is_space(c)) {\n"
+        "                c = getchar();\n"
+        "            }\n"
+        "\n"
+        "            fputs(\"Invalid input: not a number\\n\", stderr);\n"
+        "            continue;\n"
+        "        }\n"
+        "\n"
+        "        if (magnitude > limit) {\n"
+        "            fputs(\"Invalid input: out of range\\n\", stderr);\n"
+        "            continue;\n"
+        "        }\n"
+        "\n"
+        "        *acc = negative ? (int) (0U - (unsigned int) magnitude) : (int) magnitude;\n"
+        "        return 1;\n"
+        "    }\n"
+        "}\n"
+        "\n";
+
+static const char *RUNTIME_FUNCTIONS =
+        "// set once the interpreter writes a cell that compiled code treats as constant, after which only the interpreter is used\n"
+        "static int unchecked_write = 0;\n"
+        "\n"
+        "static int report_error(unsigned int pc, unsigned int cir) {\n"
+        "    fprintf(stderr, \"Error occurred with PC = %u CIR = %u\\n\", pc, cir);\n"
+        "    return FAILED;\n"
+        "}\n"
+        "\n"
+        "static int report_overflow(int acc, unsigned int mdr, unsigned int pc, unsigned int cir) {\n"
+        "    fprintf(stderr, \"Error: Accumulator overflow: %u + %u > %u\\n\", (unsigned int) acc, mdr, (unsigned int) INT_MAX);\n"
+        "    return report_error(pc, cir);\n"
+        "}\n"
+        "\n"
+        "static int report_underflow(int acc, unsigned int mdr, unsigned int pc, unsigned int cir) {\n"
+        "    fprintf(stderr, \"Error: Accumulator underflow: %u - %u < %u\\n\", (unsigned int) acc, mdr, (unsigned int) INT_MIN);\n"
+        "    return report_error(pc, cir);\n"
+        "}\n"
+        "\n"
+        "static int report_out_of_range(int acc, unsigned int pc, unsigned int cir) {\n"
+        "    fprintf(stderr, \"Error: Accumulator value out of memory range: %d\\n\", acc);\n"
+        "    return report_error(pc, cir);\n"
+        "}\n"
+        "\n"
+        "// runs a single instruction the way lmvm does, for cells that have changed since they were compiled\n"
+        "static int interpret(int *acc, unsigned int *pc) {\n"
+        "    if (*pc >= CELLS) {\n"
+        "        fprintf(stderr, \"Error: Program counter out of range: %u\\n\", *pc + 1);\n"
+        "        return report_error(*pc + 1, 0);\n"
+        "    }\n"
+        "\n"
+        "    unsigned int cir = memory[*pc];\n"
+        "    unsigned int address = cir % 100;\n"
+        "    *pc += 1;\n"
+        "\n"
+        "    switch (cir / 100) {\n"
+        "        case 0:\n"
+        "            return HALTED;\n"
+        "        case 1:\n"
+        "            if (*acc > INT_MAX - memory[address]) {\n"
+        "                return report_overflow(*acc, memory[address], *pc, cir);\n"
+        "            }\n"
+        "            *acc += memory[address];\n"
+        "            return RUNNING;\n"
+        "        case 2:\n"
+        "            if (*acc < INT_MIN + memory[address]) {\n"
+        "                return report_underflow(*acc, memory[address], *pc, cir);\n"
+        "            }\n"
+        "            *acc -= memory[address];\n"
+        "            return RUNNING;\n"
+        "        case 3:\n"
+        "            if (*acc < 0 || *acc > 999) {\n"
+        "                return report_out_of_range(*acc, *pc, cir);\n"
+        "            }\n"
+        "            memory[address] = (unsigned short int) *acc;\n"
+        "            unchecked_write |= !GUARDED[address];\n"
+        "            return RUNNING;\n"
+        "        case 5:\n"
+        "            *acc = memory[address];\n"
+        "            return RUNNING;\n"
+        "        case 6:\n"
+        "            *pc = address;\n"
+        "            return RUNNING;\n"
+        "        case 7:\n"
+        "            if (*acc == 0) {\n"
+        "                *pc = address;\n"
+        "            }\n"
+        "            return RUNNING;\n"
+        "        case 8:\n"
+        "            if (*acc >= 0) {\n"
+        "                *pc = address;\n"
+        "            }\n"
+        "            return RUNNING;\n"
+        "        case 9:\n"
+        "            if (cir == 901) {\n"
+        "                return read_input(acc) ? RUNNING : report_error(*pc, cir);\n"
+        "            }\n"
+        "            if (cir == 902) {\n"
+        "                printf(\"%d\\n\", *acc);\n"
+        "                return RUNNING;\n"
+        "            }\n"
+        "            fprintf(stderr, \"Error: Invalid IO operation: %u\\n\", cir);\n"
+        "            return report_error(*pc, cir);\n"
+        "        default:\n"
+        "            fprintf(stderr, \"Error: Invalid opcode: %d\\n\", (int) (cir / 100));\n"
+        "            return report_error(*pc, cir);\n"
+        "    }\n"
+        "}\n"
+        "\n";
+
+static const char *MAIN_HEADER =
+        "int main(void) {\n"
+        "    int acc = 0;\n"
+        "    unsigned int pc = 0;\n"
+        "\n"
+        "    for (;;) {\n"
+        "        // cells that have changed since compilation can't run as compiled code\n"
+        "        while (unchecked_write || (pc < CELLS && memory[pc] != IMAGE[pc])) {\n"
+        "            int status = interpret(&acc, &pc);\n"
+        "\n"
+        "            if (status != RUNNING) {\n"
+        "                return status;\n"
+        "            }\n"
+        "        }\n"
+        "\n"
+        "        switch (pc) {\n";
+
+static const char *MAIN_FOOTER =
+        "            case CELLS:\n"
+        "            default:\n"
+        "                fprintf(stderr, \"Error: Program counter out of range: %u\\n\", CELLS + 1);\n"
+        "                return report_error(CELLS + 1, 0);\n"
+        "        }\n"
+        "    }\n"
+        "}\n";
+
+
+static void write_cells(FILE *out, const char *name, const unsigned short int *cells) {
+    fprintf(out, "%s[CELLS] = {", name);
+
+    for (int address = 0; address < EXECUTABLE_SIZE; address++) {
+        fprintf(out, "%s%u%s", address % 10 == 0 ? "\n        " : "", cells[address], address + 1 < EXECUTABLE_SIZE ? ", " : "");
+    }
+
+    fputs("\n};\n\n", out);
+}
+
+// writes an operand, which is folded to a constant if nothing compiled can change it
+static void write_operand(FILE *out, const unsigned short int *image, const unsigned char *guarded, unsigned int address) {
+    if (guarded[address]) {
+        fprintf(out, "memory[%u]", address);
+    } else {
+        fprintf(out, "%u", image[address]);
+    }
+}
+
+static void write_cell(FILE *out, const unsigned short int *image, const unsigned char *guarded, const unsigned char *branch_target, unsigned int address) {
+    unsigned int cir = image[address];
+    unsigned int opcode = cir / 100;
+    unsigned int operand = cir % 100;
+    unsigned int next_pc = address + 1;
+
+    fprintf(out, "            case %u:\n", address);
+
+    if (branch_target[address]) {
+        fprintf(out, "            cell_%u:\n", address);
+    }
+
+    if (guarded[address]) {
+        fprintf(out, "                if (memory[%u] != %u) {\n", address, cir);
+        fprintf(out, "                    pc = %u;\n", address);
+        fputs("                    continue;\n", out);
+        fputs("                }\n", out);
+    }
+
+    switch (opcode) {
+        case OP_LMC_HLT:
+            fputs("                return HALTED;\n", out);
+            return;
+        case OP_LMC_ADD:
+        case OP_LMC_SUB:
+            if (opcode == OP_LMC_ADD) {
+                fputs("                if (acc > INT_MAX - ", out);
+                write_operand(out, image, guarded, operand);
+                fputs(") {\n                    return report_overflow(acc, ", out);
+            } else {
+                fputs("                if (acc < INT_MIN + ", out);
+                write_operand(out, image, guarded, operand);
+                fputs(") {\n                    return report_underflow(acc, ", out);
+            }
+
+            write_operand(out, image, guarded, operand);
+            fprintf(out, ", %u, %u);\n", next_pc, cir);
+            fputs("                }\n", out);
+
+            fprintf(out, "                acc %s= ", opcode == OP_LMC_ADD ? "+" : "-");
+            write_operand(out, image, guarded, operand);
+            fputs(";\n", out);
+            break;
+        case OP_LMC_STA:
+            fputs("                if (acc < 0 || acc > 999) {\n", out);
+            fprintf(out, "                    return report_out_of_range(acc, %u, %u);\n", next_pc, cir);
+            fputs("                }\n", out);
+            fprintf(out, "                memory[%u] = (unsigned short int) acc;\n", operand);
+            break;
+        case OP_LMC_LDA:
+            fputs("                acc = ", out);
+            write_operand(out, image, guarded, operand);
+            fputs(";\n", out);
+            break;
+        case OP_LMC_BRA:
+            fprintf(out, "                goto cell_%u;\n", operand);
+            return;
+        case OP_LMC_BRZ:
+            fprintf(out, "                if (acc == 0) {\n                    goto cell_%u;\n                }\n", operand);
+            break;
+        case OP_LMC_BRP:
+            fprintf(out, "                if (acc >= 0) {\n                    goto cell_%u;\n                }\n", operand);
+            break;
+        case OP_LMC_IO_OP:
+            if (cir == OP_LMC_IO_OP_INP) {
+                fputs("                if (!read_input(&acc)) {\n", out);
+                fprintf(out, "                    return report_error(%u, %u);\n", next_pc, cir);
+                fputs("                }\n", out);
+                break;
+            }
+
+            if (cir == OP_LMC_IO_OP_OUT) {
+                fputs("                printf(\"%d\\n\", acc);\n", out);
+                break;
+            }
+
+            fprintf(out, "                fprintf(stderr, \"Error: Invalid IO operation: %u\\n\");\n", cir);
+            fprintf(out, "                return report_error(%u, %u);\n", next_pc, cir);
+            return;
+        default:
+            fprintf(out, "                fprintf(stderr, \"Error: Invalid opcode: %u\\n\");\n", opcode);
+            fprintf(out, "                return report_error(%u, %u);\n", next_pc, cir);
+            return;
+    }
+
+    // the next case is the next cell
+    fputs("                // fall through\n", out);
+}
+
+int generate_c_program(FILE *out, const unsigned short int image[EXECUTABLE_SIZE], const char *source_name) {
+    // LMC has no indirect addressing, so the only cells compiled code can change are the operands of STAs in the image
+    // (an STA the interpreter runs from a changed cell could change another, but then unchecked_write is set)
+    unsigned char guarded[EXECUTABLE_SIZE] = {0};
+    unsigned char branch_target[EXECUTABLE_SIZE] = {0};
+
+    for (int address = 0; address < EXECUTABLE_SIZE; address++) {
+        unsigned int opcode = image[address] / 100;
+        unsigned int operand = image[address] % 100;
+
+        if (opcode == OP_LMC_STA) {
+            guarded[operand] = 1;
+        } else if (opcode == OP_LMC_BRA || opcode == OP_LMC_BRZ || opcode == OP_LMC_BRP) {
+            branch_target[operand] = 1;
+        }
+    }
+
+    fprintf(out, "// Generated by lmc2c from %s, do not edit\n\n", source_name);
+    fputs(RUNTIME_HEADER, out);
+
+    write_cells(out, "static unsigned short int memory", image);
+
+    fputs("// the image the program was compiled from\n", out);
+    write_cells(out, "static const unsigned short int IMAGE", image);
+
+    unsigned short int guarded_cells[EXECUTABLE_SIZE];
+    for (int address = 0; address < EXECUTABLE_SIZE; address++) {
+        guarded_cells[address] = guarded[address];
+    }
+
+    fputs("// the cells that compiled code can write to, which it checks before running and reads rather than folding\n", out);
+    write_cells(out, "static const unsigned char GUARDED", guarded_cells);
+
+    fputs(RUNTIME_INPUT, out);
+    fputs(RUNTIME_FUNCTIONS, out);
+    fputs(MAIN_HEADER, out);
+
+    for (unsigned int address = 0; address < EXECUTABLE_SIZE; address++) {
+        write_cell(out, image, guarded, branch_target, address);
+    }
+
+    fputs(MAIN_FOOTER, out);
+
+    return !ferror(out);
+}
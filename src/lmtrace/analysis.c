@@ -0,0 +1,499 @@
+#include "lmtrace/analysis.h"
+#include "common/trace_format.h"
+#include "common/opcodes.h"
+
+#include <string.h>
+
+#define READ_BUFFER_SIZE (1 << 16)
+
+// must be in the same order as the results written by the VM
+static const char *const RESULT_NAMES[] = {"indeterminate", "error", "ACC changed", "ACC unchanged", "branched", "halt"};
+
+#define HEADER_SIZE (MAGIC_STRING_TRACE_SIZE + 2 + EXECUTABLE_SIZE * 2)
+
+
+/**
+ * Represents a buffered view of the trace, since records are read a byte at a time.
+ * @see trace_reader_st
+ */
+struct trace_reader_s {
+    FILE *in;
+    unsigned char buffer[READ_BUFFER_SIZE];
+    size_t used;
+    size_t filled;
+};
+
+/**
+ * Represents a buffered view of the trace, since records are read a byte at a time.
+ * @see trace_reader_s
+ */
+typedef struct trace_reader_s trace_reader_st;
+
+
+// returns the next byte, or -1 at the end of the trace
+static int read_byte(trace_reader_st *reader) {
+    if (reader->used == reader->filled) {
+        reader->filled = fread(reader->buffer, 1, READ_BUFFER_SIZE, reader->in);
+        reader->used = 0;
+
+        if (reader->filled == 0) {
+            return -1;
+        }
+    }
+
+    return reader->buffer[reader->used++];
+}
+
+// returns 1 if successful, 0 if the trace ended part way through the varint or it was too long
+static int read_zigzag_varint(trace_reader_st *reader, long long *value) {
+    unsigned long long zigzag = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        int byte = read_byte(reader);
+
+        if (byte == -1) {
+            return 0;
+        }
+
+        zigzag |= (unsigned long long) (byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            *value = (long long) (zigzag >> 1) ^ -(long long) (zigzag & 1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int read_header(trace_reader_st *reader, trace_analysis_st *analysis, FILE *errors) {
+    unsigned char header[HEADER_SIZE];
+
+    for (size_t index = 0; index < HEADER_SIZE; index++) {
+        int byte = read_byte(reader);
+
+        if (byte == -1) {
+            fputs("Error: The trace is too short to have a header\n", errors);
+            return 0;
+        }
+
+        header[index] = (unsigned char) byte;
+    }
+
+    if (memcmp(header, MAGIC_STRING_TRACE, MAGIC_STRING_TRACE_SIZE) != 0) {
+        fputs("Error: The file is not a trace\n", errors);
+        return 0;
+    }
+
+    unsigned int version = header[MAGIC_STRING_TRACE_SIZE] | (header[MAGIC_STRING_TRACE_SIZE + 1] << 8);
+    if (version != TRACE_FORMAT_VERSION) {
+        fprintf(errors, "Error: The trace is of version %u, but only version %u is supported\n", version, TRACE_FORMAT_VERSION);
+        return 0;
+    }
+
+    for (size_t cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        const unsigned char *value = &header[MAGIC_STRING_TRACE_SIZE + 2 + cell * 2];
+        analysis->image[cell] = (unsigned short int) (value[0] | (value[1] << 8));
+    }
+
+    return 1;
+}
+
+
+static void close_loop(loop_stats_st *loop) {
+    unsigned int bucket = 0;
+    while (bucket + 1 < LOOP_HISTOGRAM_BUCKETS && loop->current >> (bucket + 1) != 0) {
+        bucket++;
+    }
+
+    loop->histogram[bucket]++;
+    loop->iterations += loop->current;
+
+    if (loop->current > loop->most_iterations) {
+        loop->most_iterations = loop->current;
+    }
+
+    loop->active = 0;
+}
+
+static int is_branch(unsigned short int cir) {
+    unsigned int opcode = cir / 100;
+    return opcode == OP_LMC_BRA || opcode == OP_LMC_BRZ || opcode == OP_LMC_BRP;
+}
+
+
+int analyse_trace(FILE *in, trace_analysis_st *analysis, FILE *errors) {
+    static trace_reader_st reader;
+    reader.in = in;
+    reader.used = 0;
+    reader.filled = 0;
+
+    memset(analysis, 0, sizeof(trace_analysis_st));
+    analysis->last_result = -1;
+
+    if (!read_header(&reader, analysis, errors)) {
+        return 0;
+    }
+
+    // mirror what the writer expects, so the fields it left out can be filled in
+    unsigned short int cirs[EXECUTABLE_SIZE + 1];
+    memcpy(cirs, analysis->image, sizeof(analysis->image));
+    cirs[EXECUTABLE_SIZE] = 0;
+    unsigned int expected_pc = 0;
+    long long acc = 0;
+
+    // the loops being run, innermost last
+    unsigned char loop_stack[EXECUTABLE_SIZE];
+    unsigned int loop_depth = 0;
+
+    int flags;
+    while ((flags = read_byte(&reader)) != -1) {
+        unsigned int pc = expected_pc;
+
+        if (flags & ~(TRACE_FLAG_RESULT_MASK | TRACE_FLAG_PC | TRACE_FLAG_CIR | TRACE_FLAG_ACC)) {
+            fprintf(errors, "Error: The trace is corrupted at instruction %llu (unknown flags %d)\n", analysis->instructions, flags);
+            return 0;
+        }
+
+        if (flags & TRACE_FLAG_PC) {
+            int byte = read_byte(&reader);
+
+            if (byte == -1 || byte > EXECUTABLE_SIZE) {
+                fprintf(errors, "Error: The trace is corrupted at instruction %llu (bad PC)\n", analysis->instructions);
+                return 0;
+            }
+
+            pc = (unsigned int) byte;
+        }
+
+        if (pc > EXECUTABLE_SIZE) {
+            fprintf(errors, "Error: The trace is corrupted at instruction %llu (bad PC)\n", analysis->instructions);
+            return 0;
+        }
+
+        if (flags & TRACE_FLAG_CIR) {
+            int low = read_byte(&reader);
+            int high = read_byte(&reader);
+
+            if (low == -1 || high == -1) {
+                fprintf(errors, "Error: The trace is corrupted at instruction %llu (truncated CIR)\n", analysis->instructions);
+                return 0;
+            }
+
+            cirs[pc] = (unsigned short int) (low | (high << 8));
+            analysis->rewritten[pc]++;
+        }
+
+        if (flags & TRACE_FLAG_ACC) {
+            long long delta;
+
+            if (!read_zigzag_varint(&reader, &delta)) {
+                fprintf(errors, "Error: The trace is corrupted at instruction %llu (truncated ACC)\n", analysis->instructions);
+                return 0;
+            }
+
+            acc += delta;
+        }
+
+        unsigned short int cir = cirs[pc];
+        unsigned int result = (unsigned int) flags & TRACE_FLAG_RESULT_MASK;
+
+        analysis->instructions++;
+        analysis->runs[pc]++;
+        analysis->last_result = (int) result;
+
+        // what the instruction read and wrote tells the cells holding data from the ones holding code
+        if (pc < EXECUTABLE_SIZE) {
+            switch (cir / 100) {
+                case OP_LMC_ADD:
+                case OP_LMC_SUB:
+                case OP_LMC_LDA:
+                    analysis->reads[cir % 100]++;
+                    break;
+                case OP_LMC_STA:
+                    if (result != TRACE_RESULT_ERROR) {
+                        analysis->writes[cir % 100]++;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // leaving a loop ends the stay in it
+        while (loop_depth > 0) {
+            loop_stats_st *loop = &analysis->loops[loop_stack[loop_depth - 1]];
+
+            if (pc >= loop->start && pc <= loop_stack[loop_depth - 1]) {
+                break;
+            }
+
+            close_loop(loop);
+            loop_depth--;
+        }
+
+        if (pc < EXECUTABLE_SIZE && is_branch(cir)) {
+            analysis->branches[pc]++;
+
+            if (result == TRACE_RESULT_BRANCHED) {
+                analysis->taken[pc]++;
+
+                unsigned int target = cir % 100;
+                loop_stats_st *loop = &analysis->loops[pc];
+
+                // a loop is keyed by its branch, so one that jumps back somewhere else is a new stay
+                if (target <= pc && loop->active && loop->start != target) {
+                    close_loop(loop);
+                    for (unsigned int depth = 0; depth < loop_depth; depth++) {
+                        if (loop_stack[depth] == pc) {
+                            memmove(&loop_stack[depth], &loop_stack[depth + 1], loop_depth - depth - 1);
+                            loop_depth--;
+                            break;
+                        }
+                    }
+                }
+
+                if (target <= pc && !loop->active) {
+                    loop->start = (unsigned char) target;
+                    loop->entries++;
+                    loop->active = 1;
+                    loop->current = 0;
+                    loop_stack[loop_depth++] = (unsigned char) pc;
+                }
+
+                if (target <= pc) {
+                    loop->current++;
+                }
+            }
+        }
+
+        expected_pc = trace_expected_pc(pc, cir, result);
+    }
+
+    if (ferror(in)) {
+        fputs("Error: Failed to read the trace\n", errors);
+        return 0;
+    }
+
+    while (loop_depth > 0) {
+        close_loop(&analysis->loops[loop_stack[--loop_depth]]);
+    }
+
+    return 1;
+}
+
+
+static void format_instruction(char text[16], unsigned short int cir) {
+    unsigned int operand = cir % 100;
+
+    switch (cir / 100) {
+        case OP_LMC_HLT:
+            strcpy(text, "HLT");
+            return;
+        case OP_LMC_ADD:
+            sprintf(text, "ADD %u", operand);
+            return;
+        case OP_LMC_SUB:
+            sprintf(text, "SUB %u", operand);
+            return;
+        case OP_LMC_STA:
+            sprintf(text, "STA %u", operand);
+            return;
+        case OP_LMC_LDA:
+            sprintf(text, "LDA %u", operand);
+            return;
+        case OP_LMC_BRA:
+            sprintf(text, "BRA %u", operand);
+            return;
+        case OP_LMC_BRZ:
+            sprintf(text, "BRZ %u", operand);
+            return;
+        case OP_LMC_BRP:
+            sprintf(text, "BRP %u", operand);
+            return;
+        default:
+            break;
+    }
+
+    if (cir == OP_LMC_IO_OP_INP) {
+        strcpy(text, "INP");
+    } else if (cir == OP_LMC_IO_OP_OUT) {
+        strcpy(text, "OUT");
+    } else {
+        strcpy(text, "DAT");
+    }
+}
+
+// the widest code the report shows, which longer source lines are cut to
+#define CODE_WIDTH 16
+
+// whether a cell holds a value rather than an instruction, as the source says, or else as the trace suggests by the
+// cell never running but being read or written
+static int is_data(const trace_analysis_st *analysis, const source_map_st *source, unsigned int address) {
+    if (source != NULL && address < source->cell_count) {
+        return source->data[address];
+    }
+
+    return analysis->runs[address] == 0 && (analysis->reads[address] > 0 || analysis->writes[address] > 0);
+}
+
+// writes the address, source line, label and code of a cell, or what it held at the start where there's no source for it
+static void write_cell(FILE *out, const trace_analysis_st *analysis, const source_map_st *source, unsigned int address) {
+    if (source != NULL && address < source->cell_count) {
+        fprintf(out, "  %-7u %-5u %-10.10s %-*.*s", address, source->lines[address],
+                source->labels[address] != NULL ? source->labels[address] : "", CODE_WIDTH, CODE_WIDTH, source->code[address]);
+        return;
+    }
+
+    char code[16];
+    if (is_data(analysis, source, address)) {
+        sprintf(code, "DAT %u", analysis->image[address]);
+    } else {
+        format_instruction(code, analysis->image[address]);
+    }
+
+    fprintf(out, "  %-7u %-5s %-10s %-*s", address, "-", "", CODE_WIDTH, code);
+}
+
+static void write_cell_header(FILE *out) {
+    fprintf(out, "  %-7s %-5s %-10s %-*s", "Address", "Line", "Label", CODE_WIDTH, "Code");
+}
+
+static void write_coverage(FILE *out, const trace_analysis_st *analysis, const source_map_st *source) {
+    unsigned int code_cells = 0;
+    unsigned int run_cells = 0;
+    unsigned int data_cells = 0;
+
+    fputs("Coverage:\n", out);
+    write_cell_header(out);
+    fprintf(out, " %-5s %s\n", "Value", "Runs");
+
+    for (unsigned int address = 0; address < EXECUTABLE_SIZE; address++) {
+        unsigned short int value = analysis->image[address];
+        unsigned long long runs = analysis->runs[address];
+        int data = is_data(analysis, source, address);
+
+        // trailing zeroes are just empty memory, unless the source has them or something used them
+        if (value == 0 && runs == 0 && analysis->reads[address] == 0 && analysis->writes[address] == 0
+            && (source == NULL || address >= source->cell_count)) {
+            continue;
+        }
+
+        write_cell(out, analysis, source, address);
+        fprintf(out, " %-5u ", value);
+
+        if (data) {
+            data_cells++;
+        } else {
+            code_cells++;
+        }
+
+        if (runs > 0) {
+            run_cells += !data;
+            fprintf(out, "%llu", runs);
+        } else if (data) {
+            fprintf(out, "data, read %llu and written %llu times", analysis->reads[address], analysis->writes[address]);
+        } else {
+            fputs("never run", out);
+        }
+
+        if (runs > 0 && data) {
+            fputs(" (run as code)", out);
+        }
+
+        if (analysis->rewritten[address] > 0) {
+            fprintf(out, " (a different instruction %llu times)", analysis->rewritten[address]);
+        }
+
+        fputc('\n', out);
+    }
+
+    if (analysis->runs[EXECUTABLE_SIZE] > 0) {
+        fprintf(out, "  %-7u %-5s %-10s %-*s %-5s %llu\n", EXECUTABLE_SIZE, "-", "", CODE_WIDTH, "(off the end)", "-", analysis->runs[EXECUTABLE_SIZE]);
+    }
+
+    fprintf(out, "%u of %u code cells executed, and %u cells of data\n", run_cells, code_cells, data_cells);
+}
+
+static void write_branches(FILE *out, const trace_analysis_st *analysis, const source_map_st *source) {
+    fputs("\nBranches:\n", out);
+    write_cell_header(out);
+    fprintf(out, " %-12s %-12s %s\n", "Runs", "Taken", "Ratio");
+
+    int any = 0;
+    for (unsigned int address = 0; address < EXECUTABLE_SIZE; address++) {
+        unsigned long long branches = analysis->branches[address];
+
+        if (branches == 0) {
+            continue;
+        }
+
+        write_cell(out, analysis, source, address);
+        fprintf(out, " %-12llu %-12llu %.1f%%\n", branches, analysis->taken[address], 100.0 * (double) analysis->taken[address] / (double) branches);
+        any = 1;
+    }
+
+    if (!any) {
+        fputs("  No branches were run\n", out);
+    }
+}
+
+static void write_loops(FILE *out, const trace_analysis_st *analysis, const source_map_st *source) {
+    fputs("\nLoops:\n", out);
+
+    int any = 0;
+    for (unsigned int address = 0; address < EXECUTABLE_SIZE; address++) {
+        const loop_stats_st *loop = &analysis->loops[address];
+
+        if (loop->entries == 0) {
+            continue;
+        }
+
+        fprintf(out, "  %u-%u", loop->start, address);
+
+        // named after the label at its start, where it has one
+        if (source != NULL && loop->start < source->cell_count && source->labels[loop->start] != NULL) {
+            fprintf(out, " (%s)", source->labels[loop->start]);
+        }
+
+        fprintf(out, ": entered %llu times, %llu iterations, at most %llu in one go\n", loop->entries, loop->iterations, loop->most_iterations);
+
+        for (unsigned int bucket = 0; bucket < LOOP_HISTOGRAM_BUCKETS; bucket++) {
+            if (loop->histogram[bucket] == 0) {
+                continue;
+            }
+
+            unsigned long long low = 1ULL << bucket;
+            unsigned long long high = low * 2 - 1;
+
+            char range[48];
+            if (low == high) {
+                sprintf(range, "%llu", low);
+            } else {
+                sprintf(range, "%llu-%llu", low, high);
+            }
+
+            fprintf(out, "    %-24s %llu\n", range, loop->histogram[bucket]);
+        }
+
+        any = 1;
+    }
+
+    if (!any) {
+        fputs("  No branches jumped back\n", out);
+    }
+}
+
+void write_trace_report(FILE *out, const trace_analysis_st *analysis, const source_map_st *source) {
+    fprintf(out, "Trace of %llu instructions", analysis->instructions);
+
+    if (analysis->last_result >= 0 && analysis->last_result < (int) (sizeof(RESULT_NAMES) / sizeof(RESULT_NAMES[0]))) {
+        fprintf(out, ", the last with result: %s", RESULT_NAMES[analysis->last_result]);
+    }
+
+    fputs("\n\n", out);
+
+    write_coverage(out, analysis, source);
+    write_branches(out, analysis, source);
+    write_loops(out, analysis, source);
+}
@@ -0,0 +1,151 @@
+#include "lmtrace/analysis.h"
+#include "common/executable_props.h"
+#include "common/file_io.h"
+#include "common/checked_alloc.h"
+#include "common/source_map.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <getopt.h>
+
+#ifndef VERSION_MAJOR
+#define VERSION_MAJOR 0
+#endif
+#ifndef VERSION_MINOR
+#define VERSION_MINOR 0
+#endif
+#ifndef VERSION_PATCH
+#define VERSION_PATCH 0
+#endif
+static const unsigned short int VERSION[3] = {VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH};
+
+#define VERSION_STRING "\nLMTRACE v%u.%u.%u\nA component of the Little Man Virtual Machine.\nCopyright (c) 2023 obfuscatedgenerated\nMIT License\n\n"
+
+static char *infile_path = NULL;
+static char *outfile_path = NULL;
+static char *source_path = NULL;
+
+#define USAGE_STRING "%s [-h | --help] INFILE [-o | --output OUTFILE] [optional-flags]\n"
+#define OPTIONS "-ho:s:v"
+static const struct option LONG_OPTIONS[] = {
+        {"help",         no_argument,       NULL,         'h'},
+        {"output",       required_argument, NULL,         'o'},
+        {"source",       required_argument, NULL,         's'},
+        {"version",      no_argument,       NULL,         'v'},
+        {NULL,           0,                 NULL,         0}
+};
+
+
+static void parse_args(int argc, char **argv) {
+    int c;
+    while ((c = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                puts("\nUsage:");
+                printf(USAGE_STRING, argv[0]);
+                puts("\n-h | --help:               Show this help message and exit");
+                puts("\nRequired positional arguments:");
+                puts("INFILE:                    The trace to analyse, written with lmvm --trace");
+                puts("\nOptional arguments:");
+                puts("-o | --output OUTFILE:     The file to write the report to. Defaults to stdout");
+                puts("-s | --source SOURCE:      The assembly the program was assembled from. Defaults to INFILE with a .lmasm extension, if it exists");
+                puts("-v | --version:            Show the version number and license information");
+                puts("");
+                exit(0);
+            case 'o':
+                outfile_path = optarg;
+                break;
+            case 's':
+                source_path = optarg;
+                break;
+            case 'v':
+                printf(VERSION_STRING, VERSION[0], VERSION[1], VERSION[2]);
+                break;
+            case 1:
+                infile_path = optarg;
+                break;
+            case '?':
+            case ':':
+                printf(USAGE_STRING, argv[0]);
+                exit(1);
+        }
+    }
+}
+
+
+int main(int argc, char **argv) {
+    parse_args(argc, argv);
+
+    // check for input file
+    if (infile_path == NULL) {
+        fputs("Error: No input file specified\n", stderr);
+        fprintf(stderr, "\nUsage: ");
+        fprintf(stderr, USAGE_STRING, argv[0]);
+        exit(1);
+    }
+
+    // check if the input file is a directory
+    if (is_dir(infile_path)) {
+        fprintf(stderr, "Error: Input file '%s' is a directory\n", infile_path);
+        exit(1);
+    }
+
+    FILE *in = fopen(infile_path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Error: Input file '%s' does not exist or cannot be opened\n", infile_path);
+        exit(1);
+    }
+
+    // the analysis is too big for the stack
+    trace_analysis_st *analysis = checked_malloc(sizeof(trace_analysis_st));
+    int analysed = analyse_trace(in, analysis, stderr);
+    fclose(in);
+
+    if (!analysed) {
+        fprintf(stderr, "Error: Failed to analyse trace '%s'\n", infile_path);
+        exit(1);
+    }
+
+    // cells are shown as the lines they were assembled from, if the source is there and assembles to the traced program
+    source_map_st source;
+    const source_map_st *annotations = NULL;
+    char *default_source_path = source_path == NULL ? source_path_for(infile_path) : NULL;
+    char *annotations_path = source_path != NULL ? source_path : default_source_path;
+
+    if (source_path != NULL || file_exists_and_accessible(annotations_path)) {
+        if (read_source_map(annotations_path, analysis->image, &source) == 0) {
+            annotations = &source;
+        } else {
+            fprintf(stderr, "Warning: '%s' doesn't assemble to the traced program, so the report isn't annotated from it\n", annotations_path);
+        }
+    }
+
+    FILE *out = stdout;
+    if (outfile_path != NULL) {
+        if (is_dir(outfile_path)) {
+            fprintf(stderr, "Error: Output file '%s' is a directory\n", outfile_path);
+            exit(1);
+        }
+
+        out = fopen(outfile_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Error: Failed to open output file '%s'\n", outfile_path);
+            exit(1);
+        }
+    }
+
+    write_trace_report(out, analysis, annotations);
+
+    if (fflush(out) != 0 || ferror(out) || (out != stdout && fclose(out) != 0)) {
+        fprintf(stderr, "Error: Failed to write the report\n");
+        exit(1);
+    }
+
+    if (annotations != NULL) {
+        free_source_map(&source);
+    }
+    silent_checked_free(default_source_path);
+    checked_free(analysis);
+
+    return 0;
+}
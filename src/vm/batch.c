@@ -0,0 +1,342 @@
+#include "vm/batch.h"
+#include "vm/execution.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// workers are posix threads, and job output is collected with open_memstream
+#if defined(__unix__) || defined(__APPLE__)
+#define BATCH_THREADS_SUPPORTED 1
+#include <pthread.h>
+#include <unistd.h>
+#else
+#define BATCH_THREADS_SUPPORTED 0
+#endif
+
+static const char *NULL_DEVICE =
+#ifdef _WIN32
+        "NUL";
+#else
+        "/dev/null";
+#endif
+
+
+/**
+ * Represents the tasks a worker has left, which are always a contiguous range of the batch.
+ * The worker takes tasks from the bottom of its range, and other workers steal from the top.
+ * @see batch_worker_st
+ */
+struct batch_worker_s {
+    size_t top;
+    size_t bottom;
+
+    struct batch_pool_s *pool;
+
+#if BATCH_THREADS_SUPPORTED
+    pthread_mutex_t lock;
+    pthread_t thread;
+#endif
+};
+
+/**
+ * Represents the tasks a worker has left, which are always a contiguous range of the batch.
+ * @see batch_worker_s
+ */
+typedef struct batch_worker_s batch_worker_st;
+
+/**
+ * Represents a batch being run, shared by all of its workers.
+ * @see batch_pool_st
+ */
+struct batch_pool_s {
+    batch_task_fn task;
+    void *context;
+
+    batch_worker_st *workers;
+    size_t worker_count;
+};
+
+/**
+ * Represents a batch being run, shared by all of its workers.
+ * @see batch_pool_s
+ */
+typedef struct batch_pool_s batch_pool_st;
+
+
+FILE *open_batch_buffer(char **data, size_t *size) {
+#if BATCH_THREADS_SUPPORTED
+    FILE *stream = open_memstream(data, size);
+#else
+    // without open_memstream, write to a temporary file and read it back once it is closed
+    FILE *stream = tmpfile();
+    *data = NULL;
+    *size = 0;
+#endif
+
+    if (stream == NULL) {
+        fputs("Internal Error: Failed to open a buffer for task output\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    return stream;
+}
+
+void close_batch_buffer(FILE *stream, char **data, size_t *size) {
+#if BATCH_THREADS_SUPPORTED
+    fclose(stream);
+
+    // an empty memstream may not have allocated anything
+    if (*data == NULL) {
+        *size = 0;
+    }
+#else
+    long length = ftell(stream);
+    rewind(stream);
+
+    *data = checked_malloc(length > 0 ? (size_t) length : 1);
+    *size = length > 0 ? fread(*data, 1, (size_t) length, stream) : 0;
+
+    fclose(stream);
+#endif
+}
+
+/**
+ * Represents the jobs of a batch and the engine to run them with.
+ * @see batch_jobs_st
+ */
+struct batch_jobs_s {
+    batch_job_st *jobs;
+    batch_engine_fn engine;
+};
+
+/**
+ * Represents the jobs of a batch and the engine to run them with.
+ * @see batch_jobs_s
+ */
+typedef struct batch_jobs_s batch_jobs_st;
+
+static void run_job(size_t index, void *context) {
+    batch_job_st *job = &((batch_jobs_st *) context)->jobs[index];
+    batch_engine_fn engine = ((batch_jobs_st *) context)->engine;
+
+    FILE *output = open_batch_buffer(&job->output, &job->output_size);
+    FILE *errors = open_batch_buffer(&job->errors, &job->errors_size);
+
+    // a job can start as soon as its own program is loaded, while the rest are still being read
+    const unsigned short int *image = job->image;
+    if (job->load != NULL) {
+        const program_load_st *program = wait_for_program(job->load, job->program);
+
+        if (program->status != LOAD_SUCCESS) {
+            report_load_error(errors, program->path, program->status, program->cell_count);
+            job->exit_code = 1;
+
+            close_batch_buffer(output, &job->output, &job->output_size);
+            close_batch_buffer(errors, &job->errors, &job->errors_size);
+            return;
+        }
+
+        image = program->image;
+    }
+
+    const char *input_path = job->input_path != NULL ? job->input_path : NULL_DEVICE;
+    FILE *input = fopen(input_path, "r");
+
+    if (input == NULL) {
+        fprintf(errors, "Error: Failed to open input file '%s'\n", input_path);
+        job->exit_code = 1;
+    } else {
+        // the image is shared with other jobs, so each runs on its own copy
+        unsigned short int memory[EXECUTABLE_SIZE];
+        memcpy(memory, image, sizeof(memory));
+
+        // nobody watches a job's output as it comes, so it can always be buffered
+        output_buffer_st output_buffer;
+        input_source_st input_source;
+        init_output_buffer(&output_buffer, output, 0);
+        init_input_source(&input_source, input, 0, NULL);
+
+        execution_io_st io;
+        init_execution_io(&io, input, output, errors);
+        io.buffer = &output_buffer;
+        io.source = &input_source;
+        io.limits = job->limits;
+
+        job->exit_code = engine(memory, &io, NULL);
+
+        close_input_source(&input_source);
+        fclose(input);
+    }
+
+    close_batch_buffer(output, &job->output, &job->output_size);
+    close_batch_buffer(errors, &job->errors, &job->errors_size);
+}
+
+static void lock_worker(batch_worker_st *worker) {
+#if BATCH_THREADS_SUPPORTED
+    pthread_mutex_lock(&worker->lock);
+#else
+    (void) worker;
+#endif
+}
+
+static void unlock_worker(batch_worker_st *worker) {
+#if BATCH_THREADS_SUPPORTED
+    pthread_mutex_unlock(&worker->lock);
+#else
+    (void) worker;
+#endif
+}
+
+static int take_task(batch_worker_st *worker, size_t *task) {
+    int taken = 0;
+
+    lock_worker(worker);
+    if (worker->top < worker->bottom) {
+        *task = --worker->bottom;
+        taken = 1;
+    }
+    unlock_worker(worker);
+
+    return taken;
+}
+
+// takes the top half of the first other worker with tasks left, running the first task of it straight away
+static int steal_tasks(batch_worker_st *thief, size_t *task) {
+    batch_pool_st *pool = thief->pool;
+    size_t thief_index = (size_t) (thief - pool->workers);
+
+    for (size_t offset = 1; offset < pool->worker_count; offset++) {
+        batch_worker_st *victim = &pool->workers[(thief_index + offset) % pool->worker_count];
+
+        lock_worker(victim);
+        size_t remaining = victim->bottom - victim->top;
+        size_t start = victim->top;
+        size_t stolen = (remaining + 1) / 2;
+        victim->top += stolen;
+        unlock_worker(victim);
+
+        if (stolen == 0) {
+            continue;
+        }
+
+        // tasks never create more tasks, so once every worker is empty the batch is done
+        lock_worker(thief);
+        thief->top = start + 1;
+        thief->bottom = start + stolen;
+        unlock_worker(thief);
+
+        *task = start;
+        return 1;
+    }
+
+    return 0;
+}
+
+static void *run_worker(void *arg) {
+    batch_worker_st *worker = arg;
+    size_t task;
+
+    while (take_task(worker, &task) || steal_tasks(worker, &task)) {
+        worker->pool->task(task, worker->pool->context);
+    }
+
+    return NULL;
+}
+
+
+size_t batch_worker_count(void) {
+#if BATCH_THREADS_SUPPORTED
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (size_t) cores : 1;
+#else
+    return 1;
+#endif
+}
+
+void run_batch_tasks(size_t task_count, size_t worker_count, batch_task_fn task, void *context) {
+#if !BATCH_THREADS_SUPPORTED
+    worker_count = 1;
+#endif
+
+    if (worker_count > task_count) {
+        worker_count = task_count;
+    }
+    if (worker_count == 0) {
+        worker_count = 1;
+    }
+
+    batch_pool_st pool;
+    pool.task = task;
+    pool.context = context;
+    pool.workers = checked_malloc(sizeof(batch_worker_st) * worker_count);
+    pool.worker_count = worker_count;
+
+    // deal the tasks out in contiguous ranges, which stealing then balances
+    for (size_t index = 0; index < worker_count; index++) {
+        batch_worker_st *worker = &pool.workers[index];
+        worker->top = task_count * index / worker_count;
+        worker->bottom = task_count * (index + 1) / worker_count;
+        worker->pool = &pool;
+
+#if BATCH_THREADS_SUPPORTED
+        pthread_mutex_init(&worker->lock, NULL);
+#endif
+    }
+
+#if BATCH_THREADS_SUPPORTED
+    // the calling thread is the first worker, so if a thread can't be started its tasks are still stolen and run
+    int *started = checked_calloc(worker_count, sizeof(int));
+
+    for (size_t index = 1; index < worker_count; index++) {
+        started[index] = pthread_create(&pool.workers[index].thread, NULL, run_worker, &pool.workers[index]) == 0;
+    }
+
+    run_worker(&pool.workers[0]);
+
+    for (size_t index = 1; index < worker_count; index++) {
+        if (started[index]) {
+            pthread_join(pool.workers[index].thread, NULL);
+        }
+    }
+
+    for (size_t index = 0; index < worker_count; index++) {
+        pthread_mutex_destroy(&pool.workers[index].lock);
+    }
+
+    checked_free(started);
+#else
+    run_worker(&pool.workers[0]);
+#endif
+
+    checked_free(pool.workers);
+}
+
+int do_batch_execution(batch_job_st *jobs, size_t job_count, size_t worker_count, batch_engine_fn engine) {
+    for (size_t job = 0; job < job_count; job++) {
+        jobs[job].output = NULL;
+        jobs[job].output_size = 0;
+        jobs[job].errors = NULL;
+        jobs[job].errors_size = 0;
+        jobs[job].exit_code = 0;
+    }
+
+    batch_jobs_st batch = {jobs, engine};
+    run_batch_tasks(job_count, worker_count, run_job, &batch);
+
+    int exit_code = 0;
+    for (size_t job = 0; job < job_count; job++) {
+        exit_code |= jobs[job].exit_code;
+    }
+
+    return exit_code;
+}
+
+void free_batch_outputs(batch_job_st *jobs, size_t job_count) {
+    for (size_t job = 0; job < job_count; job++) {
+        silent_checked_free(jobs[job].output);
+        silent_checked_free(jobs[job].errors);
+    }
+}
@@ -0,0 +1,375 @@
+#include "vm/buffered_io.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+// files are mapped and pipes read without stdio on posix, and everything goes through stdio elsewhere
+#if defined(__unix__) || defined(__APPLE__)
+#define POSIX_IO_SUPPORTED 1
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define POSIX_IO_SUPPORTED 0
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+
+int stream_is_interactive(FILE *stream) {
+#if POSIX_IO_SUPPORTED
+    return isatty(fileno(stream));
+#elif defined(_WIN32)
+    return _isatty(_fileno(stream));
+#else
+    (void) stream;
+    return 0;
+#endif
+}
+
+// raw values are bytes, which windows would otherwise translate newlines in
+static void use_binary_mode(FILE *stream) {
+#ifdef _WIN32
+    _setmode(_fileno(stream), _O_BINARY);
+#else
+    (void) stream;
+#endif
+}
+
+
+void init_output_buffer(output_buffer_st *buffer, FILE *stream, int raw) {
+    buffer->stream = stream;
+    buffer->raw = raw;
+    buffer->failed = 0;
+    buffer->used = 0;
+
+    if (raw) {
+        use_binary_mode(stream);
+    }
+}
+
+void write_output_value(output_buffer_st *buffer, int value) {
+    if (OUTPUT_BUFFER_SIZE - buffer->used < OUTPUT_VALUE_MAX_SIZE) {
+        flush_output_buffer(buffer);
+    }
+
+    unsigned char *at = &buffer->data[buffer->used];
+    unsigned int magnitude = (unsigned int) value;
+
+    if (buffer->raw) {
+        at[0] = (unsigned char) (magnitude & 0xFF);
+        at[1] = (unsigned char) ((magnitude >> 8) & 0xFF);
+        at[2] = (unsigned char) ((magnitude >> 16) & 0xFF);
+        at[3] = (unsigned char) (magnitude >> 24);
+        buffer->used += 4;
+        return;
+    }
+
+    if (value < 0) {
+        *at++ = '-';
+        magnitude = 0U - magnitude;
+    }
+
+    // digits come out backwards, so write them to the end of a scratch space first
+    unsigned char digits[10];
+    int length = 0;
+
+    do {
+        digits[length++] = (unsigned char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    while (length > 0) {
+        *at++ = digits[--length];
+    }
+
+    *at++ = '\n';
+    buffer->used = (size_t) (at - buffer->data);
+}
+
+int flush_output_buffer(output_buffer_st *buffer) {
+    if (buffer->used > 0 && fwrite(buffer->data, 1, buffer->used, buffer->stream) != buffer->used) {
+        buffer->failed = 1;
+    }
+
+    buffer->used = 0;
+
+    if (fflush(buffer->stream) != 0) {
+        buffer->failed = 1;
+    }
+
+    return buffer->failed;
+}
+
+
+void init_input_source(input_source_st *source, FILE *stream, int raw, output_buffer_st *flush_before_wait) {
+    source->stream = stream;
+    source->raw = raw;
+    source->data = NULL;
+    source->size = 0;
+    source->used = 0;
+    source->position = 0;
+    source->mapping = NULL;
+    source->mapping_size = 0;
+    source->ended = 0;
+    source->whole = 0;
+    source->flush_before_wait = flush_before_wait;
+    source->stop = NULL;
+    source->interrupted = 0;
+    source->unread = 0;
+
+    if (raw) {
+        use_binary_mode(stream);
+    }
+
+#if POSIX_IO_SUPPORTED
+    // a regular file can be scanned in place, without copying it through a buffer
+    int fd = fileno(stream);
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        return;
+    }
+
+    // an empty file has nothing to map, but is still known to be empty
+    if (info.st_size <= 0) {
+        source->ended = 1;
+        source->whole = 1;
+        return;
+    }
+
+    // the stream may not be at the start of the file, e.g. if stdin was inherited part way through
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= info.st_size) {
+        return;
+    }
+
+    void *mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(mapping, (size_t) info.st_size, MADV_SEQUENTIAL);
+#endif
+
+    source->mapping = mapping;
+    source->mapping_size = (size_t) info.st_size;
+    source->data = (const unsigned char *) mapping + offset;
+    source->size = (size_t) (info.st_size - offset);
+
+    // nothing more will come from the stream once the mapping is used up
+    source->ended = 1;
+    source->whole = 1;
+#endif
+}
+
+void close_input_source(input_source_st *source) {
+#if POSIX_IO_SUPPORTED
+    if (source->mapping != NULL) {
+        munmap(source->mapping, source->mapping_size);
+    }
+#endif
+
+    source->mapping = NULL;
+    source->data = NULL;
+    source->size = 0;
+    source->used = 0;
+}
+
+// returns 0 once there is nothing more to read
+static int refill(input_source_st *source) {
+    if (source->ended) {
+        return 0;
+    }
+
+    if (source->flush_before_wait != NULL) {
+        flush_output_buffer(source->flush_before_wait);
+    }
+
+#if POSIX_IO_SUPPORTED
+    // read takes whatever is there, where fread would wait for the whole chunk
+    ssize_t got;
+    do {
+        got = read(fileno(source->stream), source->chunk, INPUT_CHUNK_SIZE);
+    } while (got < 0 && errno == EINTR && (source->stop == NULL || !*source->stop));
+
+    // the signal asked for the run to stop, which it can't do while waiting here
+    if (got < 0 && errno == EINTR) {
+        source->interrupted = 1;
+        return 0;
+    }
+#else
+    size_t got = fread(source->chunk, 1, INPUT_CHUNK_SIZE, source->stream);
+#endif
+
+    if (got <= 0) {
+        source->ended = 1;
+        return 0;
+    }
+
+    source->position += source->size;
+    source->data = source->chunk;
+    source->size = (size_t) got;
+    source->used = 0;
+
+    return 1;
+}
+
+// returns the next byte, or -1 at the end of the input
+static inline int next_byte(input_source_st *source) {
+    if (source->used == source->size && !refill(source)) {
+        return -1;
+    }
+
+    return source->data[source->used++];
+}
+
+static inline int is_space(int c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+static input_status_et read_raw_value(input_source_st *source, int *value) {
+    unsigned int bytes = 0;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        int c = next_byte(source);
+
+        if (c == -1) {
+            return INPUT_END;
+        }
+
+        bytes |= (unsigned int) c << shift;
+    }
+
+    *value = (int) bytes;
+    return INPUT_VALUE;
+}
+
+static input_status_et read_text_value(input_source_st *source, int *value) {
+    int c;
+
+    do {
+        c = next_byte(source);
+    } while (is_space(c));
+
+    if (c == -1) {
+        return INPUT_END;
+    }
+
+    int negative = c == '-';
+    if (c == '-' || c == '+') {
+        c = next_byte(source);
+    }
+
+    // INT_MIN has one more than INT_MAX, so the limit depends on the sign
+    unsigned long long limit = negative ? (unsigned long long) INT_MAX + 1 : (unsigned long long) INT_MAX;
+    unsigned long long magnitude = 0;
+    int digits = 0;
+    int out_of_range = 0;
+
+    while (c >= '0' && c <= '9') {
+        magnitude = magnitude * 10 + (unsigned long long) (c - '0');
+        digits++;
+
+        // stop growing once too big, but carry on eating the digits
+        if (magnitude > limit) {
+            out_of_range = 1;
+            magnitude = limit + 1;
+        }
+
+        c = next_byte(source);
+    }
+
+    // the whole word has to be the number, anything else in it means it isn't one
+    if (digits == 0 || (c != -1 && !is_space(c))) {
+        while (c != -1 && !is_space(c)) {
+            c = next_byte(source);
+        }
+
+        return INPUT_NOT_A_NUMBER;
+    }
+
+    if (out_of_range) {
+        return INPUT_OUT_OF_RANGE;
+    }
+
+    *value = negative ? (int) (0U - (unsigned int) magnitude) : (int) magnitude;
+    return INPUT_VALUE;
+}
+
+input_status_et parse_input_word(const char *word, size_t length, int *value) {
+    // a word is parsed the same way as read_text_value, which can't use this as its words can span chunks
+    size_t at = 0;
+    int negative = length > 0 && word[0] == '-';
+    if (length > 0 && (word[0] == '-' || word[0] == '+')) {
+        at++;
+    }
+
+    unsigned long long limit = negative ? (unsigned long long) INT_MAX + 1 : (unsigned long long) INT_MAX;
+    unsigned long long magnitude = 0;
+    int out_of_range = 0;
+
+    if (at == length) {
+        return INPUT_NOT_A_NUMBER;
+    }
+
+    for (; at < length; at++) {
+        if (word[at] < '0' || word[at] > '9') {
+            return INPUT_NOT_A_NUMBER;
+        }
+
+        magnitude = magnitude * 10 + (unsigned long long) (word[at] - '0');
+
+        if (magnitude > limit) {
+            out_of_range = 1;
+            magnitude = limit + 1;
+        }
+    }
+
+    if (out_of_range) {
+        return INPUT_OUT_OF_RANGE;
+    }
+
+    *value = negative ? (int) (0U - (unsigned int) magnitude) : (int) magnitude;
+    return INPUT_VALUE;
+}
+
+input_status_et read_input_value(input_source_st *source, int *value) {
+    unsigned long long start = input_source_position(source);
+
+    int read;
+    input_status_et status = source->raw ? read_raw_value(source, &read) : read_text_value(source, &read);
+
+    // whatever of the value came before giving up is read again by the run carrying on from here
+    if (source->interrupted) {
+        source->unread = input_source_position(source) - start;
+        return INPUT_INTERRUPTED;
+    }
+
+    if (status == INPUT_VALUE) {
+        *value = read;
+    }
+
+    return status;
+}
+
+int skip_input_source(input_source_st *source, unsigned long long count) {
+    while (count > 0) {
+        if (source->used == source->size && !refill(source)) {
+            return 0;
+        }
+
+        size_t available = source->size - source->used;
+        size_t skipped = count < available ? (size_t) count : available;
+
+        source->used += skipped;
+        count -= skipped;
+    }
+
+    return 1;
+}
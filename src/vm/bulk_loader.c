@@ -0,0 +1,529 @@
+#include "vm/bulk_loader.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// loading happens on posix threads, which wait_for_program blocks on
+#if defined(__unix__) || defined(__APPLE__)
+#define BULK_THREADS_SUPPORTED 1
+#include <pthread.h>
+#else
+#define BULK_THREADS_SUPPORTED 0
+#endif
+
+// io_uring is used through its system calls, so it only needs the kernel headers, not liburing
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if BULK_THREADS_SUPPORTED && defined(__linux__) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define IO_URING_SUPPORTED 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#else
+#define IO_URING_SUPPORTED 0
+#endif
+
+
+void report_load_error(FILE *errors, const char *path, load_status_et status, size_t cell_count) {
+    switch (status) {
+        case LOAD_SUCCESS:
+            break;
+        case LOAD_IS_DIRECTORY:
+            fprintf(errors, "Error: Input file '%s' is a directory\n", path);
+            break;
+        case LOAD_CANT_OPEN:
+            fprintf(errors, "Error: Input file '%s' does not exist or cannot be opened\n", path);
+            break;
+        case LOAD_INVALID:
+            fprintf(errors, "Error: Failed to read input file '%s'\n", path);
+            break;
+        case LOAD_UNSUPPORTED_EXT:
+            fprintf(errors, "Error: Input file '%s' is of a newer lmvm-ext version than this VM supports\n", path);
+            break;
+        case LOAD_TOO_LARGE:
+            fprintf(errors, "Error: Input file '%s' is too large to fit in memory (expected %u values but got %zu)\n", path, EXECUTABLE_SIZE, cell_count);
+            break;
+    }
+}
+
+static void load_one(program_load_st *program) {
+    unsigned short int ext_version;
+    program->status = load_lmcx_image(program->path, program->image, EXECUTABLE_SIZE, &program->cell_count, &ext_version);
+}
+
+#if BULK_THREADS_SUPPORTED
+
+/**
+ * Represents the thread loading the programs, and the threads waiting for them.
+ * @see bulk_loader_st
+ */
+struct bulk_loader_s {
+    bulk_load_st *load;
+    pthread_t thread;
+    int started;
+
+    // only taken by programs that have to wait, and by the loader when one is
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    int waiting;
+
+    size_t next;  // the next program for a loading thread to take, without io_uring
+};
+
+/**
+ * Represents the thread loading the programs, and the threads waiting for them.
+ * @see bulk_loader_s
+ */
+typedef struct bulk_loader_s bulk_loader_st;
+
+static void finish_program(bulk_loader_st *loader, program_load_st *program) {
+    __atomic_store_n(&program->done, 1, __ATOMIC_SEQ_CST);
+
+    // a waiter counts itself before it checks done, so either it sees done or this sees it
+    if (__atomic_load_n(&loader->waiting, __ATOMIC_SEQ_CST) != 0) {
+        pthread_mutex_lock(&loader->lock);
+        pthread_cond_broadcast(&loader->loaded);
+        pthread_mutex_unlock(&loader->lock);
+    }
+}
+
+#if IO_URING_SUPPORTED
+
+// two operations are in flight for each file at most, the open or read and then its close
+#define BULK_RING_ENTRIES (2 * BULK_LOAD_QUEUE_DEPTH)
+
+// the completion of a close, which nothing waits for
+#define CLOSE_USER_DATA ((__u64) -1)
+
+/**
+ * Represents a file being loaded through the ring, opened and then read into a buffer a byte longer than any
+ * executable that fits, so one that doesn't fit can be told apart.
+ * @see ring_slot_st
+ */
+struct ring_slot_s {
+    program_load_st *program;
+    int fd;  // -1 while the file is being opened
+    unsigned char data[EXECUTABLE_MAX_FILE_SIZE + 1];
+};
+
+/**
+ * Represents a file being loaded through the ring.
+ * @see ring_slot_s
+ */
+typedef struct ring_slot_s ring_slot_st;
+
+/**
+ * Represents an io_uring, with its submission and completion queues mapped.
+ * @see ring_st
+ */
+struct ring_s {
+    int fd;
+
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned pending;  // queued since the last io_uring_enter
+};
+
+/**
+ * Represents an io_uring.
+ * @see ring_s
+ */
+typedef struct ring_s ring_st;
+
+static void close_ring(ring_st *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+    if (ring->sq_map != NULL) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+
+    close(ring->fd);
+}
+
+// returns 0 if the ring is set up, or 1 if io_uring isn't there, isn't allowed or is too old to open files
+static int open_ring(ring_st *ring) {
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = (int) syscall(__NR_io_uring_setup, BULK_RING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        return 1;
+    }
+
+    // opening and closing through the ring came in the same kernel as this feature, so it stands in for them
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return 1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // both queues share one mapping where the kernel allows it
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+        ring->cq_map_size = ring->sq_map_size;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring->sq_map = NULL;
+        close_ring(ring);
+        return 1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    } else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            ring->cq_map = NULL;
+            close_ring(ring);
+            return 1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        close_ring(ring);
+        return 1;
+    }
+
+    unsigned char *sq = ring->sq_map;
+    unsigned char *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+// the caller never has more in flight than the queue holds, so there is always room
+static struct io_uring_sqe *queue_sqe(ring_st *ring, __u8 opcode, int fd, __u64 user_data) {
+    unsigned tail = *ring->sq_tail + ring->pending;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    ring->pending++;
+
+    return sqe;
+}
+
+// submits everything queued, then waits for at least one completion
+static int enter_ring(ring_st *ring) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->pending, __ATOMIC_RELEASE);
+
+    unsigned submitting = ring->pending;
+    ring->pending = 0;
+
+    while (syscall(__NR_io_uring_enter, ring->fd, submitting, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+
+        // whatever was submitted before the interruption stays submitted
+        submitting = 0;
+    }
+
+    return 0;
+}
+
+static void queue_open(ring_st *ring, ring_slot_st *slots, size_t slot) {
+    struct io_uring_sqe *sqe = queue_sqe(ring, IORING_OP_OPENAT, AT_FDCWD, slot);
+    sqe->addr = (__u64) (size_t) slots[slot].program->path;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    slots[slot].fd = -1;
+}
+
+// works out how a file that was read went, loading the cells if it's an executable
+static void finish_read(ring_slot_st *slot, int result) {
+    program_load_st *program = slot->program;
+    unsigned short int ext_version;
+
+    if (result == -EISDIR) {
+        program->status = LOAD_IS_DIRECTORY;
+    } else if (result < 0) {
+        program->status = LOAD_CANT_OPEN;
+    } else if ((size_t) result > EXECUTABLE_MAX_FILE_SIZE) {
+        // too large to have been read whole, so it's loaded again just to report how large
+        load_one(program);
+    } else {
+        program->status = parse_lmcx_image(slot->data, (size_t) result, program->image, EXECUTABLE_SIZE, &program->cell_count, &ext_version);
+    }
+}
+
+// returns 0 if every program was loaded, or 1 if the ring failed, leaving the ones it didn't finish to the caller
+static int load_through_ring(bulk_loader_st *loader, ring_st *ring) {
+    bulk_load_st *load = loader->load;
+
+    ring_slot_st *slots = checked_malloc(sizeof(ring_slot_st) * BULK_LOAD_QUEUE_DEPTH);
+    size_t free_slots[BULK_LOAD_QUEUE_DEPTH];
+    size_t free_count = BULK_LOAD_QUEUE_DEPTH;
+    for (size_t slot = 0; slot < BULK_LOAD_QUEUE_DEPTH; slot++) {
+        free_slots[slot] = BULK_LOAD_QUEUE_DEPTH - 1 - slot;
+    }
+
+    size_t next = 0;
+    size_t in_flight = 0;
+    int failed = 0;
+
+    while (!failed && (next < load->program_count || in_flight > 0)) {
+        // every free slot opens the next program, so they are started in order
+        while (free_count > 0 && next < load->program_count) {
+            size_t slot = free_slots[--free_count];
+            slots[slot].program = &load->programs[next++];
+            queue_open(ring, slots, slot);
+            in_flight++;
+        }
+
+        if (enter_ring(ring) != 0) {
+            failed = 1;
+            break;
+        }
+
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            __u64 user_data = cqe->user_data;
+            int result = cqe->res;
+            head++;
+
+            in_flight--;
+            if (user_data == CLOSE_USER_DATA) {
+                continue;
+            }
+
+            ring_slot_st *slot = &slots[user_data];
+
+            if (slot->fd == -1 && result >= 0) {
+                // opened, so read as much as any executable that fits could be, and a byte more
+                slot->fd = result;
+
+                struct io_uring_sqe *sqe = queue_sqe(ring, IORING_OP_READ, slot->fd, user_data);
+                sqe->addr = (__u64) (size_t) slot->data;
+                sqe->len = sizeof(slot->data);
+                sqe->off = 0;
+                in_flight++;
+                continue;
+            }
+
+            if (slot->fd == -1) {
+                slot->program->status = LOAD_CANT_OPEN;
+            } else {
+                finish_read(slot, result);
+
+                queue_sqe(ring, IORING_OP_CLOSE, slot->fd, CLOSE_USER_DATA);
+                in_flight++;
+            }
+
+            finish_program(loader, slot->program);
+            free_slots[free_count++] = (size_t) user_data;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // anything still in flight is finished with blocking calls, as the ring can't be trusted to finish it, though the
+    // kernel may still be reading into the slots, so they are left allocated
+    if (failed) {
+        int busy[BULK_LOAD_QUEUE_DEPTH] = {0};
+        for (size_t index = 0; index < free_count; index++) {
+            busy[free_slots[index]] = -1;
+        }
+
+        for (size_t slot = 0; slot < BULK_LOAD_QUEUE_DEPTH; slot++) {
+            if (busy[slot] == 0) {
+                load_one(slots[slot].program);
+                finish_program(loader, slots[slot].program);
+            }
+        }
+
+        loader->next = next;
+        return 1;
+    }
+
+    checked_free(slots);
+    return 0;
+}
+
+#endif
+
+// each loading thread takes the next program in order, so the first programs are ready first
+static void *run_loading_thread(void *arg) {
+    bulk_loader_st *loader = arg;
+    bulk_load_st *load = loader->load;
+
+    while (1) {
+        size_t program = __atomic_fetch_add(&loader->next, 1, __ATOMIC_RELAXED);
+
+        if (program >= load->program_count) {
+            return NULL;
+        }
+
+        load_one(&load->programs[program]);
+        finish_program(loader, &load->programs[program]);
+    }
+}
+
+static void *run_loader(void *arg) {
+    bulk_loader_st *loader = arg;
+
+#if IO_URING_SUPPORTED
+    ring_st ring;
+    if (open_ring(&ring) == 0) {
+        int failed = load_through_ring(loader, &ring);
+        close_ring(&ring);
+
+        if (!failed) {
+            loader->load->used_io_uring = 1;
+            return NULL;
+        }
+    }
+#endif
+
+    // the blocking calls of each thread overlap the others', keeping as many files in flight as the ring would
+    pthread_t threads[BULK_LOAD_QUEUE_DEPTH - 1];
+    int started[BULK_LOAD_QUEUE_DEPTH - 1];
+
+    size_t remaining = loader->load->program_count - loader->next;
+    size_t thread_count = remaining < BULK_LOAD_QUEUE_DEPTH ? remaining : BULK_LOAD_QUEUE_DEPTH;
+
+    for (size_t index = 0; index + 1 < thread_count; index++) {
+        started[index] = pthread_create(&threads[index], NULL, run_loading_thread, loader) == 0;
+    }
+
+    // this thread is one of them, so the programs are still loaded if no others could be started
+    run_loading_thread(loader);
+
+    for (size_t index = 0; index + 1 < thread_count; index++) {
+        if (started[index]) {
+            pthread_join(threads[index], NULL);
+        }
+    }
+
+    return NULL;
+}
+
+void start_bulk_load(bulk_load_st *load, program_load_st *programs, size_t program_count) {
+    load->programs = programs;
+    load->program_count = program_count;
+    load->used_io_uring = 0;
+
+    for (size_t program = 0; program < program_count; program++) {
+        programs[program].done = 0;
+        programs[program].cell_count = 0;
+    }
+
+    bulk_loader_st *loader = checked_malloc(sizeof(bulk_loader_st));
+    loader->load = load;
+    loader->waiting = 0;
+    loader->next = 0;
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->loaded, NULL);
+    load->loader = loader;
+
+    loader->started = pthread_create(&loader->thread, NULL, run_loader, loader) == 0;
+
+    // without a thread to do it in the background, the programs are loaded now
+    if (!loader->started) {
+        run_loader(loader);
+    }
+}
+
+const program_load_st *wait_for_program(bulk_load_st *load, size_t program) {
+    program_load_st *loaded = &load->programs[program];
+
+    if (__atomic_load_n(&loaded->done, __ATOMIC_SEQ_CST)) {
+        return loaded;
+    }
+
+    bulk_loader_st *loader = load->loader;
+
+    pthread_mutex_lock(&loader->lock);
+    __atomic_fetch_add(&loader->waiting, 1, __ATOMIC_SEQ_CST);
+
+    while (!__atomic_load_n(&loaded->done, __ATOMIC_SEQ_CST)) {
+        pthread_cond_wait(&loader->loaded, &loader->lock);
+    }
+
+    __atomic_fetch_sub(&loader->waiting, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&loader->lock);
+
+    return loaded;
+}
+
+void finish_bulk_load(bulk_load_st *load) {
+    bulk_loader_st *loader = load->loader;
+
+    if (loader->started) {
+        pthread_join(loader->thread, NULL);
+    }
+
+    pthread_cond_destroy(&loader->loaded);
+    pthread_mutex_destroy(&loader->lock);
+    checked_free(loader);
+    load->loader = NULL;
+}
+
+#else
+
+void start_bulk_load(bulk_load_st *load, program_load_st *programs, size_t program_count) {
+    load->programs = programs;
+    load->program_count = program_count;
+    load->used_io_uring = 0;
+    load->loader = NULL;
+
+    // without threads, there is nothing to overlap the loading with, so it is all done up front
+    for (size_t program = 0; program < program_count; program++) {
+        load_one(&programs[program]);
+        programs[program].done = 1;
+    }
+}
+
+const program_load_st *wait_for_program(bulk_load_st *load, size_t program) {
+    return &load->programs[program];
+}
+
+void finish_bulk_load(bulk_load_st *load) {
+    (void) load;
+}
+
+#endif
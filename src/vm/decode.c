@@ -0,0 +1,126 @@
+#include "vm/decode.h"
+#include "common/opcodes.h"
+
+static const decoded_handler_et OPCODE_HANDLERS[10] = {
+        HANDLER_HLT,
+        HANDLER_ADD,
+        HANDLER_SUB,
+        HANDLER_STA,
+        HANDLER_INVALID, // 4xx is unused
+        HANDLER_LDA,
+        HANDLER_BRA,
+        HANDLER_BRZ,
+        HANDLER_BRP,
+        HANDLER_INVALID  // 9xx is decided by the full value
+};
+
+static const lmc_opcode_et HANDLER_OPCODES[HANDLER_COUNT] = {
+        OP_LMC_HLT,
+        OP_LMC_ADD,
+        OP_LMC_SUB,
+        OP_LMC_STA,
+        OP_LMC_LDA,
+        OP_LMC_BRA,
+        OP_LMC_BRZ,
+        OP_LMC_BRP,
+        OP_LMC_IO_OP_INP,
+        OP_LMC_IO_OP_OUT
+        // the remaining handlers have no opcode
+};
+
+
+decoded_instruction_st decode_instruction(unsigned short int cir) {
+    decoded_instruction_st instruction;
+
+    // opcode is first digit, operand is last two digits
+    unsigned short int opcode = cir / 100;
+
+    instruction.cir = cir;
+    instruction.operand = (unsigned char) (cir % 100);
+    instruction.operand2 = 0;
+    instruction.operand3 = 0;
+
+    if (opcode == OP_LMC_IO_OP) {
+        // IO operations are identified by the full value (INP: 901, OUT: 902)
+        if (cir == OP_LMC_IO_OP_INP) {
+            instruction.handler = HANDLER_INP;
+        } else if (cir == OP_LMC_IO_OP_OUT) {
+            instruction.handler = HANDLER_OUT;
+        } else {
+            instruction.handler = HANDLER_INVALID;
+        }
+    } else if (opcode < 10) {
+        instruction.handler = OPCODE_HANDLERS[opcode];
+    } else {
+        // cells can hold values larger than any opcode if the file wasn't made by the assembler
+        instruction.handler = HANDLER_INVALID;
+    }
+
+    return instruction;
+}
+
+// combines the instruction at the address with the ones following it if they form a common idiom
+static decoded_instruction_st fuse_instruction(const unsigned short int *memory, unsigned short int address) {
+    decoded_instruction_st first = decode_instruction(memory[address]);
+
+    // the group must fit in memory
+    if (address + 1 >= EXECUTABLE_SIZE) {
+        return first;
+    }
+
+    decoded_instruction_st second = decode_instruction(memory[address + 1]);
+
+    // LDA x / ADD y / STA z and LDA x / SUB y / STA z
+    if (first.handler == HANDLER_LDA && (second.handler == HANDLER_ADD || second.handler == HANDLER_SUB) && address + 2 < EXECUTABLE_SIZE) {
+        decoded_instruction_st third = decode_instruction(memory[address + 2]);
+
+        if (third.handler == HANDLER_STA) {
+            first.handler = second.handler == HANDLER_ADD ? HANDLER_LDA_ADD_STA : HANDLER_LDA_SUB_STA;
+            first.operand2 = second.operand;
+            first.operand3 = third.operand;
+            return first;
+        }
+    }
+
+    // SUB k / BRZ L
+    if (first.handler == HANDLER_SUB && second.handler == HANDLER_BRZ) {
+        first.handler = HANDLER_SUB_BRZ;
+        first.operand2 = second.operand;
+        return first;
+    }
+
+    // LDA x / OUT
+    if (first.handler == HANDLER_LDA && second.handler == HANDLER_OUT) {
+        first.handler = HANDLER_LDA_OUT;
+        return first;
+    }
+
+    return first;
+}
+
+void decode_image(instruction_cache_st *cache, const unsigned short int *memory, int fuse) {
+    cache->fuse = fuse;
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        cache->ops[address] = fuse ? fuse_instruction(memory, address) : decode_instruction(memory[address]);
+    }
+
+    // falling off the end of memory lands here
+    cache->ops[EXECUTABLE_SIZE] = decode_instruction(0);
+    cache->ops[EXECUTABLE_SIZE].handler = HANDLER_PC_OUT_OF_RANGE;
+}
+
+decoded_instruction_st redecode_cell(instruction_cache_st *cache, const unsigned short int *memory, unsigned short int address) {
+    cache->ops[address] = cache->fuse ? fuse_instruction(memory, address) : decode_instruction(memory[address]);
+
+    return cache->ops[address];
+}
+
+lmc_opcode_et decoded_opcode(decoded_instruction_st instruction) {
+    // a superinstruction starts with the instruction in its own cell, so this also gives the first opcode of a group
+    if (instruction.handler > HANDLER_OUT) {
+        return (lmc_opcode_et) (instruction.cir / 100);
+    }
+
+    return HANDLER_OPCODES[instruction.handler];
+}
@@ -1,4 +1,6 @@
 #include "vm/execution.h"
+#include "vm/pipeline.h"
+#include "vm/operations.h"
 #include "common/opcodes.h"
 
 #include <stdio.h>
@@ -7,41 +9,60 @@
 #include <errno.h>
 
 
+void init_execution_io(execution_io_st *io, FILE *input, FILE *output, FILE *errors) {
+    io->input = input;
+    io->output = output;
+    io->errors = errors;
+    io->accept_digits = -1;
+    io->recorder = NULL;
+    io->trace = NULL;
+    io->buffer = NULL;
+    io->source = NULL;
+    io->in_ring = NULL;
+    io->out_ring = NULL;
+    io->output_count = 0;
+    io->snapshots = NULL;
+    io->limits = NULL;
+}
+
+
+// reports an error in the same words liblmvm describes it with
+static void report_fault(execution_io_st *io, lmc_fault_et fault, int acc, unsigned short int mdr, unsigned short int cir, unsigned int pc) {
+    char message[128];
+    describe_fault(message, sizeof(message), fault, acc, mdr, cir, pc);
+    fprintf(io->errors, "Error: %s\n", message);
+}
+
+
 static void op_add(
         unsigned short int mdr,
         int *reg_ACC,
-        execution_result_et *result
+        execution_result_et *result,
+        execution_io_st *io
 ) {
     // check value will stay within range of int
-    if (*reg_ACC + mdr > INT_MAX) {
-        fprintf(stderr, "Error: Accumulator overflow: %u + %u > %u\n", *reg_ACC, mdr, INT_MAX);
+    if (add_to_acc(reg_ACC, mdr) != FAULT_NONE) {
+        report_fault(io, FAULT_OVERFLOW, *reg_ACC, mdr, 0, 0);
         *result = EXECUTION_ERROR;
         return;
     }
 
-    // doesn't need to stay within 0-999, this will be checked when STA is executed
-
-    *reg_ACC += mdr;
-
     *result = EXECUTION_SUCCESS_ACC_CHANGED;
 }
 
 static void op_sub(
         unsigned short int mdr,
         int *reg_ACC,
-        execution_result_et *result
+        execution_result_et *result,
+        execution_io_st *io
 ) {
     // check value will stay within range of int
-    if (*reg_ACC - mdr < INT_MIN) {
-        fprintf(stderr, "Error: Accumulator underflow: %u - %u < %u\n", *reg_ACC, mdr, INT_MIN);
+    if (subtract_from_acc(reg_ACC, mdr) != FAULT_NONE) {
+        report_fault(io, FAULT_UNDERFLOW, *reg_ACC, mdr, 0, 0);
         *result = EXECUTION_ERROR;
         return;
     }
 
-    // doesn't need to stay within 0-999, this will be checked when STA is executed
-
-    *reg_ACC -= mdr;
-
     *result = EXECUTION_SUCCESS_ACC_CHANGED;
 }
 
@@ -50,16 +71,21 @@ static void op_sta(
         const unsigned short int *reg_MAR,
         const int *reg_ACC,
         execution_result_et *result,
-        unsigned short int *memory
+        unsigned short int *memory,
+        instruction_cache_st *cache,
+        execution_io_st *io
 ) {
     // check value is within range of memory
-    if (*reg_ACC < 0 || *reg_ACC > 999) {
-        fprintf(stderr, "Error: Accumulator value out of memory range: %d\n", *reg_ACC);
+    if (store_acc(*reg_ACC, &memory[*reg_MAR]) != FAULT_NONE) {
+        report_fault(io, FAULT_OUT_OF_MEMORY_RANGE, *reg_ACC, 0, 0, 0);
         *result = EXECUTION_ERROR;
         return;
     }
 
-    memory[*reg_MAR] = *reg_ACC;
+    // the cell may hold code, so make sure it's decoded again before it's next run
+    if (cache != NULL) {
+        invalidate_cell(cache, *reg_MAR);
+    }
 
     *result = EXECUTION_SUCCESS_ACC_UNCHANGED;
 }
@@ -113,18 +139,60 @@ static void op_brp(
 }
 
 
+// reads from the input source, skipping anything that isn't a valid value
+static void op_inp_source(
+        int *reg_ACC,
+        execution_result_et *result,
+        execution_io_st *io
+) {
+    while (1) {
+        switch (read_input_value(io->source, reg_ACC)) {
+            case INPUT_VALUE:
+                *result = EXECUTION_SUCCESS_ACC_CHANGED;
+                return;
+            case INPUT_NOT_A_NUMBER:
+                fputs("Invalid input: not a number\n", io->errors);
+                break;
+            case INPUT_OUT_OF_RANGE:
+                fputs("Invalid input: out of range\n", io->errors);
+                break;
+            case INPUT_END:
+                report_fault(io, FAULT_OUT_OF_INPUT, *reg_ACC, 0, 0, 0);
+                *result = EXECUTION_ERROR;
+                return;
+            case INPUT_INTERRUPTED:
+                *result = EXECUTION_INTERRUPTED;
+                return;
+        }
+    }
+}
+
 static void op_inp(
         int *reg_ACC,
-        execution_result_et *result
+        execution_result_et *result,
+        execution_io_st *io
 ) {
     // TODO: this op will accept the range of ACC, but this wont be guaranteed to be within 0-999
     // should we limit either this op or the range of ACC to 0-999, or just leave it?
     // for now, we'll just leave it
 
-    // get number of digits to accept
-    static int accept_digits = -1;
+    if (io->in_ring != NULL) {
+        if (pop_ring_value(io->in_ring, reg_ACC)) {
+            *result = EXECUTION_SUCCESS_ACC_CHANGED;
+        } else {
+            report_fault(io, FAULT_OUT_OF_INPUT, *reg_ACC, 0, 0, 0);
+            *result = EXECUTION_ERROR;
+        }
+        return;
+    }
+
+    if (io->source != NULL) {
+        op_inp_source(reg_ACC, result, io);
+        return;
+    }
 
-    if (accept_digits == -1) {
+    // get number of digits to accept, once per instance
+    if (io->accept_digits == -1) {
         int max_digits = 0;
         int min_digits = 0;
 
@@ -143,22 +211,33 @@ static void op_inp(
 
         // accept the number of digits that is larger
         if (min_digits > max_digits) {
-            accept_digits = min_digits;
+            io->accept_digits = min_digits;
         } else {
-            accept_digits = max_digits;
+            io->accept_digits = max_digits;
         }
     }
 
+    int accept_digits = io->accept_digits;
+
     // read user input up to the number of digits
     int input;
     while (1) {
         char in_buf[accept_digits + 1];
 
-        if (fgets(in_buf, accept_digits + 1, stdin) == NULL && errno != 0) {
-            fprintf(stderr, "Invalid input: failed to read\n");
-            fprintf(stderr, "Errno: %d\n", errno);
+        if (fgets(in_buf, accept_digits + 1, io->input) == NULL) {
+            // input from a file can run out, which would otherwise ask for more forever
+            if (feof(io->input)) {
+                report_fault(io, FAULT_OUT_OF_INPUT, *reg_ACC, 0, 0, 0);
+                *result = EXECUTION_ERROR;
+                return;
+            }
 
-            continue;
+            if (errno != 0) {
+                fprintf(io->errors, "Invalid input: failed to read\n");
+                fprintf(io->errors, "Errno: %d\n", errno);
+
+                continue;
+            }
         }
 
         // TODO: check for truncation (ISSUE #5)
@@ -168,7 +247,7 @@ static void op_inp(
         input = strtol(in_buf, &end_ptr, 10);
 
         if (end_ptr == in_buf) {
-            puts("Invalid input: not a number\n");
+            fputs("Invalid input: not a number\n\n", io->output);
             continue;
         }
 
@@ -187,10 +266,22 @@ static void op_inp(
 
 static void op_out(
         const int *reg_ACC,
-        execution_result_et *result
+        execution_result_et *result,
+        execution_io_st *io
 ) {
-    printf("%d\n", *reg_ACC);
+    if (io->out_ring != NULL) {
+        // the next stage of the pipeline has stopped, so stop quietly the way a closed pipe would stop a process
+        if (!push_ring_value(io->out_ring, *reg_ACC)) {
+            *result = EXECUTION_HALT;
+            return;
+        }
+    } else if (io->buffer != NULL) {
+        write_output_value(io->buffer, *reg_ACC);
+    } else {
+        fprintf(io->output, "%d\n", *reg_ACC);
+    }
 
+    io->output_count++;
     *result = EXECUTION_SUCCESS_ACC_UNCHANGED;
 }
 
@@ -202,20 +293,22 @@ execution_result_et execute(
         unsigned short int *reg_MAR,
         int *reg_ACC,
         unsigned short int *reg_PC,
-        unsigned short int *memory
+        unsigned short int *memory,
+        instruction_cache_st *cache,
+        execution_io_st *io
 ) {
     unsigned short int mdr = memory[*reg_MAR]; // memory data register
     execution_result_et result = EXECUTION_INDETERMINATE;
 
     switch (opcode) {
         case OP_LMC_ADD:
-            op_add(mdr, reg_ACC, &result);
+            op_add(mdr, reg_ACC, &result, io);
             break;
         case OP_LMC_SUB:
-            op_sub(mdr, reg_ACC, &result);
+            op_sub(mdr, reg_ACC, &result, io);
             break;
         case OP_LMC_STA:
-            op_sta(reg_MAR, reg_ACC, &result, memory);
+            op_sta(reg_MAR, reg_ACC, &result, memory, cache, io);
             break;
         case OP_LMC_LDA:
             op_lda(reg_MAR, reg_ACC, &result, memory);
@@ -230,19 +323,64 @@ execution_result_et execute(
             op_brp(reg_MAR, reg_ACC, reg_PC, &result);
             break;
         case OP_LMC_IO_OP_INP:
-            op_inp(reg_ACC, &result);
+            op_inp(reg_ACC, &result, io);
             break;
         case OP_LMC_IO_OP_OUT:
-            op_out(reg_ACC, &result);
+            op_out(reg_ACC, &result, io);
             break;
         case OP_LMC_HLT:
             result = EXECUTION_HALT;
             break;
         default:
-            fprintf(stderr, "Error: Invalid opcode: %d\n", opcode);
+            report_fault(io, FAULT_INVALID_OPCODE, *reg_ACC, 0, (unsigned short int) (opcode * 100), *reg_PC);
             result = EXECUTION_ERROR;
             break;
     }
 
     return result;
 }
+
+execution_result_et execute_decoded(
+        decoded_instruction_st instruction,
+        int *reg_ACC,
+        unsigned short int *reg_PC,
+        unsigned short int *memory,
+        instruction_cache_st *cache,
+        execution_io_st *io
+) {
+    if (instruction.handler == HANDLER_PC_OUT_OF_RANGE) {
+        report_fault(io, FAULT_PC_OUT_OF_RANGE, *reg_ACC, 0, 0, *reg_PC);
+        return EXECUTION_ERROR;
+    }
+
+    lmc_opcode_et opcode = decoded_opcode(instruction);
+    unsigned short int reg_MAR = instruction.operand; // memory address register
+
+    // if opcode is IO_OP, it must have been a full valid operation (INP: 901, OUT: 902)
+    if (instruction.handler == HANDLER_INVALID && opcode == OP_LMC_IO_OP) {
+        report_fault(io, invalid_instruction_fault(instruction.cir), *reg_ACC, 0, instruction.cir, *reg_PC);
+        return EXECUTION_ERROR;
+    }
+
+    execution_result_et result = execute(opcode, &reg_MAR, reg_ACC, reg_PC, memory, cache, io);
+
+    // execute should never return EXECUTION_INDETERMINATE
+    if (result == EXECUTION_INDETERMINATE) {
+        fputs("Internal Error: Execution returned indeterminate result\n", io->errors);
+        result = EXECUTION_ERROR;
+    }
+
+    return result;
+}
+
+execution_result_et execute_io(lmc_opcode_et opcode, int *reg_ACC, execution_io_st *io) {
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    if (opcode == OP_LMC_IO_OP_INP) {
+        op_inp(reg_ACC, &result, io);
+    } else {
+        op_out(reg_ACC, &result, io);
+    }
+
+    return result;
+}
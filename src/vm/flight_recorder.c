@@ -0,0 +1,190 @@
+#include "vm/flight_recorder.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+
+// signal handlers write straight to the file descriptor, since stdio isn't safe to use from them
+#if defined(__unix__) || defined(__APPLE__)
+#define SIGNAL_SAFE_WRITE 1
+#include <unistd.h>
+#else
+#define SIGNAL_SAFE_WRITE 0
+#endif
+
+// must be in the same order as decoded_handler_e, up to HANDLER_INVALID
+static const char *const MNEMONICS[] = {"HLT", "ADD", "SUB", "STA", "LDA", "BRA", "BRZ", "BRP", "INP", "OUT", "???"};
+
+// must be in the same order as execution_result_e
+static const char *const RESULT_NAMES[] = {"indeterminate", "error", "ACC changed", "ACC unchanged", "branched", "halt", "interrupted"};
+
+// long enough for the longest line format_record can write
+#define LINE_SIZE 128
+
+static flight_recorder_st *volatile watched_recorder = NULL;
+
+
+static char *append_text(char *at, const char *text) {
+    while (*text != '\0') {
+        *at++ = *text++;
+    }
+
+    return at;
+}
+
+static char *append_number(char *at, long long number) {
+    char digits[24];
+    int length = 0;
+
+    unsigned long long magnitude = number < 0 ? 0ULL - (unsigned long long) number : (unsigned long long) number;
+
+    do {
+        digits[length++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (number < 0) {
+        *at++ = '-';
+    }
+
+    while (length > 0) {
+        *at++ = digits[--length];
+    }
+
+    return at;
+}
+
+// formats without stdio, so it can be used from a signal handler, returning the length of the line
+static size_t format_record(char line[LINE_SIZE], const flight_record_st *record) {
+    char *at = line;
+
+    // a skipped loop keeps the address of its branch back where an instruction would be
+    if (record->result == FLIGHT_RESULT_SKIPPED) {
+        at = append_text(at, "  PC = ");
+        at = append_number(at, record->pc);
+        at = append_text(at, " to ");
+        at = append_number(at, record->cir);
+        at = append_text(at, " (counting loop) ACC = ");
+        at = append_number(at, record->acc);
+        at = append_text(at, " Result = skipped\n");
+
+        return (size_t) (at - line);
+    }
+
+    decoded_instruction_st instruction = decode_instruction(record->cir);
+    unsigned char handler = instruction.handler <= HANDLER_INVALID ? instruction.handler : HANDLER_INVALID;
+
+    at = append_text(at, "  PC = ");
+    at = append_number(at, record->pc);
+    at = append_text(at, " CIR = ");
+    at = append_number(at, record->cir);
+    at = append_text(at, " (");
+    at = append_text(at, MNEMONICS[handler]);
+
+    if (handler != HANDLER_HLT && handler != HANDLER_INP && handler != HANDLER_OUT && handler != HANDLER_INVALID) {
+        at = append_text(at, " ");
+        at = append_number(at, instruction.operand);
+    }
+
+    at = append_text(at, ") ACC = ");
+    at = append_number(at, record->acc);
+    at = append_text(at, " Result = ");
+    at = append_text(at, record->result <= EXECUTION_INTERRUPTED ? RESULT_NAMES[record->result] : "unknown");
+    at = append_text(at, "\n");
+
+    return (size_t) (at - line);
+}
+
+static size_t format_header(char line[LINE_SIZE], unsigned long long count) {
+    char *at = line;
+    at = append_text(at, "Flight recorder, last ");
+    at = append_number(at, (long long) (count < FLIGHT_RECORDER_SIZE ? count : FLIGHT_RECORDER_SIZE));
+    at = append_text(at, " of ");
+    at = append_number(at, (long long) count);
+    at = append_text(at, " records:\n");
+
+    return (size_t) (at - line);
+}
+
+void dump_flight_recorder(const flight_recorder_st *recorder, FILE *stream) {
+    char line[LINE_SIZE];
+    unsigned long long count = recorder->count;
+
+    fwrite(line, 1, format_header(line, count), stream);
+
+    unsigned long long first = count < FLIGHT_RECORDER_SIZE ? 0 : count - FLIGHT_RECORDER_SIZE;
+    for (unsigned long long index = first; index < count; index++) {
+        fwrite(line, 1, format_record(line, &recorder->records[index & (FLIGHT_RECORDER_SIZE - 1)]), stream);
+    }
+}
+
+
+static void write_signal_safe(const char *data, size_t size) {
+#if SIGNAL_SAFE_WRITE
+    while (size > 0) {
+        ssize_t written = write(STDERR_FILENO, data, size);
+
+        if (written <= 0) {
+            return;
+        }
+
+        data += written;
+        size -= (size_t) written;
+    }
+#else
+    fwrite(data, 1, size, stderr);
+#endif
+}
+
+static void dump_watched_recorder(void) {
+    const flight_recorder_st *recorder = watched_recorder;
+
+    if (recorder == NULL) {
+        return;
+    }
+
+    char line[LINE_SIZE];
+
+    unsigned long long count = recorder->count;
+
+    write_signal_safe(line, format_header(line, count));
+
+    // the VM may still be running if the signal went to another thread, so the oldest records may be overwritten as they're read
+    unsigned long long first = count < FLIGHT_RECORDER_SIZE ? 0 : count - FLIGHT_RECORDER_SIZE;
+    for (unsigned long long index = first; index < count; index++) {
+        write_signal_safe(line, format_record(line, &recorder->records[index & (FLIGHT_RECORDER_SIZE - 1)]));
+    }
+}
+
+static void handle_fatal_signal(int sig) {
+    dump_watched_recorder();
+
+    // carry on dying the way the signal would have without us
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+#ifdef SIGUSR1
+static void handle_dump_signal(int sig) {
+    (void) sig;
+    dump_watched_recorder();
+}
+#endif
+
+void watch_flight_recorder(flight_recorder_st *recorder) {
+    watched_recorder = recorder;
+
+    void (*fatal_handler)(int) = recorder != NULL ? handle_fatal_signal : SIG_DFL;
+
+    signal(SIGINT, fatal_handler);
+    signal(SIGTERM, fatal_handler);
+    signal(SIGSEGV, fatal_handler);
+    signal(SIGABRT, fatal_handler);
+    signal(SIGFPE, fatal_handler);
+
+#ifdef SIGUSR1
+    signal(SIGUSR1, recorder != NULL ? handle_dump_signal : SIG_DFL);
+#endif
+}
@@ -0,0 +1,428 @@
+#include "vm/host.h"
+#include "vm/server.h"
+#include "vm/batch.h"
+#include "vm/buffered_io.h"
+#include "liblmvm/lmvm.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// sessions are multiplexed with epoll, which only linux has
+#if defined(__linux__)
+#define HOST_SUPPORTED 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#else
+#define HOST_SUPPORTED 0
+#endif
+
+#if HOST_SUPPORTED
+
+// the most events each thread takes from epoll at once
+#define HOST_MAX_EVENTS 64
+
+/**
+ * Represents the listening socket and the program every session runs, shared by every thread.
+ * @see host_st
+ */
+struct host_s {
+    int listen_fd;
+    lmvm_state_st program;  // loaded once, and copied into every session
+    const run_limits_st *limits;
+};
+
+/**
+ * Represents the listening socket and the program every session runs.
+ * @see host_s
+ */
+typedef struct host_s host_st;
+
+/**
+ * Represents a connection and the machine running for it, which keeps everything the program needs while it waits.
+ * @see host_session_st
+ */
+struct host_session_s {
+    int fd;
+    lmvm_state_st machine;
+
+    char input[HOST_INPUT_SIZE];
+    size_t input_length;
+    int input_closed;  // the client won't send any more
+    int fresh_input;   // input has come since the program last waited for it
+
+    char *output;
+    size_t output_length;
+    size_t output_sent;
+    size_t output_capacity;
+
+    unsigned int events;  // what the session is registered with epoll for
+};
+
+/**
+ * Represents a connection and the machine running for it.
+ * @see host_session_s
+ */
+typedef struct host_session_s host_session_st;
+
+/**
+ * Represents a thread's epoll loop, and the scheduler the sessions on it that have instructions to run take turns on.
+ * @see host_loop_st
+ */
+struct host_loop_s {
+    const host_st *host;
+    int epoll_fd;
+
+    lmvm_scheduler_st scheduler;
+};
+
+/**
+ * Represents a thread's epoll loop.
+ * @see host_loop_s
+ */
+typedef struct host_loop_s host_loop_st;
+
+
+static inline int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+static void append_output(host_session_st *session, const char *text, size_t length) {
+    if (session->output_length + length > session->output_capacity) {
+        session->output_capacity = session->output_capacity * 2 + length;
+        session->output = checked_realloc(session->output, session->output_capacity);
+    }
+
+    memcpy(session->output + session->output_length, text, length);
+    session->output_length += length;
+}
+
+static int take_output(void *context, int value) {
+    char text[OUTPUT_VALUE_MAX_SIZE + 1];
+    int length = snprintf(text, sizeof(text), "%d\n", value);
+
+    append_output(context, text, (size_t) length);
+    return 0;
+}
+
+// takes the next word the client has sent, waiting if it hasn't sent a whole one yet
+static lmvm_input_result_et take_input(void *context, int *value) {
+    host_session_st *session = context;
+
+    while (1) {
+        size_t start = 0;
+        while (start < session->input_length && is_space(session->input[start])) {
+            start++;
+        }
+
+        size_t end = start;
+        while (end < session->input_length && !is_space(session->input[end])) {
+            end++;
+        }
+
+        // the word may carry on in what hasn't been sent yet, unless it already fills the buffer
+        int whole = end < session->input_length || session->input_closed || (start == 0 && end == HOST_INPUT_SIZE);
+
+        if (start == end || !whole) {
+            memmove(session->input, session->input + start, session->input_length - start);
+            session->input_length -= start;
+
+            return session->input_length == 0 && session->input_closed ? LMVM_INPUT_END : LMVM_INPUT_WAIT;
+        }
+
+        input_status_et status = parse_input_word(session->input + start, end - start, value);
+
+        memmove(session->input, session->input + end, session->input_length - end);
+        session->input_length -= end;
+
+        switch (status) {
+            case INPUT_VALUE:
+                return LMVM_INPUT_VALUE;
+            case INPUT_NOT_A_NUMBER:
+                append_output(session, "Invalid input: not a number\n", strlen("Invalid input: not a number\n"));
+                break;
+            case INPUT_OUT_OF_RANGE:
+                append_output(session, "Invalid input: out of range\n", strlen("Invalid input: out of range\n"));
+                break;
+            case INPUT_END:
+            case INPUT_INTERRUPTED:
+                // parse_input_word never gives either, a word is a value or not
+                return LMVM_INPUT_END;
+        }
+    }
+}
+
+
+static void queue_session(host_loop_st *loop, host_session_st *session) {
+    session->fresh_input = 0;
+    lmvm_schedule(&loop->scheduler, &session->machine);
+}
+
+static void free_session(host_session_st *session) {
+    silent_checked_free(session->output);
+    checked_free(session);
+}
+
+static void close_session(host_loop_st *loop, host_session_st *session) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+
+    lmvm_unschedule(&loop->scheduler, &session->machine);
+    free_session(session);
+}
+
+// returns 0 unless the client has gone
+static int flush_session(host_session_st *session) {
+    while (session->output_sent < session->output_length) {
+        ssize_t put = write(session->fd, session->output + session->output_sent, session->output_length - session->output_sent);
+
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (put <= 0) {
+            return 1;
+        }
+
+        session->output_sent += (size_t) put;
+    }
+
+    session->output_sent = 0;
+    session->output_length = 0;
+    return 0;
+}
+
+// sends what it can, then works out what the session is waiting for next, closing it once it is done
+static void update_session(host_loop_st *loop, host_session_st *session) {
+    if (flush_session(session) != 0) {
+        close_session(loop, session);
+        return;
+    }
+
+    lmvm_status_et status = session->machine.status;
+    int finished = status == LMVM_HALTED || status == LMVM_ERROR;
+    size_t unsent = session->output_length - session->output_sent;
+
+    if (finished && unsent == 0) {
+        close_session(loop, session);
+        return;
+    }
+
+    unsigned int events = 0;
+    if (!finished && !session->input_closed && session->input_length < HOST_INPUT_SIZE) {
+        events |= EPOLLIN;
+    }
+    if (unsent > 0) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != session->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = session;
+
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        session->events = events;
+    }
+
+    // a session that is falling behind its client doesn't run until the client catches up
+    if (unsent < HOST_OUTPUT_HIGH_WATER && (status == LMVM_RUNNABLE || (status == LMVM_NEED_INPUT && session->fresh_input))) {
+        queue_session(loop, session);
+    }
+}
+
+static void read_session(host_loop_st *loop, host_session_st *session) {
+    while (!session->input_closed && session->input_length < HOST_INPUT_SIZE) {
+        ssize_t got = read(session->fd, session->input + session->input_length, HOST_INPUT_SIZE - session->input_length);
+
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (got < 0) {
+            close_session(loop, session);
+            return;
+        }
+
+        // the end of the input is news too, as a program waiting for more will now run out
+        if (got == 0) {
+            session->input_closed = 1;
+        }
+
+        session->input_length += (size_t) got;
+        session->fresh_input = 1;
+    }
+
+    update_session(loop, session);
+}
+
+static void accept_sessions(host_loop_st *loop) {
+    while (1) {
+        int fd = accept(loop->host->listen_fd, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            // another thread may have taken the connection, or there are none left
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        host_session_st *session = checked_calloc(1, sizeof(host_session_st));
+        session->fd = fd;
+
+        // the program was decoded once when the host started, so a session is just a copy of it
+        memcpy(&session->machine, &loop->host->program, sizeof(session->machine));
+        lmvm_set_input_callback(&session->machine, take_input, session);
+        lmvm_set_output_callback(&session->machine, take_output, session);
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free_session(session);
+            continue;
+        }
+
+        session->events = EPOLLIN;
+        queue_session(loop, session);
+    }
+}
+
+// gives every session in the run queue one turn, in the order they were queued
+static void run_sessions(host_loop_st *loop) {
+    // sessions queued again go to the back, after the last one that was waiting when the round started
+    const lmvm_state_st *last = loop->scheduler.tail;
+
+    while (loop->scheduler.head != NULL) {
+        lmvm_state_st *machine = lmvm_run_turn(&loop->scheduler);
+        host_session_st *session = machine->output_context;
+
+        if (machine->status == LMVM_ERROR) {
+            char message[128];
+            lmvm_describe_error(machine, message, sizeof(message));
+
+            append_output(session, "Error: ", strlen("Error: "));
+            append_output(session, message, strlen(message));
+            append_output(session, "\n", 1);
+        }
+
+        update_session(loop, session);
+
+        if (machine == last) {
+            break;
+        }
+    }
+}
+
+static void run_host_loop(size_t task, void *context) {
+    (void) task;
+
+    host_loop_st loop;
+    loop.host = context;
+    loop.epoll_fd = epoll_create1(0);
+
+    if (loop.epoll_fd == -1) {
+        perror("Error: Failed to create epoll instance");
+        return;
+    }
+
+    // every thread waits on the listening socket, but only one is woken for each connection where that's supported
+    struct epoll_event listen_event;
+    listen_event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+    listen_event.events |= EPOLLEXCLUSIVE;
+#endif
+    listen_event.data.ptr = NULL;
+    epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, loop.host->listen_fd, &listen_event);
+
+    const run_limits_st *limits = loop.host->limits;
+    lmvm_scheduler_init(&loop.scheduler, HOST_QUANTUM, limits != NULL ? limits->max_steps : 0, limits != NULL ? limits->max_ms : 0);
+
+    struct epoll_event events[HOST_MAX_EVENTS];
+
+    while (1) {
+        // sessions with instructions to run only give the sockets a look between turns
+        int count = epoll_wait(loop.epoll_fd, events, HOST_MAX_EVENTS, loop.scheduler.head != NULL ? 0 : -1);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("Error: Failed to wait for connections");
+            break;
+        }
+
+        for (int index = 0; index < count; index++) {
+            host_session_st *session = events[index].data.ptr;
+
+            if (session == NULL) {
+                accept_sessions(&loop);
+            } else if (events[index].events & (EPOLLERR | EPOLLHUP)) {
+                close_session(&loop, session);
+            } else if (events[index].events & EPOLLIN) {
+                read_session(&loop, session);
+            } else {
+                update_session(&loop, session);
+            }
+        }
+
+        run_sessions(&loop);
+    }
+
+    close(loop.epoll_fd);
+}
+
+int do_host_sessions(const char *socket_path, const unsigned short int image[EXECUTABLE_SIZE], const run_limits_st *limits, size_t thread_count) {
+    int listen_fd = open_server_socket(socket_path);
+
+    if (listen_fd == -1) {
+        return 1;
+    }
+
+    remove_socket_on_stop(socket_path);
+
+    // a connection another thread took first shouldn't block the rest in accept
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+    host_st host;
+    host.listen_fd = listen_fd;
+    host.limits = limits;
+    lmvm_init(&host.program);
+    lmvm_load_image(&host.program, image, EXECUTABLE_SIZE);
+
+    // each thread runs its loop until it can no longer wait for connections
+    run_batch_tasks(thread_count, thread_count, run_host_loop, &host);
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    return 1;
+}
+
+#else
+
+int do_host_sessions(const char *socket_path, const unsigned short int image[EXECUTABLE_SIZE], const run_limits_st *limits, size_t thread_count) {
+    (void) socket_path;
+    (void) image;
+    (void) limits;
+    (void) thread_count;
+
+    fputs("Error: Hosting sessions is not supported on this platform\n", stderr);
+    return 1;
+}
+
+#endif
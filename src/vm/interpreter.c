@@ -0,0 +1,110 @@
+#include "vm/interpreter.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "vm/loop_detector.h"
+#include "vm/metering.h"
+
+#include <stdio.h>
+
+// for now, the VM is just going to interpret the bytecode
+// we might add a JIT compiler later (or direct translation to native asm/machine code), but that's a little overengineered for now
+// jvm hotspot interprets and then switches to JIT if a method is called a lot
+
+
+int do_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, FILE *debugout, unsigned long long *executed) {
+    int reg_ACC = 0; // accumulator
+    unsigned short int reg_PC = 0; // program counter
+    // MDR isn't needed since we can simply access memory[reg_MAR] directly
+
+    unsigned long long steps = 0;
+
+    // decode every cell up front, so the loop only has to decode cells that the program writes to
+    instruction_cache_st cache;
+    decode_image(&cache, memory, 0);
+
+    // the trace only goes to the debug stream in debug mode, so keep the last of it to report errors with either way
+    flight_recorder_st own_recorder;
+    flight_recorder_st *recorder = io->recorder != NULL ? io->recorder : &own_recorder;
+    unsigned long long recorded = 0;
+    reset_flight_recorder(recorder);
+
+    // a program that comes back round to a state it's been in before will never halt, so stop it
+    loop_detector_st detector;
+    reset_loop_detector(&detector, memory);
+
+    // limits are only checked at branches, once per basic block rather than every instruction
+    step_meter_st meter;
+    start_meter(&meter, io->limits);
+
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
+        // fetch
+        // a real computer would go via the MAR and MDR, but we can go straight from the decoded cache to CIR
+        decoded_instruction_st instruction = cache.ops[reg_PC];
+
+        if (instruction.handler == HANDLER_REDECODE) {
+            instruction = redecode_cell(&cache, memory, reg_PC);
+        }
+
+        unsigned short int reg_CIR = instruction.cir;  // current instruction register
+        unsigned short int address = reg_PC;
+        reg_PC++;
+
+        if (debugout != NULL) {
+            fprintf(debugout, "DEBUG: CIR = %u\n", reg_CIR);
+        }
+
+
+        // decode
+        // already done by the cache, the operand is always in range since it is the last two digits (stored to MAR)
+        if (debugout != NULL) {
+            fprintf(debugout, "DEBUG: Opcode = %u, Operand = %u\n", decoded_opcode(instruction), instruction.operand);
+        }
+
+
+        // execute
+        if (instruction.handler == HANDLER_STA && reg_ACC >= 0 && reg_ACC <= 999) {
+            note_loop_store(&detector, memory, instruction.operand, (unsigned short int) reg_ACC);
+        }
+
+        result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+        steps++;
+        record_flight(recorder, recorded++, address, reg_CIR, reg_ACC, result);
+
+        if (io->trace != NULL) {
+            write_trace_step(io->trace, address, reg_CIR, reg_ACC, result);
+        }
+
+        if (debugout != NULL) {
+            fprintf(debugout, "DEBUG: Result = %u\n", result);
+        }
+
+
+        // branches can't leave memory, since the target is always a decoded operand
+
+        // input can send the program somewhere new, and a program writing output is doing something, wherever it goes
+        if (instruction.handler == HANDLER_INP || instruction.handler == HANDLER_OUT) {
+            forget_loop_states(&detector);
+        } else if (result == EXECUTION_SUCCESS_BRANCHED && reg_PC <= address && check_loop_state(&detector, memory, address, reg_PC, reg_ACC)) {
+            report_loop(&detector, io->errors);
+            result = EXECUTION_ERROR;
+        } else if (instruction.handler >= HANDLER_BRA && instruction.handler <= HANDLER_BRP && steps >= meter.due && check_meter(&meter, steps) != 0) {
+            report_limit(&meter, steps, io->errors);
+            result = EXECUTION_ERROR;
+        }
+
+        if (result == EXECUTION_ERROR) {
+            fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, reg_CIR);
+            dump_flight_recorder(recorder, io->errors);
+        }
+    }
+
+    flush_execution_io(io);
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
@@ -0,0 +1,301 @@
+#include "vm/jit.h"
+#include "vm/threaded.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "vm/x86_64_emit.h"
+
+#include <stdio.h>
+
+#if NATIVE_CODE_SUPPORTED
+
+#include <string.h>
+
+// every cell is compiled into a slot of this size, so the native entry point of a cell is just an offset from the first slot
+// this also means a cell can be recompiled in place without moving any other code
+#define SLOT_SIZE 96
+#define PROLOGUE_SIZE 128
+#define CODE_SIZE (PROLOGUE_SIZE + SLOT_SIZE * (EXECUTABLE_SIZE + 1))
+
+/**
+ * Represents the reason generated code returned to C.
+ * @see jit_exit_reason_et
+ */
+enum jit_exit_reason_e {
+    JIT_EXIT_INTERPRET,    // the cell at PC needs to go through execute (IO, HLT, invalid, or it would raise an error)
+    JIT_EXIT_CODE_WRITTEN  // a cell that could run was changed, so the image needs recompiling before resuming at PC
+};
+
+/**
+ * Represents the reason generated code returned to C.
+ * @see jit_exit_reason_e
+ */
+typedef enum jit_exit_reason_e jit_exit_reason_et;
+
+
+/**
+ * Represents a compiled image and what each slot was compiled from.
+ * @see jit_image_st
+ */
+struct jit_image_s {
+    code_buffer_st buffer;
+    native_entry_fn entry;
+    unsigned char *exit;
+    unsigned char *slots;
+    unsigned short int compiled[EXECUTABLE_SIZE];
+    unsigned char guarded[EXECUTABLE_SIZE];
+};
+
+/**
+ * Represents a compiled image and what each slot was compiled from.
+ * @see jit_image_s
+ */
+typedef struct jit_image_s jit_image_st;
+
+
+static unsigned char *slot_address(const jit_image_st *image, unsigned int address) {
+    return image->slots + address * SLOT_SIZE;
+}
+
+// guarded stores are to cells that could run, so they exit to recompile if they change the cell
+static void emit_slot(jit_image_st *image, unsigned short int address, unsigned short int cir, int guard_store) {
+    emitter_st emitter = {slot_address(image, address)};
+    decoded_instruction_st instruction = decode_instruction(cir);
+
+    // jumps to an exit that runs the cell through execute instead, so it can report the error
+    unsigned char *slow = NULL;
+
+    switch (instruction.handler) {
+        case HANDLER_ADD:
+        case HANDLER_SUB:
+            slow = emit_add_sub_to_ecx(&emitter, instruction.operand, instruction.handler == HANDLER_SUB);
+            emit_commit_ecx(&emitter);
+            break;
+        case HANDLER_STA:
+            slow = emit_sta_check(&emitter);
+
+            if (guard_store) {
+                // storing the value already there doesn't change the code
+                emit_compare_cell(&emitter, instruction.operand);
+                unsigned char *unchanged = emit_jcc(&emitter, CC_ZERO, NULL);
+
+                emit_store(&emitter, instruction.operand);
+                emit_exit(&emitter, address + 1, JIT_EXIT_CODE_WRITTEN, image->exit);
+
+                patch_jump(unchanged, emitter.at);
+            } else {
+                emit_store(&emitter, instruction.operand);
+            }
+            break;
+        case HANDLER_LDA:
+            emit_lda(&emitter, instruction.operand);
+            break;
+        case HANDLER_BRA:
+            emit_count_step(&emitter);
+            emit_jmp(&emitter, slot_address(image, instruction.operand));
+            return;
+        case HANDLER_BRZ:
+            emit_count_step(&emitter);
+            emit_test_acc(&emitter);
+            emit_jcc(&emitter, CC_ZERO, slot_address(image, instruction.operand));
+            break;
+        case HANDLER_BRP:
+            emit_count_step(&emitter);
+            emit_test_acc(&emitter);
+            emit_jcc(&emitter, CC_NOT_SIGN, slot_address(image, instruction.operand));
+            break;
+        default:
+            // HLT, INP, OUT and invalid instructions
+            emit_exit(&emitter, address, JIT_EXIT_INTERPRET, image->exit);
+            return;
+    }
+
+    // fall through to the next cell
+    emit_jmp(&emitter, slot_address(image, address + 1));
+
+    if (slow != NULL) {
+        patch_jump(slow, emitter.at);
+        emit_exit(&emitter, address, JIT_EXIT_INTERPRET, image->exit);
+    }
+}
+
+// marks every cell that could run from the root without the code changing first
+static void find_reachable(const unsigned short int *memory, unsigned short int root, unsigned char reachable[EXECUTABLE_SIZE]) {
+    unsigned short int stack[EXECUTABLE_SIZE];
+    int stack_size = 0;
+
+    memset(reachable, 0, EXECUTABLE_SIZE);
+
+    if (root < EXECUTABLE_SIZE) {
+        reachable[root] = 1;
+        stack[stack_size++] = root;
+    }
+
+    while (stack_size > 0) {
+        unsigned short int address = stack[--stack_size];
+        decoded_instruction_st instruction = decode_instruction(memory[address]);
+
+        unsigned short int successors[2];
+        int successor_count = 0;
+
+        switch (instruction.handler) {
+            case HANDLER_HLT:
+            case HANDLER_INVALID:
+                break;
+            case HANDLER_BRA:
+                successors[successor_count++] = instruction.operand;
+                break;
+            case HANDLER_BRZ:
+            case HANDLER_BRP:
+                successors[successor_count++] = instruction.operand;
+                successors[successor_count++] = address + 1;
+                break;
+            default:
+                successors[successor_count++] = address + 1;
+                break;
+        }
+
+        for (int i = 0; i < successor_count; i++) {
+            unsigned short int successor = successors[i];
+
+            // running off the end is handled by the sentinel slot
+            if (successor < EXECUTABLE_SIZE && !reachable[successor]) {
+                reachable[successor] = 1;
+                stack[stack_size++] = successor;
+            }
+        }
+    }
+}
+
+// recompiles the slots that are out of date, returning 0 on failure
+static int update_image(jit_image_st *image, const unsigned short int *memory, unsigned short int root, int force) {
+    unsigned char reachable[EXECUTABLE_SIZE];
+    find_reachable(memory, root, reachable);
+
+    int writable = 0;
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        decoded_instruction_st instruction = decode_instruction(memory[address]);
+        int guard_store = instruction.handler == HANDLER_STA && reachable[instruction.operand];
+
+        if (!force && image->compiled[address] == memory[address] && image->guarded[address] == guard_store) {
+            continue;
+        }
+
+        if (!writable) {
+            if (!code_buffer_make_writable(&image->buffer)) {
+                return 0;
+            }
+
+            writable = 1;
+        }
+
+        emit_slot(image, address, memory[address], guard_store);
+        image->compiled[address] = memory[address];
+        image->guarded[address] = (unsigned char) guard_store;
+    }
+
+    if (writable) {
+        return code_buffer_make_executable(&image->buffer);
+    }
+
+    return 1;
+}
+
+static int compile_image(jit_image_st *image, const unsigned short int *memory) {
+    if (!code_buffer_init(&image->buffer, CODE_SIZE)) {
+        return 0;
+    }
+
+    emitter_st emitter = {image->buffer.base};
+    image->entry = emit_entry_and_exit(&emitter, &image->exit);
+    image->slots = image->buffer.base + PROLOGUE_SIZE;
+
+    // falling off the end of memory lands here, and execute_decoded reports it
+    emitter.at = slot_address(image, EXECUTABLE_SIZE);
+    emit_exit(&emitter, EXECUTABLE_SIZE, JIT_EXIT_INTERPRET, image->exit);
+
+    if (!update_image(image, memory, 0, 1)) {
+        code_buffer_free(&image->buffer);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+int jit_available(void) {
+    return 1;
+}
+
+int do_jit_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed) {
+    jit_image_st image;
+
+    if (!compile_image(&image, memory)) {
+        fputs("Warning: Failed to allocate executable memory for the JIT, using the threaded engine instead\n", io->errors);
+        return do_threaded_execution(memory, io, executed);
+    }
+
+    native_context_st context = {0, 0, memory, 0, io, EXECUTION_INDETERMINATE};
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    // only the instructions that leave native code are recorded, which still covers the one that errored
+    flight_recorder_st own_recorder;
+    flight_recorder_st *recorder = io->recorder != NULL ? io->recorder : &own_recorder;
+    unsigned long long recorded = 0;
+    reset_flight_recorder(recorder);
+
+    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
+        jit_exit_reason_et reason = (jit_exit_reason_et) image.entry(&context, slot_address(&image, context.pc));
+
+        if (reason == JIT_EXIT_CODE_WRITTEN) {
+            if (!update_image(&image, memory, (unsigned short int) context.pc, 0)) {
+                fputs("Internal Error: Failed to recompile JIT code\n", io->errors);
+                result = EXECUTION_ERROR;
+            }
+
+            continue;
+        }
+
+        // the cell couldn't run natively, so run it through execute like the other engines would
+        decoded_instruction_st instruction;
+        if (context.pc < EXECUTABLE_SIZE) {
+            instruction = decode_instruction(memory[context.pc]);
+        } else {
+            instruction = decode_instruction(0);
+            instruction.handler = HANDLER_PC_OUT_OF_RANGE;
+        }
+
+        unsigned short int reg_PC = (unsigned short int) (context.pc + 1);
+        context.steps++;
+
+        result = execute_decoded(instruction, &context.acc, &reg_PC, memory, NULL, io);
+        record_flight(recorder, recorded++, (unsigned short int) context.pc, instruction.cir, context.acc, result);
+        context.pc = reg_PC;
+
+        if (result == EXECUTION_ERROR) {
+            fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, instruction.cir);
+            dump_flight_recorder(recorder, io->errors);
+        }
+    }
+
+    code_buffer_free(&image.buffer);
+    flush_execution_io(io);
+
+    if (executed != NULL) {
+        *executed = context.steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
+
+#else
+
+int jit_available(void) {
+    return 0;
+}
+
+int do_jit_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed) {
+    return do_threaded_execution(memory, io, executed);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "vm/large_execution.h"
+#include "vm/metering.h"
+#include "common/opcodes.h"
+
+#include <stdio.h>
+#include <limits.h>
+
+
+int do_large_execution(const large_image_st *image, execution_io_st *io, FILE *debugout, unsigned long long *executed) {
+    paged_memory_st memory;
+    init_paged_memory(&memory, image);
+
+    int reg_ACC = 0;
+    uint32_t reg_PC = 0;
+    unsigned long long steps = 0;
+
+    // like the interpreter, limits are only checked at branches
+    step_meter_st meter;
+    start_meter(&meter, io->limits);
+
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
+        // only running off the end of memory can take the program counter out of range, since branch targets fit
+        if (reg_PC >= LARGE_ADDRESS_SPACE) {
+            fprintf(io->errors, "Error: Program counter out of range: %u\n", reg_PC);
+            result = EXECUTION_ERROR;
+            break;
+        }
+
+        uint32_t reg_CIR = read_paged_cell(&memory, reg_PC);
+        uint32_t opcode = reg_CIR / LARGE_ADDRESS_SPACE;
+        uint32_t reg_MAR = reg_CIR % LARGE_ADDRESS_SPACE;
+        reg_PC++;
+
+        // the loader checked every cell is below LARGE_CELL_LIMIT, and STA only stores values that are, so the
+        // accumulator never needs to check a cell fits in an int
+        uint32_t mdr;
+
+        switch (opcode) {
+            case OP_LMC_HLT:
+                result = EXECUTION_HALT;
+                break;
+            case OP_LMC_ADD:
+                mdr = read_paged_cell(&memory, reg_MAR);
+
+                if (reg_ACC > INT_MAX - (int) mdr) {
+                    fprintf(io->errors, "Error: Accumulator overflow: %u + %u > %u\n", reg_ACC, mdr, INT_MAX);
+                    result = EXECUTION_ERROR;
+                    break;
+                }
+
+                reg_ACC += (int) mdr;
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case OP_LMC_SUB:
+                mdr = read_paged_cell(&memory, reg_MAR);
+
+                if (reg_ACC < INT_MIN + (int) mdr) {
+                    fprintf(io->errors, "Error: Accumulator underflow: %u - %u < %u\n", reg_ACC, mdr, INT_MIN);
+                    result = EXECUTION_ERROR;
+                    break;
+                }
+
+                reg_ACC -= (int) mdr;
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case OP_LMC_STA:
+                if (reg_ACC < 0 || (uint32_t) reg_ACC >= LARGE_CELL_LIMIT) {
+                    fprintf(io->errors, "Error: Accumulator value out of memory range: %d\n", reg_ACC);
+                    result = EXECUTION_ERROR;
+                    break;
+                }
+
+                write_paged_cell(&memory, reg_MAR, (uint32_t) reg_ACC);
+                result = EXECUTION_SUCCESS_ACC_UNCHANGED;
+                break;
+            case OP_LMC_LDA:
+                reg_ACC = (int) read_paged_cell(&memory, reg_MAR);
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case OP_LMC_BRA:
+            case OP_LMC_BRZ:
+            case OP_LMC_BRP:
+                if ((opcode == OP_LMC_BRZ && reg_ACC != 0) || (opcode == OP_LMC_BRP && reg_ACC < 0)) {
+                    result = EXECUTION_SUCCESS_ACC_UNCHANGED;
+                    break;
+                }
+
+                reg_PC = reg_MAR;
+                result = EXECUTION_SUCCESS_BRANCHED;
+
+                if (steps + 1 >= meter.due && check_meter(&meter, steps + 1) != 0) {
+                    report_limit(&meter, steps + 1, io->errors);
+                    result = EXECUTION_ERROR;
+                }
+                break;
+            case OP_LMC_IO_OP:
+                if (reg_MAR != OP_LMC_IO_OP_INP % 100 && reg_MAR != OP_LMC_IO_OP_OUT % 100) {
+                    fprintf(io->errors, "Error: Invalid IO operation: %u\n", reg_CIR);
+                    result = EXECUTION_ERROR;
+                    break;
+                }
+
+                result = execute_io(reg_MAR == OP_LMC_IO_OP_INP % 100 ? OP_LMC_IO_OP_INP : OP_LMC_IO_OP_OUT, &reg_ACC, io);
+                break;
+            default:
+                fprintf(io->errors, "Error: Invalid opcode: %u\n", opcode);
+                result = EXECUTION_ERROR;
+                break;
+        }
+
+        steps++;
+
+        if (result == EXECUTION_ERROR) {
+            fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, reg_CIR);
+        }
+    }
+
+    flush_execution_io(io);
+
+    if (debugout != NULL) {
+        fprintf(debugout, "DEBUG: Copied %zu pages of memory from the image\n", memory.private_pages);
+    }
+
+    reset_paged_memory(&memory);
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
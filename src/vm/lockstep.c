@@ -0,0 +1,394 @@
+#include "vm/lockstep.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "vm/metering.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+// lanes are stepped VECTOR_LANES at a time using the compiler's vector extensions, which lower to SSE2 on x86-64 by default
+// on x86-64 the kernel is compiled a second time for AVX2, which is used if the CPU supports it
+#if defined(__GNUC__)
+#define VECTOR_LANES 8
+typedef int lane_vector_t __attribute__((vector_size(VECTOR_LANES * sizeof(int))));
+typedef unsigned int lane_uvector_t __attribute__((vector_size(VECTOR_LANES * sizeof(int))));
+
+// vector comparisons are already -1 where true
+#define MASK(comparison) (comparison)
+#else
+#define VECTOR_LANES 1
+typedef int lane_vector_t;
+typedef unsigned int lane_uvector_t;
+
+#define MASK(comparison) (-(lane_vector_t) (comparison))
+#endif
+
+// the kernel has to be inlined into each of its copies for each to be compiled for its own instruction set
+#if defined(__GNUC__)
+#define ALWAYS_INLINE __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define AVX2_KERNEL_SUPPORTED 1
+#else
+#define AVX2_KERNEL_SUPPORTED 0
+#endif
+
+#define SELECT(mask, if_set, if_clear) (((mask) & (if_set)) | (~(mask) & (if_clear)))
+
+// vectors are copied rather than dereferenced, as the lane arrays are only aligned for int
+#define LOAD_LANES(vector, from) memcpy(&(vector), (from), sizeof(vector))
+#define STORE_LANES(to, vector) memcpy((to), &(vector), sizeof(vector))
+
+// the PC of a lane that has halted or errored, which is never the lowest PC of a lane still running
+#define RETIRED INT_MAX
+
+
+/**
+ * Represents the registers and memory of every lane, as struct-of-arrays so lanes sit next to each other.
+ * @see lockstep_state_st
+ */
+struct lockstep_state_s {
+    size_t width;  // the lane count rounded up to the vector width, the padding lanes are retired from the start
+
+    int *acc;
+    int *pc;
+    int *memory;  // memory[cell * width + lane]
+
+    size_t *inputs_used;
+    size_t *output_capacity;
+
+    // lanes do their own IO, so this is only used to report errors from execute
+    execution_io_st io;
+};
+
+/**
+ * Represents the registers and memory of every lane.
+ * @see lockstep_state_s
+ */
+typedef struct lockstep_state_s lockstep_state_st;
+
+
+/**
+ * The signature of a kernel that steps every lane at the PC that is running the given instruction.
+ * Returns the lowest PC of any lane afterwards.
+ */
+typedef int (*step_kernel_fn)(lockstep_state_st *state, decoded_instruction_st instruction, int pc, unsigned long long *ran, int *failed);
+
+
+// runs the instruction for every lane at pc whose cell holds the same instruction
+// lanes that would error are left at pc for step_lane to report
+static inline ALWAYS_INLINE int
+step_lanes(lockstep_state_st *state, decoded_instruction_st instruction, int pc, unsigned long long *ran, int *failed) {
+    const size_t width = state->width;
+    const int *code = state->memory + (size_t) pc * width;
+    int *cells = state->memory + (size_t) instruction.operand * width;
+
+    const int cir = instruction.cir;
+    const int operand = instruction.operand;
+    const lane_vector_t zero = {0};
+
+    lane_vector_t ran_lanes = zero;
+    lane_vector_t failed_lanes = zero;
+    lane_vector_t lowest = zero + RETIRED;
+
+    for (size_t lane = 0; lane < width; lane += VECTOR_LANES) {
+        lane_vector_t pcs, code_lanes, acc, operands;
+        LOAD_LANES(pcs, state->pc + lane);
+        LOAD_LANES(code_lanes, code + lane);
+        LOAD_LANES(acc, state->acc + lane);
+        LOAD_LANES(operands, cells + lane);
+
+        // lanes that have written a different instruction to this cell wait for their own turn
+        lane_vector_t active = MASK(pcs == pc) & MASK(code_lanes == cir);
+        lane_vector_t ok = active;
+
+        lane_vector_t new_acc = acc;
+        lane_vector_t new_pc = zero + (pc + 1);
+
+        switch (instruction.handler) {
+            case HANDLER_LDA:
+                new_acc = operands;
+                break;
+            case HANDLER_ADD:
+                // the same checks as op_add and op_sub, done in unsigned so the lanes that fail don't overflow
+                ok &= ~MASK(acc > INT_MAX - operands);
+                new_acc = (lane_vector_t) ((lane_uvector_t) acc + (lane_uvector_t) operands);
+                break;
+            case HANDLER_SUB:
+                ok &= ~MASK(acc < INT_MIN + operands);
+                new_acc = (lane_vector_t) ((lane_uvector_t) acc - (lane_uvector_t) operands);
+                break;
+            case HANDLER_STA: {
+                ok &= ~(MASK(acc < 0) | MASK(acc > 999));
+
+                lane_vector_t stored = SELECT(ok, acc, operands);
+                STORE_LANES(cells + lane, stored);
+                break;
+            }
+            case HANDLER_BRA:
+                new_pc = zero + operand;
+                break;
+            case HANDLER_BRZ:
+                new_pc = SELECT(MASK(acc == 0), zero + operand, new_pc);
+                break;
+            case HANDLER_BRP:
+                new_pc = SELECT(MASK(acc < 0), new_pc, zero + operand);
+                break;
+            default:
+                ok = zero;
+                break;
+        }
+
+        acc = SELECT(ok, new_acc, acc);
+        pcs = SELECT(ok, new_pc, pcs);
+
+        STORE_LANES(state->acc + lane, acc);
+        STORE_LANES(state->pc + lane, pcs);
+
+        // masks are -1, so subtracting them counts
+        ran_lanes -= ok;
+        failed_lanes -= active & ~ok;
+        lowest = SELECT(MASK(pcs < lowest), pcs, lowest);
+    }
+
+    int ran_counts[VECTOR_LANES];
+    int failed_counts[VECTOR_LANES];
+    int lowest_pcs[VECTOR_LANES];
+    STORE_LANES(ran_counts, ran_lanes);
+    STORE_LANES(failed_counts, failed_lanes);
+    STORE_LANES(lowest_pcs, lowest);
+
+    int next_pc = RETIRED;
+    for (int i = 0; i < VECTOR_LANES; i++) {
+        *ran += (unsigned int) ran_counts[i];
+        *failed += failed_counts[i];
+
+        if (lowest_pcs[i] < next_pc) {
+            next_pc = lowest_pcs[i];
+        }
+    }
+
+    return next_pc;
+}
+
+static int step_lanes_generic(lockstep_state_st *state, decoded_instruction_st instruction, int pc, unsigned long long *ran, int *failed) {
+    return step_lanes(state, instruction, pc, ran, failed);
+}
+
+#if AVX2_KERNEL_SUPPORTED
+__attribute__((target("avx2")))
+static int step_lanes_avx2(lockstep_state_st *state, decoded_instruction_st instruction, int pc, unsigned long long *ran, int *failed) {
+    return step_lanes(state, instruction, pc, ran, failed);
+}
+#endif
+
+static step_kernel_fn select_kernel(void) {
+#if AVX2_KERNEL_SUPPORTED
+    if (__builtin_cpu_supports("avx2")) {
+        return step_lanes_avx2;
+    }
+#endif
+
+    return step_lanes_generic;
+}
+
+
+static void retire_lane(lockstep_state_st *state, lockstep_lane_st *lanes, size_t lane, int exit_code) {
+    state->pc[lane] = RETIRED;
+    lanes[lane].exit_code = exit_code;
+}
+
+static void fail_lane(lockstep_state_st *state, lockstep_lane_st *lanes, size_t lane, unsigned int reg_PC, unsigned int cir) {
+    fprintf(stderr, "Error occurred in lane %zu with PC = %u CIR = %u\n", lane, reg_PC, cir);
+    retire_lane(state, lanes, lane, 1);
+}
+
+// stops every lane still running once the run has hit a limit, reporting the instruction each was about to run
+static void stop_lanes(lockstep_state_st *state, lockstep_lane_st *lanes, size_t lane_count, const step_meter_st *meter, unsigned long long steps) {
+    report_limit(meter, steps, stderr);
+
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        int reg_PC = state->pc[lane];
+
+        if (reg_PC != RETIRED) {
+            unsigned int cir = reg_PC < EXECUTABLE_SIZE ? (unsigned int) state->memory[(size_t) reg_PC * state->width + lane] : 0;
+            fail_lane(state, lanes, lane, (unsigned int) reg_PC, cir);
+        }
+    }
+}
+
+// runs an instruction the kernels don't handle (IO, HLT, errors) for a single lane
+static void step_lane(lockstep_state_st *state, lockstep_lane_st *lanes, size_t lane, decoded_instruction_st instruction) {
+    const size_t width = state->width;
+    unsigned short int reg_PC = (unsigned short int) (state->pc[lane] + 1);
+
+    // IO goes to the lane rather than stdin and stdout
+    if (instruction.handler == HANDLER_INP) {
+        if (state->inputs_used[lane] == lanes[lane].input_count) {
+            fputs("Error: Ran out of input\n", stderr);
+            fail_lane(state, lanes, lane, reg_PC, instruction.cir);
+            return;
+        }
+
+        state->acc[lane] = lanes[lane].inputs[state->inputs_used[lane]++];
+        state->pc[lane] = reg_PC;
+        return;
+    }
+
+    if (instruction.handler == HANDLER_OUT) {
+        lockstep_lane_st *output_lane = &lanes[lane];
+
+        if (output_lane->output_count == state->output_capacity[lane]) {
+            state->output_capacity[lane] = state->output_capacity[lane] == 0 ? 16 : state->output_capacity[lane] * 2;
+            output_lane->outputs = checked_realloc(output_lane->outputs, sizeof(int) * state->output_capacity[lane]);
+        }
+
+        output_lane->outputs[output_lane->output_count++] = state->acc[lane];
+        state->pc[lane] = reg_PC;
+        return;
+    }
+
+    // everything else goes through execute on a copy of the lane, so it reports errors like the other engines
+    unsigned short int memory[EXECUTABLE_SIZE];
+    for (size_t cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        memory[cell] = (unsigned short int) state->memory[cell * width + lane];
+    }
+
+    execution_result_et result = execute_decoded(instruction, &state->acc[lane], &reg_PC, memory, NULL, &state->io);
+
+    for (size_t cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        state->memory[cell * width + lane] = memory[cell];
+    }
+
+    if (result == EXECUTION_HALT) {
+        retire_lane(state, lanes, lane, 0);
+    } else if (result == EXECUTION_ERROR) {
+        fail_lane(state, lanes, lane, reg_PC, instruction.cir);
+    } else {
+        state->pc[lane] = reg_PC;
+    }
+}
+
+int do_lockstep_execution(const unsigned short int image[EXECUTABLE_SIZE], lockstep_lane_st *lanes, size_t lane_count, const run_limits_st *limits, unsigned long long *executed) {
+    lockstep_state_st state;
+    state.width = (lane_count + VECTOR_LANES - 1) / VECTOR_LANES * VECTOR_LANES;
+    state.acc = checked_calloc(state.width, sizeof(int));
+    state.pc = checked_malloc(sizeof(int) * state.width);
+    state.memory = checked_malloc(sizeof(int) * state.width * EXECUTABLE_SIZE);
+    state.inputs_used = checked_calloc(state.width, sizeof(size_t));
+    state.output_capacity = checked_calloc(state.width, sizeof(size_t));
+    init_execution_io(&state.io, stdin, stdout, stderr);
+
+    for (size_t lane = 0; lane < state.width; lane++) {
+        state.pc[lane] = lane < lane_count ? 0 : RETIRED;
+    }
+
+    for (size_t cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        for (size_t lane = 0; lane < state.width; lane++) {
+            state.memory[cell * state.width + lane] = image[cell];
+        }
+    }
+
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        lanes[lane].outputs = NULL;
+        lanes[lane].output_count = 0;
+        lanes[lane].exit_code = 0;
+    }
+
+    step_kernel_fn kernel = select_kernel();
+    unsigned long long steps = 0;
+
+    step_meter_st meter;
+    start_meter(&meter, limits);
+
+    // always run the lowest PC, so lanes that have diverged meet again at the top of a loop or after a branch
+    int pc = lane_count > 0 ? 0 : RETIRED;
+
+    while (pc != RETIRED) {
+        // the limits cover every lane together, and are only checked once their steps reach the meter, which is never without limits
+        if (steps >= meter.due && check_meter(&meter, steps)) {
+            stop_lanes(&state, lanes, lane_count, &meter, steps);
+            break;
+        }
+
+        size_t leader = 0;
+        while (state.pc[leader] != pc) {
+            leader++;
+        }
+
+        decoded_instruction_st instruction;
+        if (pc < EXECUTABLE_SIZE) {
+            instruction = decode_instruction((unsigned short int) state.memory[(size_t) pc * state.width + leader]);
+        } else {
+            instruction = decode_instruction(0);
+            instruction.handler = HANDLER_PC_OUT_OF_RANGE;
+        }
+
+        switch (instruction.handler) {
+            case HANDLER_LDA:
+            case HANDLER_ADD:
+            case HANDLER_SUB:
+            case HANDLER_STA:
+            case HANDLER_BRA:
+            case HANDLER_BRZ:
+            case HANDLER_BRP: {
+                int failed = 0;
+                int next_pc = kernel(&state, instruction, pc, &steps, &failed);
+
+                if (!failed) {
+                    pc = next_pc;
+                    continue;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        // the rest go through one lane at a time, finding the lowest PC again as they do
+        int next_pc = RETIRED;
+
+        for (size_t lane = 0; lane < lane_count; lane++) {
+            if (state.pc[lane] == pc && (pc >= EXECUTABLE_SIZE || state.memory[(size_t) pc * state.width + lane] == instruction.cir)) {
+                step_lane(&state, lanes, lane, instruction);
+                steps++;
+            }
+
+            if (state.pc[lane] < next_pc) {
+                next_pc = state.pc[lane];
+            }
+        }
+
+        pc = next_pc;
+    }
+
+    checked_free(state.acc);
+    checked_free(state.pc);
+    checked_free(state.memory);
+    checked_free(state.inputs_used);
+    checked_free(state.output_capacity);
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    int any_errored = 0;
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        any_errored |= lanes[lane].exit_code;
+    }
+
+    return any_errored;
+}
+
+void free_lockstep_outputs(lockstep_lane_st *lanes, size_t lane_count) {
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        silent_checked_free(lanes[lane].outputs);
+        lanes[lane].outputs = NULL;
+        lanes[lane].output_count = 0;
+    }
+}
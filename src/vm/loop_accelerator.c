@@ -0,0 +1,344 @@
+#include "vm/loop_accelerator.h"
+#include "common/opcodes.h"
+
+#include <limits.h>
+#include <string.h>
+
+// the value that stands for the ACC at the start of a time round, cells stored to get the values after it
+#define VALUE_ACC 0
+// the value that stands for a cell the loop never stores to, which stays the same all the way round
+#define VALUE_CONSTANT (-1)
+
+// the time round on which something never happens
+#define NEVER ULLONG_MAX
+
+
+/**
+ * Represents a value worked out part way round a loop, as one of the values at the start of that time round plus an amount.
+ * @see loop_term_st
+ */
+struct loop_term_s {
+    int value;
+    long long offset;
+};
+
+/**
+ * Represents a value worked out part way round a loop.
+ * @see loop_term_s
+ */
+typedef struct loop_term_s loop_term_st;
+
+/**
+ * Represents how a value has to compare to a limit for the loop to stop going round.
+ * @see loop_stop_et
+ */
+enum loop_stop_e {
+    STOP_AT_LEAST,
+    STOP_AT_MOST,
+    STOP_EQUAL,
+    STOP_NOT_EQUAL
+};
+
+/**
+ * Represents how a value has to compare to a limit for the loop to stop going round.
+ * @see loop_stop_e
+ */
+typedef enum loop_stop_e loop_stop_et;
+
+/**
+ * Represents something that would stop the loop going round: a branch out of it, or an error.
+ * @see loop_event_st
+ */
+struct loop_event_s {
+    loop_term_st term;
+    loop_stop_et stop;
+    long long limit;
+};
+
+/**
+ * Represents something that would stop the loop going round.
+ * @see loop_event_s
+ */
+typedef struct loop_event_s loop_event_st;
+
+/**
+ * Represents one time round a loop, worked out in terms of the values at the start of it.
+ * @see loop_body_st
+ */
+struct loop_body_s {
+    // values[0] is the ACC, the rest are the cells stored to, in the order they are first stored to
+    unsigned short int cells[EXECUTABLE_SIZE + 1];
+    loop_term_st values[EXECUTABLE_SIZE + 1];
+    int value_count;
+
+    loop_term_st acc;
+
+    // every instruction can raise an error, and STA can in two ways
+    loop_event_st events[EXECUTABLE_SIZE * 2];
+    int event_count;
+};
+
+/**
+ * Represents one time round a loop, worked out in terms of the values at the start of it.
+ * @see loop_body_s
+ */
+typedef struct loop_body_s loop_body_st;
+
+
+static int find_value(const loop_body_st *body, unsigned short int cell) {
+    for (int value = 1; value < body->value_count; value++) {
+        if (body->cells[value] == cell) {
+            return value;
+        }
+    }
+
+    return VALUE_CONSTANT;
+}
+
+static void add_event(loop_body_st *body, loop_term_st term, loop_stop_et stop, long long limit) {
+    loop_event_st *event = &body->events[body->event_count++];
+    event->term = term;
+    event->stop = stop;
+    event->limit = limit;
+}
+
+// goes round the loop once, in terms of the values at the start of it, returning 0 if it isn't a counting loop
+static int trace_loop_body(const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int head, unsigned short int tail, loop_body_st *body) {
+    body->value_count = 1;
+    body->cells[VALUE_ACC] = 0;
+    body->values[VALUE_ACC].value = VALUE_ACC;
+    body->values[VALUE_ACC].offset = 0;
+    body->acc = body->values[VALUE_ACC];
+    body->event_count = 0;
+
+    // the cells stored to have to be known before any of them is loaded
+    for (unsigned short int address = head; address <= tail; address++) {
+        unsigned short int cell = memory[address];
+
+        if (cell / 100 == OP_LMC_STA && find_value(body, cell % 100) == VALUE_CONSTANT) {
+            // storing over the loop itself would change what it does
+            if (cell % 100 >= head && cell % 100 <= tail) {
+                return 0;
+            }
+
+            body->cells[body->value_count] = cell % 100;
+            body->values[body->value_count].value = body->value_count;
+            body->values[body->value_count].offset = 0;
+            body->value_count++;
+        }
+    }
+
+    for (unsigned short int address = head; address <= tail; address++) {
+        unsigned short int cell = memory[address];
+        unsigned short int operand = cell % 100;
+        int value = find_value(body, operand);
+
+        switch (cell / 100) {
+            case OP_LMC_LDA:
+                if (value == VALUE_CONSTANT) {
+                    body->acc.value = VALUE_CONSTANT;
+                    body->acc.offset = memory[operand];
+                } else {
+                    body->acc = body->values[value];
+                }
+                break;
+            case OP_LMC_ADD:
+                // adding a cell that changes would make the ACC grow faster each time round
+                if (value != VALUE_CONSTANT) {
+                    return 0;
+                }
+
+                add_event(body, body->acc, STOP_AT_LEAST, (long long) INT_MAX - memory[operand] + 1);
+                body->acc.offset += memory[operand];
+                break;
+            case OP_LMC_SUB:
+                if (value != VALUE_CONSTANT) {
+                    return 0;
+                }
+
+                add_event(body, body->acc, STOP_AT_MOST, (long long) INT_MIN + memory[operand] - 1);
+                body->acc.offset -= memory[operand];
+                break;
+            case OP_LMC_STA:
+                add_event(body, body->acc, STOP_AT_MOST, -1);
+                add_event(body, body->acc, STOP_AT_LEAST, 1000);
+                body->values[value] = body->acc;
+                break;
+            case OP_LMC_BRZ:
+            case OP_LMC_BRP:
+                if (address == tail) {
+                    // the branch back leaves the loop when it isn't taken
+                    if (cell / 100 == OP_LMC_BRZ) {
+                        add_event(body, body->acc, STOP_NOT_EQUAL, 0);
+                    } else {
+                        add_event(body, body->acc, STOP_AT_MOST, -1);
+                    }
+                } else if (operand >= head && operand <= tail) {
+                    // branching within the loop would skip part of it some of the time
+                    return 0;
+                } else if (cell / 100 == OP_LMC_BRZ) {
+                    add_event(body, body->acc, STOP_EQUAL, 0);
+                } else {
+                    add_event(body, body->acc, STOP_AT_LEAST, 0);
+                }
+                break;
+            case OP_LMC_BRA:
+                if (address != tail) {
+                    return 0;
+                }
+                break;
+            default:
+                // HLT, INP, OUT and invalid instructions all have to run as normal
+                return 0;
+        }
+    }
+
+    // every cell stored to has to end up as its old value plus an amount
+    for (int value = 1; value < body->value_count; value++) {
+        if (body->values[value].value != value) {
+            return 0;
+        }
+    }
+
+    // and so does the ACC, if it is used before it is loaded
+    if (body->acc.value != VALUE_ACC) {
+        for (int event = 0; event < body->event_count; event++) {
+            if (body->events[event].term.value == VALUE_ACC) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+void find_counting_loops(loop_accelerator_st *accelerator, const unsigned short int memory[EXECUTABLE_SIZE]) {
+    memcpy(accelerator->image, memory, sizeof(accelerator->image));
+
+    loop_body_st body;
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        unsigned short int opcode = memory[address] / 100;
+        unsigned short int target = memory[address] % 100;
+
+        accelerator->heads[address] = NO_COUNTING_LOOP;
+
+        if ((opcode == OP_LMC_BRA || opcode == OP_LMC_BRZ || opcode == OP_LMC_BRP) && target <= address
+            && trace_loop_body(memory, target, address, &body)) {
+            accelerator->heads[address] = target;
+        }
+    }
+}
+
+
+// the first time round, counting from 0, on which start + step * k compares to limit as stop says
+static unsigned long long first_stop(long long start, long long step, loop_stop_et stop, long long limit) {
+    switch (stop) {
+        case STOP_AT_LEAST:
+            if (start >= limit) {
+                return 0;
+            }
+            return step > 0 ? (unsigned long long) ((limit - start + step - 1) / step) : NEVER;
+        case STOP_AT_MOST:
+            if (start <= limit) {
+                return 0;
+            }
+            return step < 0 ? (unsigned long long) ((start - limit - step - 1) / -step) : NEVER;
+        case STOP_EQUAL:
+            if (step == 0) {
+                return start == limit ? 0 : NEVER;
+            }
+            if ((limit - start) % step != 0 || (limit - start) / step < 0) {
+                return NEVER;
+            }
+            return (unsigned long long) ((limit - start) / step);
+        case STOP_NOT_EQUAL:
+        default:
+            if (start != limit) {
+                return 0;
+            }
+            return step != 0 ? 1 : NEVER;
+    }
+}
+
+unsigned long long run_counting_loop(const loop_accelerator_st *accelerator, unsigned short int memory[EXECUTABLE_SIZE], unsigned short int tail, int *acc, instruction_cache_st *cache, loop_detector_st *detector, unsigned long long budget) {
+    unsigned short int head = accelerator->heads[tail];
+
+    // the program may have stored over the loop since it was found
+    if (memcmp(&memory[head], &accelerator->image[head], sizeof(unsigned short int) * (size_t) (tail - head + 1)) != 0) {
+        return 0;
+    }
+
+    // the amounts added depend on what is in the cells now
+    loop_body_st body;
+    if (!trace_loop_body(memory, head, tail, &body)) {
+        return 0;
+    }
+
+    long long starts[EXECUTABLE_SIZE + 1];
+    long long steps[EXECUTABLE_SIZE + 1];
+
+    starts[VALUE_ACC] = *acc;
+    steps[VALUE_ACC] = body.acc.value == VALUE_ACC ? body.acc.offset : 0;
+    for (int value = 1; value < body.value_count; value++) {
+        starts[value] = memory[body.cells[value]];
+        steps[value] = body.values[value].offset;
+    }
+
+    unsigned long long rounds = NEVER;
+
+    for (int index = 0; index < body.event_count; index++) {
+        const loop_event_st *event = &body.events[index];
+        long long start = event->term.offset;
+        long long step = 0;
+
+        if (event->term.value != VALUE_CONSTANT) {
+            start += starts[event->term.value];
+            step = steps[event->term.value];
+        }
+
+        unsigned long long round = first_stop(start, step, event->stop, event->limit);
+        if (round < rounds) {
+            rounds = round;
+        }
+    }
+
+    // a loop that never stops is left to the loop detector, which will report it
+    if (rounds == NEVER || rounds == 0) {
+        return 0;
+    }
+
+    // only as many times round as fit before the run's limits or snapshots are next due, so they still happen on time
+    unsigned long long length = (unsigned long long) (tail - head + 1);
+    if (rounds > budget / length) {
+        rounds = budget / length;
+
+        if (rounds == 0) {
+            return 0;
+        }
+    }
+
+    // every value goes round the loop the same way, so nothing before the last time round can overflow
+    for (int value = 1; value < body.value_count; value++) {
+        unsigned short int stored = (unsigned short int) (starts[value] + steps[value] * (long long) rounds);
+
+        if (detector != NULL) {
+            note_loop_store(detector, memory, body.cells[value], stored);
+        }
+
+        memory[body.cells[value]] = stored;
+
+        if (cache != NULL) {
+            invalidate_cell(cache, body.cells[value]);
+        }
+    }
+
+    // the ACC is left as it was at the end of the last time round skipped
+    long long last_acc = body.acc.offset;
+    if (body.acc.value != VALUE_CONSTANT) {
+        last_acc += starts[body.acc.value] + steps[body.acc.value] * (long long) (rounds - 1);
+    }
+    *acc = (int) last_acc;
+
+    return rounds * length;
+}
@@ -0,0 +1,41 @@
+#include "vm/loop_detector.h"
+
+#include <string.h>
+
+
+// spreads the bits of the address out, so each cell gets an unrelated weight
+static unsigned long long mix_address(unsigned long long address) {
+    unsigned long long mixed = address + 0x9E3779B97F4A7C15ULL;
+    mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+    return mixed ^ (mixed >> 31);
+}
+
+void reset_loop_detector(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE]) {
+    // the hash is a weighted sum of the cells, so a store only has to add the change to its cell
+    detector->hash = 0;
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        detector->weights[address] = mix_address(address);
+        detector->hash += memory[address] * detector->weights[address];
+    }
+
+    forget_loop_states(detector);
+}
+
+void take_loop_checkpoint(loop_detector_st *detector, const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int from, unsigned short int to, int acc) {
+    detector->has_checkpoint = 1;
+    detector->checkpoint_hash = detector->hash;
+    detector->checkpoint_acc = acc;
+    detector->checkpoint_pc = to;
+    memcpy(detector->checkpoint_memory, memory, sizeof(detector->checkpoint_memory));
+
+    detector->since_checkpoint = 0;
+    detector->interval *= 2;
+
+    detector->low = to;
+    detector->high = from;
+}
+
+void report_loop(const loop_detector_st *detector, FILE *errors) {
+    fprintf(errors, "Error: Infinite loop, the program keeps returning to the same state between addresses %u and %u\n", detector->low, detector->high);
+}
@@ -2,9 +2,28 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
 #include "common/file_io.h"
 #include "common/executable_props.h"
-#include "vm/execution.h"
+#include "vm/interpreter.h"
+#include "vm/threaded.h"
+#include "vm/jit.h"
+#include "vm/tracing.h"
+#include "vm/lockstep.h"
+#include "vm/batch.h"
+#include "vm/sweep.h"
+#include "vm/pipeline.h"
+#include "vm/flight_recorder.h"
+#include "vm/trace_writer.h"
+#include "vm/snapshot.h"
+#include "vm/result_cache.h"
+#include "vm/server.h"
+#include "vm/host.h"
+#include "vm/bulk_loader.h"
+#include "vm/large_execution.h"
+#include "vm/profiler.h"
+#include "common/hashtable/fnv1a.h"
 #include "common/checked_alloc.h"
 
 // TODO: consider moving some parsing to common
@@ -21,9 +40,51 @@ static const unsigned short int VERSION[3] = {VERSION_MAJOR, VERSION_MINOR, VERS
 
 #define VERSION_STRING "\nLMVM v%u.%u.%u (supporting lmvm-ext %u)\nA component of the Little Man Virtual Machine.\nCopyright (c) 2023 obfuscatedgenerated\nMIT License\n\n"
 
-static int debug_mode;
+/**
+ * Represents how the VM was asked to run, as parsed from the arguments.
+ * @see vm_options_st
+ */
+struct vm_options_s {
+    int debug_mode;
+    int jit_mode;
+    int tracing_jit_mode;
 
-static char *infile_path = NULL;
+    char *infile_path;
+    char *lockstep_inputs_path;
+    char *batch_manifest_path;
+    char *pipeline_paths;
+
+    char *sweep_range;
+    char *sweep_inputs;
+    int failures_only;
+
+    char *trace_path;
+    int raw_io;
+
+    int snapshot_on_signal;
+    char *checkpoint_every;
+    char *resume_path;
+
+    char *cache_path;
+
+    int profile;
+
+    char *max_steps;
+    char *max_ms;
+    run_limits_st limits;
+    int limited;  // whether either limit was given, so limits applies
+
+    char *serve_path;
+    char *host_path;
+
+    FILE *debugout;  // where debug messages go, or NULL if debug mode is disabled
+};
+
+/**
+ * Represents how the VM was asked to run, as parsed from the arguments.
+ * @see vm_options_s
+ */
+typedef struct vm_options_s vm_options_st;
 
 static const char *NULL_DEVICE =
 #ifdef _WIN32
@@ -32,20 +93,40 @@ static const char *NULL_DEVICE =
 "/dev/null";
 #endif
 
-static FILE *debugout = NULL;
+// a sweep run that takes longer than this is counted as failing, since it has probably got stuck in a loop
+#define SWEEP_STEP_LIMIT 1000000ULL
 
 #define USAGE_STRING "%s [-h | --help] INFILE [optional-flags]\n"
-#define OPTIONS "-hvdsx"
+#define OPTIONS "-hvds:xjtl:b:w:n:fT:rp:Sc:R:C:H:m:M:P"
 static const struct option LONG_OPTIONS[] = {
         {"help",         no_argument,       NULL,         'h'},
         {"version",      no_argument,       NULL,         'v'},
-        {"debug",        no_argument, &debug_mode,        'd'},
+        {"debug",        no_argument,       NULL,         'd'},
         {"silent",       no_argument,       NULL,         'x'},
+        {"jit",          no_argument,       NULL,         'j'},
+        {"tracing-jit",  no_argument,       NULL,         't'},
+        {"lockstep",     required_argument, NULL,         'l'},
+        {"batch",        required_argument, NULL,         'b'},
+        {"sweep",        required_argument, NULL,         'w'},
+        {"sweep-inputs", required_argument, NULL,         'n'},
+        {"failures-only", no_argument,      NULL,         'f'},
+        {"trace",        required_argument, NULL,         'T'},
+        {"raw-io",       no_argument,       NULL,         'r'},
+        {"pipeline",     required_argument, NULL,         'p'},
+        {"snapshot-on-signal", no_argument, NULL,         'S'},
+        {"checkpoint-every", required_argument, NULL,     'c'},
+        {"resume",       required_argument, NULL,         'R'},
+        {"cache",        required_argument, NULL,         'C'},
+        {"serve",        required_argument, NULL,         's'},
+        {"host",         required_argument, NULL,         'H'},
+        {"max-steps",    required_argument, NULL,         'm'},
+        {"max-ms",       required_argument, NULL,         'M'},
+        {"profile",      no_argument,       NULL,         'P'},
         {NULL,           0,                 NULL,         0}
 };
 
 
-static void parse_args(int argc, char **argv) {
+static void parse_args(int argc, char **argv, vm_options_st *options) {
     int c;
     while ((c = getopt_long(argc, argv, OPTIONS, LONG_OPTIONS, NULL)) != -1) {
         switch (c) {
@@ -54,11 +135,30 @@ static void parse_args(int argc, char **argv) {
                 printf(USAGE_STRING, argv[0]);
                 puts("\n-h | --help:               Show this help message and exit");
                 puts("\nRequired positional arguments:");
-                puts("INFILE:                    The input entrypoint to assemble");
+                puts("INFILE:                    The input entrypoint to assemble, not needed with --batch, --pipeline, --resume or --serve");
                 puts("\nOptional arguments:");
                 puts("-v | --version:            Show the version number and license information");
                 puts("-d | --debug:              Enable debug mode");
                 puts("-x | --silent:             Silent mode. No output is printed to stdout or stderr");
+                puts("-j | --jit:                Compile the program to native code before running it (x86-64 only)");
+                puts("-t | --tracing-jit:        Interpret the program, compiling hot loops to native code (x86-64 only)");
+                puts("-l | --lockstep INPUTS:    Run the program once per line of INPUTS, taking that line's numbers as input, and print each run's output on one line");
+                puts("-b | --batch MANIFEST:     Run every job in MANIFEST on all cores, each line naming a program and optionally a file to take input from");
+                puts("-w | --sweep MIN:MAX:      Run the program for every combination of inputs from MIN to MAX, printing each run's inputs and outputs on one line");
+                puts("-n | --sweep-inputs COUNT: The number of inputs to sweep, after which runs stop (default 1)");
+                puts("-f | --failures-only:      Only print the sweep's runs that errored or ran for too long");
+                puts("-T | --trace OUTFILE:      Write every instruction run to OUTFILE, for analysing with lmtrace");
+                puts("-r | --raw-io:             INP and OUT read and write little endian 32 bit integers instead of text");
+                puts("-p | --pipeline A,B,...:   Run the programs at once, each one's OUT feeding the next one's INP, like A | B | ...");
+                puts("-S | --snapshot-on-signal: Save a snapshot of the run on SIGUSR2, or save one and stop on SIGINT or SIGTERM");
+                puts("-c | --checkpoint-every N: Save a snapshot of the run every N instructions");
+                puts("-R | --resume SNAPSHOT:    Carry on the run saved in SNAPSHOT, skipping the input it had already read");
+                puts("-C | --cache DIR:          Reuse the result of an earlier run of the same program on the same input, stored in DIR");
+                puts("-s | --serve SOCKET:       Listen on the Unix domain socket SOCKET, running the programs sent to it on all cores");
+                puts("-H | --host SOCKET:        Listen on the Unix domain socket SOCKET, running an interactive session of the program for each connection");
+                puts("-m | --max-steps N:        Stop the program with an error once it has run N instructions");
+                puts("-M | --max-ms T:           Stop the program with an error once it has run for T milliseconds");
+                puts("-P | --profile:            Count what every cell does, then report the hottest cells and loops, annotated from INFILE's .lmasm if it is next to it");
                 puts("");
                 exit(0);
             case 'v':
@@ -72,11 +172,67 @@ static void parse_args(int argc, char **argv) {
                 }
                 break;
             case 1:
-                infile_path = optarg;
+                options->infile_path = optarg;
                 break;
             case 'd':
-                // flag not set if using short form
-                debug_mode = 1;
+                options->debug_mode = 1;
+                break;
+            case 'j':
+                options->jit_mode = 1;
+                break;
+            case 't':
+                options->tracing_jit_mode = 1;
+                break;
+            case 'l':
+                options->lockstep_inputs_path = optarg;
+                break;
+            case 'b':
+                options->batch_manifest_path = optarg;
+                break;
+            case 'w':
+                options->sweep_range = optarg;
+                break;
+            case 'n':
+                options->sweep_inputs = optarg;
+                break;
+            case 'f':
+                options->failures_only = 1;
+                break;
+            case 'T':
+                options->trace_path = optarg;
+                break;
+            case 'r':
+                options->raw_io = 1;
+                break;
+            case 'p':
+                options->pipeline_paths = optarg;
+                break;
+            case 'S':
+                options->snapshot_on_signal = 1;
+                break;
+            case 'c':
+                options->checkpoint_every = optarg;
+                break;
+            case 'R':
+                options->resume_path = optarg;
+                break;
+            case 'C':
+                options->cache_path = optarg;
+                break;
+            case 's':
+                options->serve_path = optarg;
+                break;
+            case 'H':
+                options->host_path = optarg;
+                break;
+            case 'm':
+                options->max_steps = optarg;
+                break;
+            case 'M':
+                options->max_ms = optarg;
+                break;
+            case 'P':
+                options->profile = 1;
                 break;
             case '?':
             case ':':
@@ -85,168 +241,854 @@ static void parse_args(int argc, char **argv) {
         }
     }
 
-    // create custom stream around stdout for debug, going to null if debug mode is disabled
-    if (debug_mode) {
-        debugout = stdout;
-    } else {
-        debugout = fopen(NULL_DEVICE, "w");
+    // debug messages go to stdout, or nowhere if debug mode is disabled, without opening the null device to throw them away
+    options->debugout = options->debug_mode ? stdout : NULL;
+}
+
+// writes a debug message, if there is anywhere for it to go
+static void debug_log(FILE *debugout, const char *format, ...) {
+    if (debugout == NULL) {
+        return;
     }
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(debugout, format, args);
+    va_end(args);
 }
 
+// reads one lane per line of the inputs file, each taking the whitespace separated numbers on its line as input
+static lockstep_lane_st *read_lockstep_lanes(char *path, size_t *lane_count) {
+    char *text = read_text_file(path);
 
-// for now, the VM is just going to interpret the bytecode
-// we might add a JIT compiler later (or direct translation to native asm/machine code), but that's a little overengineered for now
-// jvm hotspot interprets and then switches to JIT if a method is called a lot
+    if (text == NULL) {
+        fprintf(stderr, "Error: Failed to read inputs file '%s'\n", path);
+        return NULL;
+    }
 
+    // a trailing newline doesn't start another lane
+    size_t line_count = 0;
+    for (char *at = text; *at != '\0'; at++) {
+        if (*at == '\n' || at[1] == '\0') {
+            line_count++;
+        }
+    }
 
-// returns 0 if execution was successful, 1 if there was an error
-int do_execution(unsigned short int memory[EXECUTABLE_SIZE]) {
-    int reg_ACC = 0; // accumulator
-    unsigned short int reg_PC = 0; // program counter
-    // MDR isn't needed since we can simply access memory[reg_MAR] directly
+    lockstep_lane_st *lanes = checked_calloc(line_count == 0 ? 1 : line_count, sizeof(lockstep_lane_st));
+    char *at = text;
 
-    execution_result_et result = EXECUTION_INDETERMINATE;
+    for (size_t lane = 0; lane < line_count; lane++) {
+        char *line_end = strchr(at, '\n');
+        if (line_end == NULL) {
+            line_end = at + strlen(at);
+        }
+
+        int *inputs = NULL;
+        size_t input_count = 0;
+
+        while (1) {
+            while (at < line_end && (*at == ' ' || *at == '\t' || *at == '\r')) {
+                at++;
+            }
+
+            if (at == line_end) {
+                break;
+            }
+
+            char *end_ptr;
+            long input = strtol(at, &end_ptr, 10);
+
+            if (end_ptr == at || end_ptr > line_end || input < INT_MIN || input > INT_MAX) {
+                fprintf(stderr, "Error: Invalid input on line %zu of inputs file '%s'\n", lane + 1, path);
 
-    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
-        // fetch
-        // a real computer would go via the MAR and MDR, but we can go straight from RAM to CIR
-        unsigned short int reg_CIR = memory[reg_PC];  // current instruction register
-        reg_PC++;
+                silent_checked_free(inputs);
+                for (size_t freed = 0; freed < lane; freed++) {
+                    silent_checked_free((int *) lanes[freed].inputs);
+                }
+                checked_free(lanes);
+                checked_free(text);
+                return NULL;
+            }
 
-        if (reg_PC > EXECUTABLE_SIZE) {
-            fprintf(stderr, "Error: Program counter out of range: %u\n", reg_PC);
-            result = EXECUTION_ERROR;
+            inputs = checked_realloc(inputs, sizeof(int) * (input_count + 1));
+            inputs[input_count++] = (int) input;
+            at = end_ptr;
         }
 
-        fprintf(debugout, "DEBUG: CIR = %u\n", reg_CIR);
+        lanes[lane].inputs = inputs;
+        lanes[lane].input_count = input_count;
 
+        at = *line_end == '\0' ? line_end : line_end + 1;
+    }
 
-        // decode
-        // opcode is first digit, operand is last two digits (stored to MAR)
-        lmc_opcode_et opcode = (lmc_opcode_et) (reg_CIR / 100);
-        unsigned short int reg_MAR = reg_CIR % 100; // memory address register
+    checked_free(text);
+
+    *lane_count = line_count;
+    return lanes;
+}
 
-        // check operand in range
-        if (reg_MAR > 99) {
-            fprintf(stderr, "Error: Operand out of range: %u\n", reg_MAR);
-            result = EXECUTION_ERROR;
+static const run_limits_st *run_limits(const vm_options_st *options) {
+    return options->limited ? &options->limits : NULL;
+}
+
+static int run_lockstep(unsigned short int memory[EXECUTABLE_SIZE], vm_options_st *options) {
+    size_t lane_count;
+    lockstep_lane_st *lanes = read_lockstep_lanes(options->lockstep_inputs_path, &lane_count);
+
+    if (lanes == NULL) {
+        return 1;
+    }
+
+    int exit_code = do_lockstep_execution(memory, lanes, lane_count, run_limits(options), NULL);
+
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        printf("%zu:", lane);
+
+        for (size_t output = 0; output < lanes[lane].output_count; output++) {
+            printf(" %d", lanes[lane].outputs[output]);
         }
 
-        // if opcode is IO_OP, check for full valid operation (INP: 901, OUT: 902)
-        if (opcode == OP_LMC_IO_OP) {
-            if (reg_CIR == 901) {
-                opcode = OP_LMC_IO_OP_INP;
-            } else if (reg_CIR == 902) {
-                opcode = OP_LMC_IO_OP_OUT;
-            } else {
-                fprintf(stderr, "Error: Invalid IO operation: %u\n", reg_CIR);
-                result = EXECUTION_ERROR;
-            }
+        puts(lanes[lane].exit_code ? " (error)" : "");
+    }
+
+    free_lockstep_outputs(lanes, lane_count);
+
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        silent_checked_free((int *) lanes[lane].inputs);
+    }
+    checked_free(lanes);
+
+    return exit_code;
+}
+
+
+// load_program found a large memory program, which has to be loaded by load_large_program instead
+#define LOAD_PROGRAM_LARGE 2
+
+// reads a program into memory, reporting why if it can't be run
+static int load_program(char *path, unsigned short int memory[EXECUTABLE_SIZE], FILE *debugout) {
+    debug_log(debugout, "DEBUG: Input file: %s\n", path);
+
+    // the file is checked and its cells loaded straight into memory in one go, as this is most of the startup of a short run
+    size_t cell_count;
+    unsigned short int ext_version;
+    load_status_et status = load_lmcx_image(path, memory, EXECUTABLE_SIZE, &cell_count, &ext_version);
+
+    // only the header has been looked at, so a classic program never pays for large ones being possible
+    if (status == LOAD_UNSUPPORTED_EXT && ext_version == EXT_LARGE_MEMORY_VERSION) {
+        return LOAD_PROGRAM_LARGE;
+    }
+
+    if (status != LOAD_SUCCESS) {
+        report_load_error(stderr, path, status, cell_count);
+        return 1;
+    }
+
+    debug_log(debugout, "DEBUG: Input file lmvm-ext version: %u\n", ext_version);
+    debug_log(debugout, "DEBUG: Loaded %zu values into memory\n", cell_count);
+    return 0;
+}
+
+// loads a large memory program into an image of its own, reporting why if it can't be run
+static int load_large_program(char *path, large_image_st *image, vm_options_st *options) {
+    // every other way of running a program works on the classic memory
+    if (options->lockstep_inputs_path != NULL || options->sweep_range != NULL || options->trace_path != NULL ||
+        options->snapshot_on_signal || options->checkpoint_every != NULL || options->cache_path != NULL || options->host_path != NULL || options->profile) {
+        fprintf(stderr, "Error: Input file '%s' is a large memory program, which can only be run on its own\n", path);
+        return 1;
+    }
+
+    if (options->jit_mode || options->tracing_jit_mode) {
+        fputs("Warning: Large memory programs are only run by the large memory engine, ignoring the JIT\n", stderr);
+    }
+
+    size_t cell_count;
+    load_status_et status = load_large_image(path, image, &cell_count);
+
+    if (status == LOAD_TOO_LARGE) {
+        fprintf(stderr, "Error: Input file '%s' is too large to fit in memory (expected %u values but got %zu)\n", path, LARGE_ADDRESS_SPACE, cell_count);
+        return 1;
+    }
+
+    if (status != LOAD_SUCCESS) {
+        report_load_error(stderr, path, status, cell_count);
+        return 1;
+    }
+
+    debug_log(options->debugout, "DEBUG: Input file lmvm-ext version: %u\n", EXT_LARGE_MEMORY_VERSION);
+    debug_log(options->debugout, "DEBUG: Loaded %zu values into large memory\n", cell_count);
+    return 0;
+}
+
+// reads a limit that has to be a positive whole number, returning 0 if it isn't
+static int parse_limit(const char *text, const char *name, unsigned long long *limit) {
+    char *end_ptr;
+    *limit = strtoull(text, &end_ptr, 10);
+
+    if (end_ptr == text || *end_ptr != '\0' || *limit == 0 || text[0] == '-') {
+        fprintf(stderr, "Error: Invalid %s '%s'\n", name, text);
+        return 0;
+    }
+
+    return 1;
+}
+
+// returns 1 if a limit was given but isn't valid
+static int parse_limits(vm_options_st *options) {
+    options->limits.max_steps = 0;
+    options->limits.max_ms = 0;
+    options->limited = options->max_steps != NULL || options->max_ms != NULL;
+
+    if (options->max_steps != NULL && !parse_limit(options->max_steps, "step limit", &options->limits.max_steps)) {
+        return 1;
+    }
+
+    if (options->max_ms != NULL && !parse_limit(options->max_ms, "time limit", &options->limits.max_ms)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+// picks the engine to run without debug tracing, warning if the one asked for isn't available
+static batch_engine_fn select_engine(vm_options_st *options) {
+    // the native code the JITs write has nowhere to check the limits, so only the threaded engine enforces them
+    if (options->limited) {
+        if (options->jit_mode || options->tracing_jit_mode) {
+            fputs("Warning: Limits are only enforced by the interpreters, using the threaded engine instead\n", stderr);
         }
 
-        fprintf(debugout, "DEBUG: Opcode = %u, Operand = %u\n", opcode, reg_MAR);
+        return do_threaded_execution;
+    }
 
+    if (options->jit_mode && jit_available()) {
+        return do_jit_execution;
+    }
+
+    if (options->tracing_jit_mode && jit_available()) {
+        return do_tracing_execution;
+    }
+
+    if (options->jit_mode || options->tracing_jit_mode) {
+        fputs("Warning: JIT is not supported on this platform, using the threaded engine instead\n", stderr);
+    }
+
+    return do_threaded_execution;
+}
 
-        // execute
-        if (result != EXECUTION_ERROR) {
-            result = execute(opcode, &reg_MAR, &reg_ACC, &reg_PC, memory);
+// skips spaces and tabs, then terminates the path found there, returning it or NULL if the line has ended
+static char *next_manifest_path(char **at) {
+    while (**at == ' ' || **at == '\t' || **at == '\r') {
+        (*at)++;
+    }
+
+    if (**at == '\0') {
+        return NULL;
+    }
+
+    char *path = *at;
+    while (**at != '\0' && **at != ' ' && **at != '\t' && **at != '\r') {
+        (*at)++;
+    }
+
+    if (**at != '\0') {
+        **at = '\0';
+        (*at)++;
+    }
+
+    return path;
+}
+
+static int run_batch(vm_options_st *options) {
+    char *text = read_text_file(options->batch_manifest_path);
+
+    if (text == NULL) {
+        fprintf(stderr, "Error: Failed to read manifest file '%s'\n", options->batch_manifest_path);
+        return 1;
+    }
+
+    size_t line_count = 1;
+    for (char *at = text; *at != '\0'; at++) {
+        if (*at == '\n') {
+            line_count++;
         }
+    }
 
-        fprintf(debugout, "DEBUG: Result = %u\n", result);
+    // every job names a program, so there can't be more programs than jobs
+    batch_job_st *jobs = checked_calloc(line_count, sizeof(batch_job_st));
+    program_load_st *programs = checked_malloc(sizeof(program_load_st) * line_count);
+    size_t job_count = 0;
 
+    // programs are found by the hash of their path, so a manifest of many different programs is still read quickly
+    size_t index_size = 1;
+    while (index_size < 2 * line_count) {
+        index_size *= 2;
+    }
+    size_t *program_index = checked_calloc(index_size, sizeof(size_t));
+
+    size_t program_count = 0;
+    int exit_code = 0;
 
-        // execute should never return EXECUTION_INDETERMINATE
-        if (result == EXECUTION_INDETERMINATE) {
-            fputs("Internal Error: Execution returned indeterminate result\n", stderr);
-            result = EXECUTION_ERROR;
+    char *line = text;
+    for (size_t line_number = 1; line != NULL && exit_code == 0; line_number++) {
+        char *line_end = strchr(line, '\n');
+        if (line_end != NULL) {
+            *line_end = '\0';
         }
 
-        // check PC change in range
-        if (result == EXECUTION_SUCCESS_BRANCHED) {
-            if (reg_PC > EXECUTABLE_SIZE) {
-                fprintf(stderr, "Error: Program counter out of range: %u\n", reg_PC);
-                result = EXECUTION_ERROR;
+        char *at = line;
+        char *program_path = next_manifest_path(&at);
+        char *input_path = next_manifest_path(&at);
+
+        line = line_end != NULL ? line_end + 1 : NULL;
+
+        // blank lines and comments aren't jobs
+        if (program_path == NULL || program_path[0] == '#') {
+            continue;
+        }
+
+        if (next_manifest_path(&at) != NULL) {
+            fprintf(stderr, "Error: Too many paths on line %zu of manifest file '%s'\n", line_number, options->batch_manifest_path);
+            exit_code = 1;
+            break;
+        }
+
+        // each program is only loaded once, however many jobs run it, with the index holding each program's number plus one
+        size_t slot = (size_t) fnv1a(program_path, strlen(program_path)) & (index_size - 1);
+        while (program_index[slot] != 0 && strcmp(programs[program_index[slot] - 1].path, program_path) != 0) {
+            slot = (slot + 1) & (index_size - 1);
+        }
+
+        if (program_index[slot] == 0) {
+            programs[program_count].path = program_path;
+            program_index[slot] = ++program_count;
+        }
+
+        jobs[job_count].image = NULL;
+        jobs[job_count].program = program_index[slot] - 1;
+        jobs[job_count].input_path = input_path;
+        jobs[job_count].limits = run_limits(options);
+        job_count++;
+    }
+
+    if (exit_code == 0) {
+        if (options->debug_mode) {
+            fputs("Warning: Jobs can't be traced in debug mode, using the normal engines instead\n", stderr);
+        }
+
+        // the programs are read in the background, and each job starts as soon as its own program has been
+        bulk_load_st load;
+        start_bulk_load(&load, programs, program_count);
+        for (size_t job = 0; job < job_count; job++) {
+            jobs[job].load = &load;
+        }
+
+        exit_code = do_batch_execution(jobs, job_count, batch_worker_count(), select_engine(options));
+        finish_bulk_load(&load);
+        debug_log(options->debugout, "DEBUG: Loaded %zu programs %s\n", program_count, load.used_io_uring ? "with io_uring" : "with blocking reads");
+
+        // results are printed in manifest order, whichever order the jobs finished in
+        for (size_t job = 0; job < job_count; job++) {
+            printf("%zu:%s\n", job, jobs[job].exit_code ? " (error)" : "");
+            fwrite(jobs[job].output, 1, jobs[job].output_size, stdout);
+
+            if (jobs[job].errors_size > 0) {
+                fflush(stdout);
+                fwrite(jobs[job].errors, 1, jobs[job].errors_size, stderr);
+                fflush(stderr);
             }
         }
 
-        if (result == EXECUTION_ERROR) {
-            fprintf(stderr, "Error occurred with PC = %u CIR = %u\n", reg_PC, reg_CIR);
+        free_batch_outputs(jobs, job_count);
+    }
+
+    checked_free(program_index);
+    checked_free(programs);
+    checked_free(jobs);
+    checked_free(text);
+
+    return exit_code;
+}
+
+static int run_pipeline(vm_options_st *options) {
+    if (!pipeline_available()) {
+        fputs("Error: Pipelines are not supported on this platform\n", stderr);
+        return 1;
+    }
+
+    size_t stage_count = 1;
+    for (const char *at = options->pipeline_paths; *at != '\0'; at++) {
+        if (*at == ',') {
+            stage_count++;
+        }
+    }
+
+    pipeline_stage_st *stages = checked_calloc(stage_count, sizeof(pipeline_stage_st));
+    unsigned short int *images = checked_malloc(sizeof(unsigned short int) * EXECUTABLE_SIZE * stage_count);
+
+    // split the list in place, the arguments being ours to write to
+    char *path = options->pipeline_paths;
+    for (size_t stage = 0; stage < stage_count; stage++) {
+        char *comma = strchr(path, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+
+        if (load_program(path, &images[stage * EXECUTABLE_SIZE], options->debugout) != 0) {
+            checked_free(images);
+            checked_free(stages);
+            return 1;
+        }
+
+        stages[stage].image = &images[stage * EXECUTABLE_SIZE];
+        stages[stage].name = path;
+
+        path = comma != NULL ? comma + 1 : NULL;
+    }
+
+    // the first stage reads on a different thread to the one that writes, so it can't flush the output while it waits
+    static output_buffer_st output_buffer;
+    static input_source_st input_source;
+    init_output_buffer(&output_buffer, stdout, options->raw_io);
+    init_input_source(&input_source, stdin, options->raw_io, NULL);
+
+    execution_io_st ends;
+    init_execution_io(&ends, stdin, stdout, stderr);
+    ends.source = &input_source;
+    ends.limits = run_limits(options);
+    if (options->raw_io || !stream_is_interactive(stdout)) {
+        ends.buffer = &output_buffer;
+    }
+
+    int exit_code = do_pipeline_execution(stages, stage_count, select_engine(options), &ends);
+
+    close_input_source(&input_source);
+    if (flush_output_buffer(&output_buffer) != 0) {
+        fputs("Error: Failed to write output\n", stderr);
+        exit_code = 1;
+    }
+
+    // errors are printed after everything has stopped, so each stage's stay together
+    for (size_t stage = 0; stage < stage_count; stage++) {
+        if (stages[stage].errors_size > 0) {
+            fprintf(stderr, "Stage %zu (%s):\n", stage, stages[stage].name);
+            fwrite(stages[stage].errors, 1, stages[stage].errors_size, stderr);
         }
     }
 
-    return result == EXECUTION_ERROR;
+    free_pipeline_errors(stages, stage_count);
+    checked_free(images);
+    checked_free(stages);
+
+    return exit_code;
 }
 
-// TODO: give debugout to other modules
+// runs the program counting everything it does, then reports where its time went, annotated from its source if it's there
+static int run_profiled(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, vm_options_st *options) {
+    // too big for the stack, and only one program is profiled at a time
+    static execution_profile_st profile;
+    int exit_code = do_profiled_execution(memory, io, &profile, NULL);
 
-int main(int argc, char **argv) {
-    parse_args(argc, argv);
+    source_map_st source;
+    const source_map_st *annotations = NULL;
+    char *source_path = source_path_for(options->infile_path);
+
+    if (file_exists_and_accessible(source_path)) {
+        if (read_source_map(source_path, profile.image, &source) == 0) {
+            annotations = &source;
+        } else {
+            fprintf(stderr, "Warning: '%s' doesn't assemble to the program, so the profile isn't annotated from it\n", source_path);
+        }
+    }
+
+    debug_log(options->debugout, "DEBUG: Profile source: %s\n", annotations != NULL ? source_path : "none");
+    write_profile_report(&profile, annotations, stderr);
+
+    if (annotations != NULL) {
+        free_source_map(&source);
+    }
+    checked_free(source_path);
+
+    return exit_code;
+}
+
+static int run_sweep(unsigned short int memory[EXECUTABLE_SIZE], vm_options_st *options) {
+    sweep_options_st sweep;
+    sweep.input_count = 1;
+    sweep.step_limit = options->limits.max_steps != 0 ? options->limits.max_steps : SWEEP_STEP_LIMIT;
+    sweep.failures_only = options->failures_only;
+
+    char *end_ptr;
+    long min = strtol(options->sweep_range, &end_ptr, 10);
+    long max = 0;
+
+    int valid = end_ptr != options->sweep_range && *end_ptr == ':';
+    if (valid) {
+        char *max_start = end_ptr + 1;
+        max = strtol(max_start, &end_ptr, 10);
+        valid = end_ptr != max_start && *end_ptr == '\0';
+    }
+
+    if (!valid || min < INT_MIN || max > INT_MAX || min > max) {
+        fprintf(stderr, "Error: Invalid sweep range '%s', expected MIN:MAX\n", options->sweep_range);
+        return 1;
+    }
+
+    sweep.min = (int) min;
+    sweep.max = (int) max;
+
+    if (options->sweep_inputs != NULL) {
+        long input_count = strtol(options->sweep_inputs, &end_ptr, 10);
+
+        if (end_ptr == options->sweep_inputs || *end_ptr != '\0' || input_count < 0) {
+            fprintf(stderr, "Error: Invalid number of sweep inputs '%s'\n", options->sweep_inputs);
+            return 1;
+        }
+
+        sweep.input_count = (size_t) input_count;
+    }
+
+    return do_sweep_execution(memory, &sweep, batch_worker_count(), stdout);
+}
+
+// traces are written by the interpreter, which only writes its debug trace as well in debug mode
+static int run_traced(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, vm_options_st *options) {
+    io->trace = open_trace_writer(options->trace_path, memory);
+
+    if (io->trace == NULL) {
+        fprintf(stderr, "Error: Failed to create trace file '%s'\n", options->trace_path);
+        return 1;
+    }
+
+    int exit_code = do_execution(memory, io, options->debug_mode ? options->debugout : NULL, NULL);
+
+    if (close_trace_writer(io->trace) != 0) {
+        fprintf(stderr, "Error: Failed to write trace file '%s'\n", options->trace_path);
+        exit_code = 1;
+    }
+    io->trace = NULL;
+
+    return exit_code;
+}
+
+// snapshots are only taken by the threaded engine, which starts from the snapshot's state if resuming
+static int run_snapshotted(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, vm_options_st *options, const vm_snapshot_st *start) {
+    static snapshot_control_st snapshots;
+    snapshots.every = 0;
+    snapshots.start = start;
+    snapshots.requested = SNAPSHOT_NONE;
+    snapshots.stopping = 0;
+    snapshots.failed = 0;
+    snapshots.stopped = 0;
+
+    if (options->checkpoint_every != NULL) {
+        char *end_ptr;
+        unsigned long long every = strtoull(options->checkpoint_every, &end_ptr, 10);
+
+        if (end_ptr == options->checkpoint_every || *end_ptr != '\0' || every == 0 || options->checkpoint_every[0] == '-') {
+            fprintf(stderr, "Error: Invalid number of instructions between checkpoints '%s'\n", options->checkpoint_every);
+            return 1;
+        }
+
+        snapshots.every = every;
+    }
+
+    if (options->debug_mode || options->jit_mode || options->tracing_jit_mode || options->trace_path != NULL
+        || options->lockstep_inputs_path != NULL || options->sweep_range != NULL) {
+        fputs("Warning: Snapshots are only taken by the threaded engine, using it instead\n", stderr);
+    }
+
+    // a resumed run keeps saving over the snapshot it came from
+    char *snapshot_path;
+    if (start != NULL) {
+        snapshot_path = checked_malloc(strlen(options->resume_path) + 1);
+        strcpy(snapshot_path, options->resume_path);
+    } else {
+        snapshot_path = checked_malloc(strlen(options->infile_path) + strlen(".snapshot") + 1);
+        strcpy(snapshot_path, options->infile_path);
+        strcat(snapshot_path, ".snapshot");
+    }
+    snapshots.path = snapshot_path;
+
+    if (start != NULL) {
+        debug_log(options->debugout, "DEBUG: Resuming at PC = %u after %llu instructions and %llu outputs\n", start->pc, start->executed, start->output_count);
 
-    // check for input file
-    fputs("DEBUG: Input file check\n", debugout);
-    if (infile_path == NULL) {
-        fputs("Error: No input file specified\n", stderr);
-        fprintf(stderr, "\nUsage: ");
-        fprintf(stderr, USAGE_STRING, argv[0]);
-        exit(1);
+        if (io->source != NULL && !skip_input_source(io->source, start->input_offset)) {
+            fprintf(stderr, "Error: Input ends before the point saved in snapshot file '%s'\n", options->resume_path);
+            checked_free(snapshot_path);
+            return 1;
+        }
+
+        io->output_count = start->output_count;
+    }
+
+    io->snapshots = &snapshots;
+    if (options->snapshot_on_signal) {
+        watch_snapshot_signals(&snapshots);
+
+        // a run waiting for input is stopped at the INP, which it runs again when it's resumed
+        if (io->source != NULL) {
+            io->source->stop = &snapshots.stopping;
+        }
+    }
+
+    int exit_code = do_threaded_execution(memory, io, NULL);
+
+    if (options->snapshot_on_signal) {
+        watch_snapshot_signals(NULL);
+        watch_flight_recorder(io->recorder);
+
+        if (io->source != NULL) {
+            io->source->stop = NULL;
+        }
     }
+    io->snapshots = NULL;
 
-    // check if the input file is a directory
-    if (is_dir(infile_path)) {
-        fprintf(stderr, "Error: Input file '%s' is a directory\n", infile_path);
-        exit(1);
+    if (snapshots.stopped) {
+        fprintf(stderr, "Stopped, run saved to snapshot file '%s'\n", snapshot_path);
+        exit_code = 1;
     }
 
-    // check input file exists
-    if (!file_exists_and_accessible(infile_path)) {
-        fprintf(stderr, "Error: Input file '%s' does not exist or cannot be opened\n", infile_path);
-        exit(1);
+    if (snapshots.failed) {
+        exit_code = 1;
     }
 
-    fprintf(debugout, "DEBUG: Input file: %s\n", infile_path);
+    checked_free(snapshot_path);
+    return exit_code;
+}
+
+// a run only depends on the program and its input, so if both are known up front, an earlier result can be used instead
+static int run_cached(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, vm_options_st *options) {
+    batch_engine_fn engine = select_engine(options);
+
+    // a limited run may stop at a different point next time, so its result doesn't only depend on the program and input
+    if (options->limited) {
+        fputs("Warning: Runs with limits aren't cached, running without the cache\n", stderr);
+        return engine(memory, io, NULL);
+    }
+
+    if (!result_cache_available()) {
+        fputs("Warning: Results can't be cached on this platform, running without the cache\n", stderr);
+        return engine(memory, io, NULL);
+    }
 
-    // read the file into a new lmcx struct
-    fputs("DEBUG: Read input file\n", debugout);
-    lmcx_file_descriptor_st *lmcx = read_lmcx_file(infile_path);
+    if (io->source == NULL || !io->source->whole) {
+        fputs("Warning: Results can only be cached when input comes from a file, running without the cache\n", stderr);
+        return engine(memory, io, NULL);
+    }
 
-    if (lmcx == NULL) {
-        fprintf(stderr, "Error: Failed to read input file '%s'\n", infile_path);
-        exit(1);
+    result_cache_st cache;
+    if (open_result_cache(&cache, options->cache_path) != 0) {
+        fprintf(stderr, "Warning: Failed to open result cache '%s', running without it\n", options->cache_path);
+        return engine(memory, io, NULL);
     }
 
-    fprintf(debugout, "DEBUG: Input file lmxm-ext version: %u\n", lmcx->ext_version);
-    if (lmcx->ext_version > EXT_SUPPORTED_VERSION) {
-        fprintf(stderr, "Error: Input file '%s' is of a newer lmvm-ext version than this VM supports\n", infile_path);
-        exit(1);
+    unsigned char key[RESULT_KEY_SIZE];
+    hash_run(key, memory, options->raw_io, io->source->data + io->source->used, io->source->size - io->source->used);
+
+    cached_result_st result;
+    int found = find_cached_result(&cache, key, &result);
+
+    if (!found) {
+        // the output is kept to be stored, and only written out once the run is over
+        FILE *output = open_batch_buffer(&result.output, &result.output_size);
+        FILE *errors = open_batch_buffer(&result.errors, &result.errors_size);
+
+        static output_buffer_st kept_output;
+        init_output_buffer(&kept_output, output, options->raw_io);
+
+        execution_io_st kept_io = *io;
+        kept_io.output = output;
+        kept_io.errors = errors;
+        kept_io.buffer = &kept_output;
+
+        result.exit_code = engine(memory, &kept_io, &result.executed);
+        flush_output_buffer(&kept_output);
+
+        close_batch_buffer(output, &result.output, &result.output_size);
+        close_batch_buffer(errors, &result.errors, &result.errors_size);
+
+        if (store_cached_result(&cache, key, &result) != 0) {
+            fprintf(stderr, "Warning: Failed to store result in cache '%s'\n", options->cache_path);
+        }
     }
 
-    fputs("DEBUG: Check data size\n", debugout);
+    fwrite(result.output, 1, result.output_size, stdout);
+    fflush(stdout);
+    fwrite(result.errors, 1, result.errors_size, stderr);
 
-    // TODO: should we separate value size and data count in the lmcx struct?
-    unsigned int data_value_count = lmcx->data_size / sizeof(unsigned short int);
+    if (found) {
+        free_cached_result(&result);
+    } else {
+        silent_checked_free(result.output);
+        silent_checked_free(result.errors);
+    }
 
-    if (data_value_count > EXECUTABLE_SIZE) {
-        fprintf(stderr, "Error: Input file '%s' is too large to fit in memory (expected %u values but got %u)\n", infile_path, EXECUTABLE_SIZE, data_value_count);
-        exit(1);
+    close_result_cache(&cache);
+    return result.exit_code;
+}
+
+// the cache only holds the results of plain runs, so a run in any other mode says it isn't using it
+static void warn_unused_cache(const vm_options_st *options) {
+    if (options->cache_path == NULL) {
+        return;
     }
 
-    fputs("DEBUG: Load into memory\n", debugout);
+    const char *mode = NULL;
 
-    unsigned short int memory[EXECUTABLE_SIZE] = {0};
-    memcpy(memory, lmcx->data, EXECUTABLE_SIZE);
+    if (options->serve_path != NULL) {
+        mode = "--serve";
+    } else if (options->batch_manifest_path != NULL) {
+        mode = "--batch";
+    } else if (options->pipeline_paths != NULL) {
+        mode = "--pipeline";
+    } else if (options->host_path != NULL) {
+        mode = "--host";
+    } else if (options->snapshot_on_signal || options->checkpoint_every != NULL || options->resume_path != NULL) {
+        mode = "snapshots";
+    } else if (options->lockstep_inputs_path != NULL) {
+        mode = "--lockstep";
+    } else if (options->sweep_range != NULL) {
+        mode = "--sweep";
+    } else if (options->trace_path != NULL) {
+        mode = "--trace";
+    } else if (options->profile) {
+        mode = "--profile";
+    } else if (options->debug_mode) {
+        mode = "--debug";
+    }
 
+    if (mode != NULL) {
+        fprintf(stderr, "Warning: Runs with %s aren't cached, running without the cache\n", mode);
+    }
+}
 
-    fputs("DEBUG: Free lmcx data\n", debugout);
-    checked_free(lmcx->data);
 
-    fputs("DEBUG: Free lmcx\n", debugout);
-    checked_free(lmcx);
+int main(int argc, char **argv) {
+    vm_options_st options = {0};
+    parse_args(argc, argv, &options);
 
+    FILE *debugout = options.debugout;
 
-    fputs("DEBUG: Start execution\n", debugout);
+    if (parse_limits(&options) != 0) {
+        return 1;
+    }
 
-    int exit_code = do_execution(memory);
-    fprintf(debugout, "DEBUG: Execution finished with exit code %d\n", exit_code);
+    warn_unused_cache(&options);
+
+    // a server is sent its programs
+    if (options.serve_path != NULL) {
+        return do_serve(options.serve_path, run_limits(&options), batch_worker_count());
+    }
+
+    // a batch names its own programs
+    if (options.batch_manifest_path != NULL) {
+        return run_batch(&options);
+    }
+
+    // so does a pipeline
+    if (options.pipeline_paths != NULL) {
+        return run_pipeline(&options);
+    }
+
+    unsigned short int memory[EXECUTABLE_SIZE];
+
+    // a large memory program is loaded here instead, and its image is only page pointers, so it's kept off the stack
+    static large_image_st large_image;
+    int large = 0;
+
+    // a resumed run's program is in its snapshot, as it was when the snapshot was taken
+    static vm_snapshot_st start;
+    if (options.resume_path != NULL) {
+        debug_log(debugout, "DEBUG: Snapshot file: %s\n", options.resume_path);
+
+        if (read_snapshot(options.resume_path, &start) != 0) {
+            fprintf(stderr, "Error: Failed to read snapshot file '%s'\n", options.resume_path);
+            exit(1);
+        }
+
+        memcpy(memory, start.memory, sizeof(memory));
+    } else {
+        // check for input file
+        debug_log(debugout, "DEBUG: Input file check\n");
+        if (options.infile_path == NULL) {
+            fputs("Error: No input file specified\n", stderr);
+            fprintf(stderr, "\nUsage: ");
+            fprintf(stderr, USAGE_STRING, argv[0]);
+            exit(1);
+        }
+
+        int loaded = load_program(options.infile_path, memory, debugout);
+
+        if (loaded == LOAD_PROGRAM_LARGE) {
+            large = 1;
+            loaded = load_large_program(options.infile_path, &large_image, &options);
+        }
+
+        if (loaded != 0) {
+            exit(1);
+        }
+    }
+
+
+    // sessions each run their own copy of the program
+    if (options.host_path != NULL) {
+        return do_host_sessions(options.host_path, memory, run_limits(&options), batch_worker_count());
+    }
+
+    debug_log(debugout, "DEBUG: Start execution\n");
+
+    execution_io_st io;
+    init_execution_io(&io, stdin, stdout, stderr);
+    io.limits = run_limits(&options);
+
+    // keep the recording somewhere the signal handlers can find it, so a run that's killed or crashes can still show how it got there
+    static flight_recorder_st recorder;
+    reset_flight_recorder(&recorder);
+    io.recorder = &recorder;
+    watch_flight_recorder(&recorder);
+
+    // output is only held back when nobody is watching it as it comes, and never in debug mode, where it's mixed with the trace
+    static output_buffer_st output_buffer;
+    static input_source_st input_source;
+    init_output_buffer(&output_buffer, stdout, options.raw_io);
+    if (options.raw_io || (!options.debug_mode && !stream_is_interactive(stdout))) {
+        io.buffer = &output_buffer;
+    }
+
+    init_input_source(&input_source, stdin, options.raw_io, io.buffer);
+    io.source = &input_source;
+
+    // the traced interpreter is only needed when debugging, otherwise use the faster engine
+    int exit_code;
+    if (large) {
+        exit_code = do_large_execution(&large_image, &io, debugout, NULL);
+        free_large_image(&large_image);
+    } else if (options.snapshot_on_signal || options.checkpoint_every != NULL || options.resume_path != NULL) {
+        exit_code = run_snapshotted(memory, &io, &options, options.resume_path != NULL ? &start : NULL);
+    } else if (options.lockstep_inputs_path != NULL) {
+        exit_code = run_lockstep(memory, &options);
+    } else if (options.sweep_range != NULL) {
+        exit_code = run_sweep(memory, &options);
+    } else if (options.trace_path != NULL) {
+        exit_code = run_traced(memory, &io, &options);
+    } else if (options.profile) {
+        exit_code = run_profiled(memory, &io, &options);
+    } else if (options.debug_mode) {
+        exit_code = do_execution(memory, &io, debugout, NULL);
+    } else if (options.cache_path != NULL) {
+        exit_code = run_cached(memory, &io, &options);
+    } else {
+        exit_code = select_engine(&options)(memory, &io, NULL);
+    }
+    debug_log(debugout, "DEBUG: Execution finished with exit code %d\n", exit_code);
+
+    close_input_source(&input_source);
+
+    if (flush_output_buffer(&output_buffer) != 0) {
+        fputs("Error: Failed to write output\n", stderr);
+        exit_code = 1;
+    }
 
     return exit_code;
 }
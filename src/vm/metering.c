@@ -0,0 +1,75 @@
+#include "vm/metering.h"
+
+#include <limits.h>
+#include <time.h>
+
+// posix has a monotonic clock, elsewhere the processor time the VM has used has to do
+#if defined(__unix__) || defined(__APPLE__)
+#define MONOTONIC_CLOCK_SUPPORTED 1
+#else
+#define MONOTONIC_CLOCK_SUPPORTED 0
+#endif
+
+
+unsigned long long monotonic_ms(void) {
+#if MONOTONIC_CLOCK_SUPPORTED
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000 + (unsigned long long) now.tv_nsec / 1000000;
+#else
+    return (unsigned long long) clock() * 1000 / CLOCKS_PER_SEC;
+#endif
+}
+
+// the next point a limit could be reached at, which for time is the next time the clock is read
+static void schedule_meter(step_meter_st *meter, unsigned long long steps) {
+    meter->due = ULLONG_MAX;
+
+    if (meter->limits->max_steps != 0) {
+        meter->due = meter->limits->max_steps;
+    }
+
+    if (meter->limits->max_ms != 0 && steps + METER_CLOCK_INTERVAL < meter->due) {
+        meter->due = steps + METER_CLOCK_INTERVAL;
+    }
+}
+
+void start_meter(step_meter_st *meter, const run_limits_st *limits) {
+    meter->limits = limits;
+    meter->exceeded = 0;
+    meter->due = ULLONG_MAX;
+
+    if (limits == NULL) {
+        return;
+    }
+
+    if (limits->max_ms != 0) {
+        meter->started_ms = monotonic_ms();
+    }
+
+    schedule_meter(meter, 0);
+}
+
+int check_meter(step_meter_st *meter, unsigned long long steps) {
+    if (meter->limits->max_steps != 0 && steps >= meter->limits->max_steps) {
+        meter->exceeded = 1;
+        return 1;
+    }
+
+    if (meter->limits->max_ms != 0 && monotonic_ms() - meter->started_ms >= meter->limits->max_ms) {
+        meter->exceeded = 2;
+        return 1;
+    }
+
+    schedule_meter(meter, steps);
+    return 0;
+}
+
+void report_limit(const step_meter_st *meter, unsigned long long steps, FILE *errors) {
+    if (meter->exceeded == 1) {
+        fprintf(errors, "Error: Step limit of %llu instructions reached after %llu instructions\n", meter->limits->max_steps, steps);
+    } else {
+        fprintf(errors, "Error: Time limit of %llu ms reached after %llu instructions\n", meter->limits->max_ms, steps);
+    }
+}
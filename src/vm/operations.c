@@ -0,0 +1,27 @@
+#include "vm/operations.h"
+
+#include <stdio.h>
+
+
+int describe_fault(char *buffer, size_t size, lmc_fault_et fault, int acc, unsigned short int mdr, unsigned short int cir, unsigned int pc) {
+    switch (fault) {
+        case FAULT_NONE:
+            return snprintf(buffer, size, "No error");
+        case FAULT_OVERFLOW:
+            return snprintf(buffer, size, "Accumulator overflow: %u + %u > %u", (unsigned int) acc, mdr, (unsigned int) INT_MAX);
+        case FAULT_UNDERFLOW:
+            return snprintf(buffer, size, "Accumulator underflow: %u - %u < %u", (unsigned int) acc, mdr, (unsigned int) INT_MIN);
+        case FAULT_OUT_OF_MEMORY_RANGE:
+            return snprintf(buffer, size, "Accumulator value out of memory range: %d", acc);
+        case FAULT_INVALID_OPCODE:
+            return snprintf(buffer, size, "Invalid opcode: %d", cir / 100);
+        case FAULT_INVALID_IO:
+            return snprintf(buffer, size, "Invalid IO operation: %u", cir);
+        case FAULT_PC_OUT_OF_RANGE:
+            return snprintf(buffer, size, "Program counter out of range: %u", pc);
+        case FAULT_OUT_OF_INPUT:
+            return snprintf(buffer, size, "Ran out of input");
+    }
+
+    return snprintf(buffer, size, "Unknown error");
+}
@@ -0,0 +1,210 @@
+#include "vm/paged_memory.h"
+#include "common/checked_alloc.h"
+#include "common/executable_props.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the program is mapped rather than read where there's mmap, so its pages can be shared
+#if defined(__unix__) || defined(__APPLE__)
+#define MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define MMAP_SUPPORTED 0
+#endif
+
+// the magic string and the version, after which each cell is 4 little endian bytes
+#define LARGE_HEADER_SIZE (sizeof(MAGIC_STRING_LMC_EXTENDED) - 1 + 2)
+
+// every page past the end of a program, and every page of a machine that hasn't written to it, reads as zeros
+static const uint32_t ZERO_PAGE[PAGE_CELLS];
+
+
+// checks the header and every cell, then points the image's pages at the cells, where they lie if mapped is set
+static load_status_et parse_large_image(const unsigned char *data, size_t size, large_image_st *image, size_t *cell_count, int mapped) {
+    size_t magic_length = sizeof(MAGIC_STRING_LMC_EXTENDED) - 1;
+
+    if (size < LARGE_HEADER_SIZE || memcmp(data, MAGIC_STRING_LMC_EXTENDED, magic_length) != 0 ||
+        (data[magic_length] | data[magic_length + 1] << 8) != EXT_LARGE_MEMORY_VERSION) {
+        return LOAD_INVALID;
+    }
+
+    const unsigned char *at = data + LARGE_HEADER_SIZE;
+
+    // trailing bytes that don't make a whole cell aren't one
+    *cell_count = (size - LARGE_HEADER_SIZE) / 4;
+
+    if (*cell_count > LARGE_ADDRESS_SPACE) {
+        return LOAD_TOO_LARGE;
+    }
+
+    // the header leaves the cells 4 byte aligned in a mapping, so whole pages of them can be used where they are,
+    // but the last page, if it is only part full, is copied so reading past the end of the file reads zeros
+    size_t image_pages = (*cell_count + PAGE_CELLS - 1) / PAGE_CELLS;
+    size_t direct_pages = mapped && machine_is_little_endian() ? *cell_count / PAGE_CELLS : 0;
+    size_t direct_cells = direct_pages * PAGE_CELLS;
+
+    if (image_pages > direct_pages) {
+        image->cells = checked_calloc((image_pages - direct_pages) * PAGE_CELLS, sizeof(uint32_t));
+    }
+
+    // every cell is checked once here, so the engine can trust whatever it reads to fit in the accumulator
+    for (size_t address = 0; address < *cell_count; address++) {
+        const unsigned char *cell = at + 4 * address;
+        uint32_t value = (uint32_t) cell[0] | (uint32_t) cell[1] << 8 | (uint32_t) cell[2] << 16 | (uint32_t) cell[3] << 24;
+
+        if (value >= LARGE_CELL_LIMIT) {
+            return LOAD_INVALID;
+        }
+
+        if (address >= direct_cells) {
+            image->cells[address - direct_cells] = value;
+        }
+    }
+
+    for (size_t page = 0; page < PAGE_COUNT; page++) {
+        if (page < direct_pages) {
+            image->pages[page] = (const uint32_t *) at + page * PAGE_CELLS;
+        } else if (page < image_pages) {
+            image->pages[page] = image->cells + (page - direct_pages) * PAGE_CELLS;
+        } else {
+            image->pages[page] = ZERO_PAGE;
+        }
+    }
+
+    image->cell_count = *cell_count;
+    return LOAD_SUCCESS;
+}
+
+load_status_et load_large_image(const char *path, large_image_st *image, size_t *cell_count) {
+    *cell_count = 0;
+    image->cell_count = 0;
+    image->mapping = NULL;
+    image->mapping_size = 0;
+    image->cells = NULL;
+
+#if MMAP_SUPPORTED
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return is_dir((char *) path) ? LOAD_IS_DIRECTORY : LOAD_CANT_OPEN;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return LOAD_CANT_OPEN;
+    }
+
+    if (S_ISDIR(file_stat.st_mode) || file_stat.st_size == 0) {
+        close(fd);
+        return S_ISDIR(file_stat.st_mode) ? LOAD_IS_DIRECTORY : LOAD_INVALID;
+    }
+
+    // the mapping is private and read only, so the page cache holds the one copy of the program every run shares
+    size_t size = (size_t) file_stat.st_size;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return LOAD_CANT_OPEN;
+    }
+
+    image->mapping = mapping;
+    image->mapping_size = size;
+
+    load_status_et status = parse_large_image(mapping, size, image, cell_count, 1);
+#else
+    if (is_dir((char *) path)) {
+        return LOAD_IS_DIRECTORY;
+    }
+
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return LOAD_CANT_OPEN;
+    }
+
+    // without a mapping, the file is only read to be copied into the image
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (file_size <= 0) {
+        fclose(file);
+        return LOAD_INVALID;
+    }
+
+    size_t size = (size_t) file_size;
+    unsigned char *data = checked_malloc(size);
+    size = fread(data, 1, size, file);
+    fclose(file);
+
+    load_status_et status = parse_large_image(data, size, image, cell_count, 0);
+    checked_free(data);
+#endif
+
+    if (status != LOAD_SUCCESS) {
+        free_large_image(image);
+    }
+
+    return status;
+}
+
+void free_large_image(large_image_st *image) {
+#if MMAP_SUPPORTED
+    if (image->mapping != NULL) {
+        munmap(image->mapping, image->mapping_size);
+    }
+#endif
+
+    silent_checked_free(image->cells);
+
+    image->mapping = NULL;
+    image->mapping_size = 0;
+    image->cells = NULL;
+}
+
+
+void init_paged_memory(paged_memory_st *memory, const large_image_st *image) {
+    memory->image = image;
+    memset(memory->directory, 0, sizeof(memory->directory));
+    memory->private_pages = 0;
+}
+
+void reset_paged_memory(paged_memory_st *memory) {
+    for (size_t table = 0; table < PAGE_DIRECTORY_SIZE; table++) {
+        if (memory->directory[table] == NULL) {
+            continue;
+        }
+
+        for (size_t page = 0; page < PAGE_TABLE_PAGES; page++) {
+            silent_checked_free(memory->directory[table]->pages[page]);
+        }
+
+        checked_free(memory->directory[table]);
+        memory->directory[table] = NULL;
+    }
+
+    memory->private_pages = 0;
+}
+
+uint32_t *copy_paged_page(paged_memory_st *memory, uint32_t page) {
+    page_table_st **table = &memory->directory[page >> PAGE_TABLE_BITS];
+
+    // a table is only made for the part of memory being written to, so a program touching a few cells costs a few KB
+    if (*table == NULL) {
+        *table = checked_calloc(1, sizeof(page_table_st));
+    }
+
+    uint32_t *cells = checked_malloc(PAGE_CELLS * sizeof(uint32_t));
+    memcpy(cells, memory->image->pages[page], PAGE_CELLS * sizeof(uint32_t));
+
+    (*table)->pages[page & (PAGE_TABLE_PAGES - 1)] = cells;
+    memory->private_pages++;
+
+    return cells;
+}
@@ -0,0 +1,332 @@
+#include "vm/pipeline.h"
+#include "vm/execution.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// stages are posix threads, and values are passed between them with the gcc atomic builtins (which clang has too)
+#if (defined(__unix__) || defined(__APPLE__)) && defined(__GNUC__)
+#define PIPELINE_SUPPORTED 1
+#include <pthread.h>
+#else
+#define PIPELINE_SUPPORTED 0
+#endif
+
+// the two ends are kept on separate cache lines, so they don't steal the line from each other on every value
+#define CACHE_LINE_SIZE 64
+
+// how many times to check a full or empty ring again before going to sleep on it
+#define RING_SPIN_LIMIT 256
+
+
+#if PIPELINE_SUPPORTED
+
+/**
+ * Represents a bounded queue of values from one VM's OUT to the next one's INP, for exactly one writer and one reader.
+ * Positions only ever count up, and are wrapped into the ring when used, so full and empty can't be confused.
+ * Each side keeps a copy of the other's position, and only loads the real one when the copy says it has to wait.
+ * @see value_ring_st
+ */
+struct value_ring_s {
+    // written by the writer
+    size_t head;
+    size_t cached_tail;
+    int writer_closed;
+    int writer_sleeping;
+    unsigned char writer_padding[CACHE_LINE_SIZE];
+
+    // written by the reader
+    size_t tail;
+    size_t cached_head;
+    int reader_closed;
+    int reader_sleeping;
+    unsigned char reader_padding[CACHE_LINE_SIZE];
+
+    // spinning only helps if the other side is running on another core at the same time
+    int spin_limit;
+
+    // for whichever side is asleep
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    int values[VALUE_RING_SIZE];
+};
+
+
+static void init_value_ring(value_ring_st *ring) {
+    ring->head = 0;
+    ring->cached_tail = 0;
+    ring->writer_closed = 0;
+    ring->tail = 0;
+    ring->cached_head = 0;
+    ring->reader_closed = 0;
+    ring->writer_sleeping = 0;
+    ring->reader_sleeping = 0;
+    ring->spin_limit = batch_worker_count() > 1 ? RING_SPIN_LIMIT : 0;
+
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->changed, NULL);
+}
+
+static void destroy_value_ring(value_ring_st *ring) {
+    pthread_cond_destroy(&ring->changed);
+    pthread_mutex_destroy(&ring->lock);
+}
+
+// wakes the other side if it is asleep, which costs nothing more than a load if it isn't
+static void wake_ring(value_ring_st *ring, int *sleeping) {
+    // sequentially consistent, so the position just stored can't be missed by a sleeper that has set its flag
+    // clearing the flag means only the first value after it fell asleep pays for waking it
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->changed);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+// waits until the other side moves its position on from seen, or closes its end
+static void wait_on_ring(value_ring_st *ring, const size_t *position, size_t seen, const int *closed, int *sleeping) {
+    for (int spin = 0; spin < ring->spin_limit; spin++) {
+        if (__atomic_load_n(position, __ATOMIC_ACQUIRE) != seen || __atomic_load_n(closed, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&ring->lock);
+
+    // the waker clears the flag, so it's set again before every check
+    while (1) {
+        __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(position, __ATOMIC_SEQ_CST) != seen || __atomic_load_n(closed, __ATOMIC_SEQ_CST)) {
+            break;
+        }
+
+        pthread_cond_wait(&ring->changed, &ring->lock);
+    }
+
+    __atomic_store_n(sleeping, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void close_ring_end(value_ring_st *ring, int *closed) {
+    pthread_mutex_lock(&ring->lock);
+    __atomic_store_n(closed, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&ring->changed);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+
+int push_ring_value(value_ring_st *ring, int value) {
+    // like writing to a closed pipe, there's no point carrying on once nobody is reading
+    if (__atomic_load_n(&ring->reader_closed, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    size_t head = ring->head;
+
+    while (head - ring->cached_tail == VALUE_RING_SIZE) {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        if (head - ring->cached_tail < VALUE_RING_SIZE) {
+            break;
+        }
+
+        if (__atomic_load_n(&ring->reader_closed, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+
+        wait_on_ring(ring, &ring->tail, ring->cached_tail, &ring->reader_closed, &ring->writer_sleeping);
+    }
+
+    ring->values[head & (VALUE_RING_SIZE - 1)] = value;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    wake_ring(ring, &ring->reader_sleeping);
+
+    return 1;
+}
+
+int pop_ring_value(value_ring_st *ring, int *value) {
+    size_t tail = ring->tail;
+
+    while (tail == ring->cached_head) {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        if (tail != ring->cached_head) {
+            break;
+        }
+
+        // the writer may have written its last values just before closing, so look once more after seeing it closed
+        if (__atomic_load_n(&ring->writer_closed, __ATOMIC_ACQUIRE)) {
+            ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+            if (tail == ring->cached_head) {
+                return 0;
+            }
+
+            break;
+        }
+
+        wait_on_ring(ring, &ring->head, tail, &ring->writer_closed, &ring->reader_sleeping);
+    }
+
+    *value = ring->values[tail & (VALUE_RING_SIZE - 1)];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    wake_ring(ring, &ring->writer_sleeping);
+
+    return 1;
+}
+
+int pipeline_available(void) {
+    return 1;
+}
+
+
+/**
+ * Represents a stage being run, with the rings on either side of it.
+ * @see pipeline_run_st
+ */
+struct pipeline_run_s {
+    pipeline_stage_st *stage;
+    batch_engine_fn engine;
+    execution_io_st io;
+
+    value_ring_st *in_ring;   // NULL for the first stage
+    value_ring_st *out_ring;  // NULL for the last stage
+
+    pthread_t thread;
+};
+
+/**
+ * Represents a stage being run, with the rings on either side of it.
+ * @see pipeline_run_s
+ */
+typedef struct pipeline_run_s pipeline_run_st;
+
+
+static void *run_stage(void *arg) {
+    pipeline_run_st *run = arg;
+    pipeline_stage_st *stage = run->stage;
+
+    FILE *errors = open_batch_buffer(&stage->errors, &stage->errors_size);
+    run->io.errors = errors;
+
+    unsigned short int memory[EXECUTABLE_SIZE];
+    memcpy(memory, stage->image, sizeof(memory));
+
+    stage->exit_code = run->engine(memory, &run->io, NULL);
+
+    // let the neighbours know, so they stop too instead of waiting forever
+    if (run->out_ring != NULL) {
+        close_ring_end(run->out_ring, &run->out_ring->writer_closed);
+    }
+    if (run->in_ring != NULL) {
+        close_ring_end(run->in_ring, &run->in_ring->reader_closed);
+    }
+
+    close_batch_buffer(errors, &stage->errors, &stage->errors_size);
+
+    return NULL;
+}
+
+int do_pipeline_execution(pipeline_stage_st *stages, size_t stage_count, batch_engine_fn engine, execution_io_st *ends) {
+    value_ring_st *rings = checked_malloc(sizeof(value_ring_st) * (stage_count - 1));
+    pipeline_run_st *runs = checked_malloc(sizeof(pipeline_run_st) * stage_count);
+
+    for (size_t ring = 0; ring + 1 < stage_count; ring++) {
+        init_value_ring(&rings[ring]);
+    }
+
+    for (size_t stage = 0; stage < stage_count; stage++) {
+        pipeline_run_st *run = &runs[stage];
+
+        stages[stage].errors = NULL;
+        stages[stage].errors_size = 0;
+        stages[stage].exit_code = 0;
+
+        run->stage = &stages[stage];
+        run->engine = engine;
+        run->in_ring = stage > 0 ? &rings[stage - 1] : NULL;
+        run->out_ring = stage + 1 < stage_count ? &rings[stage] : NULL;
+
+        // only the ends touch the outside world, and every stage gets its own errors once it starts
+        init_execution_io(&run->io, ends->input, ends->output, ends->errors);
+        run->io.in_ring = run->in_ring;
+        run->io.out_ring = run->out_ring;
+        run->io.source = stage == 0 ? ends->source : NULL;
+        run->io.buffer = stage + 1 == stage_count ? ends->buffer : NULL;
+        run->io.limits = ends->limits;
+    }
+
+    // every stage has to be running at once, or a full ring would never drain
+    size_t started = 0;
+    while (started < stage_count && pthread_create(&runs[started].thread, NULL, run_stage, &runs[started]) == 0) {
+        started++;
+    }
+
+    int exit_code = 0;
+
+    if (started < stage_count) {
+        fputs("Error: Failed to start a thread for every stage of the pipeline\n", ends->errors);
+        exit_code = 1;
+
+        // the last stage that started would wait forever on the first that didn't, so stop it at its next OUT
+        if (started > 0) {
+            close_ring_end(&rings[started - 1], &rings[started - 1].reader_closed);
+        }
+    }
+
+    for (size_t stage = 0; stage < started; stage++) {
+        pthread_join(runs[stage].thread, NULL);
+        exit_code |= stages[stage].exit_code;
+    }
+
+    for (size_t ring = 0; ring + 1 < stage_count; ring++) {
+        destroy_value_ring(&rings[ring]);
+    }
+
+    checked_free(runs);
+    checked_free(rings);
+
+    return exit_code;
+}
+
+#else
+
+int push_ring_value(value_ring_st *ring, int value) {
+    (void) ring;
+    (void) value;
+    return 0;
+}
+
+int pop_ring_value(value_ring_st *ring, int *value) {
+    (void) ring;
+    (void) value;
+    return 0;
+}
+
+int pipeline_available(void) {
+    return 0;
+}
+
+int do_pipeline_execution(pipeline_stage_st *stages, size_t stage_count, batch_engine_fn engine, execution_io_st *ends) {
+    (void) engine;
+
+    for (size_t stage = 0; stage < stage_count; stage++) {
+        stages[stage].errors = NULL;
+        stages[stage].errors_size = 0;
+        stages[stage].exit_code = 1;
+    }
+
+    fputs("Error: Pipelines are not supported on this platform\n", ends->errors);
+    return 1;
+}
+
+#endif
+
+void free_pipeline_errors(pipeline_stage_st *stages, size_t stage_count) {
+    for (size_t stage = 0; stage < stage_count; stage++) {
+        silent_checked_free(stages[stage].errors);
+    }
+}
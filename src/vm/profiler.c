@@ -0,0 +1,371 @@
+#include "vm/profiler.h"
+#include "vm/flight_recorder.h"
+#include "vm/loop_detector.h"
+#include "vm/loop_accelerator.h"
+#include "vm/metering.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+// must be in the same order as decoded_handler_e, up to HANDLER_INVALID
+static const char *const MNEMONICS[] = {"HLT", "ADD", "SUB", "STA", "LDA", "BRA", "BRZ", "BRP", "INP", "OUT", "???"};
+
+// long enough for any line of code the report shows, which is cut short past this
+#define CODE_WIDTH 24
+
+
+// counts the times round a counting loop that were skipped, which all run every cell of it and take its branch back
+static void count_skipped_rounds(execution_profile_st *profile, const unsigned short int memory[EXECUTABLE_SIZE], unsigned short int head, unsigned short int tail, unsigned long long skipped) {
+    unsigned long long rounds = skipped / (unsigned long long) (tail - head + 1);
+
+    for (unsigned short int address = head; address <= tail; address++) {
+        decoded_instruction_st instruction = decode_instruction(memory[address]);
+
+        profile->executions[address] += rounds;
+        profile->handlers[instruction.handler] += rounds;
+
+        if (instruction.handler == HANDLER_STA) {
+            profile->writes[instruction.operand] += rounds;
+        } else if (instruction.handler == HANDLER_LDA || instruction.handler == HANDLER_ADD || instruction.handler == HANDLER_SUB) {
+            profile->reads[instruction.operand] += rounds;
+        }
+    }
+
+    // a branch out of the loop is never taken on a time round that was skipped
+    profile->taken[tail] += rounds;
+}
+
+
+int do_profiled_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, execution_profile_st *profile, unsigned long long *executed) {
+    memset(profile, 0, sizeof(execution_profile_st));
+    memcpy(profile->image, memory, sizeof(profile->image));
+
+    int reg_ACC = 0;
+    unsigned short int reg_PC = 0;
+    unsigned long long steps = 0;
+
+    // superinstructions aren't fused, so every cell is counted on its own
+    instruction_cache_st cache;
+    decode_image(&cache, memory, 0);
+
+    flight_recorder_st own_recorder;
+    flight_recorder_st *recorder = io->recorder != NULL ? io->recorder : &own_recorder;
+    unsigned long long recorded = 0;
+    reset_flight_recorder(recorder);
+
+    loop_detector_st detector;
+    reset_loop_detector(&detector, memory);
+
+    loop_accelerator_st accelerator;
+    find_counting_loops(&accelerator, memory);
+
+    step_meter_st meter;
+    start_meter(&meter, io->limits);
+
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
+        decoded_instruction_st instruction = cache.ops[reg_PC];
+
+        if (instruction.handler == HANDLER_REDECODE) {
+            instruction = redecode_cell(&cache, memory, reg_PC);
+        }
+
+        unsigned short int address = reg_PC;
+        unsigned short int mdr;
+        reg_PC++;
+        steps++;
+
+        profile->executions[address]++;
+        profile->handlers[instruction.handler]++;
+
+        // the common instructions are run here, so counting is all profiling adds to them
+        // IO, invalid instructions and anything that would raise an error go through execute, so behaviour matches the interpreter
+        switch (instruction.handler) {
+            case HANDLER_ADD:
+                mdr = memory[instruction.operand];
+                profile->reads[instruction.operand]++;
+
+                if (reg_ACC > INT_MAX - mdr) {
+                    result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+                    break;
+                }
+
+                reg_ACC += mdr;
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case HANDLER_SUB:
+                mdr = memory[instruction.operand];
+                profile->reads[instruction.operand]++;
+
+                if (reg_ACC < INT_MIN + mdr) {
+                    result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+                    break;
+                }
+
+                reg_ACC -= mdr;
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case HANDLER_STA:
+                if (reg_ACC < 0 || reg_ACC > 999) {
+                    result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+                    break;
+                }
+
+                profile->writes[instruction.operand]++;
+                note_loop_store(&detector, memory, instruction.operand, (unsigned short int) reg_ACC);
+                memory[instruction.operand] = (unsigned short int) reg_ACC;
+                invalidate_cell(&cache, instruction.operand);
+                result = EXECUTION_SUCCESS_ACC_UNCHANGED;
+                break;
+            case HANDLER_LDA:
+                profile->reads[instruction.operand]++;
+                reg_ACC = memory[instruction.operand];
+                result = EXECUTION_SUCCESS_ACC_CHANGED;
+                break;
+            case HANDLER_BRA:
+            case HANDLER_BRZ:
+            case HANDLER_BRP:
+                if ((instruction.handler == HANDLER_BRZ && reg_ACC != 0) || (instruction.handler == HANDLER_BRP && reg_ACC < 0)) {
+                    result = EXECUTION_SUCCESS_ACC_UNCHANGED;
+                    break;
+                }
+
+                profile->taken[address]++;
+                reg_PC = instruction.operand;
+                result = EXECUTION_SUCCESS_BRANCHED;
+                break;
+            case HANDLER_HLT:
+                result = EXECUTION_HALT;
+                break;
+            default:
+                result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+                break;
+        }
+
+        record_flight(recorder, recorded++, address, instruction.cir, reg_ACC, result);
+
+        // input can send the program somewhere new, and a program writing output is doing something, wherever it goes
+        // going back round is where counting loops are skipped as the threaded engine skips them, counting the rounds in one
+        // go, and where a program that never halts is caught and limits are checked
+        if (instruction.handler == HANDLER_INP || instruction.handler == HANDLER_OUT) {
+            forget_loop_states(&detector);
+        } else if (result == EXECUTION_SUCCESS_BRANCHED && reg_PC <= address) {
+            unsigned long long skipped = skip_loop_iterations(&accelerator, memory, address, &reg_ACC, &cache, &detector, meter.due > steps ? meter.due - steps : 0);
+
+            if (skipped != 0) {
+                steps += skipped;
+                count_skipped_rounds(profile, memory, reg_PC, address, skipped);
+                record_flight_skip(recorder, recorded++, reg_PC, address, reg_ACC);
+            }
+
+            if (check_loop_state(&detector, memory, address, reg_PC, reg_ACC)) {
+                report_loop(&detector, io->errors);
+                result = EXECUTION_ERROR;
+            } else if (steps >= meter.due && check_meter(&meter, steps) != 0) {
+                report_limit(&meter, steps, io->errors);
+                result = EXECUTION_ERROR;
+            }
+        }
+
+        if (result == EXECUTION_ERROR) {
+            fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, instruction.cir);
+            dump_flight_recorder(recorder, io->errors);
+        }
+    }
+
+    flush_execution_io(io);
+
+    profile->steps = steps;
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
+
+
+// orders the cells with a count by it, highest first and lowest address first between equals, returning how many there are
+static size_t rank_cells(const unsigned long long *counts, size_t ranked[EXECUTABLE_SIZE]) {
+    size_t ranked_count = 0;
+
+    for (size_t address = 0; address < EXECUTABLE_SIZE; address++) {
+        if (counts[address] == 0) {
+            continue;
+        }
+
+        size_t at = ranked_count++;
+        while (at > 0 && counts[ranked[at - 1]] < counts[address]) {
+            ranked[at] = ranked[at - 1];
+            at--;
+        }
+
+        ranked[at] = address;
+    }
+
+    return ranked_count;
+}
+
+static double percentage(unsigned long long count, unsigned long long total) {
+    return total == 0 ? 0.0 : (double) count * 100.0 / (double) total;
+}
+
+// writes the address, source line, label and code of a cell, or what it held when loaded where there's no source for it,
+// as an instruction, or as a value if it is being shown as data
+static void write_cell(const execution_profile_st *profile, const source_map_st *source, size_t address, int as_data, FILE *stream) {
+    if (source != NULL && address < source->cell_count) {
+        fprintf(stream, "  %4zu %5u  %-10.10s %-*.*s", address, source->lines[address],
+                source->labels[address] != NULL ? source->labels[address] : "", CODE_WIDTH, CODE_WIDTH, source->code[address]);
+        return;
+    }
+
+    decoded_instruction_st instruction = decode_instruction(profile->image[address]);
+    unsigned char handler = instruction.handler <= HANDLER_INVALID ? instruction.handler : HANDLER_INVALID;
+
+    char code[CODE_WIDTH + 1];
+    if (as_data) {
+        snprintf(code, sizeof(code), "DAT %u", profile->image[address]);
+    } else if (handler == HANDLER_HLT || handler == HANDLER_INP || handler == HANDLER_OUT || handler == HANDLER_INVALID) {
+        snprintf(code, sizeof(code), "%s (%u)", MNEMONICS[handler], profile->image[address]);
+    } else {
+        snprintf(code, sizeof(code), "%s %u (%u)", MNEMONICS[handler], instruction.operand, profile->image[address]);
+    }
+
+    fprintf(stream, "  %4zu %5s  %-10s %-*s", address, "-", "", CODE_WIDTH, code);
+}
+
+static void write_cell_header(FILE *stream) {
+    fprintf(stream, "  %4s %5s  %-10s %-*s", "cell", "line", "label", CODE_WIDTH, "code");
+}
+
+static void write_hot_cells(const execution_profile_st *profile, const source_map_st *source, FILE *stream) {
+    size_t ranked[EXECUTABLE_SIZE];
+    size_t ranked_count = rank_cells(profile->executions, ranked);
+
+    fputs("\nHottest cells:\n", stream);
+    write_cell_header(stream);
+    fprintf(stream, " %14s %7s\n", "runs", "%");
+
+    for (size_t rank = 0; rank < ranked_count && rank < PROFILE_TOP_COUNT; rank++) {
+        size_t address = ranked[rank];
+
+        write_cell(profile, source, address, 0, stream);
+        fprintf(stream, " %14llu %6.2f%%\n", profile->executions[address], percentage(profile->executions[address], profile->steps));
+    }
+}
+
+static void write_hot_data(const execution_profile_st *profile, const source_map_st *source, FILE *stream) {
+    unsigned long long accesses[EXECUTABLE_SIZE];
+    for (size_t address = 0; address < EXECUTABLE_SIZE; address++) {
+        accesses[address] = profile->reads[address] + profile->writes[address];
+    }
+
+    size_t ranked[EXECUTABLE_SIZE];
+    size_t ranked_count = rank_cells(accesses, ranked);
+
+    if (ranked_count == 0) {
+        return;
+    }
+
+    fputs("\nMost used data:\n", stream);
+    write_cell_header(stream);
+    fprintf(stream, " %14s %14s\n", "reads", "writes");
+
+    for (size_t rank = 0; rank < ranked_count && rank < PROFILE_TOP_COUNT; rank++) {
+        size_t address = ranked[rank];
+
+        write_cell(profile, source, address, 1, stream);
+        fprintf(stream, " %14llu %14llu\n", profile->reads[address], profile->writes[address]);
+    }
+}
+
+static int is_branch(unsigned short int cell) {
+    unsigned char handler = decode_instruction(cell).handler;
+    return handler == HANDLER_BRA || handler == HANDLER_BRZ || handler == HANDLER_BRP;
+}
+
+static void write_branches(const execution_profile_st *profile, const source_map_st *source, FILE *stream) {
+    int any = 0;
+
+    for (size_t address = 0; address < EXECUTABLE_SIZE; address++) {
+        if (profile->executions[address] == 0 || !is_branch(profile->image[address])) {
+            continue;
+        }
+
+        if (!any) {
+            fputs("\nBranches:\n", stream);
+            write_cell_header(stream);
+            fprintf(stream, " %14s %14s\n", "taken", "not taken");
+            any = 1;
+        }
+
+        write_cell(profile, source, address, 0, stream);
+        fprintf(stream, " %14llu %14llu\n", profile->taken[address], profile->executions[address] - profile->taken[address]);
+    }
+}
+
+// a loop is a branch back to an address at or before it, whose body is every cell from there to the branch
+static void write_loops(const execution_profile_st *profile, const source_map_st *source, FILE *stream) {
+    unsigned long long instructions[EXECUTABLE_SIZE] = {0};
+
+    for (size_t address = 0; address < EXECUTABLE_SIZE; address++) {
+        if (profile->taken[address] == 0 || !is_branch(profile->image[address])) {
+            continue;
+        }
+
+        size_t target = decode_instruction(profile->image[address]).operand;
+
+        if (target > address) {
+            continue;
+        }
+
+        for (size_t cell = target; cell <= address; cell++) {
+            instructions[address] += profile->executions[cell];
+        }
+    }
+
+    size_t ranked[EXECUTABLE_SIZE];
+    size_t ranked_count = rank_cells(instructions, ranked);
+
+    if (ranked_count == 0) {
+        return;
+    }
+
+    fputs("\nLoops, by the branch back to their start:\n", stream);
+    write_cell_header(stream);
+    fprintf(stream, " %5s %14s %14s %7s\n", "start", "times round", "instructions", "%");
+
+    for (size_t rank = 0; rank < ranked_count && rank < PROFILE_TOP_COUNT; rank++) {
+        size_t address = ranked[rank];
+
+        write_cell(profile, source, address, 0, stream);
+        fprintf(stream, " %5u %14llu %14llu %6.2f%%\n", decode_instruction(profile->image[address]).operand, profile->taken[address],
+                instructions[address], percentage(instructions[address], profile->steps));
+    }
+}
+
+static void write_instruction_kinds(const execution_profile_st *profile, FILE *stream) {
+    fputs("\nInstructions by kind:\n", stream);
+
+    for (int handler = HANDLER_HLT; handler <= HANDLER_INVALID; handler++) {
+        // running off the end of memory is counted as running an invalid instruction
+        unsigned long long count = profile->handlers[handler] + (handler == HANDLER_INVALID ? profile->handlers[HANDLER_PC_OUT_OF_RANGE] : 0);
+
+        if (count != 0) {
+            fprintf(stream, "  %-4s %14llu %6.2f%%\n", MNEMONICS[handler], count, percentage(count, profile->steps));
+        }
+    }
+}
+
+void write_profile_report(const execution_profile_st *profile, const source_map_st *source, FILE *stream) {
+    fprintf(stream, "\nProfile of %llu instructions:\n", profile->steps);
+
+    write_hot_cells(profile, source, stream);
+    write_loops(profile, source, stream);
+    write_branches(profile, source, stream);
+    write_hot_data(profile, source, stream);
+    write_instruction_kinds(profile, stream);
+}
@@ -0,0 +1,443 @@
+#include "vm/result_cache.h"
+#include "common/file_io.h"
+#include "common/checked_alloc.h"
+
+#include <string.h>
+
+// appends rely on O_APPEND and lookups on mmap, so the cache needs posix files
+#if defined(__unix__) || defined(__APPLE__)
+#define RESULT_CACHE_SUPPORTED 1
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define RESULT_CACHE_SUPPORTED 0
+#endif
+
+#define RESULT_RECORD_MAGIC "LMRC"
+
+// magic, exit code, key, data offset, output size, errors size, instructions run, checksum
+#define RESULT_RECORD_SIZE (4 + 4 + RESULT_KEY_SIZE + 8 + 8 + 8 + 8 + 8)
+
+// the checksum covers everything in the record before it, and the data it points to
+#define RESULT_CHECKSUM_OFFSET (RESULT_RECORD_SIZE - 8)
+
+
+/**
+ * Represents a SHA-256 hash part way through being worked out.
+ * @see sha256_st
+ */
+struct sha256_s {
+    unsigned int state[8];
+    unsigned long long length;  // bytes hashed so far
+    unsigned char block[64];
+    size_t used;                // bytes of block filled
+};
+
+/**
+ * Represents a SHA-256 hash part way through being worked out.
+ * @see sha256_s
+ */
+typedef struct sha256_s sha256_st;
+
+static const unsigned int SHA256_ROUNDS[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static unsigned int rotate_right(unsigned int value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_init(sha256_st *hash) {
+    static const unsigned int INITIAL_STATE[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(hash->state, INITIAL_STATE, sizeof(hash->state));
+    hash->length = 0;
+    hash->used = 0;
+}
+
+static void sha256_block(sha256_st *hash, const unsigned char block[64]) {
+    unsigned int words[64];
+
+    for (int word = 0; word < 16; word++) {
+        words[word] = (unsigned int) block[word * 4] << 24 | (unsigned int) block[word * 4 + 1] << 16
+                      | (unsigned int) block[word * 4 + 2] << 8 | (unsigned int) block[word * 4 + 3];
+    }
+
+    for (int word = 16; word < 64; word++) {
+        unsigned int s0 = rotate_right(words[word - 15], 7) ^ rotate_right(words[word - 15], 18) ^ (words[word - 15] >> 3);
+        unsigned int s1 = rotate_right(words[word - 2], 17) ^ rotate_right(words[word - 2], 19) ^ (words[word - 2] >> 10);
+        words[word] = words[word - 16] + s0 + words[word - 7] + s1;
+    }
+
+    unsigned int a = hash->state[0], b = hash->state[1], c = hash->state[2], d = hash->state[3];
+    unsigned int e = hash->state[4], f = hash->state[5], g = hash->state[6], h = hash->state[7];
+
+    for (int round = 0; round < 64; round++) {
+        unsigned int s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+        unsigned int choice = (e & f) ^ (~e & g);
+        unsigned int t1 = h + s1 + choice + SHA256_ROUNDS[round] + words[round];
+        unsigned int s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+        unsigned int majority = (a & b) ^ (a & c) ^ (b & c);
+        unsigned int t2 = s0 + majority;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    hash->state[0] += a;
+    hash->state[1] += b;
+    hash->state[2] += c;
+    hash->state[3] += d;
+    hash->state[4] += e;
+    hash->state[5] += f;
+    hash->state[6] += g;
+    hash->state[7] += h;
+}
+
+static void sha256_update(sha256_st *hash, const void *data, size_t size) {
+    const unsigned char *at = data;
+    hash->length += size;
+
+    while (size > 0) {
+        // whole blocks are hashed straight from the data, without copying them
+        if (hash->used == 0 && size >= 64) {
+            sha256_block(hash, at);
+            at += 64;
+            size -= 64;
+            continue;
+        }
+
+        size_t taken = 64 - hash->used < size ? 64 - hash->used : size;
+        memcpy(&hash->block[hash->used], at, taken);
+        hash->used += taken;
+        at += taken;
+        size -= taken;
+
+        if (hash->used == 64) {
+            sha256_block(hash, hash->block);
+            hash->used = 0;
+        }
+    }
+}
+
+static void sha256_final(sha256_st *hash, unsigned char digest[RESULT_KEY_SIZE]) {
+    unsigned long long bits = hash->length * 8;
+
+    // a 1 bit, then zeros up to the last 8 bytes of a block, which hold the length in bits
+    unsigned char padding[72] = {0x80};
+    size_t padding_size = hash->used < 56 ? 56 - hash->used : 120 - hash->used;
+
+    for (int byte = 0; byte < 8; byte++) {
+        padding[padding_size + byte] = (unsigned char) (bits >> (56 - byte * 8));
+    }
+
+    sha256_update(hash, padding, padding_size + 8);
+
+    for (int word = 0; word < 8; word++) {
+        digest[word * 4] = (unsigned char) (hash->state[word] >> 24);
+        digest[word * 4 + 1] = (unsigned char) (hash->state[word] >> 16);
+        digest[word * 4 + 2] = (unsigned char) (hash->state[word] >> 8);
+        digest[word * 4 + 3] = (unsigned char) hash->state[word];
+    }
+}
+
+
+void hash_run(unsigned char key[RESULT_KEY_SIZE], const unsigned short int image[EXECUTABLE_SIZE], int raw_io, const unsigned char *input, size_t input_size) {
+    // the image is hashed in the same byte order on every machine, so a cache can be shared between them
+    unsigned char header[8 + 1 + EXECUTABLE_SIZE * 2];
+    unsigned char *at = header;
+
+    memcpy(at, "LMVMRUN1", 8);
+    at += 8;
+    *at++ = (unsigned char) (raw_io != 0);
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        at = store_little_endian(at, &image[address], sizeof(image[address]));
+    }
+
+    sha256_st hash;
+    sha256_init(&hash);
+    sha256_update(&hash, header, sizeof(header));
+    sha256_update(&hash, input, input_size);
+    sha256_final(&hash, key);
+}
+
+static unsigned long long checksum_result(const unsigned char record[RESULT_RECORD_SIZE], const char *output, size_t output_size, const char *errors, size_t errors_size) {
+    unsigned char digest[RESULT_KEY_SIZE];
+
+    sha256_st hash;
+    sha256_init(&hash);
+    sha256_update(&hash, record, RESULT_CHECKSUM_OFFSET);
+    sha256_update(&hash, output, output_size);
+    sha256_update(&hash, errors, errors_size);
+    sha256_final(&hash, digest);
+
+    unsigned long long checksum;
+    load_little_endian(digest, &checksum, sizeof(checksum));
+    return checksum;
+}
+
+
+#if RESULT_CACHE_SUPPORTED
+
+int result_cache_available(void) {
+    return 1;
+}
+
+static char *join_path(const char *directory, const char *name) {
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(name);
+
+    char *path = checked_malloc(directory_length + 1 + name_length + 1);
+    memcpy(path, directory, directory_length);
+    path[directory_length] = '/';
+    memcpy(path + directory_length + 1, name, name_length + 1);
+
+    return path;
+}
+
+int open_result_cache(result_cache_st *cache, const char *directory) {
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        return 1;
+    }
+
+    struct stat info;
+    if (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return 1;
+    }
+
+    cache->index_path = join_path(directory, "index");
+    cache->data_path = join_path(directory, "data");
+
+    return 0;
+}
+
+void close_result_cache(result_cache_st *cache) {
+    checked_free(cache->index_path);
+    checked_free(cache->data_path);
+}
+
+// reads a result from the data file, returning 0 if it isn't all there yet or doesn't match its checksum
+static int read_result(int data_fd, const unsigned char *record, cached_result_st *result) {
+    unsigned long long offset, output_size, errors_size, checksum;
+    load_little_endian(record + 4 + 4 + RESULT_KEY_SIZE, &offset, sizeof(offset));
+    load_little_endian(record + 4 + 4 + RESULT_KEY_SIZE + 8, &output_size, sizeof(output_size));
+    load_little_endian(record + 4 + 4 + RESULT_KEY_SIZE + 16, &errors_size, sizeof(errors_size));
+    load_little_endian(record + RESULT_CHECKSUM_OFFSET, &checksum, sizeof(checksum));
+
+    // a record can't point past the end of the data, unless it's been damaged
+    struct stat info;
+    if (fstat(data_fd, &info) != 0 || offset > (unsigned long long) info.st_size
+        || output_size > (unsigned long long) info.st_size - offset
+        || errors_size > (unsigned long long) info.st_size - offset - output_size) {
+        return 0;
+    }
+
+    size_t size = (size_t) (output_size + errors_size);
+    char *data = checked_malloc(size > 0 ? size : 1);
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t read_size = pread(data_fd, data + got, size - got, (off_t) (offset + got));
+
+        if (read_size <= 0) {
+            checked_free(data);
+            return 0;
+        }
+
+        got += (size_t) read_size;
+    }
+
+    if (checksum_result(record, data, (size_t) output_size, data + output_size, (size_t) errors_size) != checksum) {
+        checked_free(data);
+        return 0;
+    }
+
+    // the output and errors share the one allocation, which is freed through output
+    int exit_code;
+    load_little_endian(record + 4, &exit_code, sizeof(exit_code));
+    load_little_endian(record + 4 + 4 + RESULT_KEY_SIZE + 24, &result->executed, sizeof(result->executed));
+
+    result->output = data;
+    result->output_size = (size_t) output_size;
+    result->errors = data + output_size;
+    result->errors_size = (size_t) errors_size;
+    result->exit_code = exit_code;
+
+    return 1;
+}
+
+int find_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], cached_result_st *result) {
+    int index_fd = open(cache->index_path, O_RDONLY);
+
+    if (index_fd == -1) {
+        return 0;
+    }
+
+    struct stat info;
+    if (fstat(index_fd, &info) != 0 || info.st_size < RESULT_RECORD_SIZE) {
+        close(index_fd);
+        return 0;
+    }
+
+    // only whole records, since another process may be part way through appending one
+    size_t record_count = (size_t) info.st_size / RESULT_RECORD_SIZE;
+    size_t mapping_size = record_count * RESULT_RECORD_SIZE;
+
+    const unsigned char *records = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, index_fd, 0);
+    close(index_fd);
+
+    if (records == MAP_FAILED) {
+        return 0;
+    }
+
+    int found = 0;
+    int data_fd = -1;
+
+    // newest first, so a result stored again replaces the old one
+    for (size_t record = record_count; record > 0 && !found; record--) {
+        const unsigned char *at = &records[(record - 1) * RESULT_RECORD_SIZE];
+
+        if (memcmp(at, RESULT_RECORD_MAGIC, 4) != 0 || memcmp(at + 8, key, RESULT_KEY_SIZE) != 0) {
+            continue;
+        }
+
+        if (data_fd == -1) {
+            data_fd = open(cache->data_path, O_RDONLY);
+
+            if (data_fd == -1) {
+                break;
+            }
+        }
+
+        found = read_result(data_fd, at, result);
+    }
+
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+
+    munmap((void *) records, mapping_size);
+    return found;
+}
+
+// appends in one write, returning where the data ended up, or -1 if it couldn't be written
+static long long append_file(const char *path, const void *data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (fd == -1) {
+        return -1;
+    }
+
+    ssize_t written = write(fd, data, size);
+
+    // appending moves the offset to the end first, so it now sits just after what was written
+    off_t end = lseek(fd, 0, SEEK_CUR);
+
+    if (close(fd) != 0 || written != (ssize_t) size || end < (off_t) size) {
+        return -1;
+    }
+
+    return (long long) end - (long long) size;
+}
+
+int store_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], const cached_result_st *result) {
+    // the output and errors go in one write, so nothing else can land between them
+    size_t size = result->output_size + result->errors_size;
+    char *data = checked_malloc(size > 0 ? size : 1);
+    if (result->output_size > 0) {
+        memcpy(data, result->output, result->output_size);
+    }
+    if (result->errors_size > 0) {
+        memcpy(data + result->output_size, result->errors, result->errors_size);
+    }
+
+    long long offset = append_file(cache->data_path, data, size);
+    checked_free(data);
+
+    if (offset < 0) {
+        return 1;
+    }
+
+    unsigned long long data_offset = (unsigned long long) offset;
+    unsigned long long output_size = result->output_size;
+    unsigned long long errors_size = result->errors_size;
+
+    unsigned char record[RESULT_RECORD_SIZE];
+    unsigned char *at = record;
+
+    memcpy(at, RESULT_RECORD_MAGIC, 4);
+    at += 4;
+    at = store_little_endian(at, &result->exit_code, sizeof(result->exit_code));
+    memcpy(at, key, RESULT_KEY_SIZE);
+    at += RESULT_KEY_SIZE;
+    at = store_little_endian(at, &data_offset, sizeof(data_offset));
+    at = store_little_endian(at, &output_size, sizeof(output_size));
+    at = store_little_endian(at, &errors_size, sizeof(errors_size));
+    at = store_little_endian(at, &result->executed, sizeof(result->executed));
+
+    unsigned long long checksum = checksum_result(record, result->output, result->output_size, result->errors, result->errors_size);
+    store_little_endian(at, &checksum, sizeof(checksum));
+
+    // the record is only appended once its data is in place
+    return append_file(cache->index_path, record, sizeof(record)) < 0;
+}
+
+#else
+
+int result_cache_available(void) {
+    return 0;
+}
+
+int open_result_cache(result_cache_st *cache, const char *directory) {
+    (void) directory;
+
+    cache->index_path = NULL;
+    cache->data_path = NULL;
+    return 1;
+}
+
+void close_result_cache(result_cache_st *cache) {
+    (void) cache;
+}
+
+int find_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], cached_result_st *result) {
+    (void) cache;
+    (void) key;
+    (void) result;
+    return 0;
+}
+
+int store_cached_result(const result_cache_st *cache, const unsigned char key[RESULT_KEY_SIZE], const cached_result_st *result) {
+    (void) cache;
+    (void) key;
+    (void) result;
+    return 1;
+}
+
+#endif
+
+void free_cached_result(cached_result_st *result) {
+    // errors share the allocation of output
+    silent_checked_free(result->output);
+    result->output = NULL;
+    result->errors = NULL;
+}
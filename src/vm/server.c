@@ -0,0 +1,388 @@
+#include "vm/server.h"
+#include "vm/batch.h"
+#include "liblmvm/lmvm.h"
+#include "common/file_io.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the server needs unix domain sockets, and threads to serve more than one connection at once
+#if defined(__unix__) || defined(__APPLE__)
+#define SERVE_SUPPORTED 1
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#else
+#define SERVE_SUPPORTED 0
+#endif
+
+#if SERVE_SUPPORTED
+
+/**
+ * Represents the listening socket, shared by every worker.
+ * @see server_st
+ */
+struct server_s {
+    int listen_fd;
+    const run_limits_st *limits;
+};
+
+/**
+ * Represents the listening socket, shared by every worker.
+ * @see server_s
+ */
+typedef struct server_s server_st;
+
+/**
+ * Represents a worker and everything it reuses from one request to the next, so a request only allocates when it is
+ * bigger than any the worker has run before.
+ * @see server_worker_st
+ */
+struct server_worker_s {
+    lmvm_state_st machine;
+    lmvm_scheduler_st scheduler;  // only there to hold the machine to the server's limits
+
+    unsigned char *request;
+    size_t request_capacity;
+
+    int *inputs;
+    size_t input_capacity;
+
+    int *outputs;
+    size_t output_count;
+    size_t output_capacity;
+
+    unsigned char *response;
+    size_t response_capacity;
+};
+
+/**
+ * Represents a worker and everything it reuses from one request to the next.
+ * @see server_worker_s
+ */
+typedef struct server_worker_s server_worker_st;
+
+static const char *volatile served_socket_path = NULL;
+
+
+// grows a buffer to hold at least size bytes
+static void reserve(void **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return;
+    }
+
+    *capacity = size > *capacity * 2 ? size : *capacity * 2;
+    *buffer = checked_realloc(*buffer, *capacity);
+}
+
+// returns 0 once all of it has been read, 1 if the connection closed or failed first
+static int read_fully(int fd, void *data, size_t size) {
+    unsigned char *at = data;
+
+    while (size > 0) {
+        ssize_t got = read(fd, at, size);
+
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 1;
+        }
+
+        at += got;
+        size -= (size_t) got;
+    }
+
+    return 0;
+}
+
+// returns 0 once all of it has been written
+static int write_fully(int fd, const void *data, size_t size) {
+    const unsigned char *at = data;
+
+    while (size > 0) {
+        ssize_t put = write(fd, at, size);
+
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            return 1;
+        }
+
+        at += put;
+        size -= (size_t) put;
+    }
+
+    return 0;
+}
+
+static int take_output(void *context, int value) {
+    server_worker_st *worker = context;
+
+    if (worker->output_count == SERVE_MAX_OUTPUTS) {
+        return 1;
+    }
+
+    if (worker->output_count == worker->output_capacity) {
+        worker->output_capacity = worker->output_capacity == 0 ? 64 : worker->output_capacity * 2;
+        worker->outputs = checked_realloc(worker->outputs, worker->output_capacity * sizeof(int));
+    }
+
+    worker->outputs[worker->output_count++] = value;
+    return 0;
+}
+
+// returns 0 if the response was sent
+static int send_response(server_worker_st *worker, int fd, serve_status_et status, const char *message) {
+    unsigned int status_value = status;
+    unsigned long long executed = worker->machine.executed;
+    unsigned int output_count = (unsigned int) worker->output_count;
+    unsigned int message_length = (unsigned int) strlen(message);
+
+    size_t size = SERVE_RESPONSE_HEADER_SIZE + 4 * worker->output_count + message_length;
+    reserve((void **) &worker->response, &worker->response_capacity, size);
+
+    unsigned char *at = worker->response;
+    memcpy(at, SERVE_RESPONSE_MAGIC, 4);
+    at += 4;
+    at = store_little_endian(at, &status_value, 4);
+    at = store_little_endian(at, &executed, 8);
+    at = store_little_endian(at, &output_count, 4);
+    at = store_little_endian(at, &message_length, 4);
+
+    for (size_t output = 0; output < worker->output_count; output++) {
+        at = store_little_endian(at, &worker->outputs[output], 4);
+    }
+
+    memcpy(at, message, message_length);
+
+    // the whole response goes in one write, so a client waiting on it is only woken once
+    return write_fully(fd, worker->response, size);
+}
+
+// returns 0 if the connection can carry on with another request
+static int serve_request(server_worker_st *worker, int fd) {
+    unsigned char header[SERVE_REQUEST_HEADER_SIZE];
+
+    if (read_fully(fd, header, sizeof(header)) != 0 || memcmp(header, SERVE_REQUEST_MAGIC, 4) != 0) {
+        return 1;
+    }
+
+    unsigned int image_size;
+    unsigned int input_count;
+    unsigned long long budget;
+
+    const unsigned char *at = header + 4;
+    at = load_little_endian(at, &image_size, 4);
+    at = load_little_endian(at, &input_count, 4);
+    load_little_endian(at, &budget, 8);
+
+    lmvm_reset(&worker->machine);
+    worker->output_count = 0;
+
+    // the rest of a request this big isn't read, so the connection can't carry on after it
+    if (image_size > SERVE_MAX_IMAGE_SIZE || input_count > SERVE_MAX_INPUTS) {
+        send_response(worker, fd, SERVE_BAD_REQUEST, "Request is too large");
+        return 1;
+    }
+
+    size_t body_size = image_size + 4 * (size_t) input_count;
+    reserve((void **) &worker->request, &worker->request_capacity, body_size);
+
+    if (read_fully(fd, worker->request, body_size) != 0) {
+        return 1;
+    }
+
+    reserve((void **) &worker->inputs, &worker->input_capacity, 4 * (size_t) input_count);
+
+    at = worker->request + image_size;
+    for (unsigned int input = 0; input < input_count; input++) {
+        at = load_little_endian(at, &worker->inputs[input], 4);
+    }
+
+    if (lmvm_load_executable(&worker->machine, worker->request, image_size) != 0) {
+        return send_response(worker, fd, SERVE_BAD_REQUEST, "Image is not an executable this VM can run");
+    }
+
+    lmvm_set_input_values(&worker->machine, worker->inputs, input_count);
+
+    // the clock is only read between slices, so without a time limit the whole budget is one slice
+    unsigned long long remaining = budget == 0 ? LMVM_NO_BUDGET : budget;
+    unsigned long long slice = worker->scheduler.max_ns != 0 ? SERVE_TIME_SLICE : LMVM_NO_BUDGET;
+
+    do {
+        worker->scheduler.quantum = remaining < slice ? remaining : slice;
+        remaining -= worker->scheduler.quantum;
+
+        lmvm_schedule(&worker->scheduler, &worker->machine);
+        lmvm_run_turn(&worker->scheduler);
+    } while (worker->machine.status == LMVM_RUNNABLE && remaining > 0);
+
+    switch (worker->machine.status) {
+        case LMVM_HALTED:
+            return send_response(worker, fd, SERVE_HALTED, "");
+        case LMVM_RUNNABLE:
+            return send_response(worker, fd, SERVE_STEP_LIMIT, "");
+        case LMVM_NEED_INPUT:  // input comes from an array, which never waits
+        case LMVM_ERROR:
+            break;
+    }
+
+    char message[128];
+    lmvm_describe_error(&worker->machine, message, sizeof(message));
+    return send_response(worker, fd, SERVE_ERROR, message);
+}
+
+static void serve_worker(size_t task, void *context) {
+    (void) task;
+    const server_st *server = context;
+
+    server_worker_st worker = {0};
+    lmvm_init(&worker.machine);
+    lmvm_scheduler_init(&worker.scheduler, LMVM_NO_BUDGET, server->limits != NULL ? server->limits->max_steps : 0,
+                        server->limits != NULL ? server->limits->max_ms : 0);
+    lmvm_set_output_callback(&worker.machine, take_output, &worker);
+
+    // every worker waits on the same socket, and the kernel hands each connection to one of them
+    while (1) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            perror("Error: Failed to accept connection");
+            break;
+        }
+
+        while (serve_request(&worker, fd) == 0) {
+        }
+
+        close(fd);
+    }
+
+    silent_checked_free(worker.request);
+    silent_checked_free(worker.inputs);
+    silent_checked_free(worker.outputs);
+    silent_checked_free(worker.response);
+}
+
+static void handle_stop_signal(int sig) {
+    const char *path = served_socket_path;
+
+    if (path != NULL) {
+        unlink(path);
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+int open_server_socket(const char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("Error: Failed to create socket");
+        return -1;
+    }
+
+    int bound = bind(fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+
+    if (!bound && errno == EADDRINUSE) {
+        // a socket left behind by a server that was killed can be replaced, but not one that is still being served
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int live = probe != -1 && connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0;
+
+        if (probe != -1) {
+            close(probe);
+        }
+
+        if (live) {
+            fprintf(stderr, "Error: Socket '%s' is already being served\n", socket_path);
+            close(fd);
+            return -1;
+        }
+
+        unlink(socket_path);
+        bound = bind(fd, (struct sockaddr *) &address, sizeof(address)) == 0;
+    }
+
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error: Failed to listen on socket '%s'\n", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void remove_socket_on_stop(const char *socket_path) {
+    // a client that goes away before everything is sent to it shouldn't stop the server
+    signal(SIGPIPE, SIG_IGN);
+
+    served_socket_path = socket_path;
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+}
+
+int do_serve(const char *socket_path, const run_limits_st *limits, size_t worker_count) {
+    int listen_fd = open_server_socket(socket_path);
+
+    if (listen_fd == -1) {
+        return 1;
+    }
+
+    remove_socket_on_stop(socket_path);
+
+    // work this out before the workers start, rather than in all of them at once
+    machine_is_little_endian();
+
+    server_st server;
+    server.listen_fd = listen_fd;
+    server.limits = limits;
+
+    // each worker runs until it can no longer accept connections
+    run_batch_tasks(worker_count, worker_count, serve_worker, &server);
+
+    close(listen_fd);
+    unlink(socket_path);
+    served_socket_path = NULL;
+
+    return 1;
+}
+
+#else
+
+int open_server_socket(const char *socket_path) {
+    fprintf(stderr, "Error: Can't listen on socket '%s', as sockets are not supported on this platform\n", socket_path);
+    return -1;
+}
+
+void remove_socket_on_stop(const char *socket_path) {
+    (void) socket_path;
+}
+
+int do_serve(const char *socket_path, const run_limits_st *limits, size_t worker_count) {
+    (void) socket_path;
+    (void) limits;
+    (void) worker_count;
+
+    fputs("Error: Serving is not supported on this platform\n", stderr);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,236 @@
+#include "vm/snapshot.h"
+#include "common/file_io.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// snapshots are written with a single write and read back by mapping them on posix, and through stdio elsewhere
+#if defined(__unix__) || defined(__APPLE__)
+#define POSIX_SNAPSHOT_SUPPORTED 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define POSIX_SNAPSHOT_SUPPORTED 0
+#endif
+
+static snapshot_control_st *volatile watched_control = NULL;
+
+
+static void encode_snapshot(unsigned char data[SNAPSHOT_FILE_SIZE], const vm_snapshot_st *snapshot) {
+    unsigned short int version = SNAPSHOT_VERSION;
+
+    unsigned char *at = data;
+    memcpy(at, SNAPSHOT_MAGIC, 4);
+    at += 4;
+    at = store_little_endian(at, &version, sizeof(version));
+    at = store_little_endian(at, &snapshot->pc, sizeof(snapshot->pc));
+    at = store_little_endian(at, &snapshot->acc, sizeof(snapshot->acc));
+    at = store_little_endian(at, &snapshot->input_offset, sizeof(snapshot->input_offset));
+    at = store_little_endian(at, &snapshot->output_count, sizeof(snapshot->output_count));
+    at = store_little_endian(at, &snapshot->executed, sizeof(snapshot->executed));
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        at = store_little_endian(at, &snapshot->memory[address], sizeof(snapshot->memory[address]));
+    }
+}
+
+// returns 0 if the data is a snapshot this VM can resume
+static int decode_snapshot(const unsigned char *data, size_t size, vm_snapshot_st *snapshot) {
+    if (size != SNAPSHOT_FILE_SIZE || memcmp(data, SNAPSHOT_MAGIC, 4) != 0) {
+        return 1;
+    }
+
+    unsigned short int version;
+
+    const unsigned char *at = data + 4;
+    at = load_little_endian(at, &version, sizeof(version));
+    at = load_little_endian(at, &snapshot->pc, sizeof(snapshot->pc));
+    at = load_little_endian(at, &snapshot->acc, sizeof(snapshot->acc));
+    at = load_little_endian(at, &snapshot->input_offset, sizeof(snapshot->input_offset));
+    at = load_little_endian(at, &snapshot->output_count, sizeof(snapshot->output_count));
+    at = load_little_endian(at, &snapshot->executed, sizeof(snapshot->executed));
+
+    for (unsigned short int address = 0; address < EXECUTABLE_SIZE; address++) {
+        at = load_little_endian(at, &snapshot->memory[address], sizeof(snapshot->memory[address]));
+    }
+
+    // the PC can be one past the end, if the program is about to run off it
+    return version != SNAPSHOT_VERSION || snapshot->pc > EXECUTABLE_SIZE;
+}
+
+
+int write_snapshot(const char *path, const vm_snapshot_st *snapshot) {
+    unsigned char data[SNAPSHOT_FILE_SIZE];
+    encode_snapshot(data, snapshot);
+
+    // written beside the old snapshot then renamed over it, so a crash part way leaves the old one whole
+    size_t path_length = strlen(path);
+    char *temporary_path = checked_malloc(path_length + 5);
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", 5);
+
+    int failed = 0;
+
+#if POSIX_SNAPSHOT_SUPPORTED
+    int fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1) {
+        failed = 1;
+    } else {
+        // the file is small enough that one write always takes all of it, unless something is wrong
+        failed = write(fd, data, sizeof(data)) != (ssize_t) sizeof(data);
+
+        // the rename mustn't reach the disk before the data does
+        failed |= fsync(fd) != 0;
+        failed |= close(fd) != 0;
+    }
+
+    failed = failed || rename(temporary_path, path) != 0;
+#else
+    FILE *file = fopen(temporary_path, "wb");
+
+    if (file == NULL) {
+        failed = 1;
+    } else {
+        failed = fwrite(data, 1, sizeof(data), file) != sizeof(data);
+        failed |= fclose(file) != 0;
+    }
+
+    // rename won't replace an existing file everywhere
+    if (!failed) {
+        remove(path);
+        failed = rename(temporary_path, path) != 0;
+    }
+#endif
+
+    if (failed) {
+        remove(temporary_path);
+    }
+
+    checked_free(temporary_path);
+    return failed;
+}
+
+int read_snapshot(const char *path, vm_snapshot_st *snapshot) {
+#if POSIX_SNAPSHOT_SUPPORTED
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return 1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size != SNAPSHOT_FILE_SIZE) {
+        close(fd);
+        return 1;
+    }
+
+    void *mapping = mmap(NULL, SNAPSHOT_FILE_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return 1;
+    }
+
+    int failed = decode_snapshot(mapping, SNAPSHOT_FILE_SIZE, snapshot);
+    munmap(mapping, SNAPSHOT_FILE_SIZE);
+
+    return failed;
+#else
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return 1;
+    }
+
+    // read one byte more than a snapshot, to tell if the file is too long
+    unsigned char data[SNAPSHOT_FILE_SIZE + 1];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    return decode_snapshot(data, size, snapshot);
+#endif
+}
+
+int save_snapshot(snapshot_control_st *control, const unsigned short int memory[EXECUTABLE_SIZE], int acc, unsigned short int pc, unsigned long long executed, execution_io_st *io) {
+    // everything written before the snapshot has to be out, so a resumed run's output carries straight on from it
+    flush_execution_io(io);
+    fflush(io->output);
+
+    vm_snapshot_st snapshot;
+    memcpy(snapshot.memory, memory, sizeof(snapshot.memory));
+    snapshot.acc = acc;
+    snapshot.pc = pc;
+    snapshot.input_offset = io->source != NULL ? input_source_position(io->source) : 0;
+    snapshot.output_count = io->output_count;
+    snapshot.executed = executed;
+
+    if (control->start != NULL) {
+        snapshot.executed += control->start->executed;
+    }
+
+    if (write_snapshot(control->path, &snapshot) != 0) {
+        fprintf(io->errors, "Error: Failed to write snapshot file '%s'\n", control->path);
+        control->failed = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static void handle_save_signal(int sig) {
+    (void) sig;
+
+    snapshot_control_st *control = watched_control;
+
+    // a stop already asked for shouldn't be lost
+    if (control != NULL && control->requested == SNAPSHOT_NONE) {
+        control->requested = SNAPSHOT_SAVE;
+    }
+}
+
+static void handle_stop_signal(int sig) {
+    snapshot_control_st *control = watched_control;
+
+    if (control == NULL) {
+        return;
+    }
+
+    // asking twice means the run isn't getting to a point it can stop at, so stop it now
+    if (control->requested == SNAPSHOT_STOP) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+
+    control->requested = SNAPSHOT_STOP;
+    control->stopping = 1;
+}
+
+// installed without SA_RESTART, which signal sets, so a read waiting on input returns for the run to check on the request
+static void watch_signal(int sig, void (*handler)(int)) {
+#if POSIX_SNAPSHOT_SUPPORTED
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(sig, &action, NULL);
+#else
+    signal(sig, handler);
+#endif
+}
+
+void watch_snapshot_signals(snapshot_control_st *control) {
+    watched_control = control;
+
+    watch_signal(SIGINT, handle_stop_signal);
+    watch_signal(SIGTERM, handle_stop_signal);
+
+#ifdef SIGUSR2
+    watch_signal(SIGUSR2, handle_save_signal);
+#endif
+}
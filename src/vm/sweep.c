@@ -0,0 +1,415 @@
+#include "vm/sweep.h"
+#include "vm/batch.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// about this many tasks are made per worker, so stealing has something to balance when some subtrees end early
+#define TASKS_PER_WORKER 8
+
+static const char *NULL_DEVICE =
+#ifdef _WIN32
+        "NUL";
+#else
+        "/dev/null";
+#endif
+
+
+/**
+ * Represents why a run stopped.
+ * @see sweep_stop_et
+ */
+enum sweep_stop_e {
+    SWEEP_STOP_INPUT,      // the run reached an INP, which is the next instruction
+    SWEEP_STOP_HALT,
+    SWEEP_STOP_ERROR,
+    SWEEP_STOP_STEP_LIMIT
+};
+
+/**
+ * Represents why a run stopped.
+ * @see sweep_stop_e
+ */
+typedef enum sweep_stop_e sweep_stop_et;
+
+/**
+ * Represents everything a run needs to carry on from where it stopped, which is copied into each of its children at an INP.
+ * @see sweep_state_st
+ */
+struct sweep_state_s {
+    unsigned short int memory[EXECUTABLE_SIZE];
+    instruction_cache_st cache;
+    int acc;
+    unsigned short int pc;
+    unsigned long long steps;
+};
+
+/**
+ * Represents everything a run needs to carry on from where it stopped, which is copied into each of its children at an INP.
+ * @see sweep_state_s
+ */
+typedef struct sweep_state_s sweep_state_st;
+
+/**
+ * Represents a run stopped at an INP, and the values its children still have to try there.
+ * @see sweep_frame_st
+ */
+struct sweep_frame_s {
+    sweep_state_st state;
+    long long next;       // the value the next child takes
+    long long last;       // the highest value a child takes
+    size_t output_count;  // the outputs the run had written when it stopped, which every child starts with
+};
+
+/**
+ * Represents a run stopped at an INP, and the values its children still have to try there.
+ * @see sweep_frame_s
+ */
+typedef struct sweep_frame_s sweep_frame_st;
+
+/**
+ * Represents a part of the sweep, covering the runs whose first inputs fall in its ranges.
+ * Inputs and outputs only grow along a run, so one set is shared by every run the task explores, cut back as it returns.
+ * @see sweep_task_st
+ */
+struct sweep_task_s {
+    const struct sweep_s *sweep;
+
+    long long *first;  // the lowest value this task tries for each of the first split_depth inputs
+    long long *last;   // the highest value this task tries for each of the first split_depth inputs
+
+    int *inputs;
+    int *outputs;
+    size_t output_count;
+    size_t output_capacity;
+
+    // one frame for each INP the current run has passed, kept on the heap since a run can pass any number of them
+    sweep_frame_st *frames;
+    size_t frame_capacity;
+
+    execution_io_st io;
+    FILE *lines;
+    int failed;
+};
+
+/**
+ * Represents a part of the sweep, covering the runs whose first inputs fall in its ranges.
+ * @see sweep_task_s
+ */
+typedef struct sweep_task_s sweep_task_st;
+
+/**
+ * Represents a sweep being run, shared by all of its tasks.
+ * @see sweep_st
+ */
+struct sweep_s {
+    const sweep_options_st *options;
+    unsigned long long range;
+
+    // every run starts from the root, which has already run up to the first INP
+    const sweep_state_st *root;
+    const int *root_outputs;
+    size_t root_output_count;
+
+    // the first split_depth - 1 inputs are fixed for each task, and the range of the last is split into chunks
+    size_t split_depth;
+    unsigned long long chunks;
+
+    char **lines;
+    size_t *line_sizes;
+    int *failed;
+};
+
+/**
+ * Represents a sweep being run, shared by all of its tasks.
+ * @see sweep_s
+ */
+typedef struct sweep_s sweep_st;
+
+
+static void init_task(sweep_task_st *task, const sweep_st *sweep, char **lines, size_t *line_size) {
+    size_t input_count = sweep->options->input_count;
+
+    task->sweep = sweep;
+    task->first = checked_calloc(sweep->split_depth + 1, sizeof(long long));
+    task->last = checked_calloc(sweep->split_depth + 1, sizeof(long long));
+    task->inputs = checked_calloc(input_count + 1, sizeof(int));
+    task->outputs = NULL;
+    task->output_count = 0;
+    task->output_capacity = 0;
+    task->frames = NULL;
+    task->frame_capacity = 0;
+    task->failed = 0;
+
+    // OUT and INP are handled by the sweep, so the streams are only there for errors, which the report sums up
+    FILE *discard = fopen(NULL_DEVICE, "w");
+    if (discard == NULL) {
+        fputs("Internal Error: Failed to open the null device\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    init_execution_io(&task->io, NULL, discard, discard);
+    task->lines = open_batch_buffer(lines, line_size);
+}
+
+static void free_task(sweep_task_st *task, char **lines, size_t *line_size) {
+    close_batch_buffer(task->lines, lines, line_size);
+    fclose(task->io.errors);
+
+    silent_checked_free(task->frames);
+    silent_checked_free(task->outputs);
+    checked_free(task->inputs);
+    checked_free(task->last);
+    checked_free(task->first);
+}
+
+static void add_output(sweep_task_st *task, int output) {
+    if (task->output_count == task->output_capacity) {
+        task->output_capacity = task->output_capacity == 0 ? 16 : task->output_capacity * 2;
+        task->outputs = checked_realloc(task->outputs, sizeof(int) * task->output_capacity);
+    }
+
+    task->outputs[task->output_count++] = output;
+}
+
+static sweep_stop_et run_until_stop(sweep_state_st *state, sweep_task_st *task) {
+    unsigned long long step_limit = task->sweep->options->step_limit;
+
+    while (state->steps < step_limit) {
+        decoded_instruction_st instruction = state->cache.ops[state->pc];
+
+        if (instruction.handler == HANDLER_REDECODE) {
+            instruction = redecode_cell(&state->cache, state->memory, state->pc);
+        }
+
+        if (instruction.handler == HANDLER_INP) {
+            return SWEEP_STOP_INPUT;
+        }
+
+        state->pc++;
+        state->steps++;
+
+        if (instruction.handler == HANDLER_OUT) {
+            add_output(task, state->acc);
+            continue;
+        }
+
+        execution_result_et result = execute_decoded(instruction, &state->acc, &state->pc, state->memory, &state->cache, &task->io);
+
+        if (result == EXECUTION_HALT) {
+            return SWEEP_STOP_HALT;
+        }
+
+        if (result == EXECUTION_ERROR) {
+            return SWEEP_STOP_ERROR;
+        }
+    }
+
+    return SWEEP_STOP_STEP_LIMIT;
+}
+
+static void report_run(sweep_task_st *task, size_t depth, sweep_stop_et stop) {
+    int failed = stop == SWEEP_STOP_ERROR || stop == SWEEP_STOP_STEP_LIMIT;
+    task->failed |= failed;
+
+    if (task->sweep->options->failures_only && !failed) {
+        return;
+    }
+
+    for (size_t input = 0; input < depth; input++) {
+        fprintf(task->lines, input == 0 ? "%d" : " %d", task->inputs[input]);
+    }
+    fputc(':', task->lines);
+
+    for (size_t output = 0; output < task->output_count; output++) {
+        fprintf(task->lines, " %d", task->outputs[output]);
+    }
+
+    switch (stop) {
+        case SWEEP_STOP_INPUT:
+            fputs(" (more input)", task->lines);
+            break;
+        case SWEEP_STOP_ERROR:
+            fputs(" (error)", task->lines);
+            break;
+        case SWEEP_STOP_STEP_LIMIT:
+            fputs(" (step limit)", task->lines);
+            break;
+        case SWEEP_STOP_HALT:
+            break;
+    }
+    fputc('\n', task->lines);
+}
+
+static sweep_frame_st *push_frame(sweep_task_st *task, size_t depth) {
+    if (depth == task->frame_capacity) {
+        task->frame_capacity = task->frame_capacity == 0 ? 16 : task->frame_capacity * 2;
+        task->frames = checked_realloc(task->frames, sizeof(sweep_frame_st) * task->frame_capacity);
+    }
+
+    return &task->frames[depth];
+}
+
+// runs every child of state depth first, keeping the runs stopped at each INP in the task's frames rather than recursing
+static void explore(sweep_task_st *task, sweep_state_st *state) {
+    const sweep_st *sweep = task->sweep;
+    size_t depth = 0;
+
+    for (;;) {
+        sweep_stop_et stop = run_until_stop(state, task);
+
+        if (stop == SWEEP_STOP_INPUT && depth < sweep->options->input_count) {
+            sweep_frame_st *frame = push_frame(task, depth);
+            frame->state = *state;
+            frame->next = depth < sweep->split_depth ? task->first[depth] : sweep->options->min;
+            frame->last = depth < sweep->split_depth ? task->last[depth] : sweep->options->max;
+            frame->output_count = task->output_count;
+            depth++;
+        } else {
+            // a run that ends before the task's fixed inputs are used up is shared with the tasks after it, so only the first reports it
+            int shared = 0;
+            for (size_t fixed = depth; fixed < sweep->split_depth; fixed++) {
+                shared |= task->first[fixed] != sweep->options->min;
+            }
+
+            if (!shared) {
+                report_run(task, depth, stop);
+            }
+        }
+
+        // go back to the deepest INP with values left to try
+        while (depth > 0 && task->frames[depth - 1].next > task->frames[depth - 1].last) {
+            depth--;
+        }
+
+        if (depth == 0) {
+            return;
+        }
+
+        // the child takes the value and carries on past the INP
+        sweep_frame_st *frame = &task->frames[depth - 1];
+        *state = frame->state;
+        state->acc = (int) frame->next;
+        state->pc++;
+        state->steps++;
+
+        task->inputs[depth - 1] = (int) frame->next;
+        task->output_count = frame->output_count;
+        frame->next++;
+    }
+}
+
+static void run_sweep_task(size_t index, void *context) {
+    const sweep_st *sweep = context;
+
+    sweep_task_st task;
+    init_task(&task, sweep, &sweep->lines[index], &sweep->line_sizes[index]);
+
+    // the last fixed input is a chunk of its range, and the ones before it are single values
+    size_t split_depth = sweep->split_depth;
+    unsigned long long chunk = index % sweep->chunks;
+    unsigned long long combination = index / sweep->chunks;
+
+    task.first[split_depth - 1] = sweep->options->min + (long long) (sweep->range * chunk / sweep->chunks);
+    task.last[split_depth - 1] = sweep->options->min + (long long) (sweep->range * (chunk + 1) / sweep->chunks) - 1;
+
+    for (size_t fixed = split_depth - 1; fixed-- > 0;) {
+        task.first[fixed] = sweep->options->min + (long long) (combination % sweep->range);
+        task.last[fixed] = task.first[fixed];
+        combination /= sweep->range;
+    }
+
+    for (size_t output = 0; output < sweep->root_output_count; output++) {
+        add_output(&task, sweep->root_outputs[output]);
+    }
+
+    sweep_state_st state = *sweep->root;
+    explore(&task, &state);
+
+    sweep->failed[index] = task.failed;
+    free_task(&task, &sweep->lines[index], &sweep->line_sizes[index]);
+}
+
+int do_sweep_execution(const unsigned short int image[EXECUTABLE_SIZE], const sweep_options_st *options, size_t worker_count, FILE *report) {
+    sweep_st sweep;
+    sweep.options = options;
+    sweep.range = (unsigned long long) ((long long) options->max - options->min + 1);
+    sweep.split_depth = 0;
+    sweep.chunks = 1;
+
+    sweep_state_st *root = checked_malloc(sizeof(sweep_state_st));
+    memcpy(root->memory, image, sizeof(root->memory));
+    decode_image(&root->cache, root->memory, 0);
+    root->acc = 0;
+    root->pc = 0;
+    root->steps = 0;
+
+    // everything before the first INP is the same for every run, so it's only run once
+    char *root_lines = NULL;
+    size_t root_line_size = 0;
+    sweep_task_st root_task;
+    init_task(&root_task, &sweep, &root_lines, &root_line_size);
+
+    sweep_stop_et stop = run_until_stop(root, &root_task);
+    int exit_code;
+
+    if (stop != SWEEP_STOP_INPUT || options->input_count == 0 || options->min > options->max) {
+        report_run(&root_task, 0, stop);
+        exit_code = root_task.failed;
+        free_task(&root_task, &root_lines, &root_line_size);
+
+        fwrite(root_lines, 1, root_line_size, report);
+        silent_checked_free(root_lines);
+        checked_free(root);
+
+        return exit_code;
+    }
+
+    // fix enough of the first inputs that there are a few tasks for every worker
+    unsigned long long target = worker_count * TASKS_PER_WORKER;
+    unsigned long long combinations = 1;
+
+    sweep.split_depth = 1;
+    while (combinations * sweep.range < target && sweep.split_depth < options->input_count) {
+        combinations *= sweep.range;
+        sweep.split_depth++;
+    }
+
+    sweep.chunks = (target + combinations - 1) / combinations;
+    if (sweep.chunks > sweep.range) {
+        sweep.chunks = sweep.range;
+    }
+
+    size_t task_count = (size_t) (combinations * sweep.chunks);
+
+    sweep.root = root;
+    sweep.root_outputs = root_task.outputs;
+    sweep.root_output_count = root_task.output_count;
+    sweep.lines = checked_calloc(task_count, sizeof(char *));
+    sweep.line_sizes = checked_calloc(task_count, sizeof(size_t));
+    sweep.failed = checked_calloc(task_count, sizeof(int));
+
+    run_batch_tasks(task_count, worker_count, run_sweep_task, &sweep);
+
+    // tasks cover the runs in order of their inputs, so the report comes out in order
+    exit_code = 0;
+    for (size_t task = 0; task < task_count; task++) {
+        fwrite(sweep.lines[task], 1, sweep.line_sizes[task], report);
+        exit_code |= sweep.failed[task];
+        silent_checked_free(sweep.lines[task]);
+    }
+
+    checked_free(sweep.failed);
+    checked_free(sweep.line_sizes);
+    checked_free(sweep.lines);
+
+    free_task(&root_task, &root_lines, &root_line_size);
+    silent_checked_free(root_lines);
+    checked_free(root);
+
+    return exit_code;
+}
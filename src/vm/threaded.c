@@ -0,0 +1,368 @@
+#include "vm/threaded.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "vm/loop_detector.h"
+#include "vm/loop_accelerator.h"
+#include "vm/snapshot.h"
+#include "vm/metering.h"
+
+#include <stdio.h>
+#include <limits.h>
+
+// computed goto (labels as values) is a GNU extension, so only use it where it's available
+// it lets every handler jump straight to the next one, rather than going back through a single switch
+// -pedantic is only turned off around the label table and the jumps through it, so the rest of the engine is still checked
+#if defined(__GNUC__) && !defined(LMVM_NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO 1
+#define ALLOW_EXTENSIONS_BEGIN _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wpedantic\"")
+#define ALLOW_EXTENSIONS_END _Pragma("GCC diagnostic pop")
+#else
+#define USE_COMPUTED_GOTO 0
+#endif
+
+#if USE_COMPUTED_GOTO
+#define DISPATCH_START NEXT();
+#define DISPATCH_END
+#define TARGET(handler) target_##handler:
+#define NEXT() do { \
+        instruction = cache.ops[reg_PC]; \
+        ALLOW_EXTENSIONS_BEGIN goto *DISPATCH_TABLE[instruction.handler]; ALLOW_EXTENSIONS_END \
+    } while (0)
+#else
+#define DISPATCH_START dispatch: instruction = cache.ops[reg_PC]; switch (instruction.handler) {
+#define DISPATCH_END default: goto slow_path; }
+#define TARGET(handler) case handler:
+#define NEXT() goto dispatch
+#endif
+
+// records the instruction at pc with the ACC as it is now, so call it once the instruction has changed ACC
+#define RECORD(pc, cir, result) record_flight(recorder, recorded++, (pc), (cir), reg_ACC, (result))
+
+// checks the run's limits or saves a snapshot if either is due, or saves one if it has been asked for
+#define CHECK_DUE() do { if (steps >= due || (snapshots != NULL && snapshots->requested != SNAPSHOT_NONE)) goto check_due; } while (0)
+
+// once a branch at address has moved reg_PC, skips ahead if it went back round a counting loop,
+// then stops the program if it went back round to a state it's been in before
+// going back round is also where limits are checked and snapshots are taken, since every long run keeps doing it,
+// so a skip never goes past the instruction count they are next due at, and is recorded in place of the rounds it skipped
+#define CHECK_LOOP() do { \
+        if (reg_PC <= address) { \
+            unsigned long long skipped = skip_loop_iterations(&accelerator, memory, address, &reg_ACC, &cache, &detector, due > steps ? due - steps : 0); \
+            if (skipped != 0) { \
+                steps += skipped; \
+                record_flight_skip(recorder, recorded++, reg_PC, address, reg_ACC); \
+            } \
+            if (check_loop_state(&detector, memory, address, reg_PC, reg_ACC)) goto infinite_loop; \
+            CHECK_DUE(); \
+        } \
+    } while (0)
+
+
+int do_threaded_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed) {
+    // registers are kept in locals, so the compiler can hold them in machine registers
+    int reg_ACC = 0;
+    unsigned short int reg_PC = 0;
+    unsigned long long steps = 0;
+
+    execution_result_et result;
+    decoded_instruction_st instruction;
+    unsigned short int address;
+
+    // a resumed run carries on from where its snapshot was taken
+    snapshot_control_st *snapshots = io->snapshots;
+    unsigned long long snapshot_due = snapshots != NULL && snapshots->every > 0 ? snapshots->every : ULLONG_MAX;
+
+    // limits and snapshots are both only looked at once the instruction count reaches the sooner of the two
+    step_meter_st meter;
+    start_meter(&meter, io->limits);
+    unsigned long long due = snapshot_due < meter.due ? snapshot_due : meter.due;
+
+    if (snapshots != NULL && snapshots->start != NULL) {
+        reg_ACC = snapshots->start->acc;
+        reg_PC = snapshots->start->pc;
+    }
+
+    instruction_cache_st cache;
+    decode_image(&cache, memory, 1);
+
+    flight_recorder_st own_recorder;
+    flight_recorder_st *recorder = io->recorder != NULL ? io->recorder : &own_recorder;
+    unsigned long long recorded = 0;
+    reset_flight_recorder(recorder);
+
+    loop_detector_st detector;
+    reset_loop_detector(&detector, memory);
+
+    loop_accelerator_st accelerator;
+    find_counting_loops(&accelerator, memory);
+
+#if USE_COMPUTED_GOTO
+    // must be in the same order as decoded_handler_e
+    ALLOW_EXTENSIONS_BEGIN
+    static const void *const DISPATCH_TABLE[HANDLER_COUNT] = {
+            &&target_HANDLER_HLT,
+            &&target_HANDLER_ADD,
+            &&target_HANDLER_SUB,
+            &&target_HANDLER_STA,
+            &&target_HANDLER_LDA,
+            &&target_HANDLER_BRA,
+            &&target_HANDLER_BRZ,
+            &&target_HANDLER_BRP,
+            &&slow_path,          // INP
+            &&slow_path,          // OUT
+            &&slow_path,          // INVALID
+            &&slow_path,          // PC_OUT_OF_RANGE
+            &&target_HANDLER_REDECODE,
+            &&target_HANDLER_LDA_ADD_STA,
+            &&target_HANDLER_LDA_SUB_STA,
+            &&target_HANDLER_SUB_BRZ,
+            &&target_HANDLER_LDA_OUT
+    };
+    ALLOW_EXTENSIONS_END
+#endif
+
+    DISPATCH_START
+
+    TARGET(HANDLER_ADD) {
+        unsigned short int mdr = memory[instruction.operand];
+
+        // leave overflow for execute to report
+        if (reg_ACC > INT_MAX - mdr) {
+            goto slow_path;
+        }
+
+        reg_ACC += mdr;
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_PC++;
+        steps++;
+        NEXT();
+    }
+
+    TARGET(HANDLER_SUB) {
+        unsigned short int mdr = memory[instruction.operand];
+
+        // leave underflow for execute to report
+        if (reg_ACC < INT_MIN + mdr) {
+            goto slow_path;
+        }
+
+        reg_ACC -= mdr;
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_PC++;
+        steps++;
+        NEXT();
+    }
+
+    TARGET(HANDLER_STA) {
+        // leave values out of memory range for execute to report
+        if (reg_ACC < 0 || reg_ACC > 999) {
+            goto slow_path;
+        }
+
+        note_loop_store(&detector, memory, instruction.operand, (unsigned short int) reg_ACC);
+        memory[instruction.operand] = (unsigned short int) reg_ACC;
+        invalidate_cell(&cache, instruction.operand);
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_UNCHANGED);
+        reg_PC++;
+        steps++;
+        NEXT();
+    }
+
+    TARGET(HANDLER_LDA) {
+        reg_ACC = memory[instruction.operand];
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_PC++;
+        steps++;
+        NEXT();
+    }
+
+    TARGET(HANDLER_BRA) {
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_BRANCHED);
+        address = reg_PC;
+        reg_PC = instruction.operand;
+        steps++;
+        CHECK_LOOP();
+        NEXT();
+    }
+
+    TARGET(HANDLER_BRZ) {
+        RECORD(reg_PC, instruction.cir, reg_ACC == 0 ? EXECUTION_SUCCESS_BRANCHED : EXECUTION_SUCCESS_ACC_UNCHANGED);
+        address = reg_PC;
+        reg_PC = reg_ACC == 0 ? instruction.operand : reg_PC + 1;
+        steps++;
+        CHECK_LOOP();
+        NEXT();
+    }
+
+    TARGET(HANDLER_BRP) {
+        RECORD(reg_PC, instruction.cir, reg_ACC >= 0 ? EXECUTION_SUCCESS_BRANCHED : EXECUTION_SUCCESS_ACC_UNCHANGED);
+        address = reg_PC;
+        reg_PC = reg_ACC >= 0 ? instruction.operand : reg_PC + 1;
+        steps++;
+        CHECK_LOOP();
+        NEXT();
+    }
+
+    TARGET(HANDLER_REDECODE) {
+        redecode_cell(&cache, memory, reg_PC);
+        NEXT();
+    }
+
+    // superinstructions run a whole group at once, or just their first instruction if any of the group would error
+    // the first instruction then goes through execute, and the rest of the group runs one by one from its own cells
+    // each instruction of a group is still recorded on its own, taking the value of its cell from the cells after the first
+
+    TARGET(HANDLER_LDA_ADD_STA) {
+        // cells hold at most 65535, so the sum can't overflow
+        int value = memory[instruction.operand] + memory[instruction.operand2];
+
+        if (value > 999) {
+            goto slow_path;
+        }
+
+        reg_ACC = memory[instruction.operand];
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_ACC = value;
+        RECORD(reg_PC + 1, memory[reg_PC + 1], EXECUTION_SUCCESS_ACC_CHANGED);
+        RECORD(reg_PC + 2, memory[reg_PC + 2], EXECUTION_SUCCESS_ACC_UNCHANGED);
+        note_loop_store(&detector, memory, instruction.operand3, (unsigned short int) value);
+        memory[instruction.operand3] = (unsigned short int) value;
+        invalidate_cell(&cache, instruction.operand3);
+        reg_PC += 3;
+        steps += 3;
+        NEXT();
+    }
+
+    TARGET(HANDLER_LDA_SUB_STA) {
+        int value = memory[instruction.operand] - memory[instruction.operand2];
+
+        if (value < 0 || value > 999) {
+            goto slow_path;
+        }
+
+        reg_ACC = memory[instruction.operand];
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_ACC = value;
+        RECORD(reg_PC + 1, memory[reg_PC + 1], EXECUTION_SUCCESS_ACC_CHANGED);
+        RECORD(reg_PC + 2, memory[reg_PC + 2], EXECUTION_SUCCESS_ACC_UNCHANGED);
+        note_loop_store(&detector, memory, instruction.operand3, (unsigned short int) value);
+        memory[instruction.operand3] = (unsigned short int) value;
+        invalidate_cell(&cache, instruction.operand3);
+        reg_PC += 3;
+        steps += 3;
+        NEXT();
+    }
+
+    TARGET(HANDLER_SUB_BRZ) {
+        unsigned short int mdr = memory[instruction.operand];
+
+        if (reg_ACC < INT_MIN + mdr) {
+            goto slow_path;
+        }
+
+        reg_ACC -= mdr;
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        RECORD(reg_PC + 1, memory[reg_PC + 1], reg_ACC == 0 ? EXECUTION_SUCCESS_BRANCHED : EXECUTION_SUCCESS_ACC_UNCHANGED);
+        address = reg_PC + 1;
+        reg_PC = reg_ACC == 0 ? instruction.operand2 : reg_PC + 2;
+        steps += 2;
+        CHECK_LOOP();
+        NEXT();
+    }
+
+    TARGET(HANDLER_LDA_OUT) {
+        reg_ACC = memory[instruction.operand];
+        RECORD(reg_PC, instruction.cir, EXECUTION_SUCCESS_ACC_CHANGED);
+        reg_PC++;
+        steps++;
+
+        // output still goes through execute
+        instruction = decode_instruction(OP_LMC_IO_OP_OUT);
+        goto slow_path;
+    }
+
+    TARGET(HANDLER_HLT) {
+        RECORD(reg_PC, instruction.cir, EXECUTION_HALT);
+        steps++;
+        result = EXECUTION_HALT;
+        goto finished;
+    }
+
+    DISPATCH_END
+
+slow_path:
+    // IO, invalid instructions and anything that would raise an error go through execute, so behaviour matches the interpreter
+    address = reg_PC;
+    reg_PC++;
+    steps++;
+    result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+
+    // an INP that gave up waiting for input is left to run again, so the snapshot is taken from just before it
+    if (result == EXECUTION_INTERRUPTED) {
+        reg_PC = address;
+        steps--;
+        goto check_due;
+    }
+
+    RECORD(address, instruction.cir, result);
+
+    if (result == EXECUTION_ERROR) {
+        fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, instruction.cir);
+        dump_flight_recorder(recorder, io->errors);
+        goto finished;
+    }
+
+    // input can send the program somewhere new, and a program writing output is doing something, wherever it goes
+    if (instruction.handler == HANDLER_INP || instruction.handler == HANDLER_OUT) {
+        forget_loop_states(&detector);
+    }
+
+    if (result != EXECUTION_HALT) {
+        CHECK_DUE();
+        NEXT();
+    }
+
+    goto finished;
+
+check_due:
+    if (steps >= meter.due && check_meter(&meter, steps) != 0) {
+        // limits are only due after a branch back or IO, which is at address, so the error is given as the other engines give it
+        report_limit(&meter, steps, io->errors);
+        fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, memory[address]);
+        dump_flight_recorder(recorder, io->errors);
+        result = EXECUTION_ERROR;
+        goto finished;
+    }
+
+    if (steps >= snapshot_due || (snapshots != NULL && snapshots->requested != SNAPSHOT_NONE)) {
+        snapshot_due = snapshots->every > 0 ? steps + snapshots->every : ULLONG_MAX;
+
+        if (snapshots->requested == SNAPSHOT_STOP) {
+            save_snapshot(snapshots, memory, reg_ACC, reg_PC, steps, io);
+            snapshots->stopped = 1;
+            result = EXECUTION_HALT;
+            goto finished;
+        }
+
+        snapshots->requested = SNAPSHOT_NONE;
+        save_snapshot(snapshots, memory, reg_ACC, reg_PC, steps, io);
+    }
+
+    due = snapshot_due < meter.due ? snapshot_due : meter.due;
+    NEXT();
+
+infinite_loop:
+    report_loop(&detector, io->errors);
+    fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, memory[address]);
+    dump_flight_recorder(recorder, io->errors);
+    result = EXECUTION_ERROR;
+
+finished:
+    flush_execution_io(io);
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
@@ -0,0 +1,191 @@
+#include "vm/trace_writer.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the buffers are written by a posix thread, or straight away without one
+#if defined(__unix__) || defined(__APPLE__)
+#define TRACE_THREADS_SUPPORTED 1
+#include <pthread.h>
+#else
+#define TRACE_THREADS_SUPPORTED 0
+#endif
+
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+
+/**
+ * Represents the background thread writing a trace's buffers out, and the buffer it's been handed.
+ * @see trace_flusher_st
+ */
+struct trace_flusher_s {
+    FILE *file;
+    unsigned char *buffers[2];
+    int failed;
+
+    // the buffer waiting to be written, or NULL if the thread is free
+    unsigned char *pending;
+    size_t pending_size;
+    int closing;
+
+#if TRACE_THREADS_SUPPORTED
+    int threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+};
+
+/**
+ * Represents the background thread writing a trace's buffers out, and the buffer it's been handed.
+ * @see trace_flusher_s
+ */
+typedef struct trace_flusher_s trace_flusher_st;
+
+
+static void write_buffer(trace_flusher_st *flusher, const unsigned char *buffer, size_t size) {
+    if (fwrite(buffer, 1, size, flusher->file) != size) {
+        flusher->failed = 1;
+    }
+}
+
+#if TRACE_THREADS_SUPPORTED
+static void *run_flusher(void *arg) {
+    trace_flusher_st *flusher = arg;
+
+    pthread_mutex_lock(&flusher->lock);
+
+    while (1) {
+        while (flusher->pending == NULL && !flusher->closing) {
+            pthread_cond_wait(&flusher->changed, &flusher->lock);
+        }
+
+        if (flusher->pending == NULL) {
+            break;
+        }
+
+        // the VM can carry on filling the other buffer while this one is written
+        unsigned char *buffer = flusher->pending;
+        size_t size = flusher->pending_size;
+        pthread_mutex_unlock(&flusher->lock);
+
+        write_buffer(flusher, buffer, size);
+
+        pthread_mutex_lock(&flusher->lock);
+        flusher->pending = NULL;
+        pthread_cond_broadcast(&flusher->changed);
+    }
+
+    pthread_mutex_unlock(&flusher->lock);
+    return NULL;
+}
+#endif
+
+static void write_header(FILE *file, const unsigned short int image[EXECUTABLE_SIZE]) {
+    unsigned char header[MAGIC_STRING_TRACE_SIZE + 2 + EXECUTABLE_SIZE * 2] = {0};
+
+    memcpy(header, MAGIC_STRING_TRACE, MAGIC_STRING_TRACE_SIZE);
+    header[MAGIC_STRING_TRACE_SIZE] = TRACE_FORMAT_VERSION & 0xFF;
+    header[MAGIC_STRING_TRACE_SIZE + 1] = TRACE_FORMAT_VERSION >> 8;
+
+    // always little endian, whatever the machine
+    for (size_t cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        header[MAGIC_STRING_TRACE_SIZE + 2 + cell * 2] = (unsigned char) (image[cell] & 0xFF);
+        header[MAGIC_STRING_TRACE_SIZE + 3 + cell * 2] = (unsigned char) (image[cell] >> 8);
+    }
+
+    fwrite(header, 1, sizeof(header), file);
+}
+
+
+trace_writer_st *open_trace_writer(const char *path, const unsigned short int image[EXECUTABLE_SIZE]) {
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    write_header(file, image);
+
+    trace_flusher_st *flusher = checked_calloc(1, sizeof(trace_flusher_st));
+    flusher->file = file;
+    flusher->buffers[0] = checked_malloc(TRACE_BUFFER_SIZE);
+    flusher->buffers[1] = checked_malloc(TRACE_BUFFER_SIZE);
+
+#if TRACE_THREADS_SUPPORTED
+    pthread_mutex_init(&flusher->lock, NULL);
+    pthread_cond_init(&flusher->changed, NULL);
+
+    // if the thread can't be started, buffers are written as they fill instead
+    flusher->threaded = pthread_create(&flusher->thread, NULL, run_flusher, flusher) == 0;
+#endif
+
+    trace_writer_st *writer = checked_malloc(sizeof(trace_writer_st));
+    writer->buffer = flusher->buffers[0];
+    writer->used = 0;
+    writer->capacity = TRACE_BUFFER_SIZE;
+    writer->expected_pc = 0;
+    writer->acc = 0;
+    memcpy(writer->cirs, image, sizeof(unsigned short int) * EXECUTABLE_SIZE);
+    writer->cirs[EXECUTABLE_SIZE] = 0;
+    writer->flusher = flusher;
+
+    return writer;
+}
+
+void swap_trace_buffers(trace_writer_st *writer) {
+    trace_flusher_st *flusher = writer->flusher;
+
+#if TRACE_THREADS_SUPPORTED
+    if (flusher->threaded) {
+        pthread_mutex_lock(&flusher->lock);
+
+        while (flusher->pending != NULL) {
+            pthread_cond_wait(&flusher->changed, &flusher->lock);
+        }
+
+        flusher->pending = writer->buffer;
+        flusher->pending_size = writer->used;
+        pthread_cond_broadcast(&flusher->changed);
+        pthread_mutex_unlock(&flusher->lock);
+
+        writer->buffer = writer->buffer == flusher->buffers[0] ? flusher->buffers[1] : flusher->buffers[0];
+        writer->used = 0;
+        return;
+    }
+#endif
+
+    write_buffer(flusher, writer->buffer, writer->used);
+    writer->used = 0;
+}
+
+int close_trace_writer(trace_writer_st *writer) {
+    trace_flusher_st *flusher = writer->flusher;
+
+    swap_trace_buffers(writer);
+
+#if TRACE_THREADS_SUPPORTED
+    if (flusher->threaded) {
+        pthread_mutex_lock(&flusher->lock);
+        flusher->closing = 1;
+        pthread_cond_broadcast(&flusher->changed);
+        pthread_mutex_unlock(&flusher->lock);
+
+        pthread_join(flusher->thread, NULL);
+    }
+
+    pthread_cond_destroy(&flusher->changed);
+    pthread_mutex_destroy(&flusher->lock);
+#endif
+
+    int failed = flusher->failed || ferror(flusher->file);
+    failed |= fclose(flusher->file) != 0;
+
+    checked_free(flusher->buffers[0]);
+    checked_free(flusher->buffers[1]);
+    checked_free(flusher);
+    checked_free(writer);
+
+    return failed;
+}
@@ -0,0 +1,477 @@
+#include "vm/tracing.h"
+#include "vm/execution.h"
+#include "vm/decode.h"
+#include "vm/x86_64_emit.h"
+#include "common/checked_alloc.h"
+
+#include <stdio.h>
+
+// how many times a backward branch target is hit before the loop is recorded
+#define HOT_LOOP_THRESHOLD 50
+
+// recordings longer than this are abandoned, as are loops that fail to record this many times
+#define MAX_TRACE_LENGTH 256
+#define MAX_TRACE_ABORTS 3
+
+#define TRACE_CODE_SIZE (256 * 1024)
+
+// the most native code a single recorded instruction can need, including its side exit
+#define MAX_TRACE_STEP_BYTES 96
+
+/**
+ * Represents the reason a trace returned to the interpreter.
+ * A write to a traced cell returns TRACE_EXIT_CODE_WRITTEN plus the address of the cell.
+ * @see trace_exit_reason_et
+ */
+enum trace_exit_reason_e {
+    TRACE_EXIT_SIDE,             // a guard failed, or the instruction at PC needs to go through execute
+    TRACE_EXIT_OUTPUT_STOPPED,   // an OUT ran and stopped the program, with the result in the context
+    TRACE_EXIT_CODE_WRITTEN
+};
+
+/**
+ * Represents the reason a trace returned to the interpreter.
+ * @see trace_exit_reason_e
+ */
+typedef enum trace_exit_reason_e trace_exit_reason_et;
+
+
+/**
+ * Represents a recorded instruction, and the PC it led to.
+ * @see trace_step_st
+ */
+struct trace_step_s {
+    unsigned short int address;
+    unsigned short int cir;
+    unsigned short int next;
+};
+
+/**
+ * Represents a recorded instruction, and the PC it led to.
+ * @see trace_step_s
+ */
+typedef struct trace_step_s trace_step_st;
+
+
+/**
+ * Represents the hot loop counters, the loop being recorded and the compiled traces.
+ * @see tracer_st
+ */
+struct tracer_s {
+    int native;
+    code_buffer_st buffer;
+    native_entry_fn entry;
+    unsigned char *exit;
+    unsigned char *free;
+
+    const unsigned char *traces[EXECUTABLE_SIZE];
+    unsigned char covers[EXECUTABLE_SIZE][EXECUTABLE_SIZE];
+    unsigned short int coverage[EXECUTABLE_SIZE];
+
+    // cells outside each trace that it stores to, which the interpreter must treat as written once the trace exits
+    unsigned char stores[EXECUTABLE_SIZE][EXECUTABLE_SIZE];
+    unsigned char store_count[EXECUTABLE_SIZE];
+
+    unsigned short int hotness[EXECUTABLE_SIZE];
+    unsigned char aborts[EXECUTABLE_SIZE];
+
+    int recording;
+    trace_step_st recorded[MAX_TRACE_LENGTH];
+    int recorded_length;
+};
+
+/**
+ * Represents the hot loop counters, the loop being recorded and the compiled traces.
+ * @see tracer_s
+ */
+typedef struct tracer_s tracer_st;
+
+
+static void abort_recording(tracer_st *tracer) {
+    tracer->aborts[tracer->recording]++;
+    tracer->hotness[tracer->recording] = 0;
+    tracer->recording = -1;
+}
+
+// throws away every trace that was compiled from the cell, so its loop can be recorded again
+static void discard_traces_covering(tracer_st *tracer, unsigned short int address) {
+    for (int head = 0; head < EXECUTABLE_SIZE; head++) {
+        if (tracer->traces[head] == NULL || !tracer->covers[head][address]) {
+            continue;
+        }
+
+        tracer->traces[head] = NULL;
+        tracer->hotness[head] = 0;
+        tracer->store_count[head] = 0;
+
+        for (int cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+            if (tracer->covers[head][cell]) {
+                tracer->covers[head][cell] = 0;
+                tracer->coverage[cell]--;
+            }
+        }
+    }
+}
+
+
+#if NATIVE_CODE_SUPPORTED
+
+// OUT from inside a trace, going through execute so it matches the interpreter, returning 1 if it stopped the program
+static int native_output(native_context_st *context, int acc) {
+    unsigned short int reg_MAR = 0;
+    unsigned short int reg_PC = 0;
+
+    execution_result_et result = execute(OP_LMC_IO_OP_OUT, &reg_MAR, &acc, &reg_PC, context->memory, NULL, context->io);
+
+    if (result == EXECUTION_SUCCESS_ACC_UNCHANGED) {
+        return 0;
+    }
+
+    context->result = result;
+    return 1;
+}
+
+static void init_native(tracer_st *tracer) {
+    if (!code_buffer_init(&tracer->buffer, TRACE_CODE_SIZE)) {
+        return;
+    }
+
+    emitter_st emitter = {tracer->buffer.base};
+    tracer->entry = emit_entry_and_exit(&emitter, &tracer->exit);
+    tracer->free = emitter.at;
+
+    if (!code_buffer_make_executable(&tracer->buffer)) {
+        code_buffer_free(&tracer->buffer);
+        return;
+    }
+
+    tracer->native = 1;
+}
+
+static void free_native(tracer_st *tracer) {
+    if (tracer->native) {
+        code_buffer_free(&tracer->buffer);
+    }
+}
+
+// compiles the recorded loop, returning NULL if it can't be
+static const unsigned char *compile_trace(tracer_st *tracer, const unsigned short int *memory) {
+    const trace_step_st *recorded = tracer->recorded;
+    int length = tracer->recorded_length;
+
+    // traces are never freed, so stop compiling once the buffer is full
+    if ((size_t) (tracer->buffer.base + tracer->buffer.size - tracer->free) < (size_t) (length + 1) * MAX_TRACE_STEP_BYTES) {
+        return NULL;
+    }
+
+    // a cell may have been written to while it was being recorded
+    unsigned char in_trace[EXECUTABLE_SIZE] = {0};
+    for (int i = 0; i < length; i++) {
+        if (memory[recorded[i].address] != recorded[i].cir) {
+            return NULL;
+        }
+
+        in_trace[recorded[i].address] = 1;
+    }
+
+    if (!code_buffer_make_writable(&tracer->buffer)) {
+        return NULL;
+    }
+
+    emitter_st emitter = {tracer->free};
+    const unsigned char *start = emitter.at;
+
+    unsigned char stored[EXECUTABLE_SIZE] = {0};
+
+    // side exits are written after the loop body, so the body stays straight-line code
+    unsigned char *exit_jumps[MAX_TRACE_LENGTH];
+    unsigned short int exit_pcs[MAX_TRACE_LENGTH];
+    int exit_count = 0;
+
+    for (int i = 0; i < length; i++) {
+        const trace_step_st *step = &recorded[i];
+        decoded_instruction_st instruction = decode_instruction(step->cir);
+        unsigned short int fallthrough = step->address + 1;
+
+        switch (instruction.handler) {
+            case HANDLER_LDA:
+                emit_lda(&emitter, instruction.operand);
+                break;
+            case HANDLER_ADD:
+            case HANDLER_SUB:
+                // overflow goes back to the interpreter to be reported
+                exit_jumps[exit_count] = emit_add_sub_to_ecx(&emitter, instruction.operand, instruction.handler == HANDLER_SUB);
+                exit_pcs[exit_count++] = step->address;
+                emit_commit_ecx(&emitter);
+                break;
+            case HANDLER_STA:
+                exit_jumps[exit_count] = emit_sta_check(&emitter);
+                exit_pcs[exit_count++] = step->address;
+
+                if (in_trace[instruction.operand]) {
+                    // changing a traced cell invalidates this trace
+                    emit_compare_cell(&emitter, instruction.operand);
+                    unsigned char *unchanged = emit_jcc(&emitter, CC_ZERO, NULL);
+
+                    emit_store(&emitter, instruction.operand);
+                    emit_exit(&emitter, fallthrough, TRACE_EXIT_CODE_WRITTEN + instruction.operand, tracer->exit);
+
+                    patch_jump(unchanged, emitter.at);
+                } else {
+                    emit_store(&emitter, instruction.operand);
+                    stored[instruction.operand] = 1;
+                }
+                break;
+            case HANDLER_BRA:
+                emit_count_step(&emitter);
+                break;
+            case HANDLER_BRZ:
+            case HANDLER_BRP:
+                emit_count_step(&emitter);
+
+                // a branch to the next cell goes the same way either way
+                if (instruction.operand == fallthrough) {
+                    break;
+                }
+
+                emit_test_acc(&emitter);
+
+                // guard that the branch goes the way it did while recording
+                if (step->next == instruction.operand) {
+                    exit_jumps[exit_count] = emit_jcc(&emitter, instruction.handler == HANDLER_BRZ ? CC_NOT_ZERO : CC_SIGN, NULL);
+                    exit_pcs[exit_count++] = fallthrough;
+                } else {
+                    exit_jumps[exit_count] = emit_jcc(&emitter, instruction.handler == HANDLER_BRZ ? CC_ZERO : CC_NOT_SIGN, NULL);
+                    exit_pcs[exit_count++] = instruction.operand;
+                }
+                break;
+            case HANDLER_OUT: {
+                emit_count_step(&emitter);
+                emit_call_helper(&emitter, native_output);
+
+                // the OUT has run by the time it stops the program, so the trace leaves from after it
+                unsigned char *carried_on = emit_jcc(&emitter, CC_ZERO, NULL);
+                emit_exit(&emitter, fallthrough, TRACE_EXIT_OUTPUT_STOPPED, tracer->exit);
+                patch_jump(carried_on, emitter.at);
+                break;
+            }
+            default:
+                // never recorded
+                break;
+        }
+    }
+
+    // the recording ended back at the loop head
+    emit_jmp(&emitter, start);
+
+    for (int i = 0; i < exit_count; i++) {
+        patch_jump(exit_jumps[i], emitter.at);
+        emit_exit(&emitter, exit_pcs[i], TRACE_EXIT_SIDE, tracer->exit);
+    }
+
+    tracer->free = emitter.at;
+
+    if (!code_buffer_make_executable(&tracer->buffer)) {
+        tracer->native = 0;
+        return NULL;
+    }
+
+    int head = tracer->recording;
+    tracer->store_count[head] = 0;
+
+    for (int cell = 0; cell < EXECUTABLE_SIZE; cell++) {
+        if (in_trace[cell]) {
+            tracer->covers[head][cell] = 1;
+            tracer->coverage[cell]++;
+        }
+
+        if (stored[cell]) {
+            tracer->stores[head][tracer->store_count[head]++] = (unsigned char) cell;
+        }
+    }
+
+    return start;
+}
+
+#else
+
+static void init_native(tracer_st *tracer) {
+    tracer->native = 0;
+}
+
+static void free_native(tracer_st *tracer) {
+    (void) tracer;
+}
+
+static const unsigned char *compile_trace(tracer_st *tracer, const unsigned short int *memory) {
+    (void) tracer;
+    (void) memory;
+    return NULL;
+}
+
+#endif
+
+
+// records an executed instruction, compiling the trace if it has arrived back at the loop head
+static void record_step(tracer_st *tracer, decoded_instruction_st instruction, unsigned short int address, unsigned short int next, const unsigned short int *memory) {
+    switch (instruction.handler) {
+        case HANDLER_LDA:
+        case HANDLER_ADD:
+        case HANDLER_SUB:
+        case HANDLER_STA:
+        case HANDLER_BRA:
+        case HANDLER_BRZ:
+        case HANDLER_BRP:
+        case HANDLER_OUT:
+            break;
+        default:
+            // INP waits on the outside world, and the rest end execution
+            abort_recording(tracer);
+            return;
+    }
+
+    if (tracer->recorded_length == MAX_TRACE_LENGTH) {
+        abort_recording(tracer);
+        return;
+    }
+
+    trace_step_st *step = &tracer->recorded[tracer->recorded_length++];
+    step->address = address;
+    step->cir = instruction.cir;
+    step->next = next;
+
+    if (next != tracer->recording) {
+        return;
+    }
+
+    const unsigned char *trace = compile_trace(tracer, memory);
+
+    if (trace == NULL) {
+        abort_recording(tracer);
+        return;
+    }
+
+    tracer->traces[tracer->recording] = trace;
+    tracer->recording = -1;
+}
+
+int do_tracing_execution(unsigned short int memory[EXECUTABLE_SIZE], execution_io_st *io, unsigned long long *executed) {
+    int reg_ACC = 0;
+    unsigned short int reg_PC = 0;
+    unsigned long long steps = 0;
+
+    instruction_cache_st cache;
+    decode_image(&cache, memory, 0);
+
+    tracer_st *tracer = checked_calloc(1, sizeof(tracer_st));
+    tracer->recording = -1;
+    init_native(tracer);
+
+    native_context_st context = {0, 0, memory, 0, io, EXECUTION_INDETERMINATE};
+
+    // only interpreted instructions are recorded, since traces run natively
+    flight_recorder_st own_recorder;
+    flight_recorder_st *recorder = io->recorder != NULL ? io->recorder : &own_recorder;
+    unsigned long long recorded = 0;
+    reset_flight_recorder(recorder);
+
+    // traces are only entered straight after a branch, and never straight after leaving one, so there's always progress
+    int may_enter_trace = 0;
+
+    execution_result_et result = EXECUTION_INDETERMINATE;
+
+    while (result != EXECUTION_HALT && result != EXECUTION_ERROR) {
+        if (may_enter_trace && tracer->traces[reg_PC] != NULL) {
+            context.acc = reg_ACC;
+            context.pc = reg_PC;
+            context.steps = steps;
+
+            unsigned short int head = reg_PC;
+            int reason = tracer->entry(&context, tracer->traces[head]);
+
+            reg_ACC = context.acc;
+            reg_PC = (unsigned short int) context.pc;
+            steps = context.steps;
+
+            // native stores don't go through execute, so catch up on them
+            for (int i = 0; i < tracer->store_count[head]; i++) {
+                unsigned short int stored = tracer->stores[head][i];
+
+                invalidate_cell(&cache, stored);
+
+                if (tracer->coverage[stored] > 0) {
+                    discard_traces_covering(tracer, stored);
+                }
+            }
+
+            if (reason >= TRACE_EXIT_CODE_WRITTEN) {
+                unsigned short int written = (unsigned short int) (reason - TRACE_EXIT_CODE_WRITTEN);
+
+                invalidate_cell(&cache, written);
+                discard_traces_covering(tracer, written);
+            }
+
+            // an OUT that stopped the program inside the trace stops it just as it would have in the interpreter
+            if (reason == TRACE_EXIT_OUTPUT_STOPPED) {
+                unsigned short int address = (unsigned short int) (reg_PC - 1);
+                result = (execution_result_et) context.result;
+                record_flight(recorder, recorded++, address, memory[address], reg_ACC, result);
+
+                if (result == EXECUTION_ERROR) {
+                    fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, memory[address]);
+                    dump_flight_recorder(recorder, io->errors);
+                }
+            }
+
+            may_enter_trace = 0;
+            continue;
+        }
+
+        decoded_instruction_st instruction = cache.ops[reg_PC];
+
+        if (instruction.handler == HANDLER_REDECODE) {
+            instruction = redecode_cell(&cache, memory, reg_PC);
+        }
+
+        unsigned short int address = reg_PC;
+        reg_PC++;
+        steps++;
+
+        result = execute_decoded(instruction, &reg_ACC, &reg_PC, memory, &cache, io);
+        record_flight(recorder, recorded++, address, instruction.cir, reg_ACC, result);
+
+        if (result == EXECUTION_ERROR) {
+            fprintf(io->errors, "Error occurred with PC = %u CIR = %u\n", reg_PC, instruction.cir);
+            dump_flight_recorder(recorder, io->errors);
+            break;
+        }
+
+        if (instruction.handler == HANDLER_STA && tracer->coverage[instruction.operand] > 0) {
+            discard_traces_covering(tracer, instruction.operand);
+        }
+
+        if (tracer->recording != -1) {
+            record_step(tracer, instruction, address, reg_PC, memory);
+        }
+
+        may_enter_trace = result == EXECUTION_SUCCESS_BRANCHED;
+
+        // count backward branches, and start recording once the loop is hot
+        if (may_enter_trace && reg_PC <= address && tracer->native && tracer->recording == -1 && tracer->traces[reg_PC] == NULL) {
+            if (++tracer->hotness[reg_PC] >= HOT_LOOP_THRESHOLD && tracer->aborts[reg_PC] < MAX_TRACE_ABORTS) {
+                tracer->recording = reg_PC;
+                tracer->recorded_length = 0;
+            }
+        }
+    }
+
+    free_native(tracer);
+    checked_free(tracer);
+    flush_execution_io(io);
+
+    if (executed != NULL) {
+        *executed = steps;
+    }
+
+    return result == EXECUTION_ERROR;
+}
@@ -0,0 +1,289 @@
+#include "vm/x86_64_emit.h"
+
+#if NATIVE_CODE_SUPPORTED
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#define CONTEXT_ACC ((unsigned char) offsetof(native_context_st, acc))
+#define CONTEXT_PC ((unsigned char) offsetof(native_context_st, pc))
+#define CONTEXT_MEMORY ((unsigned char) offsetof(native_context_st, memory))
+#define CONTEXT_STEPS ((unsigned char) offsetof(native_context_st, steps))
+
+
+int code_buffer_init(code_buffer_st *buffer, size_t size) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (base == MAP_FAILED) {
+        buffer->base = NULL;
+        buffer->size = 0;
+        return 0;
+    }
+
+    buffer->base = base;
+    buffer->size = size;
+
+    return 1;
+}
+
+void code_buffer_free(code_buffer_st *buffer) {
+    if (buffer->base != NULL) {
+        munmap(buffer->base, buffer->size);
+    }
+
+    buffer->base = NULL;
+    buffer->size = 0;
+}
+
+int code_buffer_make_writable(code_buffer_st *buffer) {
+    return mprotect(buffer->base, buffer->size, PROT_READ | PROT_WRITE) == 0;
+}
+
+int code_buffer_make_executable(code_buffer_st *buffer) {
+    return mprotect(buffer->base, buffer->size, PROT_READ | PROT_EXEC) == 0;
+}
+
+
+static void emit_u8(emitter_st *emitter, unsigned char value) {
+    *emitter->at++ = value;
+}
+
+static void emit_u32(emitter_st *emitter, uint32_t value) {
+    // x86 is little endian
+    emit_u8(emitter, (unsigned char) value);
+    emit_u8(emitter, (unsigned char) (value >> 8));
+    emit_u8(emitter, (unsigned char) (value >> 16));
+    emit_u8(emitter, (unsigned char) (value >> 24));
+}
+
+static void emit_bytes(emitter_st *emitter, const unsigned char *bytes, size_t count) {
+    memcpy(emitter->at, bytes, count);
+    emitter->at += count;
+}
+
+// displacement of a cell from the memory base
+static uint32_t cell_displacement(unsigned int address) {
+    return (uint32_t) (address * sizeof(unsigned short int));
+}
+
+
+native_entry_fn emit_entry_and_exit(emitter_st *emitter, unsigned char **exit) {
+    unsigned char *entry = emitter->at;
+
+    // push rbx, rbp, r12, r13, r14, r15
+    static const unsigned char PUSHES[] = {0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57};
+    emit_bytes(emitter, PUSHES, sizeof(PUSHES));
+
+    // sub rsp, 8 (keep the stack 16 byte aligned for calls)
+    static const unsigned char ALIGN[] = {0x48, 0x83, 0xEC, 0x08};
+    emit_bytes(emitter, ALIGN, sizeof(ALIGN));
+
+    // mov r14, rdi
+    static const unsigned char LOAD_CONTEXT[] = {0x49, 0x89, 0xFE};
+    emit_bytes(emitter, LOAD_CONTEXT, sizeof(LOAD_CONTEXT));
+
+    // mov r12d, [r14 + acc]
+    static const unsigned char LOAD_ACC[] = {0x45, 0x8B, 0x66};
+    emit_bytes(emitter, LOAD_ACC, sizeof(LOAD_ACC));
+    emit_u8(emitter, CONTEXT_ACC);
+
+    // mov r13, [r14 + memory]
+    static const unsigned char LOAD_MEMORY[] = {0x4D, 0x8B, 0x6E};
+    emit_bytes(emitter, LOAD_MEMORY, sizeof(LOAD_MEMORY));
+    emit_u8(emitter, CONTEXT_MEMORY);
+
+    // mov r15, [r14 + steps]
+    static const unsigned char LOAD_STEPS[] = {0x4D, 0x8B, 0x7E};
+    emit_bytes(emitter, LOAD_STEPS, sizeof(LOAD_STEPS));
+    emit_u8(emitter, CONTEXT_STEPS);
+
+    // jmp rsi
+    static const unsigned char JUMP_TARGET[] = {0xFF, 0xE6};
+    emit_bytes(emitter, JUMP_TARGET, sizeof(JUMP_TARGET));
+
+
+    *exit = emitter->at;
+
+    // mov [r14 + acc], r12d
+    static const unsigned char STORE_ACC[] = {0x45, 0x89, 0x66};
+    emit_bytes(emitter, STORE_ACC, sizeof(STORE_ACC));
+    emit_u8(emitter, CONTEXT_ACC);
+
+    // mov [r14 + steps], r15
+    static const unsigned char STORE_STEPS[] = {0x4D, 0x89, 0x7E};
+    emit_bytes(emitter, STORE_STEPS, sizeof(STORE_STEPS));
+    emit_u8(emitter, CONTEXT_STEPS);
+
+    // add rsp, 8
+    static const unsigned char UNALIGN[] = {0x48, 0x83, 0xC4, 0x08};
+    emit_bytes(emitter, UNALIGN, sizeof(UNALIGN));
+
+    // pop r15, r14, r13, r12, rbp, rbx, then ret
+    static const unsigned char POPS[] = {0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3};
+    emit_bytes(emitter, POPS, sizeof(POPS));
+
+    // ISO C doesn't allow casting data pointers to function pointers, but copying the representation is fine on POSIX
+    native_entry_fn entry_fn;
+    memcpy(&entry_fn, &entry, sizeof(entry_fn));
+
+    return entry_fn;
+}
+
+void emit_lda(emitter_st *emitter, unsigned int address) {
+    // movzx r12d, word [r13 + disp32]
+    static const unsigned char LOAD[] = {0x45, 0x0F, 0xB7, 0xA5};
+    emit_bytes(emitter, LOAD, sizeof(LOAD));
+    emit_u32(emitter, cell_displacement(address));
+
+    emit_count_step(emitter);
+}
+
+unsigned char *emit_add_sub_to_ecx(emitter_st *emitter, unsigned int address, int subtract) {
+    // movzx eax, word [r13 + disp32]
+    static const unsigned char LOAD[] = {0x41, 0x0F, 0xB7, 0x85};
+    emit_bytes(emitter, LOAD, sizeof(LOAD));
+    emit_u32(emitter, cell_displacement(address));
+
+    // mov ecx, r12d
+    static const unsigned char COPY_ACC[] = {0x44, 0x89, 0xE1};
+    emit_bytes(emitter, COPY_ACC, sizeof(COPY_ACC));
+
+    // add ecx, eax / sub ecx, eax
+    emit_u8(emitter, subtract ? 0x29 : 0x01);
+    emit_u8(emitter, 0xC1);
+
+    // the overflow flag is exactly the condition op_add/op_sub check for
+    return emit_jcc(emitter, CC_OVERFLOW, NULL);
+}
+
+void emit_commit_ecx(emitter_st *emitter) {
+    // mov r12d, ecx
+    static const unsigned char COMMIT[] = {0x41, 0x89, 0xCC};
+    emit_bytes(emitter, COMMIT, sizeof(COMMIT));
+
+    emit_count_step(emitter);
+}
+
+unsigned char *emit_sta_check(emitter_st *emitter) {
+    // cmp r12d, 999
+    static const unsigned char COMPARE[] = {0x41, 0x81, 0xFC};
+    emit_bytes(emitter, COMPARE, sizeof(COMPARE));
+    emit_u32(emitter, 999);
+
+    // unsigned comparison, so negative values are above too
+    unsigned char *slow = emit_jcc(emitter, CC_ABOVE, NULL);
+
+    emit_count_step(emitter);
+
+    return slow;
+}
+
+void emit_compare_cell(emitter_st *emitter, unsigned int address) {
+    // cmp word [r13 + disp32], r12w
+    static const unsigned char COMPARE[] = {0x66, 0x45, 0x39, 0xA5};
+    emit_bytes(emitter, COMPARE, sizeof(COMPARE));
+    emit_u32(emitter, cell_displacement(address));
+}
+
+void emit_store(emitter_st *emitter, unsigned int address) {
+    // mov word [r13 + disp32], r12w
+    static const unsigned char STORE[] = {0x66, 0x45, 0x89, 0xA5};
+    emit_bytes(emitter, STORE, sizeof(STORE));
+    emit_u32(emitter, cell_displacement(address));
+}
+
+void emit_count_step(emitter_st *emitter) {
+    // inc r15
+    static const unsigned char INCREMENT[] = {0x49, 0xFF, 0xC7};
+    emit_bytes(emitter, INCREMENT, sizeof(INCREMENT));
+}
+
+void emit_call_helper(emitter_st *emitter, native_helper_fn helper) {
+    // mov rdi, r14
+    static const unsigned char PASS_CONTEXT[] = {0x4C, 0x89, 0xF7};
+    emit_bytes(emitter, PASS_CONTEXT, sizeof(PASS_CONTEXT));
+
+    // mov esi, r12d
+    static const unsigned char PASS_ACC[] = {0x44, 0x89, 0xE6};
+    emit_bytes(emitter, PASS_ACC, sizeof(PASS_ACC));
+
+    // mov rax, imm64
+    uint64_t address;
+    memcpy(&address, &helper, sizeof(address));
+
+    emit_u8(emitter, 0x48);
+    emit_u8(emitter, 0xB8);
+    emit_u32(emitter, (uint32_t) address);
+    emit_u32(emitter, (uint32_t) (address >> 32));
+
+    // call rax (the stack is kept aligned by the entry trampoline, and the VM state is in callee-saved registers)
+    static const unsigned char CALL[] = {0xFF, 0xD0};
+    emit_bytes(emitter, CALL, sizeof(CALL));
+
+    // test eax, eax
+    static const unsigned char TEST_RESULT[] = {0x85, 0xC0};
+    emit_bytes(emitter, TEST_RESULT, sizeof(TEST_RESULT));
+}
+
+void emit_test_acc(emitter_st *emitter) {
+    // test r12d, r12d
+    static const unsigned char TEST[] = {0x45, 0x85, 0xE4};
+    emit_bytes(emitter, TEST, sizeof(TEST));
+}
+
+unsigned char *emit_jcc(emitter_st *emitter, condition_code_et condition, const unsigned char *target) {
+    emit_u8(emitter, 0x0F);
+    emit_u8(emitter, (unsigned char) condition);
+
+    unsigned char *jump = emitter->at;
+    emit_u32(emitter, 0);
+
+    if (target != NULL) {
+        patch_jump(jump, target);
+    }
+
+    return jump;
+}
+
+unsigned char *emit_jmp(emitter_st *emitter, const unsigned char *target) {
+    emit_u8(emitter, 0xE9);
+
+    unsigned char *jump = emitter->at;
+    emit_u32(emitter, 0);
+
+    if (target != NULL) {
+        patch_jump(jump, target);
+    }
+
+    return jump;
+}
+
+void patch_jump(unsigned char *jump, const unsigned char *target) {
+    // relative to the end of the instruction, which is the end of the rel32
+    int32_t relative = (int32_t) (target - (jump + 4));
+
+    memcpy(jump, &relative, sizeof(relative));
+}
+
+void emit_exit(emitter_st *emitter, unsigned int pc, int reason, const unsigned char *exit) {
+    // mov dword [r14 + pc], imm32
+    static const unsigned char STORE_PC[] = {0x41, 0xC7, 0x46};
+    emit_bytes(emitter, STORE_PC, sizeof(STORE_PC));
+    emit_u8(emitter, CONTEXT_PC);
+    emit_u32(emitter, pc);
+
+    // mov eax, imm32
+    emit_u8(emitter, 0xB8);
+    emit_u32(emitter, (uint32_t) reason);
+
+    emit_jmp(emitter, exit);
+}
+
+#else
+
+// keeps the translation unit non-empty on platforms without native code support
+typedef int native_code_unsupported_t;
+
+#endif